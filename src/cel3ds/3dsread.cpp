@@ -14,13 +14,30 @@
 #include "3dsread.h"
 #include <celutil/bytes.h>
 #include <celutil/debug.h>
+#include <celutil/mappedfile.h>
+#include <cstring>
+#include <iterator>
 
 using namespace Eigen;
 using namespace std;
 
-using ProcessChunkFunc = bool (*)(ifstream &, unsigned short, int, void *);
+namespace
+{
+// The whole file is parsed from memory; reads past the end of the buffer
+// return zeros and flag the buffer as bad.
+struct M3DBuffer
+{
+    const char* pos;
+    const char* end;
+    bool bad;
+
+    size_t remaining() const { return (size_t) (end - pos); }
+};
+} // end unnamed namespace
 
-static int read3DSChunk(ifstream& in,
+using ProcessChunkFunc = bool (*)(M3DBuffer &, unsigned short, int, void *);
+
+static int read3DSChunk(M3DBuffer& in,
                         ProcessChunkFunc chunkFunc,
                         void* obj);
 
@@ -28,82 +45,69 @@ static int read3DSChunk(ifstream& in,
 static int logIndent = 0;
 
 
-static int32_t readInt(ifstream& in)
+template<typename T> static T readValue(M3DBuffer& in)
+{
+    T ret {};
+    if (in.remaining() < sizeof(T))
+    {
+        in.pos = in.end;
+        in.bad = true;
+        return ret;
+    }
+
+    memcpy(&ret, in.pos, sizeof(T));
+    in.pos += sizeof(T);
+    return ret;
+}
+
+static int32_t readInt(M3DBuffer& in)
 {
-    int32_t ret;
-    in.read((char *) &ret, sizeof(int32_t));
+    auto ret = readValue<int32_t>(in);
     LE_TO_CPU_INT32(ret, ret);
     return ret;
 }
 
-static int16_t readShort(ifstream& in)
+static int16_t readShort(M3DBuffer& in)
 {
-    int16_t ret;
-    in.read((char *) &ret, sizeof(int16_t));
+    auto ret = readValue<int16_t>(in);
     LE_TO_CPU_INT16(ret, ret);
     return ret;
 }
 
-static uint16_t readUshort(ifstream& in)
+static uint16_t readUshort(M3DBuffer& in)
 {
-    uint16_t ret;
-    in.read((char *) &ret, sizeof(uint16_t));
+    auto ret = readValue<uint16_t>(in);
     LE_TO_CPU_INT16(ret, ret);
     return ret;
 }
 
-static float readFloat(ifstream& in)
+static float readFloat(M3DBuffer& in)
 {
-    float f;
-    in.read((char*) &f, sizeof(float));
+    auto f = readValue<float>(in);
     LE_TO_CPU_FLOAT(f, f);
     return f;
 }
 
 
-static char readChar(ifstream& in)
+static char readChar(M3DBuffer& in)
 {
-    char c;
-    in.read(&c, 1);
-    return c;
+    return readValue<char>(in);
 }
 
 
-/* Not currently used
-static int readString(ifstream& in, char* s, int maxLength)
-{
-    int count;
-    for (count = 0; count < maxLength; count++)
-    {
-        in.read(s + count, 1);
-        if (s[count] == '\0')
-            break;
-    }
-
-    return count;
-}*/
-
-static string readString(ifstream& in)
+static string readString(M3DBuffer& in)
 {
-    char s[1024];
-    int maxLength = sizeof(s);
-
-    for (int count = 0; count < maxLength; count++)
+    const char* start = in.pos;
+    const char* nul = static_cast<const char*>(memchr(start, '\0', in.remaining()));
+    if (nul == nullptr)
     {
-        in.read(s + count, 1);
-        if (s[count] == '\0')
-            break;
+        in.pos = in.end;
+        in.bad = true;
+        return string(start, in.end);
     }
 
-    return string(s);
-}
-
-
-static void skipBytes(ifstream& in, int count)
-{
-    char c;
-    while (count-- > 0)
-        in.get(c);
+    in.pos = nul + 1;
+    return string(start, nul);
 }
 
 
@@ -209,45 +213,69 @@ void logChunk(uint16_t /*chunkType*/ /*, int chunkSize*/)
 }
 
 
-int read3DSChunk(ifstream& in,
+int read3DSChunk(M3DBuffer& in,
                  ProcessChunkFunc chunkFunc,
                  void* obj)
 {
     unsigned short chunkType = readUshort(in);
     int32_t chunkSize = readInt(in);
     int contentSize = chunkSize - 6;
+    if (in.bad || contentSize < 0 || (size_t) contentSize > in.remaining())
+    {
+        DPRINTF(LOG_LEVEL_ERROR, "Read3DSFile: Chunk %04x doesn't fit in its parent\n", chunkType);
+        in.pos = in.end;
+        in.bad = true;
+        return 0;
+    }
+
+    // Limit the chunk function to the chunk contents; unread contents are
+    // skipped.
+    const char* parentEnd = in.end;
+    const char* chunkEnd = in.pos + contentSize;
+    in.end = chunkEnd;
 
     //logChunk(chunkType/*, chunkSize*/);
-    bool chunkWasRead = chunkFunc(in, chunkType, contentSize, obj);
+    chunkFunc(in, chunkType, contentSize, obj);
 
-    if (!chunkWasRead)
-    {
-        skipBytes(in, contentSize);
-    }
+    in.pos = chunkEnd;
+    in.end = parentEnd;
 
     return chunkSize;
 }
 
 
-int read3DSChunks(ifstream& in,
+int read3DSChunks(M3DBuffer& in,
                   int nBytes,
                   ProcessChunkFunc chunkFunc,
                   void* obj)
 {
+    if (nBytes <= 0)
+        return 0;
+    if ((size_t) nBytes > in.remaining())
+    {
+        in.pos = in.end;
+        in.bad = true;
+        return 0;
+    }
+
+    M3DBuffer chunks = { in.pos, in.pos + nBytes, false };
     int bytesRead = 0;
 
     logIndent++;
-    while (bytesRead < nBytes)
-        bytesRead += read3DSChunk(in, chunkFunc, obj);
+    while (chunks.remaining() >= 6 && !chunks.bad)
+        bytesRead += read3DSChunk(chunks, chunkFunc, obj);
     logIndent--;
 
     if (bytesRead != nBytes)
         cout << "Expected " << nBytes << " bytes but read " << bytesRead << '\n';
+
+    in.pos += nBytes;
+    in.bad = in.bad || chunks.bad;
     return bytesRead;
 }
 
 
-M3DColor readColor(ifstream& in/*, int nBytes*/)
+M3DColor readColor(M3DBuffer& in/*, int nBytes*/)
 {
     auto r = (unsigned char) readChar(in);
     auto g = (unsigned char) readChar(in);
@@ -259,7 +287,7 @@ M3DColor readColor(ifstream& in/*, int nBytes*/)
 }
 
 
-M3DColor readFloatColor(ifstream& in/*, int nBytes*/)
+M3DColor readFloatColor(M3DBuffer& in/*, int nBytes*/)
 {
     float r = readFloat(in);
     float g = readFloat(in);
@@ -271,7 +299,7 @@ M3DColor readFloatColor(ifstream& in/*, int nBytes*/)
 }
 
 
-Matrix4f readMeshMatrix(ifstream& in/*, int nBytes*/)
+Matrix4f readMeshMatrix(M3DBuffer& in/*, int nBytes*/)
 {
     float m00 = readFloat(in);
     float m01 = readFloat(in);
@@ -303,7 +331,7 @@ Matrix4f readMeshMatrix(ifstream& in/*, int nBytes*/)
 }
 
 
-bool stubProcessChunk(/* ifstream& in,
+bool stubProcessChunk(/* M3DBuffer& in,
                          unsigned short chunkType,
                          int contentSize,
                          void* obj */)
@@ -312,7 +340,7 @@ bool stubProcessChunk(/* ifstream& in,
 }
 
 
-void readPointArray(ifstream& in, M3DTriangleMesh* triMesh)
+void readPointArray(M3DBuffer& in, M3DTriangleMesh* triMesh)
 {
     uint16_t nPoints = readUshort(in);
 
@@ -326,7 +354,7 @@ void readPointArray(ifstream& in, M3DTriangleMesh* triMesh)
 }
 
 
-void readTextureCoordArray(ifstream& in, M3DTriangleMesh* triMesh)
+void readTextureCoordArray(M3DBuffer& in, M3DTriangleMesh* triMesh)
 {
     uint16_t nPoints = readUshort(in);
 
@@ -339,7 +367,7 @@ void readTextureCoordArray(ifstream& in, M3DTriangleMesh* triMesh)
 }
 
 
-bool processFaceArrayChunk(ifstream& in,
+bool processFaceArrayChunk(M3DBuffer& in,
                            unsigned short chunkType,
                            int /*contentSize*/,
                            void* obj)
@@ -379,7 +407,7 @@ bool processFaceArrayChunk(ifstream& in,
 }
 
 
-void readFaceArray(ifstream& in, M3DTriangleMesh* triMesh, int contentSize)
+void readFaceArray(M3DBuffer& in, M3DTriangleMesh* triMesh, int contentSize)
 {
     uint16_t nFaces = readUshort(in);
 
@@ -403,7 +431,7 @@ void readFaceArray(ifstream& in, M3DTriangleMesh* triMesh, int contentSize)
 }
 
 
-bool processTriMeshChunk(ifstream& in,
+bool processTriMeshChunk(M3DBuffer& in,
                          unsigned short chunkType,
                          int contentSize,
                          void* obj)
@@ -430,7 +458,7 @@ bool processTriMeshChunk(ifstream& in,
 }
 
 
-bool processModelChunk(ifstream& in,
+bool processModelChunk(M3DBuffer& in,
                        unsigned short chunkType,
                        int contentSize,
                        void* obj)
@@ -449,7 +477,7 @@ bool processModelChunk(ifstream& in,
 }
 
 
-bool processColorChunk(ifstream& in,
+bool processColorChunk(M3DBuffer& in,
                        unsigned short chunkType,
                        int /*contentSize*/,
                        void* obj)
@@ -470,7 +498,7 @@ bool processColorChunk(ifstream& in,
 }
 
 
-static bool processPercentageChunk(ifstream& in,
+static bool processPercentageChunk(M3DBuffer& in,
                                    unsigned short chunkType,
                                    int /*contentSize*/,
                                    void* obj)
@@ -491,7 +519,7 @@ static bool processPercentageChunk(ifstream& in,
 }
 
 
-static bool processTexmapChunk(ifstream& in,
+static bool processTexmapChunk(M3DBuffer& in,
                                unsigned short chunkType,
                                int /*contentSize*/,
                                void* obj)
@@ -509,7 +537,7 @@ static bool processTexmapChunk(ifstream& in,
 }
 
 
-bool processMaterialChunk(ifstream& in,
+bool processMaterialChunk(M3DBuffer& in,
                           unsigned short chunkType,
                           int contentSize,
                           void* obj)
@@ -554,7 +582,7 @@ bool processMaterialChunk(ifstream& in,
 }
 
 
-bool processSceneChunk(ifstream& in,
+bool processSceneChunk(M3DBuffer& in,
                        unsigned short chunkType,
                        int contentSize,
                        void* obj)
@@ -598,7 +626,7 @@ bool processSceneChunk(ifstream& in,
 }
 
 
-bool processTopLevelChunk(ifstream& in,
+bool processTopLevelChunk(M3DBuffer& in,
                           unsigned short chunkType,
                           int contentSize,
                           void* obj)
@@ -615,8 +643,9 @@ bool processTopLevelChunk(ifstream& in,
 }
 
 
-M3DScene* Read3DSFile(ifstream& in)
+M3DScene* Read3DSFile(const char* data, size_t size)
 {
+    M3DBuffer in = { data, data + size, false };
     unsigned short chunkType = readUshort(in);
     if (chunkType != M3DCHUNK_MAGIC)
     {
@@ -624,8 +653,8 @@ M3DScene* Read3DSFile(ifstream& in)
         return nullptr;
     }
 
-   int32_t chunkSize = readInt(in);
-    if (in.bad())
+    int32_t chunkSize = readInt(in);
+    if (in.bad)
     {
         DPRINTF(LOG_LEVEL_ERROR, "Read3DSFile: Error reading 3DS file.\n");
         return nullptr;
@@ -637,23 +666,40 @@ M3DScene* Read3DSFile(ifstream& in)
     int contentSize = chunkSize - 6;
 
     read3DSChunks(in, contentSize, processTopLevelChunk, (void*) scene);
+    if (in.bad)
+    {
+        DPRINTF(LOG_LEVEL_ERROR, "Read3DSFile: 3DS file is truncated or corrupt.\n");
+        delete scene;
+        return nullptr;
+    }
 
     return scene;
 }
 
 
+M3DScene* Read3DSFile(istream& in)
+{
+    string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    if (in.bad())
+    {
+        DPRINTF(LOG_LEVEL_ERROR, "Read3DSFile: Error reading 3DS file.\n");
+        return nullptr;
+    }
+
+    return Read3DSFile(data.data(), data.size());
+}
+
+
 M3DScene* Read3DSFile(const fs::path& filename)
 {
-    ifstream in(filename.string(), ios::in | ios::binary);
-    if (!in.good())
+    MappedFile file;
+    if (!file.open(filename))
     {
         DPRINTF(LOG_LEVEL_ERROR, "Read3DSFile: Error opening %s\n", filename);
         return nullptr;
     }
 
-    M3DScene* scene = Read3DSFile(in);
-    in.close();
-    return scene;
+    return Read3DSFile(file.getData(), file.getSize());
 }
 
 
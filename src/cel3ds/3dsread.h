@@ -10,12 +10,15 @@
 #ifndef _3DSREAD_H_
 #define _3DSREAD_H_
 
+#include <cstddef>
 #include <iostream>
-#include <fstream>
 #include <cel3ds/3dsmodel.h>
 #include <celcompat/filesystem.h>
 
-M3DScene* Read3DSFile(std::ifstream& in);
+// Parse a 3DS file held in memory. Returns nullptr if the file is truncated
+// or corrupt.
+M3DScene* Read3DSFile(const char* data, size_t size);
+M3DScene* Read3DSFile(std::istream& in);
 M3DScene* Read3DSFile(const fs::path& filename);
 
 #endif // _3DSREAD_H_
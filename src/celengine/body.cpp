@@ -10,8 +10,15 @@
 #include <cstdlib>
 #include <cassert>
 #include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <fmt/format.h>
 #include <celmath/mathlib.h>
 #include <celutil/gettext.h>
+#include <celutil/bytes.h>
+#include <celutil/cachefile.h>
+#include <celutil/debug.h>
+#include <celutil/mappedfile.h>
 #include <celutil/utf8.h>
 #include "geometry.h"
 #include "meshmanager.h"
@@ -21,6 +28,7 @@
 #include "timeline.h"
 #include "timelinephase.h"
 #include "frametree.h"
+#include "locationindex.h"
 #include "referencemark.h"
 #include "selection.h"
 
@@ -28,6 +36,101 @@ using namespace Eigen;
 using namespace std;
 using namespace celmath;
 
+namespace
+{
+// A location cache file is this header, the key of the entry and the
+// distances along the rays to the surface.
+struct LocationCacheHeader
+{
+    char magic[8];          // "CELLOCS"
+    uint16_t byteOrder;
+    uint16_t reserved;
+    uint32_t count;
+    uint64_t keySize;
+};
+
+constexpr const char LocationCacheMagic[8] = "CELLOCS";
+constexpr const char* LocationCacheExtension = ".loccache";
+
+// The cache key covers the model file, the model's center, scale and
+// normalization (encoded in the suffix of its resolved name), the body
+// radius and the original location positions. Bodies sharing a model but
+// not the rest get cache files of their own.
+bool GetLocationCacheKey(const fs::path& resolvedName,
+                         const vector<Location*>& locations,
+                         float radius,
+                         fs::path& cacheFile,
+                         string& key)
+{
+    const auto& name = resolvedName.native();
+    auto suffixStart = name.rfind('!');
+    fs::path modelFile = name.substr(0, suffixStart);
+    fs::path suffix;
+    if (suffixStart != fs::path::string_type::npos)
+        suffix = name.substr(suffixStart);
+
+    uint64_t hash = HashFNV1a(&radius, sizeof(radius));
+    for (const auto location : locations)
+    {
+        Vector3f position = location->getPosition();
+        hash = HashFNV1a(position.data(), 3 * sizeof(float), hash);
+    }
+
+    string parameters = fmt::format("{}\n{:016x}", suffix.string(), hash);
+    if (!MakeCacheKey(modelFile, parameters, key))
+        return false;
+
+    cacheFile = modelFile;
+    cacheFile += fmt::format(".{:016x}{}", HashFNV1a(parameters), LocationCacheExtension);
+    return true;
+}
+
+bool LoadLocationCache(const fs::path& filename, const string& key, size_t count, vector<double>& distances)
+{
+    MappedFile file;
+    if (!file.open(filename) || file.getSize() != sizeof(LocationCacheHeader) + key.size() + count * sizeof(double))
+        return false;
+
+    LocationCacheHeader header;
+    memcpy(&header, file.getData(), sizeof(header));
+    const char* cachedKey = file.getData() + sizeof(header);
+    if (memcmp(header.magic, LocationCacheMagic, sizeof(header.magic)) != 0 ||
+        header.byteOrder != __BYTE_ORDER__ ||
+        header.count != count ||
+        header.keySize != key.size() ||
+        !equal(key.begin(), key.end(), cachedKey))
+    {
+        return false;
+    }
+
+    distances.resize(count);
+    memcpy(distances.data(), cachedKey + key.size(), count * sizeof(double));
+    return true;
+}
+
+// Failing to write the cache, e.g. to a read-only data directory, is not an
+// error; the locations are just projected again the next time.
+void SaveLocationCache(const fs::path& filename, const string& key, const vector<double>& distances)
+{
+    LocationCacheHeader header;
+    memcpy(header.magic, LocationCacheMagic, sizeof(header.magic));
+    header.byteOrder = __BYTE_ORDER__;
+    header.reserved = 0;
+    header.count = (uint32_t) distances.size();
+    header.keySize = key.size();
+
+    bool saved = ReplaceFileContents(filename, [&](ostream& out)
+    {
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(key.data(), key.size());
+        out.write(reinterpret_cast<const char*>(distances.data()), distances.size() * sizeof(double));
+        return true;
+    });
+    if (!saved)
+        DPRINTF(LOG_LEVEL_INFO, "Could not write location cache %s\n", filename.string());
+}
+}
+
 
 Body::Body(PlanetarySystem* _system, const string& _name) :
     system(_system),
@@ -927,6 +1030,7 @@ void Body::addLocation(Location* loc)
         locations = new vector<Location*>();
     locations->push_back(loc);
     loc->setParentBody(this);
+    locationIndex.reset();
 }
 
 
@@ -936,6 +1040,18 @@ vector<Location*>* Body::getLocations() const
 }
 
 
+const LocationIndex* Body::getLocationIndex() const
+{
+    if (!locations)
+        return nullptr;
+
+    if (!locationIndex)
+        locationIndex = unique_ptr<LocationIndex>(new LocationIndex(*locations));
+
+    return locationIndex.get();
+}
+
+
 Location* Body::findLocation(const string& name, bool i18n) const
 {
     if (!locations)
@@ -962,6 +1078,7 @@ void Body::computeLocations()
         return;
 
     locationsComputed = true;
+    locationIndex.reset();
 
     // No work to do if there's no mesh, or if the mesh cannot be loaded
     if (geometry == InvalidResource)
@@ -974,6 +1091,13 @@ void Body::computeLocations()
     // not necessary.
     double boundingRadius = 2.0;
 
+    // Cast all rays at once, so the geometry can share its acceleration
+    // structure between them.
+    vector<Ray3d> rays;
+    vector<float> altitudes;
+    vector<double> distances;
+    rays.reserve(locations->size());
+    altitudes.reserve(locations->size());
     for (const auto location : *locations)
     {
         Vector3f v = location->getPosition();
@@ -982,12 +1106,36 @@ void Body::computeLocations()
             v.normalize();
         v *= (float) boundingRadius;
 
-        Ray3d ray(v.cast<double>(), -v.cast<double>());
-        double t = 0.0;
-        if (g->pick(ray, t))
+        rays.emplace_back(v.cast<double>(), -v.cast<double>());
+        altitudes.push_back(alt);
+    }
+
+    // The results only depend on the model file and the locations, and are
+    // kept in a file next to the model.
+    const GeometryInfo* info = GetGeometryManager()->getResourceInfo(geometry);
+    fs::path cacheFile;
+    string cacheKey;
+    if (info != nullptr && GetLocationCacheKey(info->resolvedName, *locations, radius, cacheFile, cacheKey))
+    {
+        if (!LoadLocationCache(cacheFile, cacheKey, rays.size(), distances))
+        {
+            g->pickRays(rays, distances);
+            SaveLocationCache(cacheFile, cacheKey, distances);
+        }
+    }
+    else
+    {
+        g->pickRays(rays, distances);
+    }
+
+    for (size_t i = 0; i < locations->size(); i++)
+    {
+        double t = distances[i];
+        if (t >= 0.0)
         {
-            v *= (float) ((1.0 - t) * radius + alt);
-            location->setPosition(v);
+            Vector3f v = rays[i].origin.cast<float>();
+            v *= (float) ((1.0 - t) * radius + altitudes[i]);
+            (*locations)[i]->setPosition(v);
         }
     }
 }
@@ -32,6 +32,7 @@ class Body;
 class FrameTree;
 class ReferenceMark;
 class Atmosphere;
+class LocationIndex;
 
 class PlanetarySystem
 {
@@ -321,6 +322,9 @@ class Body : public AstroObject
     void addLocation(Location*);
     Location* findLocation(const std::string&, bool i18n = false) const;
     void computeLocations();
+    // Spatial index of the locations, built on first use; null if the body
+    // has no locations.
+    const LocationIndex* getLocationIndex() const;
 
     bool isVisible() const { return visible; }
     void setVisible(bool _visible);
@@ -415,6 +419,7 @@ class Body : public AstroObject
 
     std::vector<Location*>* locations{ nullptr };
     mutable bool locationsComputed{ false };
+    mutable std::unique_ptr<LocationIndex> locationIndex;
 
     std::list<ReferenceMark*>* referenceMarks{ nullptr };
 
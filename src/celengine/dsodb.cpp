@@ -18,13 +18,16 @@
 #include <celmath/mathlib.h>
 #include <celutil/gettext.h>
 #include <celutil/bytes.h>
+#include <celutil/profiler.h>
 #include <celutil/utf8.h>
+#include <celutil/workerpool.h>
 #include <celengine/dsodb.h>
 #include <config.h>
 #include "astro.h"
 #include "parser.h"
 #include "parseobject.h"
 #include "multitexture.h"
+#include "octreebuilder.h"
 #include "meshmanager.h"
 #include "tokenizer.h"
 #include <celutil/debug.h>
@@ -47,6 +50,19 @@ constexpr const float DSO_OCTREE_MAGNITUDE   = 8.0f;
 
 constexpr char FILE_HEADER[]                 = "CEL_DSOs";
 
+// Below this number of candidate objects the bulk culling pass is cheaper
+// to run on a single thread than to dispatch to the worker pool.
+constexpr const size_t DSO_PARALLEL_CULLING_THRESHOLD = 32768;
+
+// DSOs added after loading are tested one by one by the queries until there
+// are more than this many of them, then they're sorted into an octree.
+constexpr const size_t DSO_OVERLAY_MERGE_THRESHOLD = 1024;
+
+static float getDSOOctreeExclusionFactor()
+{
+    return astro::appToAbsMag(DSO_OCTREE_MAGNITUDE, DSO_OCTREE_ROOT_SIZE * (float) sqrt(3.0));
+}
+
 // Used to sort DSO pointers by catalog number
 struct PtrCatalogNumberOrderingPredicate
 {
@@ -65,6 +81,11 @@ DSODatabase::~DSODatabase()
 {
     delete [] DSOs;
     delete [] catalogNumberIndex;
+
+    // Wait for a running merge before the objects go away
+    dsoOverlay.reset();
+    for (const auto dso : addedDSOs)
+        delete dso;
 }
 
 
@@ -79,9 +100,19 @@ DeepSkyObject* DSODatabase::find(const AstroCatalog::IndexNumber catalogNumber)
                                         PtrCatalogNumberOrderingPredicate());
 
     if (dso != catalogNumberIndex + nDSOs && (*dso)->getIndex() == catalogNumber)
-        return *dso;
-    else
-        return nullptr;
+    {
+        if (removedDSOs.empty() || removedDSOs.find(*dso) == removedDSOs.end())
+            return *dso;
+    }
+
+    if (!addedDSOIndex.empty())
+    {
+        auto iter = addedDSOIndex.find(catalogNumber);
+        if (iter != addedDSOIndex.end())
+            return iter->second;
+    }
+
+    return nullptr;
 }
 
 
@@ -156,16 +187,13 @@ string DSODatabase::getDSONameList(const DeepSkyObject* const & dso, const unsig
 }
 
 
-void DSODatabase::findVisibleDSOs(DSOHandler&    dsoHandler,
-                                  const Vector3d& obsPos,
-                                  const Quaternionf& obsOrient,
-                                  float fovY,
-                                  float aspectRatio,
-                                  float limitingMag,
-                                  OctreeProcStats *stats) const
+// Compute the bounding planes of an infinite view frustum
+static void computeFrustumPlanes(Hyperplane<double, 3>* frustumPlanes,
+                                 const Vector3d& obsPos,
+                                 const Quaternionf& obsOrient,
+                                 float fovY,
+                                 float aspectRatio)
 {
-    // Compute the bounding planes of an infinite view frustum
-    Hyperplane<double, 3> frustumPlanes[5];
     Vector3d  planeNormals[5];
 
     Quaterniond obsOrientd = obsOrient.cast<double>();
@@ -184,13 +212,257 @@ void DSODatabase::findVisibleDSOs(DSOHandler&    dsoHandler,
         planeNormals[i]    = rot * planeNormals[i].normalized();
         frustumPlanes[i]   = Hyperplane<double, 3>(planeNormals[i], obsPos);
     }
+}
+
+
+namespace
+{
+// Passes on the DSOs which weren't removed from the database
+class RemovedDSOFilter : public DSOHandler
+{
+ public:
+    RemovedDSOFilter(DSOHandler& _handler, const set<const DeepSkyObject*>& _removed) :
+        handler(_handler),
+        removed(_removed)
+    {
+    }
+
+    void process(DeepSkyObject* const& dso, double distance, float absMag) override
+    {
+        if (removed.find(dso) == removed.end())
+            handler.process(dso, distance, absMag);
+    }
+
+ private:
+    DSOHandler& handler;
+    const set<const DeepSkyObject*>& removed;
+};
+
+// Applies the tests of DSODatabase::cullRange which the octree traversal
+// leaves out to the added DSOs.
+class VisibleDSOCollector : public DSOHandler
+{
+ public:
+    VisibleDSOCollector(vector<VisibleDSO>& _visibleDSOs,
+                        const Hyperplane<double, 3>* _frustumPlanes,
+                        uint64_t _renderFlags,
+                        int _labelMode,
+                        const set<const DeepSkyObject*>& _removed) :
+        visibleDSOs(_visibleDSOs),
+        frustumPlanes(_frustumPlanes),
+        renderFlags(_renderFlags),
+        labelMode(_labelMode),
+        removed(_removed)
+    {
+    }
+
+    void process(DeepSkyObject* const& dso, double distance, float absMag) override
+    {
+        if ((dso->getRenderMask() & renderFlags) == 0 && (dso->getLabelMask() & (uint32_t) labelMode) == 0)
+            return;
+
+        double radius = dso->getBoundingSphereRadius();
+        for (int i = 0; i < 5; i++)
+        {
+            if (frustumPlanes[i].signedDistance(dso->getPosition()) < -radius)
+                return;
+        }
+
+        if (removed.empty() || removed.find(dso) == removed.end())
+            visibleDSOs.push_back({ dso, distance, absMag });
+    }
+
+ private:
+    vector<VisibleDSO>& visibleDSOs;
+    const Hyperplane<double, 3>* frustumPlanes;
+    uint64_t renderFlags;
+    int labelMode;
+    const set<const DeepSkyObject*>& removed;
+};
+}
+
+
+void DSODatabase::findVisibleDSOs(DSOHandler&    dsoHandler,
+                                  const Vector3d& obsPos,
+                                  const Quaternionf& obsOrient,
+                                  float fovY,
+                                  float aspectRatio,
+                                  float limitingMag,
+                                  OctreeProcStats *stats) const
+{
+    Hyperplane<double, 3> frustumPlanes[5];
+    computeFrustumPlanes(frustumPlanes, obsPos, obsOrient, fovY, aspectRatio);
 
-    octreeRoot->processVisibleObjects(dsoHandler,
+    RemovedDSOFilter filter(dsoHandler, removedDSOs);
+    DSOHandler& handler = removedDSOs.empty() ? dsoHandler : filter;
+    octreeRoot->processVisibleObjects(handler,
                                       obsPos,
                                       frustumPlanes,
                                       limitingMag,
                                       DSO_OCTREE_ROOT_SIZE,
                                       stats);
+
+    if (dsoOverlay != nullptr)
+    {
+        dsoOverlay->process([&](const DSOOctree& node)
+        {
+            node.processVisibleObjects(handler, obsPos, frustumPlanes, limitingMag, DSO_OCTREE_ROOT_SIZE, stats);
+        });
+    }
+}
+
+
+void DSODatabase::findVisibleDSOs(vector<VisibleDSO>& visibleDSOs,
+                                  const Vector3d& obsPos,
+                                  const Quaternionf& obsOrient,
+                                  float fovY,
+                                  float aspectRatio,
+                                  float limitingMag,
+                                  uint64_t renderFlags,
+                                  int labelMode,
+                                  OctreeProcStats *stats) const
+{
+    visibleDSOs.clear();
+
+    Hyperplane<double, 3> frustumPlanes[5];
+    computeFrustumPlanes(frustumPlanes, obsPos, obsOrient, fovY, aspectRatio);
+
+    // The node level tests are cheap compared to the object tests, so the
+    // traversal itself stays on this thread.
+    vector<DSOObjectRange> ranges;
+    octreeRoot->collectVisibleRanges(ranges,
+                                     obsPos,
+                                     frustumPlanes,
+                                     limitingMag,
+                                     DSO_OCTREE_ROOT_SIZE,
+                                     stats);
+
+    size_t nCandidates = 0;
+    for (const auto& range : ranges)
+        nCandidates += range.nObjects;
+
+    WorkerPool* pool = GetWorkerPool();
+    if (nCandidates < DSO_PARALLEL_CULLING_THRESHOLD || pool->getConcurrency() == 1)
+    {
+        for (const auto& range : ranges)
+            cullRange(range, obsPos, frustumPlanes, limitingMag, renderFlags, labelMode, visibleDSOs);
+    }
+    else
+    {
+        // Each slot gets a run of consecutive ranges; concatenating the slots
+        // keeps the result in the same order as a serial traversal.
+        size_t nSlots = min(ranges.size(), (size_t) pool->getConcurrency() * 4);
+        vector<vector<VisibleDSO>> slots(nSlots);
+        pool->parallelFor(nSlots, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t slot = begin; slot < end; slot++)
+            {
+                size_t first = slot * ranges.size() / nSlots;
+                size_t last = (slot + 1) * ranges.size() / nSlots;
+                for (size_t i = first; i < last; i++)
+                    cullRange(ranges[i], obsPos, frustumPlanes, limitingMag, renderFlags, labelMode, slots[slot]);
+            }
+        });
+
+        for (const auto& slot : slots)
+            visibleDSOs.insert(visibleDSOs.end(), slot.begin(), slot.end());
+    }
+
+    if (!removedDSOs.empty())
+    {
+        visibleDSOs.erase(remove_if(visibleDSOs.begin(), visibleDSOs.end(),
+                                    [this](const VisibleDSO& v) { return removedDSOs.find(v.dso) != removedDSOs.end(); }),
+                          visibleDSOs.end());
+    }
+
+    // Added DSOs aren't part of the culling data and get the same tests
+    // through the octree traversal.
+    if (dsoOverlay != nullptr)
+    {
+        VisibleDSOCollector collector(visibleDSOs, frustumPlanes, renderFlags, labelMode, removedDSOs);
+        dsoOverlay->process([&](const DSOOctree& node)
+        {
+            node.processVisibleObjects(collector, obsPos, frustumPlanes, limitingMag, DSO_OCTREE_ROOT_SIZE, stats);
+        });
+    }
+}
+
+
+// Apply the object tests of DSOOctree::processVisibleObjects and the view
+// frustum test of the renderer to the objects of a range. Working on blocks
+// of the culling arrays keeps the test loop free of branches and virtual
+// calls so that the compiler can vectorize it.
+void DSODatabase::cullRange(const DSOObjectRange& range,
+                            const Vector3d& obsPos,
+                            const Hyperplane<double, 3>* frustumPlanes,
+                            float limitingMag,
+                            uint64_t renderFlags,
+                            int labelMode,
+                            vector<VisibleDSO>& visibleDSOs) const
+{
+    constexpr const size_t BlockSize = 64;
+    constexpr const double pc10 = 10.0 * LY_PER_PARSEC;
+
+    const CullingData& data = cullingData;
+
+    // appMag < limitingMag <=> distance < pc10 * 10^(limitingMag / 5) * 10^(-absMag / 5)
+    const double magDistance = pc10 * pow(10.0, limitingMag / 5.0);
+    const double dimmest = range.dimmest;
+    const double ox = obsPos.x(), oy = obsPos.y(), oz = obsPos.z();
+
+    double nx[5], ny[5], nz[5];
+    for (int i = 0; i < 5; i++)
+    {
+        nx[i] = frustumPlanes[i].normal().x();
+        ny[i] = frustumPlanes[i].normal().y();
+        nz[i] = frustumPlanes[i].normal().z();
+    }
+
+    size_t start = range.firstObject - DSOs;
+    size_t end = start + range.nObjects;
+
+    double distance[BlockSize];
+    uint8_t keep[BlockSize];
+
+    for (size_t blockStart = start; blockStart < end; blockStart += BlockSize)
+    {
+        size_t n = min(BlockSize, end - blockStart);
+        const double* x = &data.x[blockStart];
+        const double* y = &data.y[blockStart];
+        const double* z = &data.z[blockStart];
+        const float* radius = &data.radius[blockStart];
+        const float* absMag = &data.absMag[blockStart];
+        const double* distanceScale = &data.distanceScale[blockStart];
+        const uint64_t* renderMask = &data.renderMask[blockStart];
+        const uint32_t* labelMask = &data.labelMask[blockStart];
+
+        for (size_t i = 0; i < n; i++)
+        {
+            double rx = x[i] - ox;
+            double ry = y[i] - oy;
+            double rz = z[i] - oz;
+            double r = radius[i];
+            double d = sqrt(rx * rx + ry * ry + rz * rz) - r;
+
+            bool bright = absMag[i] < dimmest &&
+                          (d >= pc10 ? d < magDistance * distanceScale[i] : absMag[i] < limitingMag);
+
+            bool inside = true;
+            for (int j = 0; j < 5; j++)
+                inside &= nx[j] * rx + ny[j] * ry + nz[j] * rz >= -r;
+
+            bool shown = (renderMask[i] & renderFlags) != 0 || (labelMask[i] & (uint32_t) labelMode) != 0;
+
+            distance[i] = d;
+            keep[i] = bright & inside & shown;
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            if (keep[i])
+                visibleDSOs.push_back({ DSOs[blockStart + i], distance[i], absMag[i] });
+        }
+    }
 }
 
 
@@ -198,10 +470,108 @@ void DSODatabase::findCloseDSOs(DSOHandler&     dsoHandler,
                                 const Vector3d& obsPos,
                                 float           radius) const
 {
-    octreeRoot->processCloseObjects(dsoHandler,
+    RemovedDSOFilter filter(dsoHandler, removedDSOs);
+    DSOHandler& handler = removedDSOs.empty() ? dsoHandler : filter;
+    octreeRoot->processCloseObjects(handler,
                                     obsPos,
                                     radius,
                                     DSO_OCTREE_ROOT_SIZE);
+
+    if (dsoOverlay != nullptr)
+    {
+        dsoOverlay->process([&](const DSOOctree& node)
+        {
+            node.processCloseObjects(handler, obsPos, radius, DSO_OCTREE_ROOT_SIZE);
+        });
+    }
+}
+
+
+void DSODatabase::findDSOsInCone(DSOHandler&     dsoHandler,
+                                 const Vector3d& obsPos,
+                                 const Vector3d& direction,
+                                 double          maxAngle,
+                                 double          maxDistance,
+                                 float           limitingMag) const
+{
+    RemovedDSOFilter filter(dsoHandler, removedDSOs);
+    DSOHandler& handler = removedDSOs.empty() ? dsoHandler : filter;
+    octreeRoot->processObjectsInCone(handler,
+                                     obsPos,
+                                     direction,
+                                     maxAngle,
+                                     maxDistance,
+                                     limitingMag,
+                                     DSO_OCTREE_ROOT_SIZE);
+
+    if (dsoOverlay != nullptr)
+    {
+        dsoOverlay->process([&](const DSOOctree& node)
+        {
+            node.processObjectsInCone(handler,
+                                      obsPos,
+                                      direction,
+                                      maxAngle,
+                                      maxDistance,
+                                      limitingMag,
+                                      DSO_OCTREE_ROOT_SIZE);
+        });
+    }
+}
+
+
+bool DSODatabase::addDSO(DeepSkyObject* dso, const string& names)
+{
+    AstroCatalog::IndexNumber catalogNumber = dso->getIndex();
+    if (catalogNumber == AstroCatalog::InvalidIndex)
+    {
+        while (find(nextAutoCatalogNumber) != nullptr)
+            nextAutoCatalogNumber--;
+        catalogNumber = nextAutoCatalogNumber--;
+        dso->setIndex(catalogNumber);
+    }
+    else if (find(catalogNumber) != nullptr)
+    {
+        return false;
+    }
+
+    addedDSOs.push_back(dso);
+    addedDSOIndex[catalogNumber] = dso;
+    if (namesDB != nullptr && !names.empty())
+        namesDB->addNames(catalogNumber, names);
+
+    if (dsoOverlay == nullptr)
+    {
+        dsoOverlay.reset(new OctreeOverlay<DeepSkyObject*, double>(Vector3d::Zero(),
+                                                                   DSO_OCTREE_ROOT_SIZE,
+                                                                   getDSOOctreeExclusionFactor(),
+                                                                   DSO_OVERLAY_MERGE_THRESHOLD));
+    }
+    dsoOverlay->add(dso);
+
+    return true;
+}
+
+
+bool DSODatabase::removeDSO(AstroCatalog::IndexNumber catalogNumber)
+{
+    DeepSkyObject* dso = find(catalogNumber);
+    if (dso == nullptr)
+        return false;
+
+    removedDSOs.insert(dso);
+    addedDSOIndex.erase(catalogNumber);
+    return true;
+}
+
+
+void DSODatabase::update(bool waitForMerge)
+{
+    if (dsoOverlay == nullptr)
+        return;
+
+    dsoOverlay->update([this](DeepSkyObject* const& dso) { return removedDSOs.find(dso) != removedDSOs.end(); },
+                       waitForMerge);
 }
 
 
@@ -219,6 +589,8 @@ void DSODatabase::setNameDatabase(DSONameDatabase* _namesDB)
 
 bool DSODatabase::load(istream& in, const fs::path& resourcePath)
 {
+    CEL_PROFILE_ZONE("DSODatabase::load");
+
     Tokenizer tokenizer(&in);
     Parser    parser(&tokenizer);
 
@@ -318,26 +690,7 @@ bool DSODatabase::load(istream& in, const fs::path& resourcePath)
                 // List of names will replace any that already exist for
                 // this DSO.
                 namesDB->erase(objCatalogNumber);
-
-                // Iterate through the string for names delimited
-                // by ':', and insert them into the DSO database.
-                // Note that db->add() will skip empty names.
-                string::size_type startPos   = 0;
-                while (startPos != string::npos)
-                {
-                    string::size_type next    = objName.find(':', startPos);
-                    string::size_type length  = string::npos;
-                    if (next != string::npos)
-                    {
-                        length = next - startPos;
-                        ++next;
-                    }
-                    string DSOName = objName.substr(startPos, length);
-                    namesDB->add(objCatalogNumber, DSOName);
-                    if (DSOName != _(DSOName.c_str()))
-                        namesDB->add(objCatalogNumber, _(DSOName.c_str()));
-                    startPos   = next;
-                }
+                namesDB->addNames(objCatalogNumber, objName);
             }
         }
         else
@@ -360,7 +713,10 @@ bool DSODatabase::loadBinary(istream&)
 
 void DSODatabase::finish()
 {
+    CEL_PROFILE_ZONE("DSODatabase::finish");
+
     buildOctree();
+    buildCullingData();
     buildIndexes();
     calcAvgAbsMag();
     /*
@@ -378,37 +734,57 @@ void DSODatabase::finish()
 void DSODatabase::buildOctree()
 {
     DPRINTF(LOG_LEVEL_INFO, "Sorting DSOs into octree . . .\n");
-    float absMag             = astro::appToAbsMag(DSO_OCTREE_MAGNITUDE, DSO_OCTREE_ROOT_SIZE * (float) sqrt(3.0));
 
     // TODO: investigate using a different center--it's possible that more
     // objects end up straddling the base level nodes when the center of the
     // octree is at the origin.
-    DynamicDSOOctree* root   = new DynamicDSOOctree(Vector3d::Zero(), absMag);
-    for (int i = 0; i < nDSOs; ++i)
-    {
-        root->insertObject(DSOs[i], DSO_OCTREE_ROOT_SIZE);
-    }
-
-    DPRINTF(LOG_LEVEL_INFO, "Spatially sorting DSOs for improved locality of reference . . .\n");
-    DeepSkyObject** sortedDSOs    = new DeepSkyObject*[nDSOs];
-    DeepSkyObject** firstDSO      = sortedDSOs;
-
-    // The spatial sorting part is useless for DSOs since we
-    // are storing pointers to objects and not the objects themselves:
-    root->rebuildAndSort(octreeRoot, firstDSO);
-
-    DPRINTF(LOG_LEVEL_INFO, "%d DSOs total\n", (int) (firstDSO - sortedDSOs));
+    DeepSkyObject** sortedDSOs = new DeepSkyObject*[nDSOs];
+    octreeRoot = OctreeBuilder<DeepSkyObject*, double>::build(DSOs,
+                                                              nDSOs,
+                                                              sortedDSOs,
+                                                              Vector3d::Zero(),
+                                                              DSO_OCTREE_ROOT_SIZE,
+                                                              getDSOOctreeExclusionFactor());
+
+    DPRINTF(LOG_LEVEL_INFO, "%d DSOs total\n", nDSOs);
     DPRINTF(LOG_LEVEL_INFO, "Octree has %d nodes and %d DSOs.\n",
             1 + octreeRoot->countChildren(), octreeRoot->countObjects());
     //cout<<"DSOs:  "<< octreeRoot->countObjects()<<"   Nodes:"
     //    <<octreeRoot->countChildren() <<endl;
     // Clean up . . .
     delete[] DSOs;
-    delete   root;
 
     DSOs = sortedDSOs;
 }
 
+void DSODatabase::buildCullingData()
+{
+    CullingData& data = cullingData;
+    data.x.resize(nDSOs);
+    data.y.resize(nDSOs);
+    data.z.resize(nDSOs);
+    data.radius.resize(nDSOs);
+    data.absMag.resize(nDSOs);
+    data.distanceScale.resize(nDSOs);
+    data.renderMask.resize(nDSOs);
+    data.labelMask.resize(nDSOs);
+
+    for (int i = 0; i < nDSOs; ++i)
+    {
+        const DeepSkyObject* dso = DSOs[i];
+        Vector3d pos = dso->getPosition();
+        data.x[i] = pos.x();
+        data.y[i] = pos.y();
+        data.z[i] = pos.z();
+        data.radius[i] = dso->getBoundingSphereRadius();
+        data.absMag[i] = dso->getAbsoluteMagnitude();
+        data.distanceScale[i] = pow(10.0, -data.absMag[i] / 5.0);
+        data.renderMask[i] = dso->getRenderMask();
+        data.labelMask[i] = dso->getLabelMask();
+    }
+}
+
+
 void DSODatabase::calcAvgAbsMag()
 {
     uint32_t nDSOeff = size();
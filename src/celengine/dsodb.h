@@ -14,10 +14,14 @@
 #define _DSODB_H_
 
 #include <iostream>
+#include <map>
+#include <memory>
+#include <set>
 #include <vector>
 #include <celengine/dsoname.h>
 #include <celengine/deepskyobj.h>
 #include <celengine/dsooctree.h>
+#include <celengine/octreeoverlay.h>
 #include <celengine/parser.h>
 
 
@@ -26,6 +30,15 @@ constexpr const unsigned int MAX_DSO_NAMES = 10;
 // 100 Gly - on the order of the current size of the universe
 constexpr const float DSO_OCTREE_ROOT_SIZE = 1.0e11f;
 
+// A DSO which passed the bulk visibility tests, with the arguments
+// DSOHandler::process would receive for it.
+struct VisibleDSO
+{
+    DeepSkyObject* dso;
+    double         distance;
+    float          absMag;
+};
+
 //NOTE: this one and starDatabase should be derived from a common base class since they share lots of code and functionality.
 class DSODatabase
 {
@@ -50,10 +63,33 @@ class DSODatabase
                          float limitingMag,
                          OctreeProcStats * = nullptr) const;
 
+    // Gather the DSOs passing the magnitude and view frustum tests, and
+    // having a render or label mask enabled by renderFlags and labelMode,
+    // into a compact list in octree traversal order. The per-object tests
+    // run over structure-of-arrays data, split across the worker threads
+    // for large catalogs.
+    void findVisibleDSOs(std::vector<VisibleDSO>& visibleDSOs,
+                         const Eigen::Vector3d& obsPosition,
+                         const Eigen::Quaternionf& obsOrientation,
+                         float fovY,
+                         float aspectRatio,
+                         float limitingMag,
+                         uint64_t renderFlags,
+                         int labelMode,
+                         OctreeProcStats * = nullptr) const;
+
     void findCloseDSOs(DSOHandler& dsoHandler,
                        const Eigen::Vector3d& obsPosition,
                        float radius) const;
 
+    // Same as StarDatabase::findStarsInCone
+    void findDSOsInCone(DSOHandler& dsoHandler,
+                        const Eigen::Vector3d& obsPosition,
+                        const Eigen::Vector3d& direction,
+                        double maxAngle,
+                        double maxDistance,
+                        float limitingMag) const;
+
     std::string getDSOName    (const DeepSkyObject* const &, bool i18n = false) const;
     std::string getDSONameList(const DeepSkyObject* const &, const unsigned int maxNames = MAX_DSO_NAMES) const;
 
@@ -64,6 +100,21 @@ class DSODatabase
     bool loadBinary(std::istream&);
     void finish();
 
+    // Add a DSO to the finished database, which takes ownership of it
+    // unless false is returned because the catalog number is in use. A DSO
+    // without a catalog number gets the next automatic one. Like added
+    // stars, added DSOs are tested one by one by the queries until they're
+    // sorted into an octree of their own in the background. Names delimited
+    // by ':' are added to the name database.
+    bool addDSO(DeepSkyObject* dso, const std::string& names = std::string());
+
+    // Hide a DSO from find() and the queries. It isn't freed before the
+    // database, as there may still be references to it.
+    bool removeDSO(AstroCatalog::IndexNumber catalogNumber);
+
+    // Same as StarDatabase::update
+    void update(bool waitForMerge = false);
+
     static DSODatabase* read(std::istream&);
 
     double getAverageAbsoluteMagnitude() const;
@@ -71,7 +122,15 @@ class DSODatabase
 private:
     void buildIndexes();
     void buildOctree();
+    void buildCullingData();
     void calcAvgAbsMag();
+    void cullRange(const DSOObjectRange& range,
+                   const Eigen::Vector3d& obsPosition,
+                   const Eigen::Hyperplane<double, 3>* frustumPlanes,
+                   float limitingMag,
+                   uint64_t renderFlags,
+                   int labelMode,
+                   std::vector<VisibleDSO>& visibleDSOs) const;
 
     int              nDSOs{ 0 };
     int              capacity{ 0 };
@@ -82,6 +141,27 @@ private:
     AstroCatalog::IndexNumber nextAutoCatalogNumber{ 0xfffffffe };
 
     double           avgAbsMag{ 0.0 };
+
+    // Per-object culling data in octree order, stored as separate arrays so
+    // that the objects of each octree node are contiguous slices of them.
+    struct CullingData
+    {
+        std::vector<double>   x;
+        std::vector<double>   y;
+        std::vector<double>   z;
+        std::vector<float>    radius;
+        std::vector<float>    absMag;
+        // 10^(-absMag / 5): multiplying this by the distance of a magnitude
+        // 0 object at the limiting magnitude gives the distance limit.
+        std::vector<double>   distanceScale;
+        std::vector<uint64_t> renderMask;
+        std::vector<uint32_t> labelMask;
+    } cullingData;
+
+    std::vector<DeepSkyObject*> addedDSOs;
+    std::map<AstroCatalog::IndexNumber, DeepSkyObject*> addedDSOIndex;
+    std::unique_ptr<OctreeOverlay<DeepSkyObject*, double>> dsoOverlay;
+    std::set<const DeepSkyObject*> removedDSOs;
 };
 
 
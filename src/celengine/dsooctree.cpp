@@ -12,6 +12,7 @@
 
 #include <celengine/dsooctree.h>
 
+using namespace std;
 using namespace Eigen;
 
 
@@ -42,6 +43,12 @@ double dsoAbsoluteMagnitudeDecayFunction(const double excludingFactor)
 }
 
 
+Vector3d dsoPosition(DeepSkyObject* const & _dso)
+{
+    return _dso->getPosition();
+}
+
+
 template <>
 DynamicDSOOctree* DynamicDSOOctree::getChild(DeepSkyObject* const & _obj, const PointType& cellCenterPos)
 {
@@ -63,6 +70,8 @@ template<> DynamicDSOOctree::StraddlingPredicate*
            DynamicDSOOctree::straddlingPredicate = dsoStraddlesNodesPredicate;
 template<> DynamicDSOOctree::ExclusionFactorDecayFunction*
            DynamicDSOOctree::decayFunction = dsoAbsoluteMagnitudeDecayFunction;
+template<> DynamicDSOOctree::ObjectPositionFunction*
+           DynamicDSOOctree::positionFunction = dsoPosition;
 
 
 // total specialization of the StaticOctree template process*() methods for DSOs:
@@ -195,3 +204,124 @@ void DSOOctree::processCloseObjects(DSOHandler&    processor,
         }
     }
 }
+
+
+template<>
+void DSOOctree::collectVisibleRanges(vector<DSOObjectRange>& ranges,
+                                     const PointType& obsPosition,
+                                     const Hyperplane<double, 3>*  frustumPlanes,
+                                     float          limitingFactor,
+                                     double         scale,
+                                     OctreeProcStats *stats) const
+{
+#ifdef OCTREE_DEBUG
+    size_t h;
+    if (stats != nullptr)
+    {
+        h = stats->height + 1;
+        stats->nodes++;
+    }
+#endif
+    // Test the cubic octree node against each one of the five
+    // planes that define the infinite view frustum.
+    for (unsigned int i = 0; i < 5; ++i)
+    {
+        const Hyperplane<double, 3>& plane = frustumPlanes[i];
+
+        double r = scale * plane.normal().cwiseAbs().sum();
+        if (plane.signedDistance(cellCenterPos) < -r)
+            return;
+    }
+
+    double minDistance = (obsPosition - cellCenterPos).norm() - scale * DSOOctree::SQRT3;
+    double dimmest     = minDistance > 0.0 ? astro::appToAbsMag((double) limitingFactor, minDistance) : 1000.0;
+
+    if (nObjects > 0)
+    {
+#ifdef OCTREE_DEBUG
+        if (stats != nullptr)
+            stats->objects += nObjects;
+#endif
+        ranges.push_back({ _firstObject, nObjects, dimmest });
+    }
+
+    if (minDistance <= 0.0 || astro::absToAppMag((double) exclusionFactor, minDistance) <= limitingFactor)
+    {
+        if (_children != nullptr)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                _children[i]->collectVisibleRanges(ranges,
+                                                   obsPosition,
+                                                   frustumPlanes,
+                                                   limitingFactor,
+                                                   scale * 0.5f,
+                                                   stats);
+#ifdef OCTREE_DEBUG
+                if (stats != nullptr && stats->height > h)
+                    h = stats->height;
+#endif
+            }
+#ifdef OCTREE_DEBUG
+            if (stats != nullptr)
+                stats->height = h;
+#endif
+        }
+    }
+}
+
+
+template<>
+void DSOOctree::processObjectsInCone(DSOHandler&      processor,
+                                     const PointType& obsPosition,
+                                     const PointType& direction,
+                                     double           maxAngle,
+                                     double           maxDistance,
+                                     float            limitingFactor,
+                                     double           scale) const
+{
+    double nodeRadius  = scale * DSOOctree::SQRT3;
+    double minDistance = (obsPosition - cellCenterPos).norm() - nodeRadius;
+
+    if (minDistance > maxDistance ||
+        !sphereIntersectsCone(obsPosition, direction, maxAngle, cellCenterPos, nodeRadius))
+    {
+        return;
+    }
+
+    double dimmest  = minDistance > 0.0 ? astro::appToAbsMag((double) limitingFactor, minDistance) : 1000.0;
+    double cosAngle = maxAngle < PI ? std::cos(maxAngle) : -1.0;
+
+    for (unsigned int i = 0; i < nObjects; ++i)
+    {
+        DeepSkyObject* _obj = _firstObject[i];
+        float absMag = _obj->getAbsoluteMagnitude();
+        if (absMag >= dimmest)
+            continue;
+
+        Vector3d v = _obj->getPosition() - obsPosition;
+        double centerDistance = v.norm();
+        if (centerDistance > maxDistance || v.dot(direction) < cosAngle * centerDistance)
+            continue;
+
+        double distance = centerDistance - _obj->getBoundingSphereRadius();
+        float appMag = (float) ((distance >= 32.6167) ? astro::absToAppMag((double) absMag, distance) : absMag);
+        if (appMag < limitingFactor)
+            processor.process(_obj, distance, absMag);
+    }
+
+    if (_children != nullptr &&
+        (minDistance <= 0.0 || astro::absToAppMag((double) exclusionFactor, minDistance) <= limitingFactor))
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            _children[i]->processObjectsInCone(processor,
+                                               obsPosition,
+                                               direction,
+                                               maxAngle,
+                                               maxDistance,
+                                               limitingFactor,
+                                               scale * 0.5f);
+        }
+    }
+}
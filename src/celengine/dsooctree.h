@@ -20,5 +20,6 @@
 typedef DynamicOctree  <DeepSkyObject*, double> DynamicDSOOctree;
 typedef StaticOctree   <DeepSkyObject*, double> DSOOctree;
 typedef OctreeProcessor<DeepSkyObject*, double> DSOHandler;
+typedef OctreeObjectRange<DeepSkyObject*, double> DSOObjectRange;
 
 #endif  // _CELENGINE_DSOOCTREE_H_
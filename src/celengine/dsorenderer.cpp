@@ -184,7 +184,8 @@ void DSORenderer::process(DeepSkyObject* const &dso,
                                               relPos,
                                               Renderer::AlignLeft,
                                               Renderer::VerticalAlignCenter,
-                                              symbolSize);
+                                              symbolSize,
+                                              -appMagEff);
         }
     }     // labels enabled
 }
@@ -13,6 +13,7 @@
 
 #include <celmodel/material.h>
 #include <celmath/ray.h>
+#include <vector>
 
 class RenderContext;
 
@@ -33,6 +34,18 @@ public:
      */
     virtual bool pick(const celmath::Ray3d& r, double& distance) const = 0;
 
+    /*! Find the closest intersections for a batch of rays. distances
+     *  receives one value per ray, the distance of the intersection or a
+     *  negative value for rays missing the geometry.
+     */
+    virtual void pickRays(const std::vector<celmath::Ray3d>& rays,
+                          std::vector<double>& distances) const
+    {
+        distances.assign(rays.size(), -1.0);
+        for (size_t i = 0; i < rays.size(); i++)
+            pick(rays[i], distances[i]);
+    }
+
     virtual bool isOpaque() const = 0;
 
     virtual bool isNormalized() const
@@ -0,0 +1,81 @@
+// labelgrid.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <cmath>
+#include "labelgrid.h"
+
+using namespace std;
+
+
+void LabelGrid::reset(int width, int height, int cellSize)
+{
+    cellSize = max(cellSize, 1);
+    columns = max((width + cellSize - 1) / cellSize, 1);
+    rows = max((height + cellSize - 1) / cellSize, 1);
+    cellScale = 1.0f / (float) cellSize;
+
+    rects.clear();
+    if (cells.size() < (size_t) (columns * rows))
+        cells.resize(columns * rows);
+    for (auto& cell : cells)
+        cell.clear();
+}
+
+
+bool LabelGrid::getCellRange(const Rect& rect, int& x0, int& y0, int& x1, int& y1) const
+{
+    x0 = max((int) floor(rect.left * cellScale), 0);
+    y0 = max((int) floor(rect.bottom * cellScale), 0);
+    x1 = min((int) floor(rect.right * cellScale), columns - 1);
+    y1 = min((int) floor(rect.top * cellScale), rows - 1);
+    return x0 <= x1 && y0 <= y1;
+}
+
+
+bool LabelGrid::overlaps(const Rect& rect) const
+{
+    int x0, y0, x1, y1;
+    if (!getCellRange(rect, x0, y0, x1, y1))
+        return false;
+
+    for (int y = y0; y <= y1; y++)
+    {
+        for (int x = x0; x <= x1; x++)
+        {
+            for (uint32_t i : cells[y * columns + x])
+            {
+                const Rect& r = rects[i];
+                if (rect.left < r.right && r.left < rect.right &&
+                    rect.bottom < r.top && r.bottom < rect.top)
+                {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+
+void LabelGrid::insert(const Rect& rect)
+{
+    int x0, y0, x1, y1;
+    if (!getCellRange(rect, x0, y0, x1, y1))
+        return;
+
+    auto index = (uint32_t) rects.size();
+    rects.push_back(rect);
+    for (int y = y0; y <= y1; y++)
+    {
+        for (int x = x0; x <= x1; x++)
+            cells[y * columns + x].push_back(index);
+    }
+}
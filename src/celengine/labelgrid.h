@@ -0,0 +1,55 @@
+// labelgrid.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// Uniform grid of screen rectangles used to find overlapping labels.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class LabelGrid
+{
+ public:
+    struct Rect
+    {
+        float left;
+        float bottom;
+        float right;
+        float top;
+    };
+
+    // Remove all rectangles and cover a screen of width x height pixels
+    // with square cells of cellSize pixels.
+    void reset(int width, int height, int cellSize);
+
+    bool overlaps(const Rect&) const;
+    void insert(const Rect&);
+
+    // Insert the rectangle unless it overlaps one already in the grid.
+    bool tryInsert(const Rect& rect)
+    {
+        if (overlaps(rect))
+            return false;
+        insert(rect);
+        return true;
+    }
+
+ private:
+    // Range of cells covered by a rectangle; empty if off screen.
+    bool getCellRange(const Rect&, int& x0, int& y0, int& x1, int& y1) const;
+
+    int columns { 0 };
+    int rows { 0 };
+    float cellScale { 1.0f };
+
+    std::vector<Rect> rects;
+    // Indices into rects per cell; kept across frames to avoid allocations
+    std::vector<std::vector<uint32_t>> cells;
+};
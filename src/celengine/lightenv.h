@@ -22,6 +22,7 @@ static const unsigned int MaxLights = 8;
 
 class Body;
 class RingSystem;
+class Star;
 
 class DirectionalLight
 {
@@ -36,6 +37,7 @@ public:
     Eigen::Vector3d position;  // position relative to the lit object
     float apparentSize;
     bool castsShadows;
+    const Star* star;          // the light source if it casts shadows
 };
 
 class EclipseShadow
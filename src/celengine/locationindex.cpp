@@ -0,0 +1,181 @@
+// locationindex.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <cmath>
+#include <celengine/location.h>
+#include <celmath/mathlib.h>
+#include "locationindex.h"
+
+using namespace Eigen;
+using namespace std;
+
+namespace
+{
+// Cells with fewer locations aren't split
+constexpr uint32_t MaxLeafSize = 16;
+constexpr unsigned int MaxDepth = 16;
+}
+
+
+LocationIndex::LocationIndex(const vector<Location*>& locations)
+{
+    items.reserve(locations.size());
+    for (auto location : locations)
+    {
+        Item item;
+        item.location = location;
+        item.position = location->getPosition();
+        float r = item.position.norm();
+        item.longitude = (float) atan2(-item.position.z(), item.position.x());
+        item.latitude = r > 0.0f ? (float) asin(celmath::clamp(item.position.y() / r, -1.0f, 1.0f)) : 0.0f;
+        items.push_back(item);
+    }
+
+    nodes.reserve(items.size() / MaxLeafSize * 2 + 1);
+    build(0, (uint32_t) items.size(), (float) -PI, (float) PI, (float) -PI / 2, (float) PI / 2, 0);
+}
+
+
+float LocationIndex::getEffectiveSize(const Location& location)
+{
+    float size = location.getImportance();
+    return size < 0.0f ? location.getSize() : size;
+}
+
+
+uint32_t LocationIndex::build(uint32_t first, uint32_t count,
+                              float lonMin, float lonMax, float latMin, float latMax,
+                              unsigned int depth)
+{
+    auto index = (uint32_t) nodes.size();
+    nodes.emplace_back();
+
+    Node node;
+    node.first = first;
+    node.count = count;
+    fill_n(node.children, 4, 0);
+    node.maxDistance = 0.0f;
+    node.maxSize = 0.0f;
+    node.featureTypes = 0;
+
+    AlignedBox3f bounds;
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        const Item& item = items[i];
+        bounds.extend(item.position);
+        node.maxDistance = max(node.maxDistance, item.position.norm());
+        node.maxSize = max(node.maxSize, getEffectiveSize(*item.location));
+        node.featureTypes |= item.location->getFeatureType();
+    }
+    node.center = count > 0 ? Vector3f(bounds.center()) : Vector3f::Zero();
+    node.radius = 0.0f;
+    for (uint32_t i = first; i < first + count; i++)
+        node.radius = max(node.radius, (items[i].position - node.center).norm());
+
+    if (count > MaxLeafSize && depth < MaxDepth)
+    {
+        // Split into quadrants; each child covers a contiguous range of items
+        float lonMid = (lonMin + lonMax) * 0.5f;
+        float latMid = (latMin + latMax) * 0.5f;
+        auto begin = items.begin() + first;
+        auto end = begin + count;
+        auto west = [lonMid](const Item& item) { return item.longitude < lonMid; };
+        auto south = [latMid](const Item& item) { return item.latitude < latMid; };
+        auto splitLon = partition(begin, end, west);
+        auto splitLat0 = partition(begin, splitLon, south);
+        auto splitLat1 = partition(splitLon, end, south);
+
+        const decltype(begin) ranges[5] = { begin, splitLat0, splitLon, splitLat1, end };
+        const float lons[4][2] = { { lonMin, lonMid }, { lonMin, lonMid }, { lonMid, lonMax }, { lonMid, lonMax } };
+        const float lats[4][2] = { { latMin, latMid }, { latMid, latMax }, { latMin, latMid }, { latMid, latMax } };
+        for (int i = 0; i < 4; i++)
+        {
+            auto childFirst = (uint32_t) (ranges[i] - items.begin());
+            auto childCount = (uint32_t) (ranges[i + 1] - ranges[i]);
+            if (childCount > 0)
+                node.children[i] = build(childFirst, childCount, lons[i][0], lons[i][1], lats[i][0], lats[i][1], depth + 1);
+        }
+    }
+
+    nodes[index] = node;
+    return index;
+}
+
+
+bool LocationIndex::isCulled(const Node& node, const Query& query) const
+{
+    if ((node.featureTypes & query.featureMask) == 0)
+        return true;
+
+    Vector3d center = node.center.cast<double>();
+    double radius = node.radius;
+    Vector3d offset = center - query.observerPosition;
+    double distance = offset.norm();
+
+    // All locations behind the observer
+    if (offset.dot(query.viewDirection) + radius <= 0.0)
+        return true;
+
+    // All labels too small
+    double minDistance = max(distance - radius, 1.0e-9);
+    if (node.maxSize / (minDistance * query.pixelSize) <= query.minFeatureSize)
+        return true;
+
+    // All locations beyond the horizon of the occluding sphere: a point at
+    // distance d from the center is hidden by a sphere of radius R if its
+    // angle from the observer direction exceeds acos(R / observer distance)
+    // plus acos(R / d).
+    double R = query.occluderRadius;
+    double observerDistance = query.observerPosition.norm();
+    double centerDistance = center.norm();
+    if (R > 0.0 && observerDistance > R && centerDistance > radius)
+    {
+        double cosAngle = center.dot(query.observerPosition) / (centerDistance * observerDistance);
+        double angle = acos(celmath::clamp(cosAngle, -1.0, 1.0)) - asin(radius / centerDistance);
+        double maxDistance = node.maxDistance * 1.001;
+        double horizon = acos(R / observerDistance) + (maxDistance > R ? acos(R / maxDistance) : 0.0);
+        if (angle > horizon)
+            return true;
+    }
+
+    return false;
+}
+
+
+void LocationIndex::findCandidates(const Query& query, vector<Location*>& candidates) const
+{
+    if (nodes.empty() || items.empty())
+        return;
+
+    uint32_t stack[4 * MaxDepth + 4];
+    unsigned int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const Node& node = nodes[stack[--stackSize]];
+        if (isCulled(node, query))
+            continue;
+
+        if (node.children[0] == 0 && node.children[1] == 0 &&
+            node.children[2] == 0 && node.children[3] == 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+                candidates.push_back(items[i].location);
+            continue;
+        }
+
+        for (uint32_t child : node.children)
+        {
+            if (child != 0)
+                stack[stackSize++] = child;
+        }
+    }
+}
@@ -0,0 +1,73 @@
+// locationindex.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// Latitude/longitude quadtree of the locations of a body, used to find the
+// candidates for location labels without visiting every location.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <Eigen/Core>
+
+class Location;
+
+class LocationIndex
+{
+ public:
+    // All vectors are in the body-fixed frame, distances in km.
+    struct Query
+    {
+        Eigen::Vector3d observerPosition;
+        Eigen::Vector3d viewDirection;      // unit vector
+        double occluderRadius;              // radius of a sphere inside the body, 0 for none
+        float pixelSize;                    // radians per pixel
+        float minFeatureSize;               // in pixels
+        uint64_t featureMask;
+    };
+
+    LocationIndex(const std::vector<Location*>& locations);
+
+    // Add the locations which may pass the feature type, pixel size, view
+    // direction and horizon tests of the query to candidates. The tests
+    // are conservative; the caller still has to test each location.
+    void findCandidates(const Query& query, std::vector<Location*>& candidates) const;
+
+    // Size used for the pixel size test of a location label
+    static float getEffectiveSize(const Location&);
+
+ private:
+    struct Node
+    {
+        Eigen::Vector3f center;
+        float radius;
+        float maxDistance;      // largest distance of a location from the body center
+        float maxSize;
+        uint64_t featureTypes;
+        uint32_t first;         // range of items
+        uint32_t count;
+        uint32_t children[4];   // zero for a leaf
+    };
+
+    struct Item
+    {
+        Location* location;
+        Eigen::Vector3f position;
+        float longitude;
+        float latitude;
+    };
+
+    uint32_t build(uint32_t first, uint32_t count,
+                   float lonMin, float lonMax, float latMin, float latMax,
+                   unsigned int depth);
+    bool isCulled(const Node&, const Query&) const;
+
+    std::vector<Node> nodes;
+    std::vector<Item> items;
+};
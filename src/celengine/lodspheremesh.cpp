@@ -12,7 +12,13 @@
 #include <cassert>
 #include <iostream>
 #include <algorithm>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <celmath/mathlib.h>
+#include <celutil/profiler.h>
 #include "glsupport.h"
 #include "lodspheremesh.h"
 #include "shadermanager.h"
@@ -38,6 +44,64 @@ static float* cosTheta = nullptr;
 //     tex coords - 2 floats * MAX_SPHERE_MESH_TEXTURES
 constexpr const int MaxVertexSize = 3 + 3 + 3 + MAX_SPHERE_MESH_TEXTURES * 2;
 
+// Upper bound for the memory used by cached patch geometry, in bytes
+constexpr const size_t MaxPatchCacheSize = 16 * 1024 * 1024;
+
+namespace
+{
+// Least recently used cache of tessellated unit sphere patches. A patch
+// only depends on its position, extent and step and on whether tangents
+// are needed, so all bodies drawn with the same LOD share one block.
+// Like the rest of the mesh, it's only used from the rendering thread.
+class PatchCache
+{
+ public:
+    static uint64_t key(int phi0, int theta0, int extent, int step, bool tangents)
+    {
+        return (uint64_t) phi0 |
+               ((uint64_t) theta0 << 16) |
+               ((uint64_t) extent << 32) |
+               ((uint64_t) step << 48) |
+               ((uint64_t) (tangents ? 1 : 0) << 63);
+    }
+
+    const float* find(uint64_t key)
+    {
+        auto iter = index.find(key);
+        if (iter == index.end())
+            return nullptr;
+
+        entries.splice(entries.begin(), entries, iter->second);
+        return iter->second->second.data();
+    }
+
+    const float* insert(uint64_t key, vector<float>&& block)
+    {
+        size += block.size() * sizeof(float);
+        entries.emplace_front(key, std::move(block));
+        index[key] = entries.begin();
+
+        while (size > MaxPatchCacheSize && entries.size() > 1)
+        {
+            size -= entries.back().second.size() * sizeof(float);
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+
+        return entries.front().second.data();
+    }
+
+ private:
+    using Entry = pair<uint64_t, vector<float>>;
+
+    list<Entry> entries;    // most recently used first
+    unordered_map<uint64_t, list<Entry>::iterator> index;
+    size_t size{ 0 };
+};
+
+PatchCache patchCache;
+} // end unnamed namespace
+
 // TODO: figure out how to use std eigen's methods instead
 static Vector3f intersect3(const Frustum::PlaneType& p0,
                            const Frustum::PlaneType& p1,
@@ -170,6 +234,8 @@ void LODSphereMesh::render(unsigned int attributes,
                            Texture** tex,
                            int nTextures)
 {
+    CEL_PROFILE_ZONE("LODSphereMesh::render");
+
     int lod = 64;
     int lodBias = getSphereLOD(pixWidth);
 
@@ -311,6 +377,9 @@ void LODSphereMesh::render(unsigned int attributes,
     if ((attributes & Tangents) != 0)
         glEnableVertexAttribArray(CelestiaGLProgram::TangentAttributeIndex);
 
+    patchCacheHits = 0;
+    patchCacheMisses = 0;
+
     if (split == 1)
     {
         renderSection(0, 0, thetaExtent, ri);
@@ -377,6 +446,9 @@ void LODSphereMesh::render(unsigned int attributes,
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    CEL_PROFILE_COUNTER("spherePatchCacheHits", patchCacheHits);
+    CEL_PROFILE_COUNTER("spherePatchCacheMisses", patchCacheMisses);
 }
 
 
@@ -557,29 +629,28 @@ void LODSphereMesh::renderSection(int phi0, int theta0, int extent,
         }
     }
 
-    int vindex = 0;
-    for (int phi = phi0; phi <= phi1; phi += ri.step)
-    {
-        float cphi = cosPhi[phi];
-        float sphi = sinPhi[phi];
+    // Only the texture coordinates depend on the texture tiles, so the
+    // rest of each vertex is copied from the cached patch.
+    const float* geometry = getPatchGeometry(phi0, theta0, extent, ri);
+    int geometrySize = texCoordOffset;
+    int nVertices = (phiExtent / ri.step + 1) * (thetaExtent / ri.step + 1);
 
-        if ((ri.attributes & Tangents) != 0)
+    if (nTexturesUsed == 0)
+    {
+        glBufferSubData(GL_ARRAY_BUFFER, 0,
+                        nVertices * geometrySize * sizeof(float),
+                        geometry);
+    }
+    else
+    {
+        int vindex = 0;
+        for (int phi = phi0; phi <= phi1; phi += ri.step)
         {
             for (int theta = theta0; theta <= theta1; theta += ri.step)
             {
-                float ctheta = cosTheta[theta];
-                float stheta = sinTheta[theta];
-
-                vertices[vindex]      = cphi * ctheta;
-                vertices[vindex + 1]  = sphi;
-                vertices[vindex + 2]  = cphi * stheta;
-
-                // Compute the tangent--required for bump mapping
-                vertices[vindex + 3] = stheta;
-                vertices[vindex + 4] = 0.0f;
-                vertices[vindex + 5] = -ctheta;
-
-                vindex += 6;
+                copy(geometry, geometry + geometrySize, vertices + vindex);
+                geometry += geometrySize;
+                vindex += geometrySize;
 
                 for (int tex = 0; tex < nTexturesUsed; tex++)
                 {
@@ -589,31 +660,10 @@ void LODSphereMesh::renderSection(int phi0, int theta0, int extent,
                 }
             }
         }
-        else
-        {
-            for (int theta = theta0; theta <= theta1; theta += ri.step)
-            {
-                float ctheta = cosTheta[theta];
-                float stheta = sinTheta[theta];
-
-                vertices[vindex]      = cphi * ctheta;
-                vertices[vindex + 1]  = sphi;
-                vertices[vindex + 2]  = cphi * stheta;
 
-                vindex += 3;
-
-                for (int tex = 0; tex < nTexturesUsed; tex++)
-                {
-                    vertices[vindex]     = u0[tex] - theta * du[tex];
-                    vertices[vindex + 1] = v0[tex] - phi * dv[tex];
-                    vindex += 2;
-                }
-            }
-        }
+        glBufferSubData(GL_ARRAY_BUFFER, 0, vindex * sizeof(float), vertices);
     }
 
-    glBufferSubData(GL_ARRAY_BUFFER, 0, vindex * sizeof(float), vertices);
-
     int nRings = phiExtent / ri.step;
     int nSlices = thetaExtent / ri.step;
     glDrawElements(GL_TRIANGLE_STRIP,
@@ -627,3 +677,50 @@ void LODSphereMesh::renderSection(int phi0, int theta0, int extent,
         currentVB = 0;
     glBindBuffer(GL_ARRAY_BUFFER, vertexBuffers[currentVB]);
 }
+
+
+const float* LODSphereMesh::getPatchGeometry(int phi0, int theta0, int extent,
+                                             const RenderInfo& ri)
+{
+    bool tangents = (ri.attributes & Tangents) != 0;
+    uint64_t key = PatchCache::key(phi0, theta0, extent, ri.step, tangents);
+    const float* geometry = patchCache.find(key);
+    if (geometry != nullptr)
+    {
+        patchCacheHits++;
+        return geometry;
+    }
+    patchCacheMisses++;
+
+    int theta1 = theta0 + extent;
+    int phi1 = phi0 + extent / 2;
+    int nVertices = (extent / 2 / ri.step + 1) * (extent / ri.step + 1);
+
+    vector<float> block;
+    block.reserve(nVertices * (tangents ? 6 : 3));
+    for (int phi = phi0; phi <= phi1; phi += ri.step)
+    {
+        float cphi = cosPhi[phi];
+        float sphi = sinPhi[phi];
+
+        for (int theta = theta0; theta <= theta1; theta += ri.step)
+        {
+            float ctheta = cosTheta[theta];
+            float stheta = sinTheta[theta];
+
+            block.push_back(cphi * ctheta);
+            block.push_back(sphi);
+            block.push_back(cphi * stheta);
+
+            // Compute the tangent--required for bump mapping
+            if (tangents)
+            {
+                block.push_back(stheta);
+                block.push_back(0.0f);
+                block.push_back(-ctheta);
+            }
+        }
+    }
+
+    return patchCache.insert(key, std::move(block));
+}
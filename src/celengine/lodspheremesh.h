@@ -67,6 +67,10 @@ public:
 
     void renderSection(int phi0, int theta0, int extent, const RenderInfo&);
 
+    // Positions, and tangents if requested, of a unit sphere patch; these
+    // are shared by all meshes and cached between frames.
+    const float* getPatchGeometry(int phi0, int theta0, int extent, const RenderInfo&);
+
     float* vertices{ nullptr };
 
     int maxVertices{ 0 };
@@ -79,6 +83,10 @@ public:
     Texture* textures[MAX_SPHERE_MESH_TEXTURES]{};
     unsigned int subtextures[MAX_SPHERE_MESH_TEXTURES]{};
 
+    // Patch cache statistics of the current render call
+    unsigned int patchCacheHits{ 0 };
+    unsigned int patchCacheMisses{ 0 };
+
     bool vertexBuffersInitialized{ false };
     GLuint currentVB{ 0 };
     GLuint vertexBuffers[NUM_SPHERE_VERTEX_BUFFERS];
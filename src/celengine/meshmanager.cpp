@@ -24,6 +24,7 @@
 #include "tokenizer.h"
 
 #include <cel3ds/3dsread.h>
+#include <celmodel/modelcache.h>
 #include <celmodel/modelfile.h>
 
 #include <celmath/mathlib.h>
@@ -49,6 +50,11 @@ static Model* LoadCelestiaMesh(const fs::path& filename);
 static Model* Convert3DSModel(const M3DScene& scene, const fs::path& texPath);
 
 static GeometryManager* geometryManager = nullptr;
+static unique_ptr<ModelCache> modelCache;
+
+// Identifies the output of Convert3DSModel; change it whenever the
+// conversion changes to invalidate models cached by older versions.
+static const char Convert3DSParameters[] = "3ds 1";
 
 constexpr const fs::path::value_type UniqueSuffixChar = '!';
 
@@ -82,6 +88,15 @@ GeometryManager* GetGeometryManager()
 }
 
 
+void SetModelCacheDirectory(const fs::path& dir)
+{
+    if (dir.empty())
+        modelCache = nullptr;
+    else
+        modelCache = unique_ptr<ModelCache>(new ModelCache(dir));
+}
+
+
 fs::path GeometryInfo::resolve(const fs::path& baseDir)
 {
     // Ensure that models with different centers get resolved to different objects by
@@ -123,20 +138,35 @@ Geometry* GeometryInfo::load(const fs::path& resolvedFilename)
 
     if (fileType == Content_3DStudio)
     {
-        M3DScene* scene = Read3DSFile(filename);
-        if (scene != nullptr)
+        fs::path texPath = resolvedToPath ? path : fs::path();
+
+        // Converting large 3DS files is slow, so reuse the result of an
+        // earlier conversion when there is one.
+        if (modelCache != nullptr)
         {
-            if (resolvedToPath)
-                model = Convert3DSModel(*scene, path);
-            else
-                model = Convert3DSModel(*scene, "");
+            CelestiaTextureLoader textureLoader(texPath);
+            model = modelCache->load(filename, Convert3DSParameters, &textureLoader);
+        }
 
+        if (model == nullptr)
+        {
+            M3DScene* scene = Read3DSFile(filename);
+            if (scene != nullptr)
+            {
+                model = Convert3DSModel(*scene, texPath);
+                delete scene;
+
+                if (modelCache != nullptr && !modelCache->save(filename, Convert3DSParameters, *model))
+                    DPRINTF(LOG_LEVEL_WARNING, "Could not write %s to the model cache\n", filename);
+            }
+        }
+
+        if (model != nullptr)
+        {
             if (isNormalized)
                 model->normalize(center);
             else
                 model->transform(center, scale);
-
-            delete scene;
         }
     }
     else if (fileType == Content_CelestiaModel)
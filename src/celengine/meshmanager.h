@@ -76,5 +76,9 @@ typedef ResourceManager<GeometryInfo> GeometryManager;
 
 extern GeometryManager* GetGeometryManager();
 
+// Models converted from 3DS files are cached in this directory; an empty
+// path disables the cache.
+extern void SetModelCacheDirectory(const fs::path& dir);
+
 #endif // _CELENGINE_MESHMANAGER_H_
 
@@ -11,6 +11,9 @@
 #include "modelgeometry.h"
 #include "rendcontext.h"
 #include "texmanager.h"
+#include "trianglebvh.h"
+#include <celutil/profiler.h>
+#include <celutil/workerpool.h>
 #include <Eigen/Core>
 #include <functional>
 #include <algorithm>
@@ -45,6 +48,18 @@ public:
     }
 
     std::vector<GLuint> vbos; // vertex buffer objects
+
+    // Meshes with packed vertices are drawn from a copy with the packed
+    // attributes expanded to floats; the copy of the vertex data is only
+    // kept if it couldn't be placed in a vertex buffer object.
+    struct UnpackedVertices
+    {
+        UnpackedVertices(const cmod::Mesh::VertexDescription& _desc) : desc(_desc) {}
+
+        cmod::Mesh::VertexDescription desc;
+        std::vector<char> data;
+    };
+    std::vector<std::unique_ptr<UnpackedVertices>> unpacked;
 };
 
 
@@ -65,6 +80,29 @@ ModelGeometry::pick(const Ray3d& r, double& distance) const
 }
 
 
+void
+ModelGeometry::pickRays(const vector<Ray3d>& rays, vector<double>& distances) const
+{
+    CEL_PROFILE_ZONE("ModelGeometry::pickRays");
+
+    distances.assign(rays.size(), -1.0);
+
+    // Building the hierarchy only pays off for more than a few rays
+    if (rays.size() < 8)
+    {
+        Geometry::pickRays(rays, distances);
+        return;
+    }
+
+    TriangleBVH bvh(*m_model);
+    GetWorkerPool()->parallelFor(rays.size(), 64, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+            bvh.intersect(rays[i].origin, rays[i].direction, distances[i]);
+    });
+}
+
+
 /*! Render the model; the time parameter is ignored right now
  *  since this class doesn't currently support animation.
  */
@@ -85,24 +123,39 @@ ModelGeometry::render(RenderContext& rc, double /* t */)
         for (unsigned int i = 0; i < m_model->getMeshCount(); ++i)
         {
             Mesh* mesh = m_model->getMesh(i);
-            const Mesh::VertexDescription& vertexDesc = mesh->getVertexDescription();
+            const Mesh::VertexDescription* vertexDesc = &mesh->getVertexDescription();
+            const void* vertexData = mesh->getVertexData();
+
+            ModelOpenGLData::UnpackedVertices* unpacked = nullptr;
+            if (mesh->hasPackedVertices())
+            {
+                unpacked = new ModelOpenGLData::UnpackedVertices(mesh->getUnpackedVertexDescription());
+                unpacked->data.resize(mesh->getVertexCount() * unpacked->desc.stride);
+                mesh->unpackVertices(unpacked->data.data());
+                vertexDesc = &unpacked->desc;
+                vertexData = unpacked->data.data();
+            }
 
             GLuint vboId = 0;
-            if (mesh->getVertexCount() * vertexDesc.stride > MinVBOSize)
+            if (mesh->getVertexCount() * vertexDesc->stride > MinVBOSize)
             {
                 glGenBuffers(1, &vboId);
                 if (vboId != 0)
                 {
                     glBindBuffer(GL_ARRAY_BUFFER, vboId);
                     glBufferData(GL_ARRAY_BUFFER,
-                                    mesh->getVertexCount() * vertexDesc.stride,
-                                    mesh->getVertexData(),
+                                    mesh->getVertexCount() * vertexDesc->stride,
+                                    vertexData,
                                     GL_STATIC_DRAW);
                     glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+                    if (unpacked != nullptr)
+                        vector<char>().swap(unpacked->data);
                 }
             }
 
             m_glData->vbos.push_back(vboId);
+            m_glData->unpacked.emplace_back(unpacked);
         }
     }
 
@@ -114,22 +167,30 @@ ModelGeometry::render(RenderContext& rc, double /* t */)
     {
         Mesh* mesh = m_model->getMesh(meshIndex);
         GLuint vboId = 0;
+        const Mesh::VertexDescription* vertexDesc = &mesh->getVertexDescription();
+        const void* vertexData = mesh->getVertexData();
 
         if (meshIndex < m_glData->vbos.size())
         {
             vboId = m_glData->vbos[meshIndex];
+            const ModelOpenGLData::UnpackedVertices* unpacked = m_glData->unpacked[meshIndex].get();
+            if (unpacked != nullptr)
+            {
+                vertexDesc = &unpacked->desc;
+                vertexData = unpacked->data.data();
+            }
         }
 
         if (vboId != 0)
         {
             // Bind the vertex buffer object.
             glBindBuffer(GL_ARRAY_BUFFER, vboId);
-            rc.setVertexArrays(mesh->getVertexDescription(), nullptr);
+            rc.setVertexArrays(*vertexDesc, nullptr);
         }
         else
         {
             // No vertex buffer object; just use normal vertex arrays
-            rc.setVertexArrays(mesh->getVertexDescription(), mesh->getVertexData());
+            rc.setVertexArrays(*vertexDesc, vertexData);
         }
 
         // Iterate over all primitive groups in the mesh
@@ -51,6 +51,11 @@ class ModelGeometry : public Geometry
      */
     virtual bool pick(const celmath::Ray3d& r, double& distance) const;
 
+    //! Cast the rays against a bounding volume hierarchy of the model,
+    //! spread over the worker threads.
+    virtual void pickRays(const std::vector<celmath::Ray3d>& rays,
+                          std::vector<double>& distances) const;
+
     //! Render the model in the current OpenGL context
     virtual void render(RenderContext&, double t = 0.0);
 
@@ -1,4 +1,5 @@
 #include <celutil/debug.h>
+#include <celutil/gettext.h>
 #include "name.h"
 
 uint32_t NameDatabase::getNameCount() const
@@ -23,6 +24,27 @@ void NameDatabase::add(const AstroCatalog::IndexNumber catalogNumber, const std:
         numberIndex.insert(NumberIndex::value_type(catalogNumber, fname));
     }
 }
+void NameDatabase::addNames(const AstroCatalog::IndexNumber catalogNumber, const std::string& names)
+{
+    // Note that add() will skip empty names.
+    std::string::size_type startPos = 0;
+    while (startPos != std::string::npos)
+    {
+        std::string::size_type next = names.find(':', startPos);
+        std::string::size_type length = std::string::npos;
+        if (next != std::string::npos)
+        {
+            length = next - startPos;
+            ++next;
+        }
+        std::string name = names.substr(startPos, length);
+        add(catalogNumber, name);
+        if (name != _(name.c_str()))
+            add(catalogNumber, _(name.c_str()));
+        startPos = next;
+    }
+}
+
 void NameDatabase::erase(const AstroCatalog::IndexNumber catalogNumber)
 {
     numberIndex.erase(catalogNumber);
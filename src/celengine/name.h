@@ -37,6 +37,10 @@ class NameDatabase
 
     void add(const AstroCatalog::IndexNumber, const std::string&, bool parseGreek = true);
 
+    // add a list of names delimited by ':', as in catalog files, and their
+    // translations
+    void addNames(const AstroCatalog::IndexNumber, const std::string&);
+
     // delete all names associated with the specified catalog number
     void erase(const AstroCatalog::IndexNumber);
 
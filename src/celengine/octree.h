@@ -16,6 +16,9 @@
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 #include <celengine/observer.h>
+#include <celmath/mathlib.h>
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 // The DynamicOctree and StaticOctree template arguments are:
@@ -32,6 +35,16 @@ struct OctreeProcStats
     size_t objects { 0 };
 };
 
+// A run of objects stored in one octree node which passed the node level
+// visibility tests. Objects in the run that are not brighter than dimmest
+// (in the octree's limiting property) can't be visible.
+template <class OBJ, class PREC> struct OctreeObjectRange
+{
+    const OBJ*   firstObject;
+    unsigned int nObjects;
+    PREC         dimmest;
+};
+
 template <class OBJ, class PREC> class OctreeProcessor
 {
  public:
@@ -41,6 +54,24 @@ template <class OBJ, class PREC> class OctreeProcessor
     virtual void process(const OBJ& obj, PREC distance, float appMag) = 0;
 };
 
+// Extra data kept in every static octree node. Specializations which
+// summarize the objects below a node for level of detail rendering define
+// their own version; the default is empty.
+template <class OBJ> struct OctreeNodeData
+{
+};
+
+template <class OBJ, class PREC> class OctreeAggregateProcessor
+{
+ public:
+    OctreeAggregateProcessor()          {};
+    virtual ~OctreeAggregateProcessor() {};
+
+    // Called for the objects in the child nodes of a node too small to be
+    // worth descending into, summarized by the node's data.
+    virtual void processAggregate(const OctreeNodeData<OBJ>& data, PREC distance, float appMag) = 0;
+};
+
 
 
 struct OctreeLevelStatistics
@@ -52,8 +83,11 @@ struct OctreeLevelStatistics
 
 
 template <class OBJ, class PREC> class StaticOctree;
+template <class OBJ, class PREC> class OctreeBuilder;
 template <class OBJ, class PREC> class DynamicOctree
 {
+ friend class OctreeBuilder<OBJ, PREC>;
+
 public:
     typedef Eigen::Matrix<PREC, 3, 1> PointType;
 
@@ -64,6 +98,7 @@ private:
     typedef bool (LimitingFactorPredicate)     (const OBJ&, const float);
     typedef bool (StraddlingPredicate)         (const Eigen::Matrix<PREC, 3, 1>&, const OBJ&, const float);
     typedef PREC (ExclusionFactorDecayFunction)(const PREC);
+    typedef PointType (ObjectPositionFunction) (const OBJ&);
 
  public:
     DynamicOctree(const Eigen::Matrix<PREC, 3, 1>& cellCenterPos,
@@ -79,6 +114,7 @@ private:
    static LimitingFactorPredicate*      limitingFactorPredicate;
    static StraddlingPredicate*          straddlingPredicate;
    static ExclusionFactorDecayFunction* decayFunction;
+   static ObjectPositionFunction*       positionFunction;
 
  private:
     void           add  (const OBJ&);
@@ -96,9 +132,32 @@ private:
 
 
 
+// Conservative test whether a sphere overlaps the cone with its apex at
+// apex around the unit vector direction with a half angle of maxAngle.
+template <class PREC> bool
+sphereIntersectsCone(const Eigen::Matrix<PREC, 3, 1>& apex,
+                     const Eigen::Matrix<PREC, 3, 1>& direction,
+                     PREC                             maxAngle,
+                     const Eigen::Matrix<PREC, 3, 1>& center,
+                     PREC                             radius)
+{
+    if (maxAngle >= (PREC) PI)
+        return true;
+
+    Eigen::Matrix<PREC, 3, 1> v = center - apex;
+    PREC distance = v.norm();
+    if (distance <= radius)
+        return true;
+
+    PREC cosAngle = std::max((PREC) -1, std::min((PREC) 1, v.dot(direction) / distance));
+    return std::acos(cosAngle) - std::asin(radius / distance) <= maxAngle;
+}
+
+
 template <class OBJ, class PREC> class StaticOctree
 {
  friend class DynamicOctree<OBJ, PREC>;
+ friend class OctreeBuilder<OBJ, PREC>;
 
  public:
     typedef Eigen::Matrix<PREC, 3, 1> PointType;
@@ -133,6 +192,65 @@ template <class OBJ, class PREC> class StaticOctree
                              PREC                               boundingRadius,
                              PREC                               scale) const;
 
+    // Process the objects no farther than maxDistance from obsPosition and
+    // within the cone around the unit vector direction with a half angle
+    // of maxAngle radians, which are brighter than limitingFactor as seen
+    // from obsPosition. Unlike processVisibleObjects, every object passed
+    // to the processor meets all of the conditions. A maxAngle of pi or
+    // more selects all directions.
+    void processObjectsInCone(OctreeProcessor<OBJ, PREC>&        processor,
+                              const PointType&                   obsPosition,
+                              const PointType&                   direction,
+                              PREC                               maxAngle,
+                              PREC                               maxDistance,
+                              float                              limitingFactor,
+                              PREC                               scale) const;
+
+    // Same traversal as processVisibleObjects, but instead of testing the
+    // objects one by one, the object runs of all nodes that pass the node
+    // tests are appended to ranges. This lets the caller run the per-object
+    // tests in bulk, possibly on several threads.
+    void collectVisibleRanges(std::vector<OctreeObjectRange<OBJ, PREC>>& ranges,
+                              const PointType&                  obsPosition,
+                              const Eigen::Hyperplane<PREC, 3>* frustumPlanes,
+                              float                             limitingFactor,
+                              PREC                              scale,
+                              OctreeProcStats * = nullptr) const;
+
+    // Level of detail version of processVisibleObjects: child nodes are not
+    // descended into when the node's bounding sphere appears smaller than
+    // minNodeSize radians. The aggregateProcessor is invoked for their
+    // contents instead.
+    void processVisibleObjects(OctreeProcessor<OBJ, PREC>&          processor,
+                               OctreeAggregateProcessor<OBJ, PREC>& aggregateProcessor,
+                               const PointType&                     obsPosition,
+                               const Eigen::Hyperplane<PREC, 3>*    frustumPlanes,
+                               float                                limitingFactor,
+                               PREC                                 scale,
+                               float                                minNodeSize,
+                               OctreeProcStats * = nullptr) const;
+
+    // Fill in the node data of this node and all of its descendants, and
+    // return the data summarizing all objects in the subtree.
+    OctreeNodeData<OBJ> computeNodeData();
+
+    // For catalogs of moving objects: record in the node data the highest
+    // speed of the objects in each subtree and return the one of this node.
+    // speeds[i] is the speed of firstObject[i], firstObject being the
+    // start of the array the octree was sorted into.
+    float computeMaxSpeeds(const OBJ* firstObject, const float* speeds);
+
+    // Enlarge the node bounds used by the queries so that they still
+    // contain the objects after moving at their highest speed for time,
+    // measured from the positions the octree was built with.
+    void setMotionTime(float time);
+
+    // Recompute the summaries of the subtrees with moving objects whose
+    // centroid may have moved by a noticeable part of the node size since
+    // it was computed, time being measured as for setMotionTime. With
+    // totals set, return the summary of the node including its own objects.
+    OctreeNodeData<OBJ> updateNodeData(float time, PREC scale, bool totals);
+
     int countChildren() const;
     int countObjects()  const;
 
@@ -147,6 +265,8 @@ template <class OBJ, class PREC> class StaticOctree
     float          exclusionFactor;
     OBJ*           _firstObject;
     unsigned int   nObjects;
+    // Summary of the objects in the child nodes
+    OctreeNodeData<OBJ> nodeData;
 };
 
 
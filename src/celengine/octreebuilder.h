@@ -0,0 +1,455 @@
+// octreebuilder.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Bulk construction of static octrees.
+
+#pragma once
+
+#include <celengine/octree.h>
+#include <celutil/workerpool.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// OctreeBuilder creates the same kind of StaticOctree as inserting objects
+// into a DynamicOctree one at a time and calling rebuildAndSort, but in a
+// few passes over all objects that run on the worker pool:
+//
+// - Every object gets a key made of the child indices on its path from the
+//   root, three bits per level: a Morton code, computed with the same
+//   comparisons against the node centers as DynamicOctree::getChild.
+// - The keys are radix sorted, which puts the objects of every subtree into
+//   one run with the runs of the child nodes in child order.
+// - The nodes are then created over the runs. The objects that must stay in
+//   a node according to the limiting factor and straddling predicates of
+//   the DynamicOctree are moved to the front of the node's run, and that
+//   order is exactly the layout rebuildAndSort produces.
+//
+// A node gets child nodes when more than SPLIT_THRESHOLD objects reach it
+// and at least one of them can be moved into a child. This is the rule of
+// DynamicOctree::insertObject, except that the outcome no longer depends
+// on the order in which the objects are inserted.
+template <class OBJ, class PREC> class OctreeBuilder
+{
+ public:
+    typedef Eigen::Matrix<PREC, 3, 1> PointType;
+    typedef StaticOctree<OBJ, PREC>   NodeType;
+
+    // Sort objects[0] .. objects[nObjects - 1] into sortedObjects and return
+    // the root of the octree over them. Container can be anything indexable,
+    // like an array or a BlockArray.
+    template <class Container>
+    static NodeType* build(Container&       objects,
+                           unsigned int     nObjects,
+                           OBJ*             sortedObjects,
+                           const PointType& cellCenterPos,
+                           PREC             scale,
+                           float            exclusionFactor);
+
+ private:
+    typedef DynamicOctree<OBJ, PREC> Policy;
+
+    // Tree levels covered by one key. Deeper nodes recompute the keys of
+    // their objects relative to themselves.
+    static constexpr unsigned int KeyLevels = 21;
+    // Subtrees with fewer objects are built on a single thread
+    static constexpr size_t MinTaskObjects = 4096;
+    static constexpr size_t MinChunkSize = 16384;
+    // Keys are computed for this many objects at a time
+    static constexpr size_t KeyBlockSize = 16;
+
+    struct Item
+    {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    struct NodeTask
+    {
+        NodeType**   node;
+        size_t       begin;
+        size_t       end;
+        PointType    cellCenterPos;
+        PREC         scale;
+        PREC         exclusionFactor;
+        unsigned int level;
+    };
+
+    template <class Container>
+    OctreeBuilder(Container& objects, unsigned int nObjects, OBJ* sortedObjects);
+
+    void computeKeyBlock(Item* block, size_t nItems, const PointType& cellCenterPos, PREC scale) const;
+    static PointType childCenter(const PointType& cellCenterPos, PREC scale, int child);
+    static unsigned int keyDigit(uint64_t key, unsigned int level);
+    static bool isDivisible(const PointType& cellCenterPos, PREC scale);
+
+    void computeKeys(size_t begin, size_t end, const PointType& cellCenterPos, PREC scale);
+    void radixSort();
+    void buildNode(const NodeTask& task, std::vector<NodeTask>* deferred);
+    void applyNodeOrder();
+
+    std::vector<const OBJ*> objectPtrs;
+    std::vector<Item>       items;
+    std::vector<Item>       scratch;
+    OBJ*                    sortedObjects;
+    size_t                  maxTaskObjects { 0 };
+};
+
+
+template <class OBJ, class PREC> constexpr unsigned int OctreeBuilder<OBJ, PREC>::KeyLevels;
+template <class OBJ, class PREC> constexpr size_t OctreeBuilder<OBJ, PREC>::MinTaskObjects;
+template <class OBJ, class PREC> constexpr size_t OctreeBuilder<OBJ, PREC>::MinChunkSize;
+template <class OBJ, class PREC> constexpr size_t OctreeBuilder<OBJ, PREC>::KeyBlockSize;
+
+
+template <class OBJ, class PREC>
+template <class Container>
+OctreeBuilder<OBJ, PREC>::OctreeBuilder(Container& objects, unsigned int nObjects, OBJ* _sortedObjects) :
+    objectPtrs(nObjects),
+    items(nObjects),
+    scratch(nObjects),
+    sortedObjects(_sortedObjects)
+{
+    for (unsigned int i = 0; i < nObjects; i++)
+    {
+        objectPtrs[i] = &objects[i];
+        items[i].index = i;
+    }
+}
+
+
+template <class OBJ, class PREC>
+template <class Container>
+StaticOctree<OBJ, PREC>*
+OctreeBuilder<OBJ, PREC>::build(Container&       objects,
+                                unsigned int     nObjects,
+                                OBJ*             sortedObjects,
+                                const PointType& cellCenterPos,
+                                PREC             scale,
+                                float            exclusionFactor)
+{
+    OctreeBuilder builder(objects, nObjects, sortedObjects);
+    WorkerPool* pool = GetWorkerPool();
+
+    builder.computeKeys(0, nObjects, cellCenterPos, scale);
+    builder.radixSort();
+
+    // Copy the objects in key order now, so that the passes over the
+    // subtrees below read them sequentially.
+    pool->parallelFor(nObjects, MinChunkSize, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            sortedObjects[i] = *builder.objectPtrs[builder.items[i].index];
+            builder.items[i].index = (uint32_t) i;
+        }
+    });
+    pool->parallelFor(nObjects, MinChunkSize, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+            builder.objectPtrs[i] = sortedObjects + i;
+    });
+
+    // Build the upper levels here, stopping at subtrees small enough to
+    // make a reasonable share of the work for one thread.
+    builder.maxTaskObjects = std::max(MinTaskObjects, (size_t) nObjects / (pool->getConcurrency() * 8));
+    NodeType* root = nullptr;
+    std::vector<NodeTask> deferred;
+    builder.buildNode({ &root, 0, nObjects, cellCenterPos, scale, (PREC) exclusionFactor, 0 }, &deferred);
+
+    // Larger subtrees first, so that the last one to finish is short
+    std::sort(deferred.begin(), deferred.end(),
+              [](const NodeTask& a, const NodeTask& b) { return a.end - a.begin > b.end - b.begin; });
+    pool->parallelFor(deferred.size(), 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+            builder.buildNode(deferred[i], nullptr);
+    });
+
+    builder.applyNodeOrder();
+
+    return root;
+}
+
+
+template <class OBJ, class PREC>
+inline typename OctreeBuilder<OBJ, PREC>::PointType
+OctreeBuilder<OBJ, PREC>::childCenter(const PointType& cellCenterPos, PREC scale, int child)
+{
+    // Same arithmetic as DynamicOctree::split, scale being the half size of
+    // the child node.
+    PointType centerPos = cellCenterPos;
+    centerPos += PointType(((child & XPos) != 0) ? scale : -scale,
+                           ((child & YPos) != 0) ? scale : -scale,
+                           ((child & ZPos) != 0) ? scale : -scale);
+    return centerPos;
+}
+
+
+// The node centers on the path of an object depend on each other level by
+// level. Stepping a whole block of objects through the levels together
+// lets their computations overlap; the fixed block size lets the compiler
+// vectorize the loops. Items past nItems are padding.
+template <class OBJ, class PREC>
+void OctreeBuilder<OBJ, PREC>::computeKeyBlock(Item* block,
+                                               size_t nItems,
+                                               const PointType& cellCenterPos,
+                                               PREC scale) const
+{
+    PREC x[KeyBlockSize], y[KeyBlockSize], z[KeyBlockSize];
+    PREC centerX[KeyBlockSize], centerY[KeyBlockSize], centerZ[KeyBlockSize];
+    uint64_t keys[KeyBlockSize];
+    for (size_t i = 0; i < KeyBlockSize; i++)
+    {
+        PointType pos = i < nItems ? Policy::positionFunction(*objectPtrs[block[i].index]) : cellCenterPos;
+        x[i] = pos.x();
+        y[i] = pos.y();
+        z[i] = pos.z();
+        centerX[i] = cellCenterPos.x();
+        centerY[i] = cellCenterPos.y();
+        centerZ[i] = cellCenterPos.z();
+        keys[i] = 0;
+    }
+
+    for (unsigned int level = 0; level < KeyLevels; level++)
+    {
+        // Same comparisons as DynamicOctree::getChild and the same
+        // arithmetic as childCenter
+        scale *= (PREC) 0.5;
+        for (size_t i = 0; i < KeyBlockSize; i++)
+        {
+            bool xPos = !(x[i] < centerX[i]);
+            bool yPos = !(y[i] < centerY[i]);
+            bool zPos = !(z[i] < centerZ[i]);
+            keys[i] = (keys[i] << 3) | (uint64_t) ((xPos ? XPos : 0) | (yPos ? YPos : 0) | (zPos ? ZPos : 0));
+            centerX[i] += xPos ? scale : -scale;
+            centerY[i] += yPos ? scale : -scale;
+            centerZ[i] += zPos ? scale : -scale;
+        }
+    }
+
+    for (size_t i = 0; i < nItems; i++)
+        block[i].key = keys[i];
+}
+
+
+template <class OBJ, class PREC>
+inline unsigned int
+OctreeBuilder<OBJ, PREC>::keyDigit(uint64_t key, unsigned int level)
+{
+    return (unsigned int) (key >> (3 * (KeyLevels - 1 - level))) & 7;
+}
+
+
+template <class OBJ, class PREC>
+inline bool
+OctreeBuilder<OBJ, PREC>::isDivisible(const PointType& cellCenterPos, PREC scale)
+{
+    auto center = cellCenterPos.array();
+    PREC childScale = scale * (PREC) 0.5;
+    return (center + childScale != center).all() && (center - childScale != center).all();
+}
+
+
+template <class OBJ, class PREC>
+void OctreeBuilder<OBJ, PREC>::computeKeys(size_t begin, size_t end, const PointType& cellCenterPos, PREC scale)
+{
+    auto computeRange = [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i += KeyBlockSize)
+            computeKeyBlock(&items[i], std::min(KeyBlockSize, last - i), cellCenterPos, scale);
+    };
+
+    if (end - begin < MinChunkSize)
+        computeRange(begin, end);
+    else
+        GetWorkerPool()->parallelFor(end - begin, MinChunkSize, [&](size_t first, size_t last)
+        {
+            computeRange(begin + first, begin + last);
+        });
+}
+
+
+// Stable LSD radix sort of the items by key, eight bits at a time. Each
+// chunk of items counts its digits and then scatters its items to the
+// offsets reserved for it, so the passes run in parallel.
+template <class OBJ, class PREC>
+void OctreeBuilder<OBJ, PREC>::radixSort()
+{
+    constexpr unsigned int RadixBits = 8;
+    constexpr unsigned int Buckets = 1 << RadixBits;
+
+    size_t n = items.size();
+    WorkerPool* pool = GetWorkerPool();
+    size_t nChunks = std::max((size_t) 1, std::min((size_t) pool->getConcurrency() * 4, n / MinChunkSize));
+    std::vector<size_t> counts(nChunks * Buckets);
+
+    for (unsigned int shift = 0; shift < KeyLevels * 3; shift += RadixBits)
+    {
+        std::fill(counts.begin(), counts.end(), 0);
+        pool->parallelFor(nChunks, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t chunk = begin; chunk < end; chunk++)
+            {
+                size_t* chunkCounts = &counts[chunk * Buckets];
+                for (size_t i = chunk * n / nChunks; i < (chunk + 1) * n / nChunks; i++)
+                    chunkCounts[(items[i].key >> shift) & (Buckets - 1)]++;
+            }
+        });
+
+        // Turn the counts into offsets, bucket by bucket and within each
+        // bucket chunk by chunk. A pass where all items fall into the same
+        // bucket wouldn't change anything; that's common for the upper
+        // levels, which all objects share.
+        size_t offset = 0;
+        bool skip = false;
+        for (unsigned int bucket = 0; bucket < Buckets; bucket++)
+        {
+            size_t bucketStart = offset;
+            for (size_t chunk = 0; chunk < nChunks; chunk++)
+            {
+                size_t count = counts[chunk * Buckets + bucket];
+                counts[chunk * Buckets + bucket] = offset;
+                offset += count;
+            }
+            if (offset - bucketStart == n)
+                skip = true;
+        }
+        if (skip)
+            continue;
+
+        pool->parallelFor(nChunks, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t chunk = begin; chunk < end; chunk++)
+            {
+                size_t* offsets = &counts[chunk * Buckets];
+                for (size_t i = chunk * n / nChunks; i < (chunk + 1) * n / nChunks; i++)
+                    scratch[offsets[(items[i].key >> shift) & (Buckets - 1)]++] = items[i];
+            }
+        });
+        items.swap(scratch);
+    }
+}
+
+
+template <class OBJ, class PREC>
+void OctreeBuilder<OBJ, PREC>::buildNode(const NodeTask& task, std::vector<NodeTask>* deferred)
+{
+    size_t begin = task.begin;
+    size_t end = task.end;
+    size_t nKeptInNode = end - begin;
+    unsigned int level = task.level;
+
+    // Nodes too small to be subdivided at the precision of the positions
+    // keep all of their objects, which happens only when a lot of objects
+    // share the same position.
+    if (end - begin > Policy::SPLIT_THRESHOLD && isDivisible(task.cellCenterPos, task.scale))
+    {
+        // Once the levels of the keys are used up, recompute the keys of
+        // this subtree relative to this node.
+        if (level == KeyLevels)
+        {
+            computeKeys(begin, end, task.cellCenterPos, task.scale);
+            std::sort(items.begin() + begin, items.begin() + end,
+                      [](const Item& a, const Item& b) { return a.key < b.key; });
+            level = 0;
+        }
+
+        auto mustStay = [&](const Item& item)
+        {
+            const OBJ& obj = *objectPtrs[item.index];
+            return Policy::limitingFactorPredicate(obj, task.exclusionFactor) ||
+                   Policy::straddlingPredicate(task.cellCenterPos, obj, task.exclusionFactor);
+        };
+
+        // Move the objects that must stay in this node to the front,
+        // keeping the others in key order. In the upper levels of the tree
+        // usually none of them stay and nothing needs to be moved.
+        size_t nKept = 0;
+        auto firstKept = std::find_if(items.begin() + begin, items.begin() + end, mustStay);
+        if (firstKept != items.begin() + end)
+        {
+            size_t nMoved = (size_t) (firstKept - items.begin()) - begin;
+            std::copy(items.begin() + begin, firstKept, scratch.begin() + begin);
+            items[begin + nKept++] = *firstKept;
+            for (size_t i = begin + nMoved + 1; i < end; i++)
+            {
+                if (mustStay(items[i]))
+                    items[begin + nKept++] = items[i];
+                else
+                    scratch[begin + nMoved++] = items[i];
+            }
+            std::copy(scratch.begin() + begin, scratch.begin() + begin + nMoved, items.begin() + begin + nKept);
+        }
+        nKeptInNode = nKept;
+    }
+
+    // The objects are moved to their final positions at the end
+    auto* node = new NodeType(task.cellCenterPos,
+                              task.exclusionFactor,
+                              sortedObjects + begin,
+                              (unsigned int) nKeptInNode);
+    *task.node = node;
+
+    if (nKeptInNode == end - begin)
+        return;
+
+    node->_children = new NodeType*[8];
+    PREC childScale = task.scale * (PREC) 0.5;
+    PREC childExclusionFactor = Policy::decayFunction(task.exclusionFactor);
+
+    size_t childBegin = begin + nKeptInNode;
+    for (int child = 0; child < 8; child++)
+    {
+        auto childEnd = (size_t) (std::partition_point(items.begin() + childBegin, items.begin() + end,
+                                                       [&](const Item& item) { return keyDigit(item.key, level) <= (unsigned int) child; })
+                                  - items.begin());
+
+        NodeTask childTask = { &node->_children[child],
+                               childBegin,
+                               childEnd,
+                               childCenter(task.cellCenterPos, childScale, child),
+                               childScale,
+                               childExclusionFactor,
+                               level + 1 };
+        if (deferred != nullptr && childEnd - childBegin <= maxTaskObjects)
+            deferred->push_back(childTask);
+        else
+            buildNode(childTask, deferred);
+
+        childBegin = childEnd;
+    }
+}
+
+
+// Moving the objects that stay in a node to the front of its run changed
+// the order of the items; rearrange the sorted objects the same way. The
+// items only moved within their nodes, so following the cycles of the
+// permutation in place mostly touches nearby objects.
+template <class OBJ, class PREC>
+void OctreeBuilder<OBJ, PREC>::applyNodeOrder()
+{
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        if (items[i].index == i)
+            continue;
+
+        OBJ obj = sortedObjects[i];
+        size_t j = i;
+        while (items[j].index != i)
+        {
+            size_t next = items[j].index;
+            sortedObjects[j] = sortedObjects[next];
+            items[j].index = (uint32_t) j;
+            j = next;
+        }
+        sortedObjects[j] = obj;
+        items[j].index = (uint32_t) j;
+    }
+}
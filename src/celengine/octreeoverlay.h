@@ -0,0 +1,210 @@
+// octreeoverlay.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Objects added to a catalog after its octree was built.
+
+#pragma once
+
+#include <celengine/octreebuilder.h>
+#include <celutil/workerpool.h>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+
+// An OctreeOverlay holds copies of the objects added to a catalog at run
+// time, so that they can be found without rebuilding the catalog's octree.
+//
+// New objects are appended to an unsorted list, which the queries see as
+// a single octree node: the root node tests pass for any observer inside
+// the root cube, so every object of the list gets the per-object tests of
+// the octree's process methods. Once the list has grown beyond the merge
+// threshold, update() builds a StaticOctree over all objects of the
+// overlay with the OctreeBuilder in a worker pool task, and a later
+// update() swaps it in for the list entries it covers. Queries never wait
+// for a merge.
+//
+// The overlay doesn't know which objects were removed from the catalog.
+// Its owner filters them out of the query results and tells update()
+// about them, so that they are left out of the next merge.
+template <class OBJ, class PREC> class OctreeOverlay
+{
+ public:
+    typedef Eigen::Matrix<PREC, 3, 1>       PointType;
+    typedef StaticOctree<OBJ, PREC>         NodeType;
+    typedef std::function<bool(const OBJ&)> RemovedPredicate;
+    typedef std::function<void(NodeType*)>  NodeFunction;
+
+    // The cell center, scale and exclusion factor are those of the root of
+    // the catalog's octree. finishNode is applied to the roots of merged
+    // octrees in the worker task, e.g. to compute their node data.
+    OctreeOverlay(const PointType&    cellCenterPos,
+                  PREC                scale,
+                  float               exclusionFactor,
+                  size_t              mergeThreshold,
+                  const NodeFunction& finishNode = NodeFunction());
+    ~OctreeOverlay();
+
+    OctreeOverlay(const OctreeOverlay&) = delete;
+    OctreeOverlay& operator=(const OctreeOverlay&) = delete;
+
+    void add(const OBJ& obj) { unmerged.push_back(obj); }
+
+    // Objects not covered by the merged octree yet
+    size_t unmergedSize() const { return unmerged.size(); }
+    // Objects in the merged octree, including removed ones not purged yet
+    size_t mergedSize() const { return merged != nullptr ? merged->nObjects : 0; }
+    bool isMerging() const { return pendingMerge.valid(); }
+
+    // Swap in the result of a finished merge, and start a new merge when
+    // there are too many unmerged objects. With wait set, a running merge
+    // is waited for first. Without worker threads the merge runs here.
+    void update(const RemovedPredicate& isRemoved, bool wait = false);
+
+    // Call query(node) for the root of the merged octree and for the node
+    // holding the unmerged objects. The unmerged node has no children and
+    // the scale of the root node.
+    template <class F> void process(F query) const;
+
+ private:
+    struct MergedOctree
+    {
+        std::unique_ptr<OBJ[]>    objects;
+        std::unique_ptr<NodeType> root;
+        size_t                    nObjects { 0 };
+        // Length of the prefix of the unmerged list included in the octree
+        size_t                    nUnmerged { 0 };
+    };
+
+    void startMerge(const RemovedPredicate& isRemoved);
+    void finishMerge();
+
+    PointType    cellCenterPos;
+    PREC         scale;
+    float        exclusionFactor;
+    size_t       mergeThreshold;
+    NodeFunction finishNode;
+
+    std::vector<OBJ>              unmerged;
+    std::shared_ptr<MergedOctree> merged;
+    std::shared_ptr<MergedOctree> pending;
+    std::future<void>             pendingMerge;
+};
+
+
+template <class OBJ, class PREC>
+OctreeOverlay<OBJ, PREC>::OctreeOverlay(const PointType&    _cellCenterPos,
+                                        PREC                _scale,
+                                        float               _exclusionFactor,
+                                        size_t              _mergeThreshold,
+                                        const NodeFunction& _finishNode) :
+    cellCenterPos  (_cellCenterPos),
+    scale          (_scale),
+    exclusionFactor(_exclusionFactor),
+    mergeThreshold (_mergeThreshold),
+    finishNode     (_finishNode)
+{
+}
+
+
+template <class OBJ, class PREC>
+OctreeOverlay<OBJ, PREC>::~OctreeOverlay()
+{
+    // The task only touches its own snapshot and result, but the objects
+    // may refer to data owned by the catalog.
+    if (pendingMerge.valid())
+        pendingMerge.wait();
+}
+
+
+template <class OBJ, class PREC>
+void OctreeOverlay<OBJ, PREC>::update(const RemovedPredicate& isRemoved, bool wait)
+{
+    if (pendingMerge.valid())
+    {
+        if (!wait && pendingMerge.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+        finishMerge();
+    }
+
+    if (unmerged.size() > mergeThreshold)
+        startMerge(isRemoved);
+}
+
+
+template <class OBJ, class PREC>
+void OctreeOverlay<OBJ, PREC>::startMerge(const RemovedPredicate& isRemoved)
+{
+    // The task works on a snapshot, so objects can be added while it runs.
+    auto objects = std::make_shared<std::vector<OBJ>>();
+    objects->reserve(mergedSize() + unmerged.size());
+    for (size_t i = 0; i < mergedSize(); i++)
+    {
+        if (!isRemoved(merged->objects[i]))
+            objects->push_back(merged->objects[i]);
+    }
+    for (const auto& obj : unmerged)
+    {
+        if (!isRemoved(obj))
+            objects->push_back(obj);
+    }
+
+    pending = std::make_shared<MergedOctree>();
+    pending->nObjects = objects->size();
+    pending->nUnmerged = unmerged.size();
+
+    auto result = pending;
+    PointType center = cellCenterPos;
+    PREC rootScale = scale;
+    float rootExclusionFactor = exclusionFactor;
+    NodeFunction finish = finishNode;
+    pendingMerge = GetWorkerPool()->submit([=]
+    {
+        if (objects->empty())
+            return;
+        result->objects.reset(new OBJ[objects->size()]);
+        result->root.reset(OctreeBuilder<OBJ, PREC>::build(*objects,
+                                                           (unsigned int) objects->size(),
+                                                           result->objects.get(),
+                                                           center,
+                                                           rootScale,
+                                                           rootExclusionFactor));
+        if (finish)
+            finish(result->root.get());
+    });
+}
+
+
+template <class OBJ, class PREC>
+void OctreeOverlay<OBJ, PREC>::finishMerge()
+{
+    pendingMerge.get();
+    unmerged.erase(unmerged.begin(), unmerged.begin() + pending->nUnmerged);
+    merged = std::move(pending);
+}
+
+
+template <class OBJ, class PREC>
+template <class F>
+void OctreeOverlay<OBJ, PREC>::process(F query) const
+{
+    if (merged != nullptr && merged->root != nullptr)
+        query(static_cast<const NodeType&>(*merged->root));
+
+    if (!unmerged.empty())
+    {
+        // The queries don't modify the objects of the nodes
+        NodeType node(cellCenterPos,
+                      exclusionFactor,
+                      const_cast<OBJ*>(unmerged.data()),
+                      (unsigned int) unmerged.size());
+        query(static_cast<const NodeType&>(node));
+    }
+}
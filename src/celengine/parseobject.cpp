@@ -220,10 +220,16 @@ CreateEllipticalOrbit(Hash* orbitData,
  *     Source <string>
  *     Interpolation "Cubic" | "Linear"
  *     DoublePrecision <boolean>
+ *     ChebyshevTolerance <number>
  * } \endcode
  *
  * Source is the only required field. Interpolation defaults to cubic, and
  * DoublePrecision defaults to true.
+ *
+ * A ChebyshevTolerance in kilometers makes xyzv trajectories use piecewise
+ * Chebyshev polynomials fitted to the samples, which need much less memory
+ * than the samples themselves for long trajectories. Interpolation and
+ * DoublePrecision are ignored then.
  */
 static Orbit*
 CreateSampledTrajectory(Hash* trajData, const fs::path& path)
@@ -254,8 +260,11 @@ CreateSampledTrajectory(Hash* trajData, const fs::path& path)
     trajData->getBoolean("DoublePrecision", useDoublePrecision);
     TrajectoryPrecision precision = useDoublePrecision ? TrajectoryPrecisionDouble : TrajectoryPrecisionSingle;
 
+    double tolerance = 0.0;
+    trajData->getNumber("ChebyshevTolerance", tolerance);
+
     DPRINTF(LOG_LEVEL_INFO, "Attempting to load sampled trajectory from source '%s'\n", sourceName.c_str());
-    ResourceHandle orbitHandle = GetTrajectoryManager()->getHandle(TrajectoryInfo(sourceName, path, interpolation, precision));
+    ResourceHandle orbitHandle = GetTrajectoryManager()->getHandle(TrajectoryInfo(sourceName, path, interpolation, precision, tolerance));
     Orbit* orbit = GetTrajectoryManager()->find(orbitHandle);
     if (orbit == nullptr)
     {
@@ -0,0 +1,360 @@
+// particlekernel.cpp
+//
+// Copyright (C) 2008, Chris Laurel <claurel@gmail.com>
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <celmath/mathlib.h>
+#include <celutil/workerpool.h>
+#include "particlekernel.h"
+
+using namespace Eigen;
+using namespace std;
+
+// Particles are generated in batches small enough to keep the generator
+// states and intermediate values on the stack.
+constexpr const unsigned int BatchSize = LCGRandomLanes::Size;
+
+// Emitters with fewer particles are generated on the calling thread.
+constexpr const unsigned int MinParallelParticles = 16384;
+constexpr const size_t MinBatchesPerChunk = 16;
+
+static const uint64_t scrambleMask = (uint64_t(0xcccccccc) << 32) | 0xcccccccc;
+
+
+/**** Generator implementations ****/
+
+void
+VectorGenerator::generate(LCGRandomLanes& gens, unsigned int count,
+                          float* x, float* y, float* z) const
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        LCGRandomGenerator gen = gens.get(i);
+        Vector3f v = generate(gen);
+        gens.set(i, gen);
+        x[i] = v.x();
+        y[i] = v.y();
+        z[i] = v.z();
+    }
+}
+
+
+Vector3f
+ConstantGenerator::generate(LCGRandomGenerator& /* gen */) const
+{
+    return m_value;
+}
+
+
+void
+ConstantGenerator::generate(LCGRandomLanes& /* gens */, unsigned int count,
+                            float* x, float* y, float* z) const
+{
+    fill(x, x + count, m_value.x());
+    fill(y, y + count, m_value.y());
+    fill(z, z + count, m_value.z());
+}
+
+
+Vector3f
+BoxGenerator::generate(LCGRandomGenerator& gen) const
+{
+    float x = gen.randSfloat();
+    float y = gen.randSfloat();
+    float z = gen.randSfloat();
+    return Vector3f(x, y, z).cwiseProduct(m_semiAxes) + m_center;
+}
+
+
+void
+BoxGenerator::generate(LCGRandomLanes& gens, unsigned int count,
+                       float* x, float* y, float* z) const
+{
+    // One pass over the lanes per coordinate keeps the generator states
+    // in registers for the whole of each loop.
+    gens.randSfloat(count, x);
+    gens.randSfloat(count, y);
+    gens.randSfloat(count, z);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        x[i] = x[i] * m_semiAxes.x() + m_center.x();
+        y[i] = y[i] * m_semiAxes.y() + m_center.y();
+        z[i] = z[i] * m_semiAxes.z() + m_center.z();
+    }
+}
+
+
+Vector3f
+LineGenerator::generate(LCGRandomGenerator& gen) const
+{
+    return m_origin + m_direction * gen.randFloat();
+}
+
+
+void
+LineGenerator::generate(LCGRandomLanes& gens, unsigned int count,
+                        float* x, float* y, float* z) const
+{
+    gens.randFloat(count, x);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        float t = x[i];
+        x[i] = m_origin.x() + m_direction.x() * t;
+        y[i] = m_origin.y() + m_direction.y() * t;
+        z[i] = m_origin.z() + m_direction.z() * t;
+    }
+}
+
+
+Vector3f
+EllipsoidSurfaceGenerator::generate(LCGRandomGenerator& gen) const
+{
+    float theta = (float) PI * gen.randSfloat();
+    float cosPhi = gen.randSfloat();
+    float sinPhi = std::sqrt(1.0f - cosPhi * cosPhi);
+    if (cosPhi < 0.0f)
+        sinPhi = -sinPhi;
+
+    float s = std::sin(theta);
+    float c = std::cos(theta);
+    return Vector3f(sinPhi * c * m_semiAxes.x(), sinPhi * s * m_semiAxes.y(), cosPhi * m_semiAxes.z()) + m_center;
+}
+
+
+Vector3f
+ConeGenerator::generate(LCGRandomGenerator& gen) const
+{
+    float theta = (float) PI * gen.randSfloat();
+    float cosPhi = 1.0f - m_cosMinAngle - gen.randFloat() * m_cosAngleVariance;
+    float sinPhi = std::sqrt(1.0f - cosPhi * cosPhi);
+    if (cosPhi < 0.0f)
+        sinPhi = -sinPhi;
+
+    float s = std::sin(theta);
+    float c = std::cos(theta);
+    return Vector3f(sinPhi * c, sinPhi * s, cosPhi) * (m_minLength + gen.randFloat() * m_lengthVariance);
+}
+
+
+Vector3f
+GaussianDiscGenerator::generate(LCGRandomGenerator& gen) const
+{
+    float r1 = 0.0f;
+    float r2 = 0.0f;
+    float s = 0.0f;
+
+    do
+    {
+        r1 = gen.randSfloat();
+        r2 = gen.randSfloat();
+        s = r1 * r1 + r2 * r2;
+    } while (s > 1.0f);
+
+    // Choose angle uniformly distributed in [ 0, 2*PI ), radius
+    // with a Gaussian distribution. Use the polar form of the
+    // Box-Muller transform to produce a normally distributed
+    // random number.
+    float r = r1 * std::sqrt(-2.0f * std::log(s) / s) * m_sigma;
+    float theta = r2 * 2.0f * (float) PI;
+    return Vector3f(r * std::cos(theta), r * std::sin(theta), 0.0f);
+}
+
+
+void
+ParticleArrays::resize(unsigned int n)
+{
+    count = n;
+    if (x.size() >= n)
+        return;
+
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    size.resize(n);
+    rotation.resize(n);
+    color.resize(n * 4);
+}
+
+
+namespace
+{
+struct EmissionState
+{
+    int serial;         // serial number of the youngest particle
+    double age;         // age of the youngest particle
+    double interval;    // time between particles
+};
+
+
+// Generate particles [first, first + n) of an emitter. Each particle has its
+// own generator seeded from its serial number, so batches are independent.
+void GenerateBatch(const ParticleEmitterParams& emitter,
+                   const EmissionState& state,
+                   unsigned int first,
+                   unsigned int n,
+                   ParticleArrays& particles)
+{
+    LCGRandomLanes gens;
+    float vx[BatchSize];
+    float vy[BatchSize];
+    float vz[BatchSize];
+
+    // Scramble the random number generator seed so that we don't end up with
+    // artifacts from using regularly incrementing values.
+    for (unsigned int i = 0; i < n; i++)
+    {
+        int serial = state.serial - (int) (first + i);
+        gens.seed(i, uint64_t(serial) * uint64_t(0x128ef719) ^ scrambleMask);
+    }
+
+    // The velocity is generated first, then the position and the rotation
+    // rate, in the order the generators have always been called.
+    float* x = particles.x.data() + first;
+    float* y = particles.y.data() + first;
+    float* z = particles.z.data() + first;
+    emitter.velocityGenerator->generate(gens, n, vx, vy, vz);
+    emitter.positionGenerator->generate(gens, n, x, y, z);
+
+    // The values read in the loops are copied to locals: the compiler
+    // can't tell that the stores to the color bytes don't change them, and
+    // doesn't vectorize loops reloading them.
+    float ages[BatchSize];
+    double age0 = state.age + (double) first * state.interval;
+    double interval = state.interval;
+    for (unsigned int i = 0; i < n; i++)
+        ages[i] = (float) (age0 + (double) i * interval);
+
+    float* size = particles.size.data() + first;
+    float* rotation = particles.rotation.data() + first;
+    unsigned char* color = particles.color.data() + first * 4;
+    float invLifetime = 1.0f / emitter.lifetime;
+    float startSize = emitter.startSize;
+    float endSize = emitter.endSize;
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+        float age = ages[i];
+        float alpha = age * invLifetime;
+        x[i] += vx[i] * age;
+        y[i] += vy[i] * age;
+        z[i] += vz[i] * age;
+        size[i] = alpha * endSize + (1.0f - alpha) * startSize;
+    }
+
+    float startColor[4] = { emitter.startColor.red(), emitter.startColor.green(),
+                            emitter.startColor.blue(), emitter.startColor.alpha() };
+    float endColor[4] = { emitter.endColor.red(), emitter.endColor.green(),
+                          emitter.endColor.blue(), emitter.endColor.alpha() };
+    for (int c = 0; c < 4; c++)
+    {
+        float start = startColor[c] * 255.99f;
+        float end = endColor[c] * 255.99f;
+        for (unsigned int i = 0; i < n; i++)
+        {
+            float alpha = ages[i] * invLifetime;
+            color[i * 4 + c] = (unsigned char) (alpha * end + (1.0f - alpha) * start);
+        }
+    }
+
+    if (emitter.nonZeroAcceleration)
+    {
+        Vector3f a = emitter.acceleration;
+        for (unsigned int i = 0; i < n; i++)
+        {
+            float age2 = ages[i] * ages[i];
+            x[i] += a.x() * age2;
+            y[i] += a.y() * age2;
+            z[i] += a.z() * age2;
+        }
+    }
+
+    if (emitter.rotationEnabled)
+    {
+        float minRotationRate = emitter.minRotationRate;
+        float rotationRateVariance = emitter.rotationRateVariance;
+        gens.randFloat(n, rotation);
+        for (unsigned int i = 0; i < n; i++)
+            rotation[i] = (minRotationRate + rotationRateVariance * rotation[i]) * ages[i];
+    }
+}
+} // end unnamed namespace
+
+
+unsigned int
+GenerateParticles(const ParticleEmitterParams& emitter,
+                  double tsec,
+                  ParticleArrays& particles)
+{
+    particles.count = 0;
+
+    double t = tsec;
+    bool startBounded = emitter.startTime > -numeric_limits<double>::infinity();
+    bool endBounded = emitter.endTime < numeric_limits<double>::infinity();
+
+    // Return immediately if we're far enough past the end time that no
+    // particles remain.
+    if (endBounded)
+    {
+        if (t > emitter.endTime + emitter.lifetime)
+            return 0;
+    }
+
+    // If a start time is specified, set t to be relative to the start time.
+    // Return immediately if we haven't reached the start time yet.
+    if (startBounded)
+    {
+        t -= emitter.startTime;
+        if (t < 0.0)
+            return 0;
+    }
+
+    EmissionState state;
+    state.interval = 1.0 / emitter.rate;
+    double dserial = std::fmod(t * emitter.rate, 2147483648.0);
+    state.serial = (int) dserial;
+    state.age = (dserial - state.serial) * state.interval;
+
+    double maxAge = emitter.lifetime;
+    if (startBounded)
+    {
+        maxAge = std::min((double) emitter.lifetime, t);
+    }
+
+    if (endBounded && tsec > emitter.endTime)
+    {
+        auto skipParticles = (int) ((tsec - emitter.endTime) * emitter.rate);
+        state.serial -= skipParticles;
+        state.age += skipParticles * state.interval;
+    }
+
+    if (state.age >= maxAge)
+        return 0;
+
+    auto count = (unsigned int) std::ceil((maxAge - state.age) / state.interval);
+    particles.resize(count);
+
+    unsigned int nBatches = (count + BatchSize - 1) / BatchSize;
+    auto processBatches = [&](size_t begin, size_t end)
+    {
+        for (size_t b = begin; b < end; b++)
+        {
+            auto first = (unsigned int) b * BatchSize;
+            GenerateBatch(emitter, state, first, min(BatchSize, count - first), particles);
+        }
+    };
+
+    if (count < MinParallelParticles)
+        processBatches(0, nBatches);
+    else
+        GetWorkerPool()->parallelFor(nBatches, MinBatchesPerChunk, processBatches);
+
+    return count;
+}
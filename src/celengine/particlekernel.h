@@ -0,0 +1,378 @@
+// particlekernel.h
+//
+// Copyright (C) 2008, Chris Laurel <claurel@gmail.com>
+// Copyright (C) 2020, Celestia Development Team
+//
+// Generation of the particles of stateless particle system emitters. The
+// kernel only writes plain arrays and doesn't use OpenGL; drawing the
+// particles is left to ParticleEmitter::render.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <Eigen/Core>
+#include <celutil/color.h>
+
+// Same values as rand48()
+constexpr const uint64_t LCGMultiplier = ((uint64_t) 0x5deece66ul << 4) | 0xd;
+constexpr const uint64_t LCGIncrement = 0xb;
+constexpr const uint64_t LCGMask = ((uint64_t) 1 << 48) - 1;
+
+/*! Map the low 23 bits of a random integer to a floating point value in
+ *  [ 0, 1 ). This function directly manipulates the bits of a floating
+ *  point number, and will not work properly on a system that doesn't use
+ *  IEEE754 floats.
+ */
+inline float LCGBitsToFloat(uint32_t randBits)
+{
+    randBits = (randBits & 0x007fffff) | 0x3f800000;
+    float f;
+    std::memcpy(&f, &randBits, sizeof(f));
+    return f - 1.0f;
+}
+
+/*! Map the low 23 bits of a random integer to a floating point value in
+ *  [ -1, 1 ), with the same restriction as LCGBitsToFloat().
+ */
+inline float LCGBitsToSfloat(uint32_t randBits)
+{
+    randBits = (randBits & 0x007fffff) | 0x40000000;
+    float f;
+    std::memcpy(&f, &randBits, sizeof(f));
+    return f - 3.0f;
+}
+
+
+/*! Linear congruential random number generator that emulates
+ *  rand48()
+ */
+class LCGRandomGenerator
+{
+public:
+    LCGRandomGenerator() = default;
+
+    LCGRandomGenerator(uint64_t seed) :
+        previous(seed)
+    {
+    }
+
+    uint64_t randUint64()
+    {
+        previous = (LCGMultiplier * previous + LCGIncrement) & LCGMask;
+        return previous;
+    }
+
+    /*! Return a random integer between -2^31 and 2^31 - 1
+     */
+    int32_t randInt32()
+    {
+        return (int32_t) (randUint64() >> 16);
+    }
+
+    /*! Return a random integer between 0 and 2^32 - 1
+     */
+    uint32_t randUint32()
+    {
+        return (uint32_t) (randUint64() >> 16);
+    }
+
+    /*! Generate a random floating point value in [ 0, 1 )
+     */
+    float randFloat()
+    {
+        return LCGBitsToFloat(randUint32());
+    }
+
+    /*! Generate a random floating point value in [ -1, 1 )
+     */
+    float randSfloat()
+    {
+        return LCGBitsToSfloat(randUint32());
+    }
+
+    uint64_t getState() const { return previous; }
+
+private:
+    uint64_t previous{ 0 };
+};
+
+
+/*! A batch of LCGRandomGenerators advanced side by side, producing the
+ *  same sequences. Each 48 bit state is split into its low 32 and high 16
+ *  bits, kept in separate arrays and advanced with 32 bit multiplies only.
+ *  SSE2, AVX2 and NEON have no 64 bit vector multiply, so loops over an
+ *  array of LCGRandomGenerator stay scalar, while loops over the lanes of
+ *  this class get vectorized.
+ */
+class LCGRandomLanes
+{
+public:
+    static constexpr const unsigned int Size = 256;
+
+    void seed(unsigned int lane, uint64_t seed)
+    {
+        lo[lane] = (uint32_t) seed;
+        hi[lane] = (uint32_t) (seed >> 32) & 0xffff;
+    }
+
+    LCGRandomGenerator get(unsigned int lane) const
+    {
+        return LCGRandomGenerator(((uint64_t) hi[lane] << 32) | lo[lane]);
+    }
+
+    void set(unsigned int lane, const LCGRandomGenerator& gen)
+    {
+        seed(lane, gen.getState());
+    }
+
+    /*! Advance a lane; the result is the same as that of
+     *  LCGRandomGenerator::randUint32()
+     */
+    uint32_t randUint32(unsigned int lane)
+    {
+        // Product of the 48 bit multiplier and state modulo 2^48, from the
+        // 32x32 bit product of the low words and the low words of the cross
+        // products; the high words of both are at most 16 bits.
+        uint64_t low = (uint64_t) MultiplierLow * lo[lane] + LCGIncrement;
+        uint32_t high = (uint32_t) (low >> 32) + MultiplierLow * hi[lane] + MultiplierHigh * lo[lane];
+        lo[lane] = (uint32_t) low;
+        hi[lane] = high & 0xffff;
+        return (hi[lane] << 16) | (lo[lane] >> 16);
+    }
+
+    float randFloat(unsigned int lane)
+    {
+        return LCGBitsToFloat(randUint32(lane));
+    }
+
+    float randSfloat(unsigned int lane)
+    {
+        return LCGBitsToSfloat(randUint32(lane));
+    }
+
+    //! Advance the first count lanes, storing a value in [ 0, 1 ) for each
+    void randFloat(unsigned int count, float* values)
+    {
+        for (unsigned int i = 0; i < count; i++)
+            values[i] = randFloat(i);
+    }
+
+    //! Advance the first count lanes, storing a value in [ -1, 1 ) for each
+    void randSfloat(unsigned int count, float* values)
+    {
+        for (unsigned int i = 0; i < count; i++)
+            values[i] = randSfloat(i);
+    }
+
+private:
+    static constexpr const uint32_t MultiplierLow = (uint32_t) LCGMultiplier;
+    static constexpr const uint32_t MultiplierHigh = (uint32_t) (LCGMultiplier >> 32);
+
+    uint32_t lo[Size];
+    uint32_t hi[Size];
+};
+
+
+/*! Generator abstract base class.
+ *  Subclasses must implement generate() method.
+ */
+class VectorGenerator
+{
+public:
+    VectorGenerator() = default;
+    virtual ~VectorGenerator() = default;
+    virtual Eigen::Vector3f generate(LCGRandomGenerator& gen) const = 0;
+
+    /*! Generate one value for each of the first count lanes of gens and
+     *  store them in separate coordinate arrays. The default calls
+     *  generate() for each lane; subclasses with simple distributions
+     *  override it with loops over the lanes. Lanes must be advanced
+     *  exactly as generate() advances a generator.
+     */
+    virtual void generate(LCGRandomLanes& gens, unsigned int count,
+                          float* x, float* y, float* z) const;
+};
+
+
+/*! Simplest generator; produces the exact same value on each call
+ *  to generate().
+ */
+class ConstantGenerator : public VectorGenerator
+{
+public:
+    ConstantGenerator(const Eigen::Vector3f& value) : m_value(value) {}
+
+    virtual Eigen::Vector3f generate(LCGRandomGenerator& gen) const;
+    virtual void generate(LCGRandomLanes& gens, unsigned int count,
+                          float* x, float* y, float* z) const;
+
+private:
+    Eigen::Vector3f m_value;
+};
+
+
+/*! Generates values uniformly distributed within an axis-aligned box.
+ */
+class BoxGenerator : public VectorGenerator
+{
+public:
+    BoxGenerator(const Eigen::Vector3f& center, const Eigen::Vector3f& axes) :
+        m_center(center),
+        m_semiAxes(axes * 0.5f)
+    {
+    }
+
+    virtual Eigen::Vector3f generate(LCGRandomGenerator& gen) const;
+    virtual void generate(LCGRandomLanes& gens, unsigned int count,
+                          float* x, float* y, float* z) const;
+
+private:
+    Eigen::Vector3f m_center;
+    Eigen::Vector3f m_semiAxes;
+};
+
+
+/*! Generates values uniformly distributed on a line between
+ *  two points.
+ */
+class LineGenerator : public VectorGenerator
+{
+public:
+    LineGenerator(const Eigen::Vector3f& p0, const Eigen::Vector3f& p1) :
+        m_origin(p0),
+        m_direction(p1 - p0)
+    {
+    }
+
+    virtual Eigen::Vector3f generate(LCGRandomGenerator& gen) const;
+    virtual void generate(LCGRandomLanes& gens, unsigned int count,
+                          float* x, float* y, float* z) const;
+
+private:
+    Eigen::Vector3f m_origin;
+    Eigen::Vector3f m_direction;
+};
+
+
+/*! Generates values uniformly distributed on the surface
+ *  of an ellipsoid.
+ */
+class EllipsoidSurfaceGenerator : public VectorGenerator
+{
+public:
+    EllipsoidSurfaceGenerator(const Eigen::Vector3f& center, const Eigen::Vector3f& semiAxes) :
+        m_center(center),
+        m_semiAxes(semiAxes)
+    {
+    }
+
+    virtual Eigen::Vector3f generate(LCGRandomGenerator& gen) const;
+
+private:
+    Eigen::Vector3f m_center;
+    Eigen::Vector3f m_semiAxes;
+};
+
+
+/*! Generates values uniformly distributed within a spherical
+ *  section. The section is centered on the z-axis.
+ */
+class ConeGenerator : public VectorGenerator
+{
+public:
+    ConeGenerator(float minAngle, float maxAngle, float minLength, const float maxLength) :
+        m_cosMinAngle(1.0f - std::cos(minAngle)),
+        m_cosAngleVariance(std::cos(minAngle) - std::cos(maxAngle)),
+        m_minLength(minLength),
+        m_lengthVariance(maxLength - minLength)
+    {
+    }
+
+    virtual Eigen::Vector3f generate(LCGRandomGenerator& gen) const;
+
+private:
+    float m_cosMinAngle;
+    float m_cosAngleVariance;
+    float m_minLength;
+    float m_lengthVariance;
+};
+
+
+/*! Generates points in a 2D gaussian distribution in
+ *  the xy-plane and centered on the origin.
+ */
+class GaussianDiscGenerator : public VectorGenerator
+{
+public:
+    GaussianDiscGenerator(float sigma) :
+        m_sigma(sigma)
+    {
+    }
+
+    virtual Eigen::Vector3f generate(LCGRandomGenerator& gen) const;
+
+private:
+    float m_sigma;
+};
+
+
+/*! Properties of an emitter needed to generate its particles.
+ */
+struct ParticleEmitterParams
+{
+    double startTime;
+    double endTime;
+    float rate;
+    float lifetime;
+
+    Color startColor;
+    float startSize;
+    Color endColor;
+    float endSize;
+
+    const VectorGenerator* positionGenerator;
+    const VectorGenerator* velocityGenerator;
+
+    Eigen::Vector3f acceleration;
+    bool nonZeroAcceleration;
+
+    float minRotationRate;
+    float rotationRateVariance;
+    bool rotationEnabled;
+};
+
+
+/*! Particles in structure of arrays form. Colors are stored as four
+ *  bytes per particle in Color channel order; rotation angles are only
+ *  set for emitters with rotation enabled. The arrays are reused between
+ *  frames, so they only allocate memory when the particle count grows.
+ */
+struct ParticleArrays
+{
+    void resize(unsigned int n);
+
+    unsigned int count{ 0 };
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> size;
+    std::vector<float> rotation;
+    std::vector<unsigned char> color;
+};
+
+
+/*! Generate the particles alive at time tsec. Emitters producing many
+ *  particles are split between the threads of the worker pool. Returns
+ *  the number of particles.
+ */
+unsigned int GenerateParticles(const ParticleEmitterParams& emitter,
+                               double tsec,
+                               ParticleArrays& particles);
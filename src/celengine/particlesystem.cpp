@@ -75,155 +75,12 @@ using namespace std;
  *  be every time a particle is to be drawn. The well-known defects in
  *  pseudorandom sequences produced by an LCG are not visible in a particle
  *  system (and lack of apparent visual artifacts is the *only* requirement here.)
+ *
+ *  Since every particle is generated from its own seed, the particles are
+ *  generated independently of drawing them; see GenerateParticles() in
+ *  particlekernel.cpp.
  */
 
-// Same values as rand48()
-static const uint64_t A = ((uint64_t) 0x5deece66ul << 4) | 0xd;
-static const uint64_t C = 0xb;
-static const uint64_t M = ((uint64_t) 1 << 48) - 1;
-
-/*! Linear congruential random number generator that emulates
- *  rand48()
- */
-class LCGRandomGenerator
-{
-public:
-    LCGRandomGenerator() : previous(0) = default;
-
-    LCGRandomGenerator(uint64_t seed) :
-        previous(seed)
-    {
-    }
-
-    uint64_t randUint64()
-    {
-        previous = (A * previous + C) & M;
-        return previous;
-    }
-
-    /*! Return a random integer between -2^31 and 2^31 - 1
-     */
-    int32_t randInt32()
-    {
-        return (int32_t) (randUint64() >> 16);
-    }
-
-    /*! Return a random integer between 0 and 2^32 - 1
-     */
-    uint32_t randUint32()
-    {
-        return (uint32_t) (randUint64() >> 16);
-    }
-
-    /*! Generate a random floating point value in [ 0, 1 )
-     *  This function directly manipulates the bits of a floating
-     *  point number, and will not work properly on a system that
-     *  doesn't use IEEE754 floats.
-     */
-    float randFloat()
-    {
-        uint32_t randBits = randInt32();
-        randBits = (randBits & 0x007fffff) | 0x3f800000;
-        return *reinterpret_cast<float*>(&randBits) - 1.0f;
-    }
-
-    /*! Generate a random floating point value in [ -1, 1 )
-     *  This function directly manipulates the bits of a floating
-     *  point number, and will not work properly on a system that
-     *  doesn't use IEEE754 floats.
-     */
-    float randSfloat()
-    {
-        uint32_t randBits = (uint32_t) (randUint64() >> 16);
-        randBits = (randBits & 0x007fffff) | 0x40000000;
-        return *reinterpret_cast<float*>(&randBits) - 3.0f;
-    }
-
-private:
-    uint64_t previous;
-};
-
-
-/**** Generator implementations ****/
-
-Vector3f
-ConstantGenerator::generate(LCGRandomGenerator& /* gen */) const
-{
-    return m_value;
-}
-
-
-Vector3f
-BoxGenerator::generate(LCGRandomGenerator& gen) const
-{
-    return Vector3f(gen.randSfloat() * m_semiAxes.x(),
-                    gen.randSfloat() * m_semiAxes.y(),
-                    gen.randSfloat() * m_semiAxes.z()) + m_center;
-}
-
-
-Vector3f
-LineGenerator::generate(LCGRandomGenerator& gen) const
-{
-    return m_origin + m_direction * gen.randFloat();
-}
-
-
-Vector3f
-EllipsoidSurfaceGenerator::generate(LCGRandomGenerator& gen) const
-{
-    float theta = (float) PI * gen.randSfloat();
-    float cosPhi = gen.randSfloat();
-    float sinPhi = std::sqrt(1.0f - cosPhi * cosPhi);
-    if (cosPhi < 0.0f)
-        sinPhi = -sinPhi;
-
-    float s = std::sin(theta);
-    float c = std::cos(theta);
-    return Vector3f(sinPhi * c * m_semiAxes.x(), sinPhi * s * m_semiAxes.y(), cosPhi * m_semiAxes.z()) + m_center;
-}
-
-
-Vector3f
-ConeGenerator::generate(LCGRandomGenerator& gen) const
-{
-    float theta = (float) PI * gen.randSfloat();
-    float cosPhi = 1.0f - m_cosMinAngle - gen.randFloat() * m_cosAngleVariance;
-    float sinPhi = std::sqrt(1.0f - cosPhi * cosPhi);
-    if (cosPhi < 0.0f)
-        sinPhi = -sinPhi;
-
-    float s = std::sin(theta);
-    float c = std::cos(theta);
-    return Vector3f(sinPhi * c, sinPhi * s, cosPhi) * (m_minLength + gen.randFloat() * m_lengthVariance);
-}
-
-
-
-Vector3f
-GaussianDiscGenerator::generate(LCGRandomGenerator& gen) const
-{
-    float r1 = 0.0f;
-    float r2 = 0.0f;
-    float s = 0.0f;
-
-    do
-    {
-        r1 = gen.randSfloat();
-        r2 = gen.randSfloat();
-        s = r1 * r1 + r2 * r2;
-    } while (s > 1.0f);
-
-    // Choose angle uniformly distributed in [ 0, 2*PI ), radius
-    // with a Gaussian distribution. Use the polar form of the
-    // Box-Muller transform to produce a normally distributed
-    // random number.
-    float r = r1 * std::sqrt(-2.0f * std::log(s) / s) * m_sigma;
-    float theta = r2 * 2.0f * (float) PI;
-    return Vector3f(r * std::cos(theta), r * std::sin(theta), 0.0f);
-}
-
-
 
 ParticleEmitter::ParticleEmitter() :
     m_startTime(-numeric_limits<double>::infinity()),
@@ -286,34 +143,39 @@ ParticleEmitter::setBlendMode(cmod::Material::BlendMode blendMode)
 }
 
 
-static const uint64_t scrambleMask = (uint64_t(0xcccccccc) << 32) | 0xcccccccc;
+ParticleEmitterParams
+ParticleEmitter::getParams() const
+{
+    ParticleEmitterParams params;
+    params.startTime = m_startTime;
+    params.endTime = m_endTime;
+    params.rate = m_rate;
+    params.lifetime = m_lifetime;
+    params.startColor = m_startColor;
+    params.startSize = m_startSize;
+    params.endColor = m_endColor;
+    params.endSize = m_endSize;
+    params.positionGenerator = m_positionGenerator;
+    params.velocityGenerator = m_velocityGenerator;
+    params.acceleration = m_acceleration;
+    params.nonZeroAcceleration = m_nonZeroAcceleration;
+    params.minRotationRate = m_minRotationRate;
+    params.rotationRateVariance = m_rotationRateVariance;
+    params.rotationEnabled = m_rotationEnabled;
+    return params;
+}
+
 
 void
 ParticleEmitter::render(double tsec,
                         RenderContext& rc,
+                        ParticleArrays& particles,
                         ParticleVertex* particleBuffer,
                         unsigned int particleBufferCapacity) const
 {
-    double t = tsec;
-    bool startBounded = m_startTime > -numeric_limits<double>::infinity();
-    bool endBounded = m_endTime < numeric_limits<double>::infinity();
-
-    // Return immediately if we're far enough past the end time that no
-    // particles remain.
-    if (endBounded)
-    {
-        if (t > m_endTime + m_lifetime)
-            return;
-    }
-
-    // If a start time is specified, set t to be relative to the start time.
-    // Return immediately if we haven't reached the start time yet.
-    if (startBounded)
-    {
-        t -= m_startTime;
-        if (t < 0.0)
-            return;
-    }
+    unsigned int count = GenerateParticles(getParams(), tsec, particles);
+    if (count == 0)
+        return;
 
     Matrix3f modelViewMatrix = rc.getCameraOrientation().conjugate().toRotationMatrix();
 
@@ -339,31 +201,9 @@ ParticleEmitter::render(double tsec,
 
     glDepthMask(GL_FALSE);
 
-    double emissionInterval = 1.0 / m_rate;
-    double dserial = std::fmod(t * m_rate, (double) (1 << 31));
-    auto serial = (int) (dserial);
-    double age = (dserial - serial) * emissionInterval;
-    auto invLifetime = (float) (1.0 / m_lifetime);
-
-    double maxAge = m_lifetime;
-    if (startBounded)
-    {
-        maxAge = std::min((double) m_lifetime, t);
-    }
-
-    if (endBounded && tsec > m_endTime)
-    {
-        auto skipParticles = (int) ((tsec - m_endTime) * m_rate);
-        serial -= skipParticles;
-        age += skipParticles * emissionInterval;
-    }
-
-    Vec4f startColor(m_startColor.red(), m_startColor.green(), m_startColor.blue(), m_startColor.alpha());
-    Vec4f endColor(m_endColor.red(), m_endColor.green(), m_endColor.blue(), m_endColor.alpha());
-
     unsigned int particleCount = 0;
 
-    while (age < maxAge)
+    for (unsigned int i = 0; i < count; i++)
     {
         // When the particle buffer is full, render the particles and flush it
         if (particleCount == particleBufferCapacity)
@@ -372,31 +212,9 @@ ParticleEmitter::render(double tsec,
             particleCount = 0;
         }
 
-        float alpha = (float) age * invLifetime;
-        float beta = 1.0f - alpha;
-        float size = alpha * m_endSize + beta * m_startSize;
-
-        // Scramble the random number generator seed so that we don't end up with
-        // artifacts from using regularly incrementing values.
-        //
-        // TODO: consider whether the generator could be seeded just once before
-        // the first particle is drawn. This would entail further restrictions,
-        // such as no 'branching' (variable number of calls to LCG::generate()) in
-        // particle state calculation.
-        LCGRandomGenerator gen(uint64_t(serial) * uint64_t(0x128ef719) ^ scrambleMask);
-
-        // Calculate the color of the particle
-        // TODO: switch to using a lookup table for color and opacity
-        unsigned char color[4];
-        color[Color::Red]   = (unsigned char) ((alpha * endColor.x + beta * startColor.x) * 255.99f);
-        color[Color::Green] = (unsigned char) ((alpha * endColor.y + beta * startColor.y) * 255.99f);
-        color[Color::Blue]  = (unsigned char) ((alpha * endColor.z + beta * startColor.z) * 255.99f);
-        color[Color::Alpha] = (unsigned char) ((alpha * endColor.w + beta * startColor.w) * 255.99f);
-
-        Vector3f v = m_velocityGenerator->generate(gen);
-        Vector3f center = m_positionGenerator->generate(gen) + v * (float) age;
-        if (m_nonZeroAcceleration)
-            center += m_acceleration * (float) (age * age);
+        Vector3f center(particles.x[i], particles.y[i], particles.z[i]);
+        float size = particles.size[i];
+        const unsigned char* color = &particles.color[i * 4];
 
         if (!m_rotationEnabled)
         {
@@ -407,10 +225,8 @@ ParticleEmitter::render(double tsec,
         }
         else
         {
-            float rotationRate = m_minRotationRate + m_rotationRateVariance * gen.randFloat();
-            float rotation = rotationRate * (float) age;
-            float c = std::cos(rotation);
-            float s = std::sin(rotation);
+            float c = std::cos(particles.rotation[i]);
+            float s = std::sin(particles.rotation[i]);
 
             particleBuffer[particleCount * 4 + 0].set(center + (modelViewMatrix * Vector3f(-c + s, -s - c, 0.0f)) * size, Vector2f(0.0f, 1.0f), color);
             particleBuffer[particleCount * 4 + 1].set(center + (modelViewMatrix * Vector3f( c + s,  s - c, 0.0f)) * size, Vector2f(1.0f, 1.0f), color);
@@ -419,9 +235,6 @@ ParticleEmitter::render(double tsec,
         }
 
         ++particleCount;
-
-        age += emissionInterval;
-        serial--;
     }
 
     // Render any remaining particles in the buffer
@@ -482,13 +295,13 @@ ParticleSystem::render(RenderContext& rc, double tsec)
 
     for (const auto emitter : m_emitterList)
     {
-        emitter->render(tsec, rc, m_vertexData, m_particleCapacity);
+        emitter->render(tsec, rc, m_particles, m_vertexData, m_particleCapacity);
     }
 }
 
 
 bool
-ParticleSystem::pick(const Ray3d& /* r */, double& /* distance */) const
+ParticleSystem::pick(const celmath::Ray3d& /* r */, double& /* distance */) const
 {
     // Pick selection for particle systems not supported (because it's
     // not typically desirable.)
@@ -110,7 +110,11 @@ void PointStarRenderer::process(const Star& star, float distance, float appMag)
                     distr = 1.0f;
                 renderer->addBackgroundAnnotation(nullptr, starDB->getStarName(star, true),
                                                   Color(Renderer::StarLabelColor, distr * Renderer::StarLabelColor.alpha()),
-                                                  relPos);
+                                                  relPos,
+                                                  Renderer::AlignLeft,
+                                                  Renderer::VerticalAlignBottom,
+                                                  0.0f,
+                                                  -appMag);
                 nLabelled++;
             }
         }
@@ -119,63 +123,7 @@ void PointStarRenderer::process(const Star& star, float distance, float appMag)
         // planets.
         if (distance > SolarSystemMaxDistance)
         {
-#ifdef USE_HDR
-            float satPoint = saturationMag;
-            float alpha = exposure*(faintestMag - appMag)/(faintestMag - saturationMag + 0.001f);
-#else
-            float satPoint = faintestMag - (1.0f - brightnessBias) / brightnessScale; // TODO: precompute this value
-            float alpha = (faintestMag - appMag) * brightnessScale + brightnessBias;
-#endif
-#ifdef DEBUG_HDR_ADAPT
-            minMag = max(minMag, appMag);
-            maxMag = min(maxMag, appMag);
-            minAlpha = min(minAlpha, alpha);
-            maxAlpha = max(maxAlpha, alpha);
-            ++total;
-            if (alpha > above)
-            {
-                ++countAboveN;
-            }
-#endif
-
-            if (useScaledDiscs)
-            {
-                float discSize = size;
-                if (alpha < 0.0f)
-                {
-                    alpha = 0.0f;
-                }
-                else if (alpha > 1.0f)
-                {
-                    float discScale = min(MaxScaledDiscStarSize, (float) pow(2.0f, 0.3f * (satPoint - appMag)));
-                    discSize *= discScale;
-
-                    float glareAlpha = min(0.5f, discScale / 4.0f);
-                    glareVertexBuffer->addStar(relPos, Color(starColor, glareAlpha), discSize * 3.0f);
-
-                    alpha = 1.0f;
-                }
-                starVertexBuffer->addStar(relPos, Color(starColor, alpha), discSize);
-            }
-            else
-            {
-                if (alpha < 0.0f)
-                {
-                    alpha = 0.0f;
-                }
-                else if (alpha > 1.0f)
-                {
-                    float discScale = min(100.0f, satPoint - appMag + 2.0f);
-                    float glareAlpha = min(GlareOpacity, (discScale - 2.0f) / 4.0f);
-                    glareVertexBuffer->addStar(relPos, Color(starColor, glareAlpha), 2.0f * discScale * size);
-#ifdef DEBUG_HDR_ADAPT
-                    maxSize = max(maxSize, 2.0f * discScale * size);
-#endif
-                }
-                starVertexBuffer->addStar(relPos, Color(starColor, alpha), size);
-            }
-
-            ++nRendered;
+            addStar(relPos, starColor, appMag);
         }
         else
         {
@@ -201,3 +149,86 @@ void PointStarRenderer::process(const Star& star, float distance, float appMag)
         }
     }
 }
+
+void PointStarRenderer::processAggregate(const StarNodeData& data, float distance, float appMag)
+{
+    nProcessed++;
+
+    if (distance > distanceLimit || distance <= SolarSystemMaxDistance)
+        return;
+
+    Vector3f relPos = (data.centroid.cast<double>() - obsPos).cast<float>();
+    if (relPos.dot(viewNormal) <= 0.0f)
+        return;
+
+#ifdef HDR_COMPRESS
+    Color starColorFull = colorTemp->lookupColor(data.temperature);
+    Color starColor(starColorFull.red()   * 0.5f,
+                    starColorFull.green() * 0.5f,
+                    starColorFull.blue()  * 0.5f);
+#else
+    Color starColor = colorTemp->lookupColor(data.temperature);
+#endif
+    addStar(relPos, starColor, appMag);
+}
+
+void PointStarRenderer::addStar(const Vector3f& relPos, const Color& starColor, float appMag)
+{
+#ifdef USE_HDR
+    float satPoint = saturationMag;
+    float alpha = exposure*(faintestMag - appMag)/(faintestMag - saturationMag + 0.001f);
+#else
+    float satPoint = faintestMag - (1.0f - brightnessBias) / brightnessScale; // TODO: precompute this value
+    float alpha = (faintestMag - appMag) * brightnessScale + brightnessBias;
+#endif
+#ifdef DEBUG_HDR_ADAPT
+    minMag = max(minMag, appMag);
+    maxMag = min(maxMag, appMag);
+    minAlpha = min(minAlpha, alpha);
+    maxAlpha = max(maxAlpha, alpha);
+    ++total;
+    if (alpha > above)
+    {
+        ++countAboveN;
+    }
+#endif
+
+    if (useScaledDiscs)
+    {
+        float discSize = size;
+        if (alpha < 0.0f)
+        {
+            alpha = 0.0f;
+        }
+        else if (alpha > 1.0f)
+        {
+            float discScale = min(MaxScaledDiscStarSize, (float) pow(2.0f, 0.3f * (satPoint - appMag)));
+            discSize *= discScale;
+
+            float glareAlpha = min(0.5f, discScale / 4.0f);
+            glareVertexBuffer->addStar(relPos, Color(starColor, glareAlpha), discSize * 3.0f);
+
+            alpha = 1.0f;
+        }
+        starVertexBuffer->addStar(relPos, Color(starColor, alpha), discSize);
+    }
+    else
+    {
+        if (alpha < 0.0f)
+        {
+            alpha = 0.0f;
+        }
+        else if (alpha > 1.0f)
+        {
+            float discScale = min(100.0f, satPoint - appMag + 2.0f);
+            float glareAlpha = min(GlareOpacity, (discScale - 2.0f) / 4.0f);
+            glareVertexBuffer->addStar(relPos, Color(starColor, glareAlpha), 2.0f * discScale * size);
+#ifdef DEBUG_HDR_ADAPT
+            maxSize = max(maxSize, 2.0f * discScale * size);
+#endif
+        }
+        starVertexBuffer->addStar(relPos, Color(starColor, alpha), size);
+    }
+
+    ++nRendered;
+}
@@ -14,10 +14,11 @@
 #include <vector>
 #include "objectrenderer.h"
 #include "renderlistentry.h"
+#include "staroctree.h"
 
+class Color;
 class ColorTemperatureTable;
 class PointStarVertexBuffer;
-class Star;
 class StarDatabase;
 
 // TODO: move these variables to PointStarRenderer class
@@ -28,7 +29,7 @@ constexpr const float BaseStarDiscSize      = 5.0f;
 constexpr const float MaxScaledDiscStarSize = 8.0f;
 constexpr const float GlareOpacity          = 0.65f;
 
-class PointStarRenderer : public ObjectRenderer<Star, float>
+class PointStarRenderer : public ObjectRenderer<Star, float>, public StarAggregateHandler
 {
  public:
 #if 0
@@ -41,6 +42,8 @@ class PointStarRenderer : public ObjectRenderer<Star, float>
 
     PointStarRenderer();
     void process(const Star &star, float distance, float appMag);
+    // Draw the stars of a distant octree node as a single point
+    void processAggregate(const StarNodeData &data, float distance, float appMag);
 
     Eigen::Vector3d obsPos;
     std::vector<RenderListEntry>* renderList    { nullptr };
@@ -62,4 +65,7 @@ class PointStarRenderer : public ObjectRenderer<Star, float>
     unsigned long total                         { 0 };
 #endif
     bool  useScaledDiscs                        { false };
+
+ private:
+    void addStar(const Eigen::Vector3f &relPos, const Color &starColor, float appMag);
 };
@@ -56,6 +56,7 @@ void PointStarVertexBuffer::startSprites()
     glEnable(GL_POINT_SPRITE);
 
     useSprites = true;
+    started = true;
 }
 
 void PointStarVertexBuffer::startPoints()
@@ -84,10 +85,18 @@ void PointStarVertexBuffer::startPoints()
     // glPointSize(2.0f);
     // glEnable(GL_POINT_SMOOTH);
     useSprites = false;
+    started = true;
 }
 
 void PointStarVertexBuffer::render()
 {
+    // Nothing to draw with; the buffer was only filled by the culling
+    if (!started)
+    {
+        nStars = 0;
+        return;
+    }
+
     if (nStars != 0)
     {
         unsigned int stride = sizeof(StarVertex);
@@ -123,6 +132,9 @@ void PointStarVertexBuffer::render()
 
 void PointStarVertexBuffer::finish()
 {
+    if (!started)
+        return;
+
     render();
     glDisableVertexAttribArray(CelestiaGLProgram::ColorAttributeIndex);
     glDisableVertexAttribArray(CelestiaGLProgram::VertexCoordAttributeIndex);
@@ -133,6 +145,7 @@ void PointStarVertexBuffer::finish()
         glDisable(GL_POINT_SPRITE);
     }
     glUseProgram(0);
+    started = false;
 }
 
 void PointStarVertexBuffer::setTexture(Texture* _texture)
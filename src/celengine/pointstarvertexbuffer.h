@@ -53,6 +53,9 @@ private:
     StarVertex* vertices    { nullptr };
     Texture* texture        { nullptr };
     bool useSprites         { false };
+    // Set between start*() and finish(); without it the stars are only
+    // collected, as when the renderer culls without a GL context.
+    bool started            { false };
 };
 
 inline void PointStarVertexBuffer::addStar(const Eigen::Vector3f& pos,
@@ -45,6 +45,10 @@ static GLenum GLComponentTypes[Mesh::FormatMax] =
      GL_FLOAT,          // Float3
      GL_FLOAT,          // Float4,
      GL_UNSIGNED_BYTE,  // UByte4
+     GL_HALF_FLOAT,     // Half2
+     GL_HALF_FLOAT,     // Half4
+     GL_SHORT,          // Short4N
+     GL_SHORT,          // Octahedral
 };
 
 static int GLComponentCounts[Mesh::FormatMax] =
@@ -54,6 +58,10 @@ static int GLComponentCounts[Mesh::FormatMax] =
      3,  // Float3
      4,  // Float4,
      4,  // UByte4
+     2,  // Half2
+     4,  // Half4
+     4,  // Short4N
+     2,  // Octahedral
 };
 
 
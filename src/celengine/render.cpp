@@ -63,6 +63,7 @@ std::ofstream hdrlog;
 #include "orbitsampler.h"
 #include "asterismrenderer.h"
 #include "boundariesrenderer.h"
+#include "locationindex.h"
 #include "rendcontext.h"
 #include "vertexobject.h"
 #include <celcompat/memory.h>
@@ -72,6 +73,7 @@ std::ofstream hdrlog;
 #include <celmath/intersect.h>
 #include <celmath/geomutil.h>
 #include <celutil/debug.h>
+#include <celutil/profiler.h>
 #include <celutil/utf8.h>
 #include <celutil/util.h>
 #include <celutil/timer.h>
@@ -856,7 +858,8 @@ void Renderer::addAnnotation(vector<Annotation>& annotations,
                              LabelAlignment halign,
                              LabelVerticalAlignment valign,
                              float size,
-                             bool special)
+                             bool special,
+                             float priority)
 {
     GLint view[4] = { 0, 0, windowWidth, windowHeight };
     Vector3f win;
@@ -882,6 +885,8 @@ void Renderer::addAnnotation(vector<Annotation>& annotations,
         a.halign = halign;
         a.valign = valign;
         a.size = size;
+        a.priority = priority;
+        a.labelWidth = -1;
         annotations.push_back(a);
     }
 }
@@ -893,9 +898,10 @@ void Renderer::addForegroundAnnotation(const MarkerRepresentation* markerRep,
                                        const Vector3f& pos,
                                        LabelAlignment halign,
                                        LabelVerticalAlignment valign,
-                                       float size)
+                                       float size,
+                                       float priority)
 {
-    addAnnotation(foregroundAnnotations, markerRep, labelText, color, pos, halign, valign, size);
+    addAnnotation(foregroundAnnotations, markerRep, labelText, color, pos, halign, valign, size, false, priority);
 }
 
 
@@ -905,9 +911,10 @@ void Renderer::addBackgroundAnnotation(const MarkerRepresentation* markerRep,
                                        const Vector3f& pos,
                                        LabelAlignment halign,
                                        LabelVerticalAlignment valign,
-                                       float size)
+                                       float size,
+                                       float priority)
 {
-    addAnnotation(backgroundAnnotations, markerRep, labelText, color, pos, halign, valign, size);
+    addAnnotation(backgroundAnnotations, markerRep, labelText, color, pos, halign, valign, size, false, priority);
 }
 
 
@@ -917,9 +924,10 @@ void Renderer::addSortedAnnotation(const MarkerRepresentation* markerRep,
                                    const Vector3f& pos,
                                    LabelAlignment halign,
                                    LabelVerticalAlignment valign,
-                                   float size)
+                                   float size,
+                                   float priority)
 {
-    addAnnotation(depthSortedAnnotations, markerRep, labelText, color, pos, halign, valign, size, true);
+    addAnnotation(depthSortedAnnotations, markerRep, labelText, color, pos, halign, valign, size, true, priority);
 }
 
 
@@ -961,6 +969,7 @@ void Renderer::endObjectAnnotations()
 
     if (!objectAnnotations.empty())
     {
+        declutterAnnotations(objectAnnotations, FontNormal, false);
         renderAnnotations(objectAnnotations.begin(),
                           objectAnnotations.end(),
                           -depthPartitions[currentIntervalIndex].nearZ,
@@ -975,12 +984,13 @@ void Renderer::endObjectAnnotations()
 void Renderer::addObjectAnnotation(const MarkerRepresentation* markerRep,
                                    const string& labelText,
                                    Color color,
-                                   const Vector3f& pos)
+                                   const Vector3f& pos,
+                                   float priority)
 {
     assert(objectAnnotationSetOpen);
     if (objectAnnotationSetOpen)
     {
-        addAnnotation(objectAnnotations, markerRep, labelText, color, pos, AlignCenter, VerticalAlignCenter);
+        addAnnotation(objectAnnotations, markerRep, labelText, color, pos, AlignCenter, VerticalAlignCenter, 0.0f, false, priority);
     }
 }
 
@@ -1374,6 +1384,7 @@ setupLightSources(const vector<const Star*>& nearStars,
         {
             Vector3d v = star->getPosition(t).offsetFromKm(observerPos);
             LightSource ls;
+            ls.star = star;
             ls.position = v;
             ls.luminosity = star->getLuminosity();
             ls.radius = star->getRadius();
@@ -1539,13 +1550,10 @@ void Renderer::render(const Observer& observer,
 #endif
 }
 
-void Renderer::draw(const Observer& observer,
-                    const Universe& universe,
-                    float faintestMagNight,
-                    const Selection& sel)
+Frustum Renderer::beginFrame(const Observer& observer,
+                             float faintestMagNight,
+                             const Selection& sel)
 {
-    // Get the observer's time
-    double now = observer.getTime();
     realTime = observer.getRealTime();
 
     frameCount++;
@@ -1565,14 +1573,6 @@ void Renderer::draw(const Observer& observer,
 
     m_cameraOrientation = observer.getOrientationf();
 
-    // Get the view frustum used for culling in camera space.
-    Frustum frustum(degToRad(fov), getAspectRatio(), MinNearPlaneDistance);
-
-    // Get the transformed frustum, used for culling in the astrocentric coordinate
-    // system.
-    Frustum xfrustum(frustum);
-    xfrustum.transform(getCameraOrientation().conjugate().toRotationMatrix());
-
     // Set up the projection and modelview matrices.
     // We'll usethem for positioning star and planet labels.
     m_projMatrix = Perspective(fov, getAspectRatio(), NEAR_DIST, FAR_DIST);
@@ -1592,6 +1592,7 @@ void Renderer::draw(const Observer& observer,
     lightSourceList.clear();
     secondaryIlluminators.clear();
     nearStars.clear();
+    nShadowCasterIndexes = 0;
 
     // See if we want to use AutoMag.
     if ((renderFlags & ShowAutoMag) != 0)
@@ -1605,22 +1606,16 @@ void Renderer::draw(const Observer& observer,
     }
 
     faintestPlanetMag = faintestMag;
-#ifdef USE_HDR
-    float maxBodyMagPrev = saturationMag;
-    maxBodyMag = min(maxBodyMag, saturationMag);
-    vector<RenderListEntry>::iterator closestBody;
-    const Star *brightestStar = nullptr;
-    bool foundClosestBody   = false;
-    bool foundBrightestStar = false;
-#endif
-
-    if ((renderFlags & (ShowSolarSystemObjects | ShowOrbits)) != 0)
-    {
-        buildNearSystemsLists(universe, observer, xfrustum, now);
-    }
 
-    setupSecondaryLightSources(secondaryIlluminators, lightSourceList);
+    // Get the transformed view frustum, used for culling in the
+    // astrocentric coordinate system.
+    Frustum xfrustum(degToRad(fov), getAspectRatio(), MinNearPlaneDistance);
+    xfrustum.transform(getCameraOrientation().conjugate().toRotationMatrix());
+    return xfrustum;
+}
 
+void Renderer::setupStarBrightness(double now)
+{
     // Scan through the render list to see if we're inside a planetary
     // atmosphere.  If so, we need to adjust the sky color as well as the
     // limiting magnitude of stars (so stars aren't visible in the daytime
@@ -1657,6 +1652,41 @@ void Renderer::draw(const Observer& observer,
         "sat = "      << saturationMag << ", " <<
         "exposure = " << (exposure+brightPlus) << endl;
 #endif
+}
+
+void Renderer::draw(const Observer& observer,
+                    const Universe& universe,
+                    float faintestMagNight,
+                    const Selection& sel)
+{
+    CEL_PROFILE_ZONE("Renderer::draw");
+
+    // Get the observer's time
+    double now = observer.getTime();
+
+    Frustum xfrustum = beginFrame(observer, faintestMagNight, sel);
+
+    // Get the view frustum used for culling in camera space.
+    Frustum frustum(degToRad(fov), getAspectRatio(), MinNearPlaneDistance);
+#ifdef USE_HDR
+    float maxBodyMagPrev = saturationMag;
+    maxBodyMag = min(maxBodyMag, saturationMag);
+    vector<RenderListEntry>::iterator closestBody;
+    const Star *brightestStar = nullptr;
+    bool foundClosestBody   = false;
+    bool foundBrightestStar = false;
+#endif
+
+    if ((renderFlags & (ShowSolarSystemObjects | ShowOrbits)) != 0)
+    {
+        buildNearSystemsLists(universe, observer, xfrustum, now);
+    }
+
+    CEL_PROFILE_COUNTER("renderListSize", renderList.size());
+
+    setupSecondaryLightSources(secondaryIlluminators, lightSourceList);
+
+    setupStarBrightness(now);
 
 #ifdef HDR_COMPRESS
     ambientColor = Color(ambientLightLevel*.5f, ambientLightLevel*.5f, ambientLightLevel*.5f);
@@ -1749,6 +1779,7 @@ void Renderer::draw(const Observer& observer,
 
     // Sort the annotations
     sort(depthSortedAnnotations.begin(), depthSortedAnnotations.end());
+    declutterAnnotations(depthSortedAnnotations, FontNormal, false);
 
     // Sort the orbit paths
     sort(orbitPathList.begin(), orbitPathList.end());
@@ -2275,9 +2306,9 @@ Renderer::locationsToAnnotations(const Body& body,
                                  const Vector3d& bodyPosition,
                                  const Quaterniond& bodyOrientation)
 {
-    const vector<Location*>* locations = body.getLocations();
+    const LocationIndex* locationIndex = body.getLocationIndex();
 
-    if (locations == nullptr)
+    if (locationIndex == nullptr)
         return;
 
     Vector3f semiAxes = body.getSemiAxes();
@@ -2296,7 +2327,20 @@ Renderer::locationsToAnnotations(const Body& body,
 
     Matrix3d bodyMatrix = bodyOrientation.conjugate().toRotationMatrix();
 
-    for (const auto location : *locations)
+    // Only visit the locations in cells which may be visible and large
+    // enough to be labelled.
+    LocationIndex::Query query;
+    query.observerPosition = viewRayOrigin;
+    query.viewDirection = bodyOrientation * viewNormal;
+    query.occluderRadius = body.isEllipsoid() ? semiAxes.minCoeff() : 0.0;
+    query.pixelSize = pixelSize;
+    query.minFeatureSize = minFeatureSize;
+    query.featureMask = locationFilter;
+
+    locationCandidates.clear();
+    locationIndex->findCandidates(query, locationCandidates);
+
+    for (const auto location : locationCandidates)
     {
         auto featureType = location->getFeatureType();
         if ((featureType & locationFilter) != 0)
@@ -2314,9 +2358,7 @@ Renderer::locationsToAnnotations(const Body& body,
             // Get the camera space label position
             Vector3d labelPos = bodyCenter + bodyMatrix * locPos;
 
-            float effSize = location->getImportance();
-            if (effSize < 0.0f)
-                effSize = location->getSize();
+            float effSize = LocationIndex::getEffectiveSize(*location);
 
             float pixSize = effSize / (float) (labelPos.norm() * pixelSize);
 
@@ -2370,7 +2412,8 @@ Renderer::locationsToAnnotations(const Body& body,
                     addObjectAnnotation(locationMarker,
                                         location->getName(true),
                                         labelColor,
-                                        labelPos.cast<float>());
+                                        labelPos.cast<float>(),
+                                        pixSize);
                 }
             }
         }
@@ -2465,6 +2508,7 @@ setupObjectLighting(const vector<LightSource>& suns,
         ls.lights[i].position = dir;
         ls.lights[i].apparentSize = (float) (suns[i].radius / dir.norm());
         ls.lights[i].castsShadows = true;
+        ls.lights[i].star = suns[i].star;
     }
 
     // Include effects of secondary illumination (i.e. planetshine)
@@ -2518,6 +2562,7 @@ setupObjectLighting(const vector<LightSource>& suns,
             ls.lights[i].color = secondaryIlluminators[maxIrrSource].body->getSurface().color;
             ls.lights[i].apparentSize = 0.0f;
             ls.lights[i].castsShadows = false;
+            ls.lights[i].star = nullptr;
             i++;
             nLights++;
         }
@@ -3133,6 +3178,27 @@ bool Renderer::testEclipse(const Body& receiver,
 }
 
 
+// Shadow caster indexes are built on first use in a frame and shared by all
+// receivers lit by the same light.
+const ShadowCasterIndex& Renderer::getShadowCasterIndex(const PlanetarySystem* system,
+                                                        const Star* light,
+                                                        double now)
+{
+    for (size_t i = 0; i < nShadowCasterIndexes; i++)
+    {
+        if (shadowCasterIndexes[i].matches(system, light, now))
+            return shadowCasterIndexes[i];
+    }
+
+    if (nShadowCasterIndexes == shadowCasterIndexes.size())
+        shadowCasterIndexes.emplace_back();
+
+    ShadowCasterIndex& index = shadowCasterIndexes[nShadowCasterIndexes++];
+    index.build(system, light, now);
+    return index;
+}
+
+
 void Renderer::renderPlanet(Body& body,
                             const Vector3f& pos,
                             float distance,
@@ -3241,14 +3307,17 @@ void Renderer::renderPlanet(Body& body,
                 PlanetarySystem* satellites = body.getSatellites();
                 if (satellites != nullptr)
                 {
-                    int nSatellites = satellites->getSystemSize();
+                    Vector3d posReceiver = body.getAstrocentricPosition(now);
                     for (unsigned int li = 0; li < lights.nLights; li++)
                     {
                         if (lights.lights[li].castsShadows)
                         {
-                            for (int i = 0; i < nSatellites; i++)
+                            const DirectionalLight& light = lights.lights[li];
+                            getShadowCasterIndex(satellites, light.star, now)
+                                .findCasters(&body, posReceiver, light.apparentSize, shadowCasters);
+                            for (const Body* caster : shadowCasters)
                             {
-                                testEclipse(body, *satellites->getBody(i), lights, li, now);
+                                testEclipse(body, *caster, lights, li, now);
                             }
                         }
                     }
@@ -3256,6 +3325,7 @@ void Renderer::renderPlanet(Body& body,
             }
             else
             {
+                Vector3d posReceiver = body.getAstrocentricPosition(now);
                 for (unsigned int li = 0; li < lights.nLights; li++)
                 {
                     if (lights.lights[li].castsShadows)
@@ -3275,13 +3345,14 @@ void Renderer::renderPlanet(Body& body,
                                 planet = nullptr;
                         }
 
-                        int nSatellites = system->getSystemSize();
-                        for (int i = 0; i < nSatellites; i++)
+                        // Only the satellites whose shadows may reach the
+                        // body are tested.
+                        const DirectionalLight& light = lights.lights[li];
+                        getShadowCasterIndex(system, light.star, now)
+                            .findCasters(&body, posReceiver, light.apparentSize, shadowCasters);
+                        for (const Body* caster : shadowCasters)
                         {
-                            if (system->getBody(i) != &body)
-                            {
-                                testEclipse(body, *system->getBody(i), lights, li, now);
-                            }
+                            testEclipse(body, *caster, lights, li, now);
                         }
                     }
                 }
@@ -3752,6 +3823,8 @@ void Renderer::renderReferenceMark(const ReferenceMark& refMark,
 
 void Renderer::renderAsterisms(const Universe& universe, float dist)
 {
+    CEL_PROFILE_ZONE("renderAsterisms");
+
     auto *asterisms = universe.getAsterisms();
 
     if ((renderFlags & ShowDiagrams) == 0 || asterisms == nullptr)
@@ -3782,6 +3855,8 @@ void Renderer::renderAsterisms(const Universe& universe, float dist)
 
 void Renderer::renderBoundaries(const Universe& universe, float dist)
 {
+    CEL_PROFILE_ZONE("renderBoundaries");
+
     auto boundaries = universe.getBoundaries();
     if ((renderFlags & ShowBoundaries) == 0 || boundaries == nullptr)
         return;
@@ -4268,9 +4343,13 @@ static Color getBodyLabelColor(int classification)
     }
 }
 
-void Renderer::buildLabelLists(const Frustum& viewFrustum,
-                               double now)
+size_t Renderer::buildLabelLists(const Frustum& viewFrustum,
+                                 double now)
 {
+    CEL_PROFILE_ZONE("buildLabelLists");
+
+    size_t nLabels = depthSortedAnnotations.size();
+
     int labelClassMask = translateLabelModeToClassMask(labelMode);
     Body* lastPrimary = nullptr;
     Sphered primarySphere;
@@ -4377,8 +4456,11 @@ void Renderer::buildLabelLists(const Frustum& viewFrustum,
         Color labelColor = getBodyLabelColor(ri.body->getOrbitClassification());
         float opacity = sizeFade(boundingRadiusSize, minOrbitSize, 2.0f);
         labelColor.alpha(opacity * labelColor.alpha());
-        addSortedAnnotation(nullptr, body->getName(true), labelColor, pos);
+        addSortedAnnotation(nullptr, body->getName(true), labelColor, pos,
+                            AlignLeft, VerticalAlignBottom, 0.0f, boundingRadiusSize);
     } // for each render list entry
+
+    return depthSortedAnnotations.size() - nLabels;
 }
 
 
@@ -4432,14 +4514,14 @@ static double calcMaxFOV(double fovY_degrees, double aspectRatio)
 }
 
 
-void Renderer::renderPointStars(const StarDatabase& starDB,
+// Fill the star vertex buffers with the visible stars, and add the close
+// ones to the render list. Without a started vertex buffer full batches of
+// stars are dropped instead of drawn, so this needs no GL context.
+size_t Renderer::cullPointStars(const StarDatabase& starDB,
                                 float faintestMagNight,
                                 const Observer& observer)
 {
-    // Disable multisample rendering when drawing point stars
-    bool toggleAA = (starStyle == Renderer::PointStars && glIsEnabled(GL_MULTISAMPLE));
-    if (toggleAA)
-        glDisable(GL_MULTISAMPLE);
+    size_t nRenderListEntries = renderList.size();
 
     Vector3d obsPos = observer.getPosition().toLy();
 
@@ -4499,46 +4581,112 @@ void Renderer::renderPointStars(const StarDatabase& starDB,
 
     starRenderer.colorTemp = colorTemp;
 
-    gaussianDiscTex->bind();
-    starRenderer.starVertexBuffer->setTexture(gaussianDiscTex);
-    starRenderer.glareVertexBuffer->setTexture(gaussianGlareTex);
-
-    starRenderer.glareVertexBuffer->startSprites();
-    if (starStyle == PointStars)
-        starRenderer.starVertexBuffer->startPoints();
-    else
-        starRenderer.starVertexBuffer->startSprites();
-
 #ifdef OCTREE_DEBUG
     m_starProcStats.nodes = 0;
     m_starProcStats.height = 0;
     m_starProcStats.objects = 0;
 #endif
-    starDB.findVisibleStars(starRenderer,
-                            obsPos.cast<float>(),
-                            observer.getOrientationf(),
-                            degToRad(fov),
-                            getAspectRatio(),
-                            faintestMagNight,
 #ifdef OCTREE_DEBUG
-                            &m_starProcStats);
+    OctreeProcStats* starProcStats = &m_starProcStats;
 #else
-                            nullptr);
+    OctreeProcStats* starProcStats = nullptr;
 #endif
+    if (starImpostorSize > 0.0f)
+    {
+        starDB.findVisibleStars(starRenderer,
+                                starRenderer,
+                                obsPos.cast<float>(),
+                                observer.getOrientationf(),
+                                degToRad(fov),
+                                getAspectRatio(),
+                                faintestMagNight,
+                                starImpostorSize * pixelSize,
+                                starProcStats);
+    }
+    else
+    {
+        starDB.findVisibleStars(starRenderer,
+                                obsPos.cast<float>(),
+                                observer.getOrientationf(),
+                                degToRad(fov),
+                                getAspectRatio(),
+                                faintestMagNight,
+                                starProcStats);
+    }
+
+    CEL_PROFILE_COUNTER("starsProcessed", starRenderer.nProcessed);
+    CEL_PROFILE_COUNTER("starsRendered", starRenderer.nRendered);
+
+    return starRenderer.nRendered + (renderList.size() - nRenderListEntries);
+}
+
+
+void Renderer::renderPointStars(const StarDatabase& starDB,
+                                float faintestMagNight,
+                                const Observer& observer)
+{
+    CEL_PROFILE_ZONE("renderPointStars");
+
+    // Disable multisample rendering when drawing point stars
+    bool toggleAA = (starStyle == Renderer::PointStars && glIsEnabled(GL_MULTISAMPLE));
+    if (toggleAA)
+        glDisable(GL_MULTISAMPLE);
+
+    gaussianDiscTex->bind();
+    pointStarVertexBuffer->setTexture(gaussianDiscTex);
+    glareVertexBuffer->setTexture(gaussianGlareTex);
+
+    glareVertexBuffer->startSprites();
+    if (starStyle == PointStars)
+        pointStarVertexBuffer->startPoints();
+    else
+        pointStarVertexBuffer->startSprites();
+
+    cullPointStars(starDB, faintestMagNight, observer);
 
-    starRenderer.starVertexBuffer->render();
-    starRenderer.glareVertexBuffer->render();
-    starRenderer.starVertexBuffer->finish();
-    starRenderer.glareVertexBuffer->finish();
+    pointStarVertexBuffer->render();
+    glareVertexBuffer->render();
+    pointStarVertexBuffer->finish();
+    glareVertexBuffer->finish();
 
     if (toggleAA)
         glEnable(GL_MULTISAMPLE);
 }
 
+// Collect the deep sky objects which pass the bulk culling into
+// visibleDSOs.
+size_t Renderer::cullDeepSkyObjects(const Universe& universe,
+                                    const Observer& observer,
+                                    float faintestMagNight)
+{
+#ifdef OCTREE_DEBUG
+    m_dsoProcStats.objects = 0;
+    m_dsoProcStats.nodes = 0;
+    m_dsoProcStats.height = 0;
+#endif
+    universe.getDSOCatalog()->findVisibleDSOs(visibleDSOs,
+                                              observer.getPosition().toLy(),
+                                              observer.getOrientationf(),
+                                              degToRad(fov),
+                                              getAspectRatio(),
+                                              2 * faintestMagNight,
+                                              renderFlags,
+                                              labelMode,
+#ifdef OCTREE_DEBUG
+                                              &m_dsoProcStats);
+#else
+                                              nullptr);
+#endif
+
+    return visibleDSOs.size();
+}
+
 void Renderer::renderDeepSkyObjects(const Universe& universe,
                                     const Observer& observer,
                                     const float     faintestMagNight)
 {
+    CEL_PROFILE_ZONE("renderDeepSkyObjects");
+
     DSORenderer dsoRenderer;
 
     Vector3d obsPos     = observer.getPosition().toLy();
@@ -4592,22 +4740,14 @@ void Renderer::renderDeepSkyObjects(const Universe& universe,
 
     glBlendFunc(GL_SRC_ALPHA, GL_ONE);
 
-#ifdef OCTREE_DEBUG
-    m_dsoProcStats.objects = 0;
-    m_dsoProcStats.nodes = 0;
-    m_dsoProcStats.height = 0;
-#endif
-    dsoDB->findVisibleDSOs(dsoRenderer,
-                           obsPos,
-                           observer.getOrientationf(),
-                           degToRad(fov),
-                           getAspectRatio(),
-                           2 * faintestMagNight,
-#ifdef OCTREE_DEBUG
-                           &m_dsoProcStats);
-#else
-                            nullptr);
-#endif
+    cullDeepSkyObjects(universe, observer, faintestMagNight);
+
+    // Only the objects which passed the bulk culling reach the renderer;
+    // drawing has to stay on this thread.
+    for (const auto& visible : visibleDSOs)
+        dsoRenderer.process(visible.dso, visible.distance, visible.absMag);
+
+    CEL_PROFILE_COUNTER("visibleDSOs", visibleDSOs.size());
 
     // clog << "DSOs processed: " << dsoRenderer.dsosProcessed << endl;
 
@@ -4623,6 +4763,8 @@ static Vector3d toStandardCoords(const Vector3d& v)
 
 void Renderer::renderSkyGrids(const Observer& observer)
 {
+    CEL_PROFILE_ZONE("renderSkyGrids");
+
     if ((renderFlags & ShowCelestialSphere) != 0)
     {
         SkyGrid grid;
@@ -4828,9 +4970,94 @@ Renderer::renderAnnotationLabel(const Annotation &a,
     glPopMatrix();
 }
 
+void
+Renderer::declutterAnnotations(vector<Annotation>& annotations, FontStyle fs, bool aligned)
+{
+    if (!labelDeclutter || font[fs] == nullptr || annotations.size() < 2)
+        return;
+
+    CEL_PROFILE_ZONE("declutterAnnotations");
+
+    declutterOrder.clear();
+    for (uint32_t i = 0; i < (uint32_t) annotations.size(); i++)
+    {
+        if (!annotations[i].labelText.empty())
+            declutterOrder.push_back(i);
+    }
+
+    // Labels of equal priority keep their order, so the outcome doesn't
+    // flicker between frames.
+    stable_sort(declutterOrder.begin(), declutterOrder.end(),
+                [&annotations](uint32_t a, uint32_t b)
+                { return annotations[a].priority > annotations[b].priority; });
+
+    int fontHeight = font[fs]->getHeight();
+    labelGrid.reset(windowWidth, windowHeight, 4 * fontHeight);
+
+    for (uint32_t i : declutterOrder)
+    {
+        Annotation& a = annotations[i];
+
+        // The same label placement as used by renderAnnotations, which
+        // reuses the measured width of the labels that are kept.
+        a.labelWidth = font[fs]->getWidth(a.labelText);
+        float width = (float) a.labelWidth;
+        float markerOffset = a.markerRep != nullptr ? (float) ((int) a.markerRep->size() / 2) : 0.0f;
+        LabelGrid::Rect rect;
+        rect.left = a.position.x();
+        rect.bottom = a.position.y();
+        if (aligned)
+        {
+            switch (a.halign)
+            {
+            case AlignCenter:
+                rect.left -= width / 2;
+                break;
+            case AlignRight:
+                rect.left -= width + 2;
+                break;
+            case AlignLeft:
+                rect.left += 2 + markerOffset;
+                break;
+            }
+
+            switch (a.valign)
+            {
+            case VerticalAlignCenter:
+                rect.bottom -= fontHeight / 2;
+                break;
+            case VerticalAlignTop:
+                rect.bottom -= fontHeight;
+                break;
+            case VerticalAlignBottom:
+                break;
+            }
+        }
+        else if (a.markerRep != nullptr)
+        {
+            rect.left += markerOffset + 3;
+        }
+        rect.right = rect.left + width;
+        rect.top = rect.bottom + fontHeight;
+
+        if (a.priority >= FixedLabelPriority)
+            labelGrid.insert(rect);
+        else if (!labelGrid.tryInsert(rect))
+            a.labelText.clear();
+    }
+}
+
+// Width of an annotation label, measured when it wasn't decluttered
+int Renderer::annotationLabelWidth(const Annotation& a, FontStyle fs) const
+{
+    return a.labelWidth >= 0 ? a.labelWidth : font[fs]->getWidth(a.labelText);
+}
+
 // stars and constellations. DSOs
 void Renderer::renderAnnotations(const vector<Annotation>& annotations, FontStyle fs)
 {
+    CEL_PROFILE_ZONE("renderAnnotations");
+
     if (font[fs] == nullptr)
         return;
 
@@ -4866,12 +5093,12 @@ void Renderer::renderAnnotations(const vector<Annotation>& annotations, FontStyl
             switch (annotations[i].halign)
             {
             case AlignCenter:
-                labelWidth = (font[fs]->getWidth(annotations[i].labelText));
+                labelWidth = annotationLabelWidth(annotations[i], fs);
                 hOffset = -labelWidth / 2;
                 break;
 
             case AlignRight:
-                labelWidth = (font[fs]->getWidth(annotations[i].labelText));
+                labelWidth = annotationLabelWidth(annotations[i], fs);
                 hOffset = -(labelWidth + 2);
                 break;
 
@@ -4914,6 +5141,7 @@ void
 Renderer::renderBackgroundAnnotations(FontStyle fs)
 {
     glEnable(GL_DEPTH_TEST);
+    declutterAnnotations(backgroundAnnotations, fs, true);
     renderAnnotations(backgroundAnnotations, fs);
     glDisable(GL_DEPTH_TEST);
 
@@ -5010,6 +5238,8 @@ void Renderer::markersToAnnotations(const MarkerList& markers,
                                     const Observer& observer,
                                     double jd)
 {
+    CEL_PROFILE_ZONE("markersToAnnotations");
+
     const UniversalCoord& cameraPosition = observer.getPosition();
     const Quaterniond& cameraOrientation = observer.getOrientation();
     Vector3d viewVector = cameraOrientation.conjugate() * -Vector3d::UnitZ();
@@ -5185,6 +5415,28 @@ void Renderer::setSolarSystemMaxDistance(float t)
     SolarSystemMaxDistance = clamp(t, 1.0f, 10.0f);
 }
 
+void Renderer::setStarImpostorSize(float pixels)
+{
+    starImpostorSize = max(pixels, 0.0f);
+    markSettingsChanged();
+}
+
+float Renderer::getStarImpostorSize() const
+{
+    return starImpostorSize;
+}
+
+void Renderer::setLabelDeclutter(bool enable)
+{
+    labelDeclutter = enable;
+    markSettingsChanged();
+}
+
+bool Renderer::getLabelDeclutter() const
+{
+    return labelDeclutter;
+}
+
 void Renderer::getViewport(int* x, int* y, int* w, int* h) const
 {
     GLint viewport[4];
@@ -5694,60 +5946,112 @@ Renderer::adjustMagnitudeInsideAtmosphere(float &faintestMag,
     }
 }
 
-void
-Renderer::buildNearSystemsLists(const Universe &universe,
-                                const Observer &observer,
-                                const Frustum &xfrustum,
-                                double now)
+// Return the frame tree of the solar system of a star, with its bounding
+// spheres up to date.
+static FrameTree* getSolarSystemTree(const Universe& universe, const Star* sun)
+{
+    SolarSystem* solarSystem = universe.getSolarSystem(sun);
+    if (solarSystem == nullptr)
+        return nullptr;
+
+    FrameTree* solarSysTree = solarSystem->getFrameTree();
+    if (solarSysTree != nullptr && solarSysTree->updateRequired())
+    {
+        // Tree has changed, so we must recompute bounding spheres.
+        solarSysTree->recomputeBoundingSphere();
+        solarSysTree->markUpdated();
+    }
+
+    return solarSysTree;
+}
+
+size_t
+Renderer::findNearStars(const Universe &universe,
+                        const Observer &observer)
 {
     UniversalCoord observerPos = observer.getPosition();
-    Eigen::Quaterniond observerOrient = observer.getOrientation();
 
     universe.getNearStars(observerPos, SolarSystemMaxDistance, nearStars);
 
     // Set up direct light sources (i.e. just stars at the moment)
     // Skip if only star orbits to be shown
     if ((renderFlags & ShowSolarSystemObjects) != 0)
-        setupLightSources(nearStars, observerPos, now, lightSourceList, renderFlags);
+        setupLightSources(nearStars, observerPos, observer.getTime(), lightSourceList, renderFlags);
+
+    return nearStars.size();
+}
+
+size_t
+Renderer::buildSolarSystemRenderLists(const Universe &universe,
+                                      const Observer &observer,
+                                      const Frustum &xfrustum)
+{
+    // Skip if only star orbits to be shown
+    if ((renderFlags & ShowSolarSystemObjects) == 0)
+        return 0;
+
+    double now = observer.getTime();
+    UniversalCoord observerPos = observer.getPosition();
+    Vector3d viewPlaneNormal = observer.getOrientation().conjugate() * -Vector3d::UnitZ();
 
     // Traverse the frame trees of each nearby solar system and
     // build the list of objects to be rendered.
     for (const auto sun : nearStars)
     {
-        addStarOrbitToRenderList(*sun, observer, now);
-        // Skip if only star orbits to be shown
-        if ((renderFlags & ShowSolarSystemObjects) == 0)
+        const FrameTree* solarSysTree = getSolarSystemTree(universe, sun);
+        if (solarSysTree == nullptr)
             continue;
 
-        SolarSystem* solarSystem = universe.getSolarSystem(sun);
-        if (solarSystem == nullptr)
+        // Compute the position of the observer in astrocentric coordinates
+        Vector3d astrocentricObserverPos = astrocentricPosition(observerPos, *sun, now);
+
+        buildRenderLists(astrocentricObserverPos, xfrustum, viewPlaneNormal,
+                         Vector3d::Zero(), solarSysTree, observer, now);
+    }
+
+    return renderList.size();
+}
+
+size_t
+Renderer::buildSolarSystemOrbitLists(const Universe &universe,
+                                     const Observer &observer,
+                                     const Frustum &xfrustum)
+{
+    double now = observer.getTime();
+    UniversalCoord observerPos = observer.getPosition();
+    Eigen::Quaterniond observerOrient = observer.getOrientation();
+
+    for (const auto sun : nearStars)
+    {
+        addStarOrbitToRenderList(*sun, observer, now);
+        // Skip if only star orbits to be shown
+        if ((renderFlags & ShowSolarSystemObjects) == 0 || (renderFlags & ShowOrbits) == 0)
             continue;
 
-        FrameTree* solarSysTree = solarSystem->getFrameTree();
+        const FrameTree* solarSysTree = getSolarSystemTree(universe, sun);
         if (solarSysTree == nullptr)
             continue;
 
-        if (solarSysTree->updateRequired())
-        {
-            // Tree has changed, so we must recompute bounding spheres.
-            solarSysTree->recomputeBoundingSphere();
-            solarSysTree->markUpdated();
-        }
-
-        // Compute the position of the observer in astrocentric coordinates
         Vector3d astrocentricObserverPos = astrocentricPosition(observerPos, *sun, now);
-
-        // Build render lists for bodies and orbits paths
-        buildRenderLists(astrocentricObserverPos, xfrustum,
-                         observerOrient.conjugate() * -Vector3d::UnitZ(),
-                         Vector3d::Zero(), solarSysTree, observer, now);
-        if ((renderFlags & ShowOrbits) != 0)
-        {
-            buildOrbitLists(astrocentricObserverPos, observerOrient,
-                            xfrustum, solarSysTree, now);
-        }
+        buildOrbitLists(astrocentricObserverPos, observerOrient,
+                        xfrustum, solarSysTree, now);
     }
 
+    return orbitPathList.size();
+}
+
+void
+Renderer::buildNearSystemsLists(const Universe &universe,
+                                const Observer &observer,
+                                const Frustum &xfrustum,
+                                double now)
+{
+    CEL_PROFILE_ZONE("buildNearSystemsLists");
+
+    findNearStars(universe, observer);
+    buildSolarSystemRenderLists(universe, observer, xfrustum);
+    buildSolarSystemOrbitLists(universe, observer, xfrustum);
+
     if ((labelMode & BodyLabelMask) != 0)
         buildLabelLists(xfrustum, now);
 }
@@ -5755,6 +6059,8 @@ Renderer::buildNearSystemsLists(const Universe &universe,
 int
 Renderer::buildDepthPartitions()
 {
+    CEL_PROFILE_ZONE("buildDepthPartitions");
+
     // Since we're rendering objects of a huge range of sizes spread over
     // vast distances, we can't just rely on the hardware depth buffer to
     // handle hidden surface removal without a little help. We'll partition
@@ -5900,6 +6206,8 @@ Renderer::renderSolarSystemObjects(const Observer &observer,
                                    int nIntervals,
                                    double now)
 {
+    CEL_PROFILE_ZONE("renderSolarSystemObjects");
+
     // Render everything that wasn't culled.
     auto annotation = depthSortedAnnotations.begin();
     float intervalSize = 1.0f / static_cast<float>(max(1, nIntervals));
@@ -21,6 +21,8 @@
 #include <celengine/starcolors.h>
 #include <celengine/rendcontext.h>
 #include <celengine/renderlistentry.h>
+#include <celengine/labelgrid.h>
+#include <celengine/shadowcasterindex.h>
 #include "vertexobject.h"
 
 #ifdef USE_GLCONTEXT
@@ -44,6 +46,7 @@ class Frustum;
 
 struct LightSource
 {
+    const Star* star;
     Eigen::Vector3d position;
     Color color;
     float luminosity;
@@ -113,6 +116,31 @@ class Renderer
               float faintestVisible,
               const Selection& sel);
 
+    // The culling and list building stages of draw(). They make no OpenGL
+    // calls, so they can also be run without a context, as framebench
+    // does. beginFrame() sets up the frame state and returns the view
+    // frustum in astrocentric orientation; the other stages return the
+    // number of objects they produced.
+    celmath::Frustum beginFrame(const Observer&,
+                                float faintestVisible,
+                                const Selection& sel);
+    size_t findNearStars(const Universe&, const Observer&);
+    size_t buildSolarSystemRenderLists(const Universe&,
+                                       const Observer&,
+                                       const celmath::Frustum& xfrustum);
+    size_t buildSolarSystemOrbitLists(const Universe&,
+                                      const Observer&,
+                                      const celmath::Frustum& xfrustum);
+    size_t buildLabelLists(const celmath::Frustum& viewFrustum,
+                           double now);
+    void setupStarBrightness(double now);
+    size_t cullDeepSkyObjects(const Universe&,
+                              const Observer&,
+                              float faintestMagNight);
+    size_t cullPointStars(const StarDatabase& starDB,
+                          float faintestMagNight,
+                          const Observer& observer);
+
     bool getInfo(std::map<std::string, std::string>& info) const;
 
     enum {
@@ -250,6 +278,13 @@ class Renderer
     [[deprecated]] bool getVideoSync() const;
     [[deprecated]] void setVideoSync(bool);
     void setSolarSystemMaxDistance(float);
+    // Octree nodes of faint stars appearing smaller than this many pixels
+    // are drawn as a single point; 0 draws every star individually.
+    void setStarImpostorSize(float);
+    float getStarImpostorSize() const;
+    // Hide labels overlapping a label of higher priority
+    void setLabelDeclutter(bool);
+    bool getLabelDeclutter() const;
     void setShadowMapSize(unsigned);
 
     bool captureFrame(int, int, int, int, PixelFormat format, unsigned char*, bool = false) const;
@@ -290,6 +325,11 @@ class Renderer
         VerticalAlignTop,
     };
 
+    // When labels are decluttered, labels of higher priority hide the
+    // overlapping ones of lower priority. Labels of FixedLabelPriority are
+    // never hidden; stars and DSOs use their negated apparent magnitude.
+    static constexpr float FixedLabelPriority = 1.0e30f;
+
     struct Annotation
     {
         std::string labelText;
@@ -299,6 +339,9 @@ class Renderer
         LabelAlignment halign : 3;
         LabelVerticalAlignment valign : 3;
         float size;
+        float priority;
+        // Label width in pixels measured by declutterAnnotations, or -1
+        int labelWidth;
 
         bool operator<(const Annotation&) const;
     };
@@ -309,21 +352,24 @@ class Renderer
                                  const Eigen::Vector3f& position,
                                  LabelAlignment halign = AlignLeft,
                                  LabelVerticalAlignment valign = VerticalAlignBottom,
-                                 float size = 0.0f);
+                                 float size = 0.0f,
+                                 float priority = FixedLabelPriority);
     void addBackgroundAnnotation(const MarkerRepresentation* markerRep,
                                  const std::string& labelText,
                                  Color color,
                                  const Eigen::Vector3f& position,
                                  LabelAlignment halign = AlignLeft,
                                  LabelVerticalAlignment valign = VerticalAlignBottom,
-                                 float size = 0.0f);
+                                 float size = 0.0f,
+                                 float priority = FixedLabelPriority);
     void addSortedAnnotation(const MarkerRepresentation* markerRep,
                              const std::string& labelText,
                              Color color,
                              const Eigen::Vector3f& position,
                              LabelAlignment halign = AlignLeft,
                              LabelVerticalAlignment valign = VerticalAlignBottom,
-                             float size = 0.0f);
+                             float size = 0.0f,
+                             float priority = FixedLabelPriority);
 
     ShaderManager& getShaderManager() const { return *shaderManager; }
 
@@ -332,7 +378,8 @@ class Renderer
     // Callbacks for renderables; these belong in a special renderer interface
     // only visible in object's render methods.
     void beginObjectAnnotations();
-    void addObjectAnnotation(const MarkerRepresentation* markerRep, const std::string& labelText, Color, const Eigen::Vector3f&);
+    void addObjectAnnotation(const MarkerRepresentation* markerRep, const std::string& labelText, Color, const Eigen::Vector3f&,
+                             float priority = FixedLabelPriority);
     void endObjectAnnotations();
     const Eigen::Quaternionf& getCameraOrientation() const;
     float getNearPlaneDistance() const;
@@ -372,6 +419,14 @@ class Renderer
 
     FramebufferObject* getShadowFBO(int) const;
 
+    // Test whether caster shadows receiver when lit by light lightIndex of
+    // lightingState, and add its eclipse or ring shadow to lightingState.
+    static bool testEclipse(const Body& receiver,
+                            const Body& caster,
+                            LightingState& lightingState,
+                            unsigned int lightIndex,
+                            double now);
+
  public:
     // Internal types
     // TODO: Figure out how to make these private.  Even with a friend
@@ -488,8 +543,6 @@ class Renderer
                          const celmath::Frustum& viewFrustum,
                          const FrameTree* tree,
                          double now);
-    void buildLabelLists(const celmath::Frustum& viewFrustum,
-                         double now);
     int buildDepthPartitions();
 
 
@@ -564,11 +617,9 @@ class Renderer
                     float nearPlaneDistance,
                     float farPlaneDistance);
 
-    bool testEclipse(const Body& receiver,
-                     const Body& caster,
-                     LightingState& lightingState,
-                     unsigned int lightIndex,
-                     double now);
+    const ShadowCasterIndex& getShadowCasterIndex(const PlanetarySystem* system,
+                                                  const Star* light,
+                                                  double now);
 
     void labelConstellations(const AsterismList& asterisms,
                              const Observer& observer);
@@ -583,7 +634,13 @@ class Renderer
                        LabelAlignment halign = AlignLeft,
                        LabelVerticalAlignment = VerticalAlignBottom,
                        float size = 0.0f,
-                       bool special = false);
+                       bool special = false,
+                       float priority = FixedLabelPriority);
+    // Clear the labels overlapping one of higher priority. The labels of
+    // annotations rendered by the ranged version of renderAnnotations
+    // ignore their alignment, those of the others don't.
+    void declutterAnnotations(std::vector<Annotation>&, FontStyle fs, bool aligned);
+    int annotationLabelWidth(const Annotation&, FontStyle fs) const;
     void renderAnnotationMarker(const Annotation &a,
                                 FontStyle fs,
                                 float depth);
@@ -716,6 +773,7 @@ class Renderer
     std::vector<OrbitPathListEntry> orbitPathList;
     LightingState::EclipseShadowVector eclipseShadows[MaxLights];
     std::vector<const Star*> nearStars;
+    std::vector<VisibleDSO> visibleDSOs;
 
     std::vector<LightSource> lightSourceList;
 
@@ -772,6 +830,21 @@ class Renderer
     // visibility culling of solar systems.
     float SolarSystemMaxDistance{ 1.0f };
 
+    float starImpostorSize{ 0.0f };
+
+    bool labelDeclutter{ false };
+    LabelGrid labelGrid;
+    std::vector<uint32_t> declutterOrder;
+
+    // Locations passing the spatial index tests in locationsToAnnotations
+    std::vector<Location*> locationCandidates;
+
+    // Shadow caster indexes built during the current frame; the first
+    // nShadowCasterIndexes entries are valid.
+    std::vector<ShadowCasterIndex> shadowCasterIndexes;
+    size_t nShadowCasterIndexes{ 0 };
+    std::vector<const Body*> shadowCasters;
+
     // Size of a texture used in shadow mapping
     unsigned m_shadowMapSize { 0 };
     std::unique_ptr<FramebufferObject> m_shadowFBO;
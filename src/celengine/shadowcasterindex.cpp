@@ -0,0 +1,210 @@
+// shadowcasterindex.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <Eigen/Geometry>
+#include "body.h"
+#include "star.h"
+#include "shadowcasterindex.h"
+
+using namespace Eigen;
+using namespace std;
+
+// Slack added to the angular tests to cover rounding
+constexpr const double AngularSlack = 1.0e-9;
+constexpr const double RelativeSlack = 1.0e-6;
+
+// When the bound on the angle between a caster and a receiver seen from the
+// light gets this large, the small angle arguments below no longer hold
+// and every caster is returned.
+constexpr const double MaxBoundSine = 0.5;
+
+
+void ShadowCasterIndex::build(const PlanetarySystem* _system,
+                              const Star* _light,
+                              double now)
+{
+    system = _system;
+    light = _light;
+    time = now;
+    lightPosition = Vector3d::Zero();
+    casters.clear();
+    sorted.clear();
+    maxExtent = 0.0;
+    minDistance = numeric_limits<double>::infinity();
+    center = Vector3d::Zero();
+    radius = 0.0;
+
+    if (system == nullptr || light == nullptr)
+        return;
+
+    // Astrocentric positions are relative to the star of the system; other
+    // stars light it in multiple star systems.
+    const Star* sun = system->getStar();
+    if (sun != nullptr && sun != light)
+        lightPosition = light->getPosition(now).offsetFromKm(sun->getPosition(now));
+
+    // Casters failing the receiver independent tests of
+    // Renderer::testEclipse are left out.
+    Vector3d meanDirection = Vector3d::Zero();
+    for (int i = 0; i < system->getSystemSize(); i++)
+    {
+        const Body* body = system->getBody(i);
+        if (!body->hasVisibleGeometry() || !body->extant(now) || !body->isEllipsoid())
+            continue;
+
+        Vector3d position = body->getAstrocentricPosition(now);
+        Vector3d v = position - lightPosition;
+        double distance = v.norm();
+        if (distance == 0.0)
+            continue;
+
+        Caster caster;
+        caster.body = body;
+        caster.position = position;
+        caster.direction = v / distance;
+        caster.distance = distance;
+        caster.extent = body->getRadius();
+        if (body->getRings() != nullptr)
+            caster.extent = max(caster.extent, (double) body->getRings()->outerRadius);
+        casters.push_back(caster);
+
+        meanDirection += caster.direction;
+        center += position;
+        maxExtent = max(maxExtent, caster.extent);
+        minDistance = min(minDistance, distance);
+    }
+
+    if (casters.empty())
+        return;
+
+    center /= (double) casters.size();
+    for (const auto& caster : casters)
+        radius = max(radius, (caster.position - center).norm());
+
+    // Sort along whichever of two axes perpendicular to the mean direction
+    // separates the casters best; for a planet's satellites seen almost
+    // edge on, that's the direction along the orbits.
+    if (meanDirection.squaredNorm() > 0.0)
+        meanDirection.normalize();
+    else
+        meanDirection = Vector3d::UnitZ();
+    Vector3d axis0 = meanDirection.unitOrthogonal();
+    Vector3d axis1 = meanDirection.cross(axis0);
+
+    double min0 = numeric_limits<double>::infinity();
+    double max0 = -min0;
+    double min1 = min0;
+    double max1 = max0;
+    for (const auto& caster : casters)
+    {
+        double k0 = caster.direction.dot(axis0);
+        double k1 = caster.direction.dot(axis1);
+        min0 = min(min0, k0);
+        max0 = max(max0, k0);
+        min1 = min(min1, k1);
+        max1 = max(max1, k1);
+    }
+    sortAxis = (max0 - min0 >= max1 - min1) ? axis0 : axis1;
+
+    sorted.reserve(casters.size());
+    for (size_t i = 0; i < casters.size(); i++)
+        sorted.push_back({ casters[i].direction.dot(sortAxis), (int) i });
+    sort(sorted.begin(), sorted.end(),
+         [](const SortEntry& a, const SortEntry& b) { return a.key < b.key; });
+}
+
+
+bool ShadowCasterIndex::matches(const PlanetarySystem* _system,
+                                const Star* _light,
+                                double now) const
+{
+    return system == _system && light == _light && time == now;
+}
+
+
+// A receiver may only be shadowed by a caster if it is within distance
+//     receiverRadius + extent + lightSize * separation
+// of the shadow axis, which starts at the caster and points away from the
+// light; separation is the distance between the receiver and the caster.
+// Receivers in front of the caster are only affected by ring shadows, and
+// only within receiverRadius + extent of the caster. Either way the
+// receiver is farther than distance - receiverRadius - extent from the
+// light, which bounds the sine of the angle between its direction and the
+// caster's. For angles below 90 degrees the distance between the unit
+// direction vectors is at most sqrt(2) times that sine.
+static double getDirectionBound(double receiverRadius,
+                                double extent,
+                                double distance,
+                                double separation,
+                                double lightApparentSize)
+{
+    double e = receiverRadius + extent;
+    if (distance <= e)
+        return numeric_limits<double>::infinity();
+
+    double sine = (e + lightApparentSize * separation) / (distance - e);
+    if (sine > MaxBoundSine)
+        return numeric_limits<double>::infinity();
+
+    return sqrt(2.0) * sine * (1.0 + RelativeSlack) + AngularSlack;
+}
+
+
+void ShadowCasterIndex::findCasters(const Body* receiver,
+                                    const Vector3d& receiverPosition,
+                                    double lightApparentSize,
+                                    vector<const Body*>& result) const
+{
+    result.clear();
+    matchIndices.clear();
+
+    Vector3d v = receiverPosition - lightPosition;
+    double distance = v.norm();
+    double receiverRadius = receiver->getRadius();
+    double maxSeparation = (receiverPosition - center).norm() + radius;
+    double bound = getDirectionBound(receiverRadius, maxExtent, minDistance,
+                                     maxSeparation, lightApparentSize);
+
+    if (distance == 0.0 || std::isinf(bound))
+    {
+        for (const auto& caster : casters)
+        {
+            if (caster.body != receiver)
+                result.push_back(caster.body);
+        }
+        return;
+    }
+
+    Vector3d direction = v / distance;
+    double key = direction.dot(sortAxis);
+    auto first = lower_bound(sorted.begin(), sorted.end(), key - bound,
+                             [](const SortEntry& e, double k) { return e.key < k; });
+
+    for (auto iter = first; iter != sorted.end() && iter->key <= key + bound; ++iter)
+    {
+        const Caster& caster = casters[iter->caster];
+        if (caster.body == receiver)
+            continue;
+
+        double separation = (receiverPosition - caster.position).norm();
+        double casterBound = getDirectionBound(receiverRadius, caster.extent, caster.distance,
+                                               separation, lightApparentSize);
+        if ((direction - caster.direction).norm() < casterBound)
+            matchIndices.push_back(iter->caster);
+    }
+
+    // Keep the order in which the shadows would have been found by testing
+    // every body of the system.
+    sort(matchIndices.begin(), matchIndices.end());
+    for (int i : matchIndices)
+        result.push_back(casters[i].body);
+}
@@ -0,0 +1,74 @@
+// shadowcasterindex.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// Per frame index of the bodies of a planetary system that may cast eclipse
+// or ring shadows from one light source. Seen from the light, the shadow
+// of a caster lies around the direction of the caster, so the casters are
+// sorted by an angular coordinate and a receiver only needs to be tested
+// against those in a narrow band around its own direction.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <vector>
+#include <Eigen/Core>
+
+class Body;
+class PlanetarySystem;
+class Star;
+
+class ShadowCasterIndex
+{
+ public:
+    // Index the bodies of system lit by the star light at time now
+    void build(const PlanetarySystem* system,
+               const Star* light,
+               double now);
+
+    bool matches(const PlanetarySystem* system,
+                 const Star* light,
+                 double now) const;
+
+    // Replace casters with the bodies other than the receiver that may
+    // shadow it, in system order. Positions are astrocentric, in km. The test is conservative; the caller
+    // still has to test each caster. lightApparentSize is the angular
+    // radius of the light seen from the receiver.
+    void findCasters(const Body* receiver,
+                     const Eigen::Vector3d& receiverPosition,
+                     double lightApparentSize,
+                     std::vector<const Body*>& casters) const;
+
+ private:
+    struct Caster
+    {
+        const Body* body;
+        Eigen::Vector3d position;
+        Eigen::Vector3d direction;  // unit vector from the light
+        double distance;            // distance from the light
+        double extent;              // radius including rings
+    };
+
+    struct SortEntry
+    {
+        double key;                 // direction projected on the sort axis
+        int caster;
+    };
+
+    const PlanetarySystem* system{ nullptr };
+    const Star* light{ nullptr };
+    double time{ 0.0 };
+    Eigen::Vector3d lightPosition{ Eigen::Vector3d::Zero() };
+    Eigen::Vector3d sortAxis{ Eigen::Vector3d::UnitX() };
+    double maxExtent{ 0.0 };
+    double minDistance{ 0.0 };
+    Eigen::Vector3d center{ Eigen::Vector3d::Zero() };  // bounding sphere of the casters
+    double radius{ 0.0 };
+    std::vector<Caster> casters;    // in system order
+    std::vector<SortEntry> sorted;  // sorted by key
+    mutable std::vector<int> matchIndices;
+};
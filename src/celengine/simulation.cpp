@@ -118,6 +118,16 @@ void Simulation::update(double dt)
         observer->update(dt, timeScale);
     }
 
+    // Swap in the octrees of stars and DSOs added at run time which were
+    // finished in the background, and move the stars with proper motions
+    if (universe->getStarCatalog() != nullptr)
+    {
+        universe->getStarCatalog()->update();
+        universe->getStarCatalog()->setTime(getTime());
+    }
+    if (universe->getDSOCatalog() != nullptr)
+        universe->getDSOCatalog()->update();
+
     // Find the closest solar system
     closestSolarSystem = universe->getNearestSolarSystem(activeObserver->getPosition());
 }
@@ -16,6 +16,7 @@
 #include <celmath/mathlib.h>
 #include <celutil/debug.h>
 #include <celutil/gettext.h>
+#include <celutil/profiler.h>
 #include "astro.h"
 #include "parser.h"
 #include "tokenizer.h"
@@ -1080,6 +1081,8 @@ bool LoadSolarSystemObjects(istream& in,
                             Universe& universe,
                             const fs::path& directory)
 {
+    CEL_PROFILE_ZONE("LoadSolarSystemObjects");
+
     Tokenizer tokenizer(&in);
     Parser parser(&tokenizer);
 
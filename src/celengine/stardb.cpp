@@ -18,11 +18,14 @@
 #include <celutil/bytes.h>
 #include <celutil/debug.h>
 #include <celutil/gettext.h>
+#include <celutil/profiler.h>
+#include <celutil/workerpool.h>
 #include "stardb.h"
 #include "astro.h"
 #include "parser.h"
 #include "parseobject.h"
 #include "multitexture.h"
+#include "octreebuilder.h"
 #include "meshmanager.h"
 #include "tokenizer.h"
 
@@ -48,8 +51,27 @@ constexpr const char SAOCatalogPrefix[]       = "SAO ";
 constexpr const float STAR_OCTREE_ROOT_SIZE   = 1000000000.0f;
 
 constexpr const float STAR_OCTREE_MAGNITUDE   = 6.0f;
+
+// Stars added after loading are tested one by one by the queries until
+// there are more than this many of them, then they're sorted into an octree.
+constexpr const size_t STAR_OVERLAY_MERGE_THRESHOLD = 4096;
 //constexpr const float STAR_EXTRA_ROOM        = 0.01f; // Reserve 1% capacity for extra stars
 
+static Vector3f getStarOctreeCenter()
+{
+    return Vector3f(1000.0f, 1000.0f, 1000.0f);
+}
+
+static float getStarOctreeExclusionFactor()
+{
+    return astro::appToAbsMag(STAR_OCTREE_MAGNITUDE, STAR_OCTREE_ROOT_SIZE * (float) sqrt(3.0));
+}
+
+// Stars are moved in blocks of this size, and on a single thread below
+// this number of stars
+constexpr const size_t STAR_MOTION_BLOCK_SIZE = 64;
+constexpr const size_t STAR_MOTION_MIN_CHUNK_SIZE = 16384;
+
 constexpr const char FILE_HEADER[]            = "CELSTARS";
 constexpr const char CROSSINDEX_FILE_HEADER[] = "CELINDEX";
 
@@ -179,7 +201,8 @@ bool StarDatabase::CrossIndexEntry::operator<(const StarDatabase::CrossIndexEntr
 }
 
 
-StarDatabase::StarDatabase()
+StarDatabase::StarDatabase() :
+    positionTime(astro::J2000)
 {
     crossIndexes.resize(MaxCatalog);
 }
@@ -206,9 +229,19 @@ Star* StarDatabase::find(AstroCatalog::IndexNumber catalogNumber) const
                                 PtrCatalogNumberOrderingPredicate());
 
     if (star != catalogNumberIndex + nStars && (*star)->getIndex() == catalogNumber)
-        return *star;
-    else
-        return nullptr;
+    {
+        if (removedStars.empty() || removedStars.find(*star) == removedStars.end())
+            return *star;
+    }
+
+    if (!addedStarIndex.empty())
+    {
+        auto iter = addedStarIndex.find(catalogNumber);
+        if (iter != addedStarIndex.end())
+            return iter->second;
+    }
+
+    return nullptr;
 }
 
 
@@ -491,16 +524,13 @@ string StarDatabase::getStarNameList(const Star& star, const unsigned int maxNam
 }
 
 
-void StarDatabase::findVisibleStars(StarHandler& starHandler,
-                                    const Vector3f& position,
-                                    const Quaternionf& orientation,
-                                    float fovY,
-                                    float aspectRatio,
-                                    float limitingMag,
-                                    OctreeProcStats *stats) const
+// Compute the bounding planes of an infinite view frustum
+static void computeFrustumPlanes(Hyperplane<float, 3>* frustumPlanes,
+                                 const Vector3f& position,
+                                 const Quaternionf& orientation,
+                                 float fovY,
+                                 float aspectRatio)
 {
-    // Compute the bounding planes of an infinite view frustum
-    Hyperplane<float, 3> frustumPlanes[5];
     Vector3f planeNormals[5];
     Eigen::Matrix3f rot = orientation.toRotationMatrix();
     float h = (float) tan(fovY / 2);
@@ -515,13 +545,126 @@ void StarDatabase::findVisibleStars(StarHandler& starHandler,
         planeNormals[i] = rot.transpose() * planeNormals[i].normalized();
         frustumPlanes[i] = Hyperplane<float, 3>(planeNormals[i], position);
     }
+}
+
+
+namespace
+{
+// Passes on the stars which weren't removed from the database
+class RemovedStarFilter : public StarHandler
+{
+ public:
+    RemovedStarFilter(StarHandler& _handler, const set<const Star*>& _removed) :
+        handler(_handler),
+        removed(_removed)
+    {
+    }
+
+    void process(const Star& star, float distance, float appMag) override
+    {
+        if (removed.find(&star) == removed.end())
+            handler.process(star, distance, appMag);
+    }
+
+ private:
+    StarHandler& handler;
+    const set<const Star*>& removed;
+};
+
+// Passes on the added stars of the database in place of their copies in
+// the overlay, which carry the position of the star in addedStars as index.
+class AddedStarHandler : public StarHandler
+{
+ public:
+    AddedStarHandler(StarHandler& _handler,
+                     const BlockArray<Star>& _stars,
+                     const set<const Star*>& _removed) :
+        handler(_handler),
+        stars(_stars),
+        removed(_removed)
+    {
+    }
+
+    void process(const Star& star, float distance, float appMag) override
+    {
+        const Star& added = stars[star.getIndex()];
+        if (removed.empty() || removed.find(&added) == removed.end())
+            handler.process(added, distance, appMag);
+    }
 
-    octreeRoot->processVisibleObjects(starHandler,
+ private:
+    StarHandler& handler;
+    const BlockArray<Star>& stars;
+    const set<const Star*>& removed;
+};
+}
+
+
+void StarDatabase::findVisibleStars(StarHandler& starHandler,
+                                    const Vector3f& position,
+                                    const Quaternionf& orientation,
+                                    float fovY,
+                                    float aspectRatio,
+                                    float limitingMag,
+                                    OctreeProcStats *stats) const
+{
+    Hyperplane<float, 3> frustumPlanes[5];
+    computeFrustumPlanes(frustumPlanes, position, orientation, fovY, aspectRatio);
+
+    RemovedStarFilter filter(starHandler, removedStars);
+    octreeRoot->processVisibleObjects(removedStars.empty() ? starHandler : filter,
                                       position,
                                       frustumPlanes,
                                       limitingMag,
                                       STAR_OCTREE_ROOT_SIZE,
                                       stats);
+
+    processAddedStars(starHandler, [&](const StarOctree& node, StarHandler& handler)
+    {
+        node.processVisibleObjects(handler,
+                                   position,
+                                   frustumPlanes,
+                                   limitingMag,
+                                   STAR_OCTREE_ROOT_SIZE,
+                                   stats);
+    });
+}
+
+
+void StarDatabase::findVisibleStars(StarHandler& starHandler,
+                                    StarAggregateHandler& aggregateHandler,
+                                    const Vector3f& position,
+                                    const Quaternionf& orientation,
+                                    float fovY,
+                                    float aspectRatio,
+                                    float limitingMag,
+                                    float minNodeSize,
+                                    OctreeProcStats *stats) const
+{
+    Hyperplane<float, 3> frustumPlanes[5];
+    computeFrustumPlanes(frustumPlanes, position, orientation, fovY, aspectRatio);
+
+    RemovedStarFilter filter(starHandler, removedStars);
+    octreeRoot->processVisibleObjects(removedStars.empty() ? starHandler : filter,
+                                      aggregateHandler,
+                                      position,
+                                      frustumPlanes,
+                                      limitingMag,
+                                      STAR_OCTREE_ROOT_SIZE,
+                                      minNodeSize,
+                                      stats);
+
+    processAddedStars(starHandler, [&](const StarOctree& node, StarHandler& handler)
+    {
+        node.processVisibleObjects(handler,
+                                   aggregateHandler,
+                                   position,
+                                   frustumPlanes,
+                                   limitingMag,
+                                   STAR_OCTREE_ROOT_SIZE,
+                                   minNodeSize,
+                                   stats);
+    });
 }
 
 
@@ -529,10 +672,125 @@ void StarDatabase::findCloseStars(StarHandler& starHandler,
                                   const Vector3f& position,
                                   float radius) const
 {
-    octreeRoot->processCloseObjects(starHandler,
+    RemovedStarFilter filter(starHandler, removedStars);
+    octreeRoot->processCloseObjects(removedStars.empty() ? starHandler : filter,
                                     position,
                                     radius,
                                     STAR_OCTREE_ROOT_SIZE);
+
+    processAddedStars(starHandler, [&](const StarOctree& node, StarHandler& handler)
+    {
+        node.processCloseObjects(handler, position, radius, STAR_OCTREE_ROOT_SIZE);
+    });
+}
+
+
+void StarDatabase::findStarsInCone(StarHandler& starHandler,
+                                   const Vector3f& position,
+                                   const Vector3f& direction,
+                                   float maxAngle,
+                                   float maxDistance,
+                                   float limitingMag) const
+{
+    RemovedStarFilter filter(starHandler, removedStars);
+    octreeRoot->processObjectsInCone(removedStars.empty() ? starHandler : filter,
+                                     position,
+                                     direction,
+                                     maxAngle,
+                                     maxDistance,
+                                     limitingMag,
+                                     STAR_OCTREE_ROOT_SIZE);
+
+    processAddedStars(starHandler, [&](const StarOctree& node, StarHandler& handler)
+    {
+        node.processObjectsInCone(handler,
+                                  position,
+                                  direction,
+                                  maxAngle,
+                                  maxDistance,
+                                  limitingMag,
+                                  STAR_OCTREE_ROOT_SIZE);
+    });
+}
+
+
+void StarDatabase::processAddedStars(StarHandler& starHandler,
+                                     const std::function<void(const StarOctree&, StarHandler&)>& query) const
+{
+    if (starOverlay == nullptr)
+        return;
+
+    AddedStarHandler handler(starHandler, addedStars, removedStars);
+    starOverlay->process([&](const StarOctree& node) { query(node, handler); });
+}
+
+
+Star* StarDatabase::addStar(const Star& star, const string& names)
+{
+    Star newStar = star;
+    AstroCatalog::IndexNumber catalogNumber = star.getIndex();
+    if (catalogNumber == AstroCatalog::InvalidIndex)
+    {
+        while (find(nextAutoCatalogNumber) != nullptr)
+            nextAutoCatalogNumber--;
+        catalogNumber = nextAutoCatalogNumber--;
+        newStar.setIndex(catalogNumber);
+    }
+    else if (find(catalogNumber) != nullptr)
+    {
+        return nullptr;
+    }
+
+    addedStars.add(newStar);
+    int index = (int) addedStars.size() - 1;
+    Star* addedStar = &addedStars[index];
+    addedStarIndex[catalogNumber] = addedStar;
+    if (namesDB != nullptr && !names.empty())
+        namesDB->addNames(catalogNumber, names);
+
+    if (starOverlay == nullptr)
+    {
+        starOverlay.reset(new OctreeOverlay<Star, float>(getStarOctreeCenter(),
+                                                         STAR_OCTREE_ROOT_SIZE,
+                                                         getStarOctreeExclusionFactor(),
+                                                         STAR_OVERLAY_MERGE_THRESHOLD,
+                                                         [](StarOctree* root) { root->computeNodeData(); }));
+    }
+    newStar.setIndex(index);
+    starOverlay->add(newStar);
+
+    return addedStar;
+}
+
+
+bool StarDatabase::removeStar(AstroCatalog::IndexNumber catalogNumber)
+{
+    Star* star = find(catalogNumber);
+    if (star == nullptr)
+        return false;
+
+    removedStars.insert(star);
+    addedStarIndex.erase(catalogNumber);
+    return true;
+}
+
+
+void StarDatabase::update(bool waitForMerge)
+{
+    if (starOverlay == nullptr)
+        return;
+
+    starOverlay->update([this](const Star& star)
+                        {
+                            return removedStars.find(&addedStars[star.getIndex()]) != removedStars.end();
+                        },
+                        waitForMerge);
+}
+
+
+size_t StarDatabase::getUnmergedStarCount() const
+{
+    return starOverlay != nullptr ? starOverlay->unmergedSize() : 0;
 }
 
 
@@ -617,6 +875,8 @@ bool StarDatabase::loadCrossIndex(const Catalog catalog, istream& in)
 
 bool StarDatabase::loadBinary(istream& in)
 {
+    CEL_PROFILE_ZONE("StarDatabase::loadBinary");
+
     uint32_t nStarsInFile = 0;
 
     // Verify that the star database file has a correct header
@@ -720,9 +980,12 @@ bool StarDatabase::loadBinary(istream& in)
 
 void StarDatabase::finish()
 {
+    CEL_PROFILE_ZONE("StarDatabase::finish");
+
     fmt::fprintf(clog, _("Total star count: %d\n"), nStars);
 
     buildOctree();
+    octreeRoot->computeNodeData();
     buildIndexes();
 
     // Delete the temporary indices used only during loading
@@ -747,10 +1010,127 @@ void StarDatabase::finish()
         }
     }
 
+    buildMotionData();
     barycenters.clear();
 }
 
 
+void StarDatabase::buildMotionData()
+{
+    if (stcFileVelocities.empty())
+        return;
+
+    // Stars in orbits are placed at their barycenter, and move with it
+    for (const auto& b : barycenters)
+    {
+        auto iter = stcFileVelocities.find(b.barycenterCatNo);
+        if (iter != stcFileVelocities.end() && stcFileVelocities.count(b.catNo) == 0)
+            stcFileVelocities[b.catNo] = iter->second;
+    }
+
+    vector<pair<uint32_t, Vector3f>> velocities;
+    for (const auto& v : stcFileVelocities)
+    {
+        Star* star = find(v.first);
+        if (star != nullptr && v.second != Vector3f::Zero())
+            velocities.push_back(make_pair((uint32_t) (star - stars), v.second));
+    }
+    stcFileVelocities.clear();
+
+    sort(velocities.begin(), velocities.end(),
+         [](const pair<uint32_t, Vector3f>& a, const pair<uint32_t, Vector3f>& b) { return a.first < b.first; });
+
+    MotionData& data = motionData;
+    vector<float> speeds(nStars, 0.0f);
+    for (const auto& v : velocities)
+    {
+        Vector3f pos = stars[v.first].getPosition();
+        data.index.push_back(v.first);
+        data.x.push_back(pos.x());
+        data.y.push_back(pos.y());
+        data.z.push_back(pos.z());
+        data.vx.push_back(v.second.x());
+        data.vy.push_back(v.second.y());
+        data.vz.push_back(v.second.z());
+        speeds[v.first] = v.second.norm();
+    }
+
+    octreeRoot->computeMaxSpeeds(stars, speeds.data());
+    fmt::fprintf(clog, _("%d stars with proper motions\n"), (int) data.index.size());
+}
+
+
+void StarDatabase::setTime(double tdb)
+{
+    const MotionData& data = motionData;
+    if (data.index.empty() || tdb == positionTime)
+        return;
+    positionTime = tdb;
+
+    float years = (float) ((tdb - astro::J2000) / DAYS_PER_YEAR);
+    GetWorkerPool()->parallelFor(data.index.size(), STAR_MOTION_MIN_CHUNK_SIZE, [&](size_t begin, size_t end)
+    {
+        constexpr const size_t BlockSize = STAR_MOTION_BLOCK_SIZE;
+        float x[BlockSize];
+        float y[BlockSize];
+        float z[BlockSize];
+
+        for (size_t blockStart = begin; blockStart < end; blockStart += BlockSize)
+        {
+            size_t n = min(BlockSize, end - blockStart);
+            const float* x0 = &data.x[blockStart];
+            const float* y0 = &data.y[blockStart];
+            const float* z0 = &data.z[blockStart];
+            const float* vx = &data.vx[blockStart];
+            const float* vy = &data.vy[blockStart];
+            const float* vz = &data.vz[blockStart];
+
+            for (size_t i = 0; i < n; i++)
+            {
+                x[i] = x0[i] + vx[i] * years;
+                y[i] = y0[i] + vy[i] * years;
+                z[i] = z0[i] + vz[i] * years;
+            }
+
+            const uint32_t* index = &data.index[blockStart];
+            for (size_t i = 0; i < n; i++)
+                stars[index[i]].setPosition(x[i], y[i], z[i]);
+        }
+    });
+
+    octreeRoot->setMotionTime(years);
+    octreeRoot->updateNodeData(years, STAR_OCTREE_ROOT_SIZE, false);
+}
+
+
+size_t StarDatabase::getMovingStarCount() const
+{
+    return motionData.index.size();
+}
+
+
+// Velocity in light years per year of a star at right ascension ra (hours),
+// declination dec (degrees) and distance (light years), given its proper
+// motion in milliarcseconds per year, in right ascension multiplied by
+// cos(dec) as in the Hipparcos and Gaia catalogs, and its radial velocity
+// in km/s. The motion over a year is small enough to take the difference
+// of the positions at its start and end.
+static Vector3f computeStarVelocity(double ra, double dec, double distance,
+                                    double pmRA, double pmDec, double radialVelocity)
+{
+    constexpr const double DegreesPerMas = 1.0 / 3600000.0;
+
+    double cosDec = cos(degToRad(dec));
+    double dRA = cosDec > 1.0e-9 ? pmRA * DegreesPerMas / cosDec / DEG_PER_HRA : 0.0;
+    double dDec = pmDec * DegreesPerMas;
+    double dDistance = astro::kilometersToLightYears(radialVelocity * DAYS_PER_YEAR * SECONDS_PER_DAY);
+
+    Vector3d start = astro::equatorialToCelestialCart(ra, dec, distance);
+    Vector3d end = astro::equatorialToCelestialCart(ra + dRA, dec + dDec, distance + dDistance);
+    return (end - start).cast<float>();
+}
+
+
 static void stcError(const Tokenizer& tok,
                      const string& msg)
 {
@@ -1078,6 +1458,22 @@ bool StarDatabase::createStar(Star* star,
             Vector3d pos = astro::equatorialToCelestialCart((double) raf, (double) decf, (double) distancef);
             star->setPosition(pos.cast<float>());
         }
+
+        double pmRA = 0.0;
+        double pmDec = 0.0;
+        double radialVelocity = 0.0;
+        bool hasMotion = starData->getNumber("ProperMotionRA", pmRA);
+        hasMotion |= starData->getNumber("ProperMotionDec", pmDec);
+        hasMotion |= starData->getNumber("RadialVelocity", radialVelocity);
+        if (hasMotion)
+        {
+            stcFileVelocities[star->getIndex()] = computeStarVelocity(ra, dec, distance,
+                                                                       pmRA, pmDec, radialVelocity);
+        }
+        else if (disposition != DataDisposition::Modify)
+        {
+            stcFileVelocities.erase(star->getIndex());
+        }
     }
 
     if (isBarycenter)
@@ -1161,6 +1557,8 @@ bool StarDatabase::createStar(Star* star,
  */
 bool StarDatabase::load(istream& in, const fs::path& resourcePath)
 {
+    CEL_PROFILE_ZONE("StarDatabase::load");
+
     Tokenizer tokenizer(&in);
     Parser parser(&tokenizer);
 
@@ -1339,26 +1737,7 @@ bool StarDatabase::load(istream& in, const fs::path& resourcePath)
                 // List of namesDB will replace any that already exist for
                 // this star.
                 namesDB->erase(catalogNumber);
-
-                // Iterate through the string for names delimited
-                // by ':', and insert them into the star database.
-                // Note that db->add() will skip empty namesDB.
-                string::size_type startPos = 0;
-                while (startPos != string::npos)
-                {
-                    string::size_type next    = objName.find(':', startPos);
-                    string::size_type length = string::npos;
-                    if (next != string::npos)
-                    {
-                        length = next - startPos;
-                        ++next;
-                    }
-                    string starName = objName.substr(startPos, length);
-                    namesDB->add(catalogNumber, starName);
-                    if (starName != _(starName.c_str()))
-                        namesDB->add(catalogNumber, _(starName.c_str()));
-                    startPos = next;
-                }
+                namesDB->addNames(catalogNumber, objName);
             }
         }
         else
@@ -1379,22 +1758,17 @@ void StarDatabase::buildOctree()
     // ASSERT(octreeRoot == nullptr);
 
     DPRINTF(LOG_LEVEL_INFO, "Sorting stars into octree . . .\n");
-    float absMag = astro::appToAbsMag(STAR_OCTREE_MAGNITUDE,
-                                      STAR_OCTREE_ROOT_SIZE * (float) sqrt(3.0));
-    DynamicStarOctree* root = new DynamicStarOctree(Vector3f(1000.0f, 1000.0f, 1000.0f),
-                                                    absMag);
-    for (unsigned int i = 0; i < unsortedStars.size(); ++i)
-    {
-        root->insertObject(unsortedStars[i], STAR_OCTREE_ROOT_SIZE);
-    }
-
-    DPRINTF(LOG_LEVEL_INFO, "Spatially sorting stars for improved locality of reference . . .\n");
-    Star* sortedStars    = new Star[nStars];
-    Star* firstStar      = sortedStars;
-    root->rebuildAndSort(octreeRoot, firstStar);
-
-    // ASSERT((int) (firstStar - sortedStars) == nStars);
-    DPRINTF(LOG_LEVEL_INFO, "%d stars total\n", (int) (firstStar - sortedStars));
+    // The stars are spatially sorted for improved locality of reference
+    // while the octree is built.
+    Star* sortedStars = new Star[nStars];
+    octreeRoot = OctreeBuilder<Star, float>::build(unsortedStars,
+                                                   unsortedStars.size(),
+                                                   sortedStars,
+                                                   getStarOctreeCenter(),
+                                                   STAR_OCTREE_ROOT_SIZE,
+                                                   getStarOctreeExclusionFactor());
+
+    DPRINTF(LOG_LEVEL_INFO, "%d stars total\n", (int) unsortedStars.size());
     DPRINTF(LOG_LEVEL_INFO, "Octree has %d nodes and %d stars.\n",
             1 + octreeRoot->countChildren(), octreeRoot->countObjects());
 #ifdef PROFILE_OCTREE
@@ -1416,7 +1790,6 @@ void StarDatabase::buildOctree()
     // Clean up . . .
     //delete[] stars;
     unsortedStars.clear();
-    delete root;
 
     stars = sortedStars;
 }
@@ -12,13 +12,16 @@
 #define _CELENGINE_STARDB_H_
 
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <map>
+#include <set>
 #include <celutil/blockarray.h>
 #include <celengine/constellation.h>
 #include <celengine/starname.h>
 #include <celengine/star.h>
 #include <celengine/staroctree.h>
+#include <celengine/octreeoverlay.h>
 #include <celengine/parseobject.h>
 
 
@@ -49,10 +52,33 @@ class StarDatabase
                           float limitingMag,
                           OctreeProcStats * = nullptr) const;
 
+    // Level of detail version of findVisibleStars: the stars of octree nodes
+    // appearing smaller than minNodeSize radians are passed together to the
+    // aggregateHandler instead of one by one to the starHandler.
+    void findVisibleStars(StarHandler& starHandler,
+                          StarAggregateHandler& aggregateHandler,
+                          const Eigen::Vector3f& obsPosition,
+                          const Eigen::Quaternionf&   obsOrientation,
+                          float fovY,
+                          float aspectRatio,
+                          float limitingMag,
+                          float minNodeSize,
+                          OctreeProcStats * = nullptr) const;
+
     void findCloseStars(StarHandler& starHandler,
                         const Eigen::Vector3f& obsPosition,
                         float radius) const;
 
+    // Stars within maxDistance of obsPosition, within maxAngle radians of
+    // the unit vector direction and brighter than limitingMag as seen from
+    // obsPosition. Pass a maxAngle of PI to search in all directions.
+    void findStarsInCone(StarHandler& starHandler,
+                         const Eigen::Vector3f& obsPosition,
+                         const Eigen::Vector3f& direction,
+                         float maxAngle,
+                         float maxDistance,
+                         float limitingMag) const;
+
     std::string getStarName    (const Star&, bool i18n = false) const;
     void getStarName(const Star& star, char* nameBuffer, unsigned int bufferSize, bool i18n = false) const;
     std::string getStarNameList(const Star&, const unsigned int maxNames = MAX_STAR_NAMES) const;
@@ -92,6 +118,34 @@ class StarDatabase
 
     void finish();
 
+    // Add a copy of star to the finished database. A star without a catalog
+    // number gets the next automatic one. Returns the star of the database,
+    // which stays valid as long as the database does, or nullptr if the
+    // catalog number is in use. The star is found by the queries right away
+    // and is sorted into an octree of added stars in the background later.
+    // Names delimited by ':' are added to the name database.
+    Star* addStar(const Star& star, const std::string& names = std::string());
+
+    // Hide a star from find() and the queries. The star isn't freed before
+    // the database, as selections and orbits may still refer to it.
+    bool removeStar(AstroCatalog::IndexNumber catalogNumber);
+
+    // Swap in finished octrees of added stars and start building new ones;
+    // meant to be called once per frame. With waitForMerge set, a running
+    // merge is waited for first.
+    void update(bool waitForMerge = false);
+
+    // Number of added stars which the queries test one by one
+    size_t getUnmergedStarCount() const;
+
+    // Move the stars with proper motions and radial velocities from their
+    // catalog positions at J2000 to their positions at the TDB Julian date
+    // tdb, assuming uniform motion.
+    void setTime(double tdb);
+
+    // Number of stars with a velocity
+    size_t getMovingStarCount() const;
+
     static StarDatabase* read(std::istream&);
 
 private:
@@ -105,6 +159,9 @@ private:
     void buildOctree();
     void buildIndexes();
     Star* findWhileLoading(AstroCatalog::IndexNumber catalogNumber) const;
+    void buildMotionData();
+    void processAddedStars(StarHandler& starHandler,
+                           const std::function<void(const StarOctree&, StarHandler&)>& query) const;
 
     int nStars{ 0 };
 
@@ -125,12 +182,39 @@ private:
     // Catalog number -> star mapping for stars loaded from stc files
     std::map<AstroCatalog::IndexNumber, Star*> stcFileCatalogNumberIndex;
 
+    // Velocities of the stars with proper motions, in light years per year
+    std::map<AstroCatalog::IndexNumber, Eigen::Vector3f> stcFileVelocities;
+
     struct BarycenterUsage
     {
         AstroCatalog::IndexNumber catNo;
         AstroCatalog::IndexNumber barycenterCatNo;
     };
     std::vector<BarycenterUsage> barycenters;
+
+    // The stars with velocities in the order of the stars array, with their
+    // positions at J2000 and velocities stored as separate arrays so that
+    // they can be propagated in blocks of vectorized arithmetic.
+    struct MotionData
+    {
+        std::vector<uint32_t> index;
+        std::vector<float>    x;
+        std::vector<float>    y;
+        std::vector<float>    z;
+        std::vector<float>    vx;
+        std::vector<float>    vy;
+        std::vector<float>    vz;
+    } motionData;
+    // TDB Julian date of the current star positions
+    double positionTime;
+
+    // Stars added after loading. The overlay holds copies of them whose
+    // index is the position of the star in addedStars rather than its
+    // catalog number.
+    BlockArray<Star> addedStars;
+    std::map<AstroCatalog::IndexNumber, Star*> addedStarIndex;
+    std::unique_ptr<OctreeOverlay<Star, float>> starOverlay;
+    std::set<const Star*> removedStars;
 };
 
 
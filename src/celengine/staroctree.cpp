@@ -56,6 +56,12 @@ float starAbsoluteMagnitudeDecayFunction(const float excludingFactor)
 }
 
 
+Vector3f starPosition(const Star& star)
+{
+    return star.getPosition();
+}
+
+
 template<>
 DynamicStarOctree* DynamicStarOctree::getChild(const Star&          obj,
                                                const Vector3f& cellCenterPos)
@@ -81,6 +87,8 @@ template<> DynamicStarOctree::StraddlingPredicate*
            DynamicStarOctree::straddlingPredicate = starOrbitStraddlesNodesPredicate;
 template<> DynamicStarOctree::ExclusionFactorDecayFunction*
            DynamicStarOctree::decayFunction = starAbsoluteMagnitudeDecayFunction;
+template<> DynamicStarOctree::ObjectPositionFunction*
+           DynamicStarOctree::positionFunction = starPosition;
 
 
 // total specialization of the StaticOctree template process*() methods for stars:
@@ -107,14 +115,15 @@ void StarOctree::processVisibleObjects(StarHandler&    processor,
     for (unsigned int i = 0; i < 5; ++i)
     {
         const Hyperplane<float, 3>& plane = frustumPlanes[i];
-        float r = scale * plane.normal().cwiseAbs().sum();
+        float r = scale * plane.normal().cwiseAbs().sum() + nodeData.motionRadius;
         if (plane.signedDistance(cellCenterPos) < -r)
             return;
     }
 
     // Compute the distance to node; this is equal to the distance to
-    // the cellCenterPos of the node minus the boundingRadius of the node, scale * SQRT3.
-    float minDistance = (obsPosition - cellCenterPos).norm() - scale * StarOctree::SQRT3;
+    // the cellCenterPos of the node minus the boundingRadius of the node, scale * SQRT3,
+    // and the distance its stars may have moved.
+    float minDistance = (obsPosition - cellCenterPos).norm() - scale * StarOctree::SQRT3 - nodeData.motionRadius;
 
     // Process the objects in this node
     float dimmest     = minDistance > 0 ? astro::appToAbsMag(limitingFactor, minDistance) : 1000;
@@ -167,6 +176,250 @@ void StarOctree::processVisibleObjects(StarHandler&    processor,
 }
 
 
+template<>
+void StarOctree::processVisibleObjects(StarHandler&          processor,
+                                       StarAggregateHandler& aggregateProcessor,
+                                       const Vector3f&       obsPosition,
+                                       const Hyperplane<float, 3>* frustumPlanes,
+                                       float                 limitingFactor,
+                                       float                 scale,
+                                       float                 minNodeSize,
+                                       OctreeProcStats       *stats) const
+{
+#ifdef OCTREE_DEBUG
+    size_t h;
+    if (stats != nullptr)
+    {
+        h = stats->height + 1;
+        stats->nodes++;
+    }
+#endif
+    // See if this node lies within the view frustum
+    for (unsigned int i = 0; i < 5; ++i)
+    {
+        const Hyperplane<float, 3>& plane = frustumPlanes[i];
+        float r = scale * plane.normal().cwiseAbs().sum() + nodeData.motionRadius;
+        if (plane.signedDistance(cellCenterPos) < -r)
+            return;
+    }
+
+    float boundingRadius = scale * StarOctree::SQRT3 + nodeData.motionRadius;
+    float minDistance = (obsPosition - cellCenterPos).norm() - boundingRadius;
+
+    // The objects of the node itself are the brightest ones and are always
+    // processed individually.
+    float dimmest     = minDistance > 0 ? astro::appToAbsMag(limitingFactor, minDistance) : 1000;
+
+    for (unsigned int i = 0; i < nObjects; ++i)
+    {
+#ifdef OCTREE_DEBUG
+        if (stats != nullptr)
+            stats->objects++;
+#endif
+        const Star& obj = _firstObject[i];
+
+        if (obj.getAbsoluteMagnitude() < dimmest)
+        {
+            float distance    = (obsPosition - obj.getPosition()).norm();
+            float appMag      = astro::absToAppMag(obj.getAbsoluteMagnitude(), distance);
+
+            if (appMag < limitingFactor || (distance < MAX_STAR_ORBIT_RADIUS && obj.getOrbit()))
+                processor.process(obj, distance, appMag);
+        }
+    }
+
+    if (_children == nullptr)
+        return;
+    if (minDistance > 0 && astro::absToAppMag(exclusionFactor, minDistance) > limitingFactor)
+        return;
+
+    // When the whole node covers less than minNodeSize, the stars of the
+    // child nodes are merged into a single point of their total brightness.
+    if (minDistance > 0 && 2.0f * boundingRadius < minNodeSize * (minDistance + boundingRadius))
+    {
+        if (nodeData.luminosity > 0.0f)
+        {
+            float distance = (obsPosition - nodeData.centroid).norm();
+            float appMag   = astro::absToAppMag(astro::lumToAbsMag(nodeData.luminosity), distance);
+            if (appMag < limitingFactor)
+                aggregateProcessor.processAggregate(nodeData, distance, appMag);
+        }
+        return;
+    }
+
+    for (int i = 0; i < 8; ++i)
+    {
+        _children[i]->processVisibleObjects(processor,
+                                            aggregateProcessor,
+                                            obsPosition,
+                                            frustumPlanes,
+                                            limitingFactor,
+                                            scale * 0.5f,
+                                            minNodeSize,
+                                            stats);
+#ifdef OCTREE_DEBUG
+        if (stats != nullptr && stats->height > h)
+            h = stats->height;
+#endif
+    }
+#ifdef OCTREE_DEBUG
+    if (stats != nullptr)
+        stats->height = h;
+#endif
+}
+
+
+namespace
+{
+// Sums are kept in double precision, as positions of distant stars
+// weighted by the luminosities of thousands of stars exceed the precision
+// of a float.
+struct StarNodeSums
+{
+    Vector3d weightedPosition { Vector3d::Zero() };
+    double luminosity { 0.0 };
+    double weightedTemperature { 0.0 };
+    unsigned int nStars { 0 };
+
+    void add(const StarNodeData& data)
+    {
+        weightedPosition += data.centroid.cast<double>() * data.luminosity;
+        luminosity += data.luminosity;
+        weightedTemperature += (double) data.temperature * data.luminosity;
+        nStars += data.nStars;
+    }
+
+    void add(const Star& star)
+    {
+        double lum = star.getLuminosity();
+        weightedPosition += star.getPosition().cast<double>() * lum;
+        luminosity += lum;
+        weightedTemperature += (double) star.getTemperature() * lum;
+        nStars++;
+    }
+
+    StarNodeData get() const
+    {
+        StarNodeData data;
+        data.nStars = nStars;
+        if (luminosity > 0.0)
+        {
+            data.centroid = (weightedPosition / luminosity).cast<float>();
+            data.luminosity = (float) luminosity;
+            data.temperature = (float) (weightedTemperature / luminosity);
+        }
+        return data;
+    }
+};
+}
+
+
+template<>
+StarNodeData StarOctree::computeNodeData()
+{
+    StarNodeSums sums;
+    if (_children != nullptr)
+    {
+        for (int i = 0; i < 8; ++i)
+            sums.add(_children[i]->computeNodeData());
+    }
+
+    // The motion bounds are set separately
+    StarNodeData data = sums.get();
+    data.maxSpeed = nodeData.maxSpeed;
+    data.motionRadius = nodeData.motionRadius;
+    data.summaryTime = nodeData.summaryTime;
+    nodeData = data;
+
+    for (unsigned int i = 0; i < nObjects; ++i)
+        sums.add(_firstObject[i]);
+
+    return sums.get();
+}
+
+
+template<>
+float StarOctree::computeMaxSpeeds(const Star* firstStar, const float* speeds)
+{
+    float maxSpeed = 0.0f;
+    for (unsigned int i = 0; i < nObjects; ++i)
+        maxSpeed = std::max(maxSpeed, speeds[_firstObject + i - firstStar]);
+
+    if (_children != nullptr)
+    {
+        for (int i = 0; i < 8; ++i)
+            maxSpeed = std::max(maxSpeed, _children[i]->computeMaxSpeeds(firstStar, speeds));
+    }
+
+    nodeData.maxSpeed = maxSpeed;
+    return maxSpeed;
+}
+
+
+template<>
+void StarOctree::setMotionTime(float time)
+{
+    nodeData.motionRadius = nodeData.maxSpeed * std::abs(time);
+
+    // Subtrees of stars at rest keep their bounds
+    if (_children != nullptr)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            if (_children[i]->nodeData.maxSpeed > 0.0f)
+                _children[i]->setMotionTime(time);
+        }
+    }
+}
+
+
+// Largest distance, relative to the node size, the stars of a node may have
+// moved since its summary was computed. The impostor of a node is smaller
+// than a few pixels, so its centroid is off by a fraction of a pixel.
+static const float MaxCentroidDrift = 0.05f;
+
+template<>
+StarNodeData StarOctree::updateNodeData(float time, float scale, bool totals)
+{
+    bool stale = nodeData.maxSpeed * std::abs(time - nodeData.summaryTime) > MaxCentroidDrift * scale;
+
+    // Only the subtrees with moving stars can change; the others are only
+    // visited for their totals when this node is summarized again.
+    StarNodeSums sums;
+    if (_children != nullptr)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            if (_children[i]->nodeData.maxSpeed > 0.0f || stale)
+            {
+                StarNodeData childTotals = _children[i]->updateNodeData(time, scale * 0.5f, stale);
+                if (stale)
+                    sums.add(childTotals);
+            }
+        }
+    }
+
+    if (stale)
+    {
+        StarNodeData data = sums.get();
+        data.maxSpeed = nodeData.maxSpeed;
+        data.motionRadius = nodeData.motionRadius;
+        data.summaryTime = time;
+        nodeData = data;
+    }
+
+    if (!totals)
+        return StarNodeData();
+
+    if (!stale)
+        sums.add(nodeData);
+    for (unsigned int i = 0; i < nObjects; ++i)
+        sums.add(_firstObject[i]);
+
+    return sums.get();
+}
+
+
 template<>
 void StarOctree::processCloseObjects(StarHandler&    processor,
                                      const Vector3f& obsPosition,
@@ -175,7 +428,7 @@ void StarOctree::processCloseObjects(StarHandler&    processor,
 {
     // Compute the distance to node; this is equal to the distance to
     // the cellCenterPos of the node minus the boundingRadius of the node, scale * SQRT3.
-    float nodeDistance    = (obsPosition - cellCenterPos).norm() - scale * StarOctree::SQRT3;
+    float nodeDistance    = (obsPosition - cellCenterPos).norm() - scale * StarOctree::SQRT3 - nodeData.motionRadius;
 
     if (nodeDistance > boundingRadius)
         return;
@@ -213,3 +466,58 @@ void StarOctree::processCloseObjects(StarHandler&    processor,
         }
     }
 }
+
+
+template<>
+void StarOctree::processObjectsInCone(StarHandler&    processor,
+                                      const Vector3f& obsPosition,
+                                      const Vector3f& direction,
+                                      float           maxAngle,
+                                      float           maxDistance,
+                                      float           limitingFactor,
+                                      float           scale) const
+{
+    float nodeRadius  = scale * StarOctree::SQRT3 + nodeData.motionRadius;
+    float minDistance = (obsPosition - cellCenterPos).norm() - nodeRadius;
+
+    if (minDistance > maxDistance ||
+        !sphereIntersectsCone(obsPosition, direction, maxAngle, cellCenterPos, nodeRadius))
+    {
+        return;
+    }
+
+    float dimmest  = minDistance > 0 ? astro::appToAbsMag(limitingFactor, minDistance) : 1000;
+    float cosAngle = maxAngle < (float) PI ? std::cos(maxAngle) : -1.0f;
+
+    for (unsigned int i = 0; i < nObjects; ++i)
+    {
+        const Star& obj = _firstObject[i];
+        if (obj.getAbsoluteMagnitude() >= dimmest)
+            continue;
+
+        Vector3f v = obj.getPosition() - obsPosition;
+        float distance = v.norm();
+        if (distance > maxDistance || v.dot(direction) < cosAngle * distance)
+            continue;
+
+        float appMag = astro::absToAppMag(obj.getAbsoluteMagnitude(), distance);
+        if (appMag < limitingFactor)
+            processor.process(obj, distance, appMag);
+    }
+
+    // Children only hold stars fainter than exclusionFactor
+    if (_children != nullptr &&
+        (minDistance <= 0 || astro::absToAppMag(exclusionFactor, minDistance) <= limitingFactor))
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            _children[i]->processObjectsInCone(processor,
+                                               obsPosition,
+                                               direction,
+                                               maxAngle,
+                                               maxDistance,
+                                               limitingFactor,
+                                               scale * 0.5f);
+        }
+    }
+}
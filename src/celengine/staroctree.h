@@ -17,8 +17,31 @@
 #include <celengine/octree.h>
 
 
+// Summary of the stars below a node, used to draw a single impostor point
+// for all of them when the node is too far away to resolve.
+template<> struct OctreeNodeData<Star>
+{
+    // Luminosity weighted mean position
+    Eigen::Vector3f centroid { Eigen::Vector3f::Zero() };
+    // Total luminosity, in solar units
+    float luminosity         { 0.0f };
+    // Luminosity weighted mean temperature
+    float temperature        { 0.0f };
+    unsigned int nStars      { 0 };
+    // Highest speed of the stars in the node and its children, in light
+    // years per year, and the distance covered at it since the epoch of
+    // the star positions the octree was built with
+    float maxSpeed           { 0.0f };
+    float motionRadius       { 0.0f };
+    // Time in years from that epoch the summary was computed for
+    float summaryTime        { 0.0f };
+};
+
+
 typedef DynamicOctree  <Star, float> DynamicStarOctree;
 typedef StaticOctree   <Star, float> StarOctree;
 typedef OctreeProcessor<Star, float> StarHandler;
+typedef OctreeAggregateProcessor<Star, float> StarAggregateHandler;
+typedef OctreeNodeData<Star> StarNodeData;
 
 #endif  // _CELENGINE_STAROCTREE_H_
@@ -35,16 +35,16 @@ TrajectoryManager* GetTrajectoryManager()
 
 fs::path TrajectoryInfo::resolve(const fs::path& baseDir)
 {
-    // Ensure that trajectories with different interpolation or precision get resolved to different objects by
+    // Ensure that trajectories with different interpolation, precision or tolerance get resolved to different objects by
     // adding a 'uniquifying' suffix to the filename that encodes the properties other than filename which can
     // distinguish two trajectories. This suffix is stripped before the file is actually loaded.
     fs::path::string_type uniquifyingSuffix, format;
 #ifdef _WIN32
-    format = L"%c%u%u";
+    format = L"%c%u%u%g";
 #else
-    format = "%c%u%u";
+    format = "%c%u%u%g";
 #endif
-    uniquifyingSuffix = fmt::sprintf(format, UniqueSuffixChar, (unsigned int) interpolation, (unsigned int) precision);
+    uniquifyingSuffix = fmt::sprintf(format, UniqueSuffixChar, (unsigned int) interpolation, (unsigned int) precision, tolerance);
 
     if (!path.empty())
     {
@@ -68,7 +68,11 @@ Orbit* TrajectoryInfo::load(const fs::path& filename)
 
     Orbit* sampTrajectory = nullptr;
 
-    if (filetype == Content_CelestiaXYZVTrajectory)
+    if (filetype == Content_CelestiaXYZVTrajectory && tolerance > 0.0)
+    {
+        sampTrajectory = LoadXYZVTrajectoryChebyshev(strippedFilename, tolerance);
+    }
+    else if (filetype == Content_CelestiaXYZVTrajectory)
     {
         switch (precision)
         {
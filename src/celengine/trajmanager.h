@@ -24,19 +24,21 @@ class TrajectoryInfo : public ResourceInfo<Orbit>
     fs::path path;
     TrajectoryInterpolation interpolation;
     TrajectoryPrecision precision;
+    double tolerance;   // km, fit Chebyshev polynomials to xyzv samples when > 0
 
     TrajectoryInfo(const std::string& _source,
                    const fs::path& _path = "",
                    TrajectoryInterpolation _interpolation = TrajectoryInterpolationCubic,
-                   TrajectoryPrecision _precision = TrajectoryPrecisionSingle) :
-        source(_source), path(_path), interpolation(_interpolation), precision(_precision) {};
+                   TrajectoryPrecision _precision = TrajectoryPrecisionSingle,
+                   double _tolerance = 0.0) :
+        source(_source), path(_path), interpolation(_interpolation), precision(_precision), tolerance(_tolerance) {};
 
     fs::path resolve(const fs::path&) override;
     Orbit* load(const fs::path&) override;
 };
 
 // Sort trajectory info records. The same trajectory can be loaded multiple times with
-// different attributes for precision and interpolation. How the ordering is defined isn't
+// different attributes for precision, interpolation and tolerance. How the ordering is defined isn't
 // as important making this operator distinguish between trajectories with either different
 // sources or different attributes.
 inline bool operator<(const TrajectoryInfo& ti0, const TrajectoryInfo& ti1)
@@ -45,6 +47,8 @@ inline bool operator<(const TrajectoryInfo& ti0, const TrajectoryInfo& ti1)
     {
         if (ti0.precision == ti1.precision)
         {
+            if (ti0.tolerance != ti1.tolerance)
+                return ti0.tolerance < ti1.tolerance;
             if (ti0.source == ti1.source)
                 return ti0.path < ti1.path;
             else
@@ -0,0 +1,206 @@
+// trianglebvh.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <limits>
+#include <celmodel/model.h>
+#include "trianglebvh.h"
+
+using namespace cmod;
+using namespace Eigen;
+using namespace std;
+
+namespace
+{
+constexpr uint32_t MaxLeafSize = 4;
+constexpr unsigned int MaxBuildDepth = 48;
+
+// Slab test of a ray against a box; tMax is the closest hit so far
+bool intersectBox(const AlignedBox3f& box,
+                  const Vector3d& origin,
+                  const Vector3d& invDirection,
+                  double tMax)
+{
+    double t0 = 0.0;
+    double t1 = tMax;
+    for (int i = 0; i < 3; i++)
+    {
+        double tNear = ((double) box.min()[i] - origin[i]) * invDirection[i];
+        double tFar = ((double) box.max()[i] - origin[i]) * invDirection[i];
+        if (tNear > tFar)
+            swap(tNear, tFar);
+        t0 = max(t0, tNear);
+        t1 = min(t1, tFar);
+        if (t0 > t1)
+            return false;
+    }
+    return true;
+}
+}
+
+
+TriangleBVH::TriangleBVH(const Model& model)
+{
+    for (unsigned int m = 0; m < model.getMeshCount(); m++)
+    {
+        const Mesh* mesh = model.getMesh(m);
+        if (!mesh->hasPositions())
+            continue;
+
+        auto position = [&](Mesh::index32 i)
+        {
+            return mesh->getPosition(i);
+        };
+
+        for (unsigned int g = 0; g < mesh->getGroupCount(); g++)
+        {
+            const Mesh::PrimitiveGroup* group = mesh->getGroup(g);
+            Mesh::index32 nIndices = group->nIndices;
+            Mesh::PrimitiveGroupType primType = group->prim;
+            if (nIndices < 3)
+                continue;
+
+            const Mesh::index32* indices = group->indices;
+            switch (primType)
+            {
+            case Mesh::TriList:
+                if (nIndices % 3 != 0)
+                    break;
+                for (Mesh::index32 i = 0; i < nIndices; i += 3)
+                    triangles.push_back({ position(indices[i]), position(indices[i + 1]), position(indices[i + 2]) });
+                break;
+            case Mesh::TriStrip:
+                for (Mesh::index32 i = 2; i < nIndices; i++)
+                    triangles.push_back({ position(indices[i - 2]), position(indices[i - 1]), position(indices[i]) });
+                break;
+            case Mesh::TriFan:
+                for (Mesh::index32 i = 2; i < nIndices; i++)
+                    triangles.push_back({ position(indices[0]), position(indices[i - 1]), position(indices[i]) });
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    if (!triangles.empty())
+    {
+        nodes.reserve(2 * triangles.size() / MaxLeafSize + 1);
+        build(0, (uint32_t) triangles.size(), 0);
+    }
+}
+
+
+uint32_t TriangleBVH::build(uint32_t first, uint32_t count, unsigned int depth)
+{
+    auto index = (uint32_t) nodes.size();
+    nodes.emplace_back();
+
+    AlignedBox3f bounds;
+    AlignedBox3f centroidBounds;
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        const Triangle& tri = triangles[i];
+        bounds.extend(tri.v0).extend(tri.v1).extend(tri.v2);
+        centroidBounds.extend(Vector3f((tri.v0 + tri.v1 + tri.v2) / 3.0f));
+    }
+
+    Node node;
+    node.bounds = bounds;
+    node.first = first;
+    node.count = count;
+
+    Vector3f extents = centroidBounds.sizes();
+    int axis;
+    float maxExtent = extents.maxCoeff(&axis);
+    if (count > MaxLeafSize && depth < MaxBuildDepth && maxExtent > 0.0f)
+    {
+        // Median split along the longest axis of the triangle centroids
+        auto begin = triangles.begin() + first;
+        auto mid = begin + count / 2;
+        nth_element(begin, mid, begin + count,
+                    [axis](const Triangle& a, const Triangle& b)
+                    { return a.v0[axis] + a.v1[axis] + a.v2[axis] < b.v0[axis] + b.v1[axis] + b.v2[axis]; });
+
+        uint32_t leftCount = count / 2;
+        build(first, leftCount, depth + 1);
+        node.first = build(first + leftCount, count - leftCount, depth + 1);
+        node.count = 0;
+    }
+
+    nodes[index] = node;
+    return index;
+}
+
+
+bool TriangleBVH::intersect(const Vector3d& origin,
+                            const Vector3d& direction,
+                            double& distance) const
+{
+    if (nodes.empty())
+        return false;
+
+    const double maxDistance = numeric_limits<double>::max();
+    double closest = maxDistance;
+    Vector3d invDirection = direction.cwiseInverse();
+
+    // The left child of an inner node immediately follows it
+    uint32_t stack[MaxBuildDepth + 2];
+    unsigned int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        uint32_t nodeIndex = stack[--stackSize];
+        const Node& node = nodes[nodeIndex];
+
+        if (!intersectBox(node.bounds, origin, invDirection, closest))
+            continue;
+
+        if (node.count == 0)
+        {
+            stack[stackSize++] = node.first;
+            stack[stackSize++] = nodeIndex + 1;
+            continue;
+        }
+
+        for (uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+            // Moller-Trumbore ray/triangle intersection
+            const Triangle& tri = triangles[i];
+            Vector3d v0 = tri.v0.cast<double>();
+            Vector3d e0 = tri.v1.cast<double>() - v0;
+            Vector3d e1 = tri.v2.cast<double>() - v0;
+            Vector3d p = direction.cross(e1);
+            double det = e0.dot(p);
+            if (det == 0.0)
+                continue;
+
+            double invDet = 1.0 / det;
+            Vector3d s = origin - v0;
+            double u = s.dot(p) * invDet;
+            if (u < 0.0 || u > 1.0)
+                continue;
+
+            Vector3d q = s.cross(e0);
+            double v = direction.dot(q) * invDet;
+            if (v < 0.0 || u + v > 1.0)
+                continue;
+
+            double t = e1.dot(q) * invDet;
+            if (t > 0.0 && t < closest)
+                closest = t;
+        }
+    }
+
+    if (closest == maxDistance)
+        return false;
+
+    distance = closest;
+    return true;
+}
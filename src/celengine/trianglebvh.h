@@ -0,0 +1,60 @@
+// trianglebvh.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// Bounding volume hierarchy over the triangles of a model, used to cast
+// many rays against the same model.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+namespace cmod
+{
+class Model;
+}
+
+class TriangleBVH
+{
+ public:
+    // Collect the triangles of all triangle list, strip and fan groups of
+    // the model, just like Model::pick does, and build the hierarchy.
+    explicit TriangleBVH(const cmod::Model&);
+
+    // Distance along the ray to the closest intersection in front of the
+    // origin, in units of the length of direction. Returns false and leaves
+    // distance unmodified when the ray misses. Safe to call concurrently.
+    bool intersect(const Eigen::Vector3d& origin,
+                   const Eigen::Vector3d& direction,
+                   double& distance) const;
+
+    size_t getTriangleCount() const { return triangles.size(); }
+
+ private:
+    struct Triangle
+    {
+        Eigen::Vector3f v0;
+        Eigen::Vector3f v1;
+        Eigen::Vector3f v2;
+    };
+
+    struct Node
+    {
+        Eigen::AlignedBox3f bounds;
+        uint32_t first;         // first triangle of a leaf, or the right child
+        uint32_t count;         // zero for inner nodes
+    };
+
+    uint32_t build(uint32_t first, uint32_t count, unsigned int depth);
+
+    std::vector<Triangle> triangles;
+    std::vector<Node> nodes;
+};
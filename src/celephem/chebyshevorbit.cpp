@@ -0,0 +1,533 @@
+// chebyshevorbit.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <fmt/printf.h>
+#include <celengine/astro.h>
+#include <celmath/mathlib.h>
+#include <celutil/bytes.h>
+#include <celutil/cachefile.h>
+#include <celutil/debug.h>
+#include <celutil/gettext.h>
+#include "chebyshevorbit.h"
+
+using namespace Eigen;
+using namespace std;
+
+constexpr char ChebyshevMagic[8] = "CELCHEB";
+constexpr unsigned int ChebyshevOrbit::DefaultDegree;
+
+namespace
+{
+// Sample with the velocity converted to km/day
+struct FitSample
+{
+    double t;
+    Vector3d position;
+    Vector3d velocity;
+};
+
+// Cubic Hermite interpolation of the samples, the same curve
+// SampledOrbitXYZV follows with cubic interpolation. Samples [first, last]
+// must include t.
+Vector3d interpolate(const vector<FitSample>& samples, size_t first, size_t last, double t)
+{
+    auto iter = upper_bound(samples.begin() + first, samples.begin() + last, t,
+                            [](double t, const FitSample& s) { return t < s.t; });
+    size_t i = max((size_t) (iter - samples.begin()), first + 1) - 1;
+
+    const FitSample& s0 = samples[i];
+    const FitSample& s1 = samples[i + 1];
+    double h = s1.t - s0.t;
+    double u = (t - s0.t) / h;
+    Vector3d v0 = s0.velocity * h;
+    Vector3d v1 = s1.velocity * h;
+
+    return s0.position + (((2.0 * (s0.position - s1.position) + v1 + v0) * (u * u * u)) +
+                          ((3.0 * (s1.position - s0.position) - 2.0 * v0 - v1) * (u * u)) +
+                          (v0 * u));
+}
+
+// Evaluate a Chebyshev series at x in [-1, 1] with Clenshaw's recurrence.
+// The coefficients of each coordinate are stride values apart.
+Vector3d evaluateSeries(const double* c, unsigned int degree, double x)
+{
+    size_t stride = degree + 1;
+    Vector3d b1 = Vector3d::Zero();
+    Vector3d b2 = Vector3d::Zero();
+    for (unsigned int j = degree; j >= 1; j--)
+    {
+        Vector3d cj(c[j], c[stride + j], c[2 * stride + j]);
+        Vector3d b0 = 2.0 * x * b1 - b2 + cj;
+        b2 = b1;
+        b1 = b0;
+    }
+
+    return x * b1 - b2 + Vector3d(c[0], c[stride], c[2 * stride]);
+}
+
+// Derivative of the series with respect to x
+Vector3d evaluateSeriesDerivative(const double* c, unsigned int degree, double x)
+{
+    size_t stride = degree + 1;
+    if (degree == 0)
+        return Vector3d::Zero();
+
+    double t0 = 1.0, t1 = x;
+    double dt0 = 0.0, dt1 = 1.0;
+    Vector3d sum = Vector3d(c[1], c[stride + 1], c[2 * stride + 1]);
+    for (unsigned int j = 2; j <= degree; j++)
+    {
+        double t2 = 2.0 * x * t1 - t0;
+        double dt2 = 2.0 * t1 + 2.0 * x * dt1 - dt0;
+        sum += Vector3d(c[j], c[stride + j], c[2 * stride + j]) * dt2;
+        t0 = t1; t1 = t2;
+        dt0 = dt1; dt1 = dt2;
+    }
+
+    return sum;
+}
+
+// Compute the coefficients of the series interpolating a function at the
+// Chebyshev nodes of [t0, t1].
+template<typename F> void fitSegment(const F& f,
+                                     double t0, double t1,
+                                     unsigned int degree,
+                                     double* c)
+{
+    size_t nNodes = degree + 1;
+    double mid = 0.5 * (t0 + t1);
+    double half = 0.5 * (t1 - t0);
+
+    vector<Vector3d> values(nNodes);
+    for (size_t k = 0; k < nNodes; k++)
+    {
+        double x = cos(PI * ((double) k + 0.5) / (double) nNodes);
+        values[k] = f(mid + half * x);
+    }
+
+    for (size_t j = 0; j < nNodes; j++)
+    {
+        Vector3d sum = Vector3d::Zero();
+        for (size_t k = 0; k < nNodes; k++)
+            sum += values[k] * cos(PI * (double) j * ((double) k + 0.5) / (double) nNodes);
+        sum *= 2.0 / (double) nNodes;
+        if (j == 0)
+            sum *= 0.5;
+
+        c[j] = sum.x();
+        c[nNodes + j] = sum.y();
+        c[2 * nNodes + j] = sum.z();
+    }
+}
+
+// Largest position error of a fitted segment, checked at the samples and
+// halfway between them.
+double segmentError(const vector<FitSample>& samples,
+                    size_t first, size_t last,
+                    unsigned int degree,
+                    const double* c)
+{
+    double t0 = samples[first].t;
+    double t1 = samples[last].t;
+    double scale = 2.0 / (t1 - t0);
+
+    double maxError = 0.0;
+    for (size_t i = first; i <= last; i++)
+    {
+        double x = (samples[i].t - t0) * scale - 1.0;
+        maxError = max(maxError, (evaluateSeries(c, degree, x) - samples[i].position).norm());
+        if (i < last)
+        {
+            double t = 0.5 * (samples[i].t + samples[i + 1].t);
+            x = (t - t0) * scale - 1.0;
+            maxError = max(maxError, (evaluateSeries(c, degree, x) - interpolate(samples, i, i + 1, t)).norm());
+        }
+    }
+
+    return maxError;
+}
+}
+
+
+ChebyshevOrbit::ChebyshevOrbit(unsigned int _degree,
+                               vector<double>&& _boundaries,
+                               vector<double>&& _coefficients) :
+    degree(_degree),
+    boundaries(move(_boundaries)),
+    coefficients(move(_coefficients))
+{
+    buildIndex();
+
+    // The extrema of a segment are close enough to one of a few evenly
+    // spaced points for the purpose of culling.
+    size_t stride = 3 * (degree + 1);
+    for (size_t i = 0; i + 1 < boundaries.size(); i++)
+    {
+        for (unsigned int k = 0; k <= 2 * degree + 2; k++)
+        {
+            double x = -1.0 + 2.0 * k / (double) (2 * degree + 2);
+            double r = evaluateSeries(&coefficients[i * stride], degree, x).norm();
+            boundingRadius = max(boundingRadius, r);
+        }
+    }
+}
+
+
+ChebyshevOrbit* ChebyshevOrbit::fit(const vector<XYZVBinaryData>& xyzvSamples,
+                                    unsigned int degree,
+                                    double tolerance)
+{
+    auto readSamples = [&xyzvSamples](const XYZVSampleProc& process)
+    {
+        for (const auto& s : xyzvSamples)
+            process(s);
+        return true;
+    };
+    return fit(readSamples, degree, tolerance);
+}
+
+
+ChebyshevOrbit* ChebyshevOrbit::fit(const function<bool(const XYZVSampleProc&)>& readSamples,
+                                    unsigned int degree,
+                                    double tolerance)
+{
+    // A single interval between two samples is a cubic, which a series of
+    // degree three or more reproduces exactly; this guarantees the fit
+    // succeeds.
+    degree = max(degree, 3u);
+
+    vector<FitSample> samples;
+    bool read = readSamples([&samples](const XYZVBinaryData& s)
+    {
+        // Skip samples with duplicate times, as the loaders do
+        if (!samples.empty() && s.tdb <= samples.back().t)
+            return;
+        samples.push_back({ s.tdb,
+                            Map<const Vector3d>(s.position),
+                            Map<const Vector3d>(s.velocity) * astro::daysToSecs(1.0) });
+    });
+
+    if (!read || samples.size() < 2)
+        return nullptr;
+
+    size_t stride = 3 * (degree + 1);
+    vector<double> boundaries;
+    vector<double> coefficients;
+    vector<double> c(stride);
+
+    // Fit the whole range first and split segments which miss the
+    // tolerance at the sample closest to their middle.
+    vector<pair<size_t, size_t>> pending;
+    pending.emplace_back(0, samples.size() - 1);
+    while (!pending.empty())
+    {
+        size_t first = pending.back().first;
+        size_t last = pending.back().second;
+        pending.pop_back();
+
+        auto f = [&](double t) { return interpolate(samples, first, last, t); };
+        fitSegment(f, samples[first].t, samples[last].t, degree, c.data());
+        if (last - first > 1 && segmentError(samples, first, last, degree, c.data()) > tolerance)
+        {
+            size_t middle = (first + last) / 2;
+            // Pushed in reverse so that segments come out in time order
+            pending.emplace_back(middle, last);
+            pending.emplace_back(first, middle);
+            continue;
+        }
+
+        boundaries.push_back(samples[first].t);
+        coefficients.insert(coefficients.end(), c.begin(), c.end());
+    }
+    boundaries.push_back(samples.back().t);
+
+    return new ChebyshevOrbit(degree, move(boundaries), move(coefficients));
+}
+
+
+ChebyshevOrbit* ChebyshevOrbit::fit(const std::function<Vector3d(double)>& position,
+                                    double begin, double end,
+                                    unsigned int degree,
+                                    double tolerance,
+                                    double minInterval)
+{
+    if (!(end > begin))
+        return nullptr;
+
+    size_t stride = 3 * (degree + 1);
+    vector<double> boundaries;
+    vector<double> coefficients;
+    vector<double> c(stride);
+
+    vector<pair<double, double>> pending;
+    pending.emplace_back(begin, end);
+    while (!pending.empty())
+    {
+        double t0 = pending.back().first;
+        double t1 = pending.back().second;
+        pending.pop_back();
+
+        fitSegment(position, t0, t1, degree, c.data());
+
+        if (t1 - t0 > 2.0 * minInterval)
+        {
+            // Check the extrema of the next Chebyshev polynomial, which lie
+            // between the nodes and at the ends, where the interpolation
+            // error is largest.
+            double maxError = 0.0;
+            for (unsigned int k = 0; k <= degree + 1 && maxError <= tolerance; k++)
+            {
+                double x = cos(PI * (double) k / (double) (degree + 1));
+                Vector3d p = position(0.5 * (t0 + t1) + 0.5 * (t1 - t0) * x);
+                maxError = max(maxError, (evaluateSeries(c.data(), degree, x) - p).norm());
+            }
+
+            if (maxError > tolerance)
+            {
+                double middle = 0.5 * (t0 + t1);
+                pending.emplace_back(middle, t1);
+                pending.emplace_back(t0, middle);
+                continue;
+            }
+        }
+
+        boundaries.push_back(t0);
+        coefficients.insert(coefficients.end(), c.begin(), c.end());
+    }
+    boundaries.push_back(end);
+
+    return new ChebyshevOrbit(degree, move(boundaries), move(coefficients));
+}
+
+
+ChebyshevOrbit* ChebyshevOrbit::load(const fs::path& filename,
+                                     const fs::path& source,
+                                     double tolerance)
+{
+    ifstream in(filename.string(), ios::binary);
+    if (!in.good())
+        return nullptr;
+
+    ChebyshevBinaryHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        fmt::fprintf(cerr, _("Error reading header of %s.\n"), filename);
+        return nullptr;
+    }
+
+    if (memcmp(header.magic, ChebyshevMagic, sizeof(ChebyshevMagic)) != 0)
+    {
+        fmt::fprintf(cerr, _("Bad binary Chebyshev trajectory file %s.\n"), filename);
+        return nullptr;
+    }
+
+    if (header.byteOrder != __BYTE_ORDER__)
+    {
+        fmt::fprintf(cerr, _("Unsupported byte order %i, expected %i.\n"),
+                     header.byteOrder, __BYTE_ORDER__);
+        return nullptr;
+    }
+
+    if (header.digits != std::numeric_limits<double>::digits)
+    {
+        fmt::fprintf(cerr, _("Unsupported digits number %i, expected %i.\n"),
+                     header.digits, std::numeric_limits<double>::digits);
+        return nullptr;
+    }
+
+    // Check the counts against the file size before allocating anything,
+    // so that a corrupt header can't ask for gigabytes.
+    std::error_code ec;
+    uintmax_t fileSize = fs::file_size(filename, ec);
+    uint64_t segmentSize = (3 * ((uint64_t) header.degree + 1) + 1) * sizeof(double);
+    if (ec || header.degree > 100 || header.count == 0 ||
+        header.count > (fileSize - sizeof(header)) / segmentSize ||
+        fileSize != sizeof(header) + header.count * segmentSize + sizeof(double))
+    {
+        fmt::fprintf(cerr, _("Bad segment count in %s.\n"), filename);
+        return nullptr;
+    }
+
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!(header.tolerance <= tolerance) ||
+        !GetFileStamp(source, sourceSize, sourceTime) ||
+        header.sourceSize != sourceSize ||
+        header.sourceTime != sourceTime)
+    {
+        DPRINTF(LOG_LEVEL_INFO, "Chebyshev trajectory %s is out of date\n", filename);
+        return nullptr;
+    }
+
+    vector<double> boundaries(header.count + 1);
+    vector<double> coefficients(header.count * 3 * (header.degree + 1));
+    if (!in.read(reinterpret_cast<char*>(boundaries.data()), boundaries.size() * sizeof(double)) ||
+        !in.read(reinterpret_cast<char*>(coefficients.data()), coefficients.size() * sizeof(double)))
+    {
+        fmt::fprintf(cerr, _("Error reading Chebyshev trajectory file %s.\n"), filename);
+        return nullptr;
+    }
+
+    return new ChebyshevOrbit(header.degree, move(boundaries), move(coefficients));
+}
+
+
+bool ChebyshevOrbit::save(const fs::path& filename,
+                          const fs::path& source,
+                          double tolerance) const
+{
+    ChebyshevBinaryHeader header;
+    memcpy(header.magic, ChebyshevMagic, sizeof(ChebyshevMagic));
+    header.byteOrder = __BYTE_ORDER__;
+    header.digits = std::numeric_limits<double>::digits;
+    header.degree = degree;
+    header.count = getSegmentCount();
+    header.tolerance = tolerance;
+    if (!GetFileStamp(source, header.sourceSize, header.sourceTime))
+        return false;
+
+    ofstream out(filename.string(), ios::binary);
+    if (!out.good())
+        return false;
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(boundaries.data()), boundaries.size() * sizeof(double));
+    out.write(reinterpret_cast<const char*>(coefficients.data()), coefficients.size() * sizeof(double));
+
+    return out.good();
+}
+
+
+void ChebyshevOrbit::buildIndex()
+{
+    size_t nSegments = getSegmentCount();
+    double span = boundaries.back() - boundaries.front();
+    indexScale = span > 0.0 ? (double) nSegments / span : 0.0;
+
+    segmentIndex.resize(nSegments + 1);
+    size_t segment = 0;
+    for (size_t k = 0; k <= nSegments; k++)
+    {
+        double t = boundaries.front() + (double) k / indexScale;
+        while (segment + 1 < nSegments && boundaries[segment + 1] <= t)
+            segment++;
+        segmentIndex[k] = (uint32_t) segment;
+    }
+}
+
+
+size_t ChebyshevOrbit::findSegment(double jd) const
+{
+    size_t nSegments = getSegmentCount();
+    double k = (jd - boundaries.front()) * indexScale;
+    size_t bucket = (size_t) celmath::clamp(k, 0.0, (double) (nSegments - 1));
+
+    // The segment lies between the first segments of this and the next
+    // bucket; usually they are the same or adjacent.
+    auto begin = boundaries.begin() + segmentIndex[bucket] + 1;
+    auto end = boundaries.begin() + segmentIndex[bucket + 1] + 1;
+    return (size_t) (upper_bound(begin, end, jd) - boundaries.begin()) - 1;
+}
+
+
+Vector3d ChebyshevOrbit::evaluatePosition(double jd) const
+{
+    jd = celmath::clamp(jd, boundaries.front(), boundaries.back());
+    size_t i = findSegment(jd);
+    double t0 = boundaries[i];
+    double t1 = boundaries[i + 1];
+    double x = 2.0 * (jd - t0) / (t1 - t0) - 1.0;
+
+    return evaluateSeries(&coefficients[i * 3 * (degree + 1)], degree, x);
+}
+
+
+Vector3d ChebyshevOrbit::evaluateVelocity(double jd) const
+{
+    if (jd < boundaries.front() || jd > boundaries.back())
+        return Vector3d::Zero();
+
+    size_t i = findSegment(jd);
+    double t0 = boundaries[i];
+    double t1 = boundaries[i + 1];
+    double x = 2.0 * (jd - t0) / (t1 - t0) - 1.0;
+
+    return evaluateSeriesDerivative(&coefficients[i * 3 * (degree + 1)], degree, x) * (2.0 / (t1 - t0));
+}
+
+
+Vector3d ChebyshevOrbit::computePosition(double jd) const
+{
+    Vector3d pos = evaluatePosition(jd);
+
+    // Add correction for Celestia's coordinate system
+    return Vector3d(pos.x(), pos.z(), -pos.y());
+}
+
+
+Vector3d ChebyshevOrbit::computeVelocity(double jd) const
+{
+    Vector3d vel = evaluateVelocity(jd);
+
+    // Add correction for Celestia's coordinate system
+    return Vector3d(vel.x(), vel.z(), -vel.y());
+}
+
+
+double ChebyshevOrbit::getPeriod() const
+{
+    return boundaries.back() - boundaries.front();
+}
+
+
+double ChebyshevOrbit::getBoundingRadius() const
+{
+    return boundingRadius;
+}
+
+
+bool ChebyshevOrbit::isPeriodic() const
+{
+    return false;
+}
+
+
+void ChebyshevOrbit::getValidRange(double& begin, double& end) const
+{
+    begin = boundaries.front();
+    end = boundaries.back();
+}
+
+
+// Segments are long where the trajectory is smooth, so a few points per
+// segment are produced to keep the orbit path from looking polygonal.
+void ChebyshevOrbit::sample(double /* startTime */, double /* endTime */,
+                            OrbitSampleProc& proc) const
+{
+    size_t nSegments = getSegmentCount();
+    for (size_t i = 0; i < nSegments; i++)
+    {
+        double t0 = boundaries[i];
+        double t1 = boundaries[i + 1];
+        for (unsigned int k = 0; k < degree; k++)
+        {
+            double t = t0 + (t1 - t0) * k / (double) degree;
+            proc.sample(t, computePosition(t), computeVelocity(t));
+        }
+    }
+
+    double t = boundaries.back();
+    proc.sample(t, computePosition(t), computeVelocity(t));
+}
@@ -0,0 +1,120 @@
+// chebyshevorbit.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// Trajectories stored as piecewise Chebyshev polynomials, fitted to
+// sampled positions and velocities.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <Eigen/Core>
+#include <celcompat/filesystem.h>
+#include "orbit.h"
+#include "xyzvbinary.h"
+
+// Layout of a binary Chebyshev trajectory file: the header is followed by
+// count + 1 segment boundary times and then, for each segment, the
+// degree + 1 coefficients of x, y and z in turn. All values are doubles in
+// the byte order given in the header. The tolerance of the fit and the size
+// and modification time of the sampled trajectory it was fitted to tell
+// whether the file can stand in for the samples.
+struct ChebyshevBinaryHeader
+{
+    char magic[8];          // "CELCHEB"
+    uint16_t byteOrder;
+    uint16_t digits;
+    uint32_t degree;
+    uint64_t count;
+    double tolerance;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+};
+
+class ChebyshevOrbit : public CachingOrbit
+{
+ public:
+    static constexpr unsigned int DefaultDegree = 11;
+
+    ChebyshevOrbit(unsigned int degree,
+                   std::vector<double>&& boundaries,
+                   std::vector<double>&& coefficients);
+    ~ChebyshevOrbit() override = default;
+
+    // Fit segments of the given degree to the cubic Hermite interpolation
+    // of xyzv samples (velocities in km/s, as in xyzv files), so that the
+    // positions differ by at most tolerance km at the samples and halfway
+    // between them. Samples must be sorted by time.
+    static ChebyshevOrbit* fit(const std::vector<XYZVBinaryData>& samples,
+                               unsigned int degree,
+                               double tolerance);
+    // The same for samples passed by readSamples to the function it gets,
+    // which keeps only one copy of the samples in memory. readSamples
+    // returns false if they couldn't be read.
+    static ChebyshevOrbit* fit(const std::function<bool(const XYZVSampleProc&)>& readSamples,
+                               unsigned int degree,
+                               double tolerance);
+
+    // Fit segments to a position function (km) over [begin, end], halving
+    // segments until the error is at most tolerance km between the
+    // interpolation points. Segments are never shorter than minInterval.
+    static ChebyshevOrbit* fit(const std::function<Eigen::Vector3d(double)>& position,
+                               double begin, double end,
+                               unsigned int degree,
+                               double tolerance,
+                               double minInterval);
+
+    // Load a fit of the samples in source with at most the given tolerance.
+    // Returns nullptr if the file is missing or broken, or if it was fitted
+    // with a larger tolerance or to another version of source.
+    static ChebyshevOrbit* load(const fs::path& filename,
+                                const fs::path& source,
+                                double tolerance);
+    // Save a fit made with the given tolerance to the samples in source
+    bool save(const fs::path& filename,
+              const fs::path& source,
+              double tolerance) const;
+
+    unsigned int getDegree() const { return degree; }
+    size_t getSegmentCount() const { return boundaries.size() - 1; }
+    // Start times of the segments, followed by the end time of the last one
+    const std::vector<double>& getBoundaries() const { return boundaries; }
+
+    double getPeriod() const override;
+    double getBoundingRadius() const override;
+    Eigen::Vector3d computePosition(double jd) const override;
+    Eigen::Vector3d computeVelocity(double jd) const override;
+
+    bool isPeriodic() const override;
+    void getValidRange(double& begin, double& end) const override;
+
+    void sample(double startTime, double endTime, OrbitSampleProc& proc) const override;
+
+    // Position and velocity (km/day) in the frame of the samples, without
+    // the conversion to Celestia's coordinate system.
+    Eigen::Vector3d evaluatePosition(double jd) const;
+    Eigen::Vector3d evaluateVelocity(double jd) const;
+
+ private:
+    size_t findSegment(double jd) const;
+    void buildIndex();
+
+    unsigned int degree;
+    std::vector<double> boundaries;
+    std::vector<double> coefficients;
+
+    // First segment overlapping each of a set of equal time intervals,
+    // which makes finding the segment for a time a constant time operation
+    // for all but very unevenly sized segments.
+    std::vector<uint32_t> segmentIndex;
+    double indexScale { 0.0 };
+
+    double boundingRadius { 0.0 };
+};
@@ -103,6 +103,10 @@ class OrbitSampleProc
  * order to avoid redundant calculation, the CachingOrbit class saves the
  * result of the last calculation and uses it if the time matches the cached
  * time.
+ *
+ * The cache isn't synchronized, so like all orbits a CachingOrbit must only
+ * be queried from the main thread; work spread over the worker pool has to
+ * use positions computed beforehand.
  */
 class CachingOrbit : public Orbit
 {
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Binary sampled orientation files: the header is followed by count
+// records sorted by time.
+struct OrientationBinaryHeader
+{
+    char magic[8];          // "CELQUAT"
+    uint16_t byteOrder;
+    uint16_t digits;
+    uint32_t flags;         // OrientationBinaryFlags, zero in older files
+    uint64_t count;
+};
+
+enum OrientationBinaryFlags : uint32_t
+{
+    // The keys are evenly spaced in time, as checked by
+    // OrientationKeysEvenlySpaced, so readers can locate keys without
+    // reading the whole file.
+    OrientationEvenlySpaced = 0x1,
+};
+
+struct OrientationBinaryData
+{
+    double tjd;
+    float q[4];             // w, x, y, z
+};
+
+// Return the time between keys if they are evenly spaced, allowing for
+// rounding of the times in text files, or zero.
+inline double OrientationKeysEvenlySpaced(const OrientationBinaryData* samples, size_t nSamples)
+{
+    if (nSamples < 3)
+        return 0.0;
+
+    double step = (samples[nSamples - 1].tjd - samples[0].tjd) / (double) (nSamples - 1);
+    if (step <= 0.0)
+        return 0.0;
+
+    for (size_t i = 0; i < nSamples; i++)
+    {
+        if (std::abs(samples[i].tjd - (samples[0].tjd + step * (double) i)) > step * 0.01)
+            return 0.0;
+    }
+
+    return step;
+}
@@ -82,7 +82,8 @@ class RotationModel
  *  of computeAngularVelocity uses differentiation to approximate the
  *  the instantaneous angular velocity. It may be overridden if there is some
  *  better means to calculate the angular velocity for a specific rotation
- *  model.
+ *  model. As for CachingOrbit, the cache isn't synchronized and rotation
+ *  models must only be queried from the main thread.
  */
 class CachingRotationModel : public RotationModel
 {
@@ -12,6 +12,7 @@
 
 #include "orbit.h"
 #include "samporbit.h"
+#include "chebyshevorbit.h"
 #include "xyzvbinary.h"
 #include <celengine/astro.h>
 #include <celmath/mathlib.h>
@@ -25,6 +26,7 @@
 #include <iostream>
 #include <fstream>
 #include <limits>
+#include <memory>
 #include <iomanip>
 
 using namespace Eigen;
@@ -761,7 +763,7 @@ template <typename T> SampledOrbit<T>* LoadSampledOrbit(const fs::path& filename
 }
 
 
-// Load an xyzv sampled trajectory file. The file contains records with 7 double
+// Read an xyzv sampled trajectory file. The file contains records with 7 double
 // precision values:
 //
 // 1: TDB time
@@ -778,80 +780,72 @@ template <typename T> SampledOrbit<T>* LoadSampledOrbit(const fs::path& filename
 // with a #; data is read start fromt the first non-whitespace character outside
 // of a comment.
 
-template <typename T> SampledOrbitXYZV<T>* LoadSampledOrbitXYZV(const fs::path& filename, TrajectoryInterpolation interpolation, T /*unused*/)
+bool ReadXYZVSamples(const fs::path& filename, const XYZVSampleProc& process)
 {
     ifstream in(filename.string());
     if (!in.good())
-        return nullptr;
+        return false;
 
     if (!SkipComments(in))
-        return nullptr;
-
-    SampledOrbitXYZV<T>* orbit = nullptr;
-
-    orbit = new SampledOrbitXYZV<T>(interpolation);
+        return false;
 
     double lastSampleTime = -numeric_limits<double>::infinity();
     while (in.good())
     {
-        double tdb = 0.0;
-        Vector3d position;
-        Vector3d velocity;
-
-        in >> tdb;
-        in >> position.x();
-        in >> position.y();
-        in >> position.z();
-        in >> velocity.x();
-        in >> velocity.y();
-        in >> velocity.z();
+        XYZVBinaryData data;
 
-        // Convert velocities from km/sec to km/Julian day
-        velocity = velocity * astro::daysToSecs(1.0);
+        in >> data.tdb;
+        in >> data.position[0];
+        in >> data.position[1];
+        in >> data.position[2];
+        in >> data.velocity[0];
+        in >> data.velocity[1];
+        in >> data.velocity[2];
 
         if (in.good())
         {
-            if (tdb != lastSampleTime)
+            // Skip samples with duplicate times; such trajectories are invalid, but
+            // are unfortunately used in some existing add-ons.
+            if (data.tdb != lastSampleTime)
             {
-                orbit->addSample(tdb, position, velocity);
-                lastSampleTime = tdb;
+                process(data);
+                lastSampleTime = data.tdb;
             }
         }
     }
 
-    return orbit;
+    return true;
 }
 
-/* Load a binary xyzv sampled trajectory file.
+/* Read a binary xyzv sampled trajectory file.
  */
-template <typename T> SampledOrbitXYZV<T>*
-LoadSampledOrbitXYZVBinary(const fs::path& filename, TrajectoryInterpolation interpolation, T /*unused*/)
+bool ReadXYZVBinarySamples(const fs::path& filename, const XYZVSampleProc& process)
 {
     ifstream in(filename.string(), ios::binary);
     if (!in.good())
     {
         fmt::fprintf(cerr, _("Error openning %s.\n"), filename);
-        return nullptr;
+        return false;
     }
 
     XYZVBinaryHeader header;
     if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
     {
         fmt::fprintf(cerr, _("Error reading header of %s.\n"), filename);
-        return nullptr;
+        return false;
     }
 
     if (string(header.magic) != "CELXYZV")
     {
         fmt::fprintf(cerr, _("Bad binary xyzv file %s.\n"), filename);
-        return nullptr;
+        return false;
     }
 
     if (header.byteOrder != __BYTE_ORDER__)
     {
         fmt::fprintf(cerr, _("Unsupported byte order %i, expected %i.\n"),
                      header.byteOrder, __BYTE_ORDER__);
-        return nullptr;
+        return false;
     }
 
 
@@ -859,15 +853,13 @@ LoadSampledOrbitXYZVBinary(const fs::path& filename, TrajectoryInterpolation int
     {
         fmt::fprintf(cerr, _("Unsupported digits number %i, expected %i.\n"),
                      header.digits, std::numeric_limits<double>::digits);
-        return nullptr;
+        return false;
     }
 
     if (header.count == 0)
-        return nullptr;
+        return false;
 
-    SampledOrbitXYZV<T>* orbit = new SampledOrbitXYZV<T>(interpolation);
-
-    double lastSampleTime = -numeric_limits<T>::infinity();
+    double lastSampleTime = -numeric_limits<double>::infinity();
 
     while (in.good())
     {
@@ -876,21 +868,61 @@ LoadSampledOrbitXYZVBinary(const fs::path& filename, TrajectoryInterpolation int
         if (!in.read(reinterpret_cast<char*>(&data), sizeof(data)))
             break;
 
-        double tdb = data.tdb;
-        Vector3d position = Map<Vector3d>(data.position);
-        Vector3d velocity = Map<Vector3d>(data.velocity);
+        if (data.tdb != lastSampleTime)
+        {
+            process(data);
+            lastSampleTime = data.tdb;
+        }
+    }
+
+    return true;
+}
+
+
+bool LoadXYZVSamples(const fs::path& filename, vector<XYZVBinaryData>& samples)
+{
+    return ReadXYZVSamples(filename, [&samples](const XYZVBinaryData& data) { samples.push_back(data); });
+}
+
+
+bool LoadXYZVBinarySamples(const fs::path& filename, vector<XYZVBinaryData>& samples)
+{
+    return ReadXYZVBinarySamples(filename, [&samples](const XYZVBinaryData& data) { samples.push_back(data); });
+}
+
+
+// Read the samples from the binary version of an xyzv file if there is one,
+// otherwise from the text file. The binary file fails before any sample is
+// read, so the samples never come from both.
+static bool ReadXYZVSamplesAnyFormat(const fs::path& filename, const XYZVSampleProc& process)
+{
+    auto f = filename;
+    if (ReadXYZVBinarySamples(f += fs::path("bin"), process)) // FIXME
+        return true;
+
+    return ReadXYZVSamples(filename, process);
+}
+
+
+// Samples are added to the orbit as they are read, so that large files
+// aren't held in memory twice.
+template <typename T> SampledOrbitXYZV<T>*
+LoadSampledOrbitXYZV(const fs::path& filename, TrajectoryInterpolation interpolation, T /*unused*/)
+{
+    unique_ptr<SampledOrbitXYZV<T>> orbit(new SampledOrbitXYZV<T>(interpolation));
+
+    bool loaded = ReadXYZVSamplesAnyFormat(filename, [&orbit](const XYZVBinaryData& data)
+    {
+        Vector3d position = Map<const Vector3d>(data.position);
+        Vector3d velocity = Map<const Vector3d>(data.velocity);
 
         // Convert velocities from km/sec to km/Julian day
         velocity *= astro::daysToSecs(1.0);
 
-        if (tdb != lastSampleTime)
-        {
-            orbit->addSample(tdb, position, velocity);
-            lastSampleTime = tdb;
-        }
-    }
+        orbit->addSample(data.tdb, position, velocity);
+    });
 
-    return orbit;
+    return loaded ? orbit.release() : nullptr;
 }
 
 
@@ -914,11 +946,6 @@ Orbit* LoadSampledTrajectoryDoublePrec(const fs::path& filename, TrajectoryInter
  */
 Orbit* LoadXYZVTrajectorySinglePrec(const fs::path& filename, TrajectoryInterpolation interpolation)
 {
-    auto f = filename;
-    Orbit* ret = LoadSampledOrbitXYZVBinary(f += fs::path("bin"), interpolation, 0.0f); // FIXME
-    if (ret != nullptr)
-        return ret;
-
     return LoadSampledOrbitXYZV(filename, interpolation, 0.0f);
 }
 
@@ -927,10 +954,31 @@ Orbit* LoadXYZVTrajectorySinglePrec(const fs::path& filename, TrajectoryInterpol
  */
 Orbit* LoadXYZVTrajectoryDoublePrec(const fs::path& filename, TrajectoryInterpolation interpolation)
 {
+    return LoadSampledOrbitXYZV(filename, interpolation, 0.0);
+}
+
+
+/*! Load a trajectory file with positions and velocities as piecewise
+ *  Chebyshev polynomials deviating at most tolerance km from the samples.
+ *  A file with the same name plus "cheb" written by xyzv2cheb is used
+ *  instead of fitting the samples when it was fitted to the current samples
+ *  with at most the same tolerance.
+ */
+Orbit* LoadXYZVTrajectoryChebyshev(const fs::path& filename, double tolerance)
+{
+    // The samples are read from the binary file if there is one
+    auto binFile = filename;
+    binFile += fs::path("bin");
+    const fs::path& source = fs::exists(binFile) ? binFile : filename;
+
     auto f = filename;
-    Orbit* ret = LoadSampledOrbitXYZVBinary(f += fs::path("bin"), interpolation, 0.0); // FIXME
+    Orbit* ret = ChebyshevOrbit::load(f += fs::path("cheb"), source, tolerance);
     if (ret != nullptr)
         return ret;
 
-    return LoadSampledOrbitXYZV(filename, interpolation, 0.0);
+    auto readSamples = [&filename](const XYZVSampleProc& process)
+    {
+        return ReadXYZVSamplesAnyFormat(filename, process);
+    };
+    return ChebyshevOrbit::fit(readSamples, ChebyshevOrbit::DefaultDegree, tolerance);
 }
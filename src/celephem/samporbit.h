@@ -10,7 +10,9 @@
 #ifndef _CELENGINE_SAMPORBIT_H_
 #define _CELENGINE_SAMPORBIT_H_
 
+#include <vector>
 #include "orbit.h"
+#include "xyzvbinary.h"
 #include <celcompat/filesystem.h>
 
 enum TrajectoryInterpolation
@@ -29,5 +31,13 @@ extern Orbit* LoadSampledTrajectoryDoublePrec(const fs::path& filename, Trajecto
 extern Orbit* LoadSampledTrajectorySinglePrec(const fs::path& filename, TrajectoryInterpolation interpolation);
 extern Orbit* LoadXYZVTrajectoryDoublePrec(const fs::path& filename, TrajectoryInterpolation interpolation);
 extern Orbit* LoadXYZVTrajectorySinglePrec(const fs::path& filename, TrajectoryInterpolation interpolation);
+extern Orbit* LoadXYZVTrajectoryChebyshev(const fs::path& filename, double tolerance);
+
+// Read the samples of text and binary xyzv files, skipping samples with
+// duplicate times
+extern bool ReadXYZVSamples(const fs::path& filename, const XYZVSampleProc& process);
+extern bool ReadXYZVBinarySamples(const fs::path& filename, const XYZVSampleProc& process);
+extern bool LoadXYZVSamples(const fs::path& filename, std::vector<XYZVBinaryData>& samples);
+extern bool LoadXYZVBinarySamples(const fs::path& filename, std::vector<XYZVBinaryData>& samples);
 
 #endif // _CELENGINE_SAMPORBIT_H_
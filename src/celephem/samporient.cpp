@@ -12,29 +12,28 @@
 // of the License, or (at your option) any later version.
 
 #include "samporient.h"
+#include "orientbinary.h"
 #include <celmath/mathlib.h>
 #include <celmath/geomutil.h>
+#include <celutil/bytes.h>
+#include <celutil/gettext.h>
+#include <celutil/mappedfile.h>
+#include <fmt/printf.h>
 #include <cmath>
 #include <cassert>
+#include <cstring>
 #include <string>
 #include <algorithm>
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <limits>
 
 using namespace Eigen;
 using namespace std;
 using namespace celmath;
 
-struct OrientationSample
-{
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-
-    Eigen::Quaternionf q;
-    double t;
-};
-
-typedef vector<OrientationSample, aligned_allocator<OrientationSample> > OrientationSampleVector;
+constexpr char OrientationMagic[8] = "CELQUAT";
 
 /*!
  * Sampled orientation files are ASCII text files containing a sequence of
@@ -57,6 +56,9 @@ typedef vector<OrientationSample, aligned_allocator<OrientationSample> > Orienta
  * Note that while each record of this example file is on a separate line,
  * all whitespace is treated identically, so the entire file could be one
  * a single line.
+ *
+ * Long attitude histories load much faster from the binary format described
+ * in orientbinary.h, which q2bin converts text files to.
  */
 
 // 90 degree rotation about x-axis to convert orientation to Celestia's
@@ -64,14 +66,13 @@ typedef vector<OrientationSample, aligned_allocator<OrientationSample> > Orienta
 static Quaternionf coordSysCorrection = XRotation((float) (PI / 2.0));
 
 
-bool operator<(const OrientationSample& a, const OrientationSample& b)
-{
-    return a.t < b.t;
-}
-
 /*! SampledOrientation is a rotation model that interpolates a sequence
  *  of quaternion keyframes. Typically, an instance of SampledRotation will
  *  be created from a file with LoadSampledOrientation().
+ *
+ *  The keys are either read into memory from a text file or used in place
+ *  from a memory mapped binary file. Queries don't modify the object, so
+ *  a single instance can be used from several threads.
  */
 class SampledOrientation : public RotationModel
 {
@@ -80,9 +81,16 @@ public:
     ~SampledOrientation() override = default;
 
     /*! Add another quaternion key to the sampled orientation. The keys
-     *  should have monotonically increasing time values.
+     *  should have monotonically increasing time values. finish() must be
+     *  called after the last key has been added.
      */
     void addSample(double tjd, const Quaternionf& q);
+    void finish();
+
+    /*! Use the keys of a binary orientation file, which stays mapped for
+     *  the lifetime of the object.
+     */
+    bool mapFile(const fs::path& filename);
 
     /*! The orientation of a sampled rotation model is entirely due
      *  to spin (i.e. there's no notion of an equatorial frame.)
@@ -96,10 +104,23 @@ public:
 
 private:
     Quaternionf getOrientation(double tjd) const;
+    size_t findSample(double tjd) const;
+    void buildIndex();
+
+    static Quaternionf getQuaternion(const OrientationBinaryData& sample)
+    {
+        return Quaternionf(sample.q[0], sample.q[1], sample.q[2], sample.q[3]);
+    }
 
 private:
-    OrientationSampleVector samples;
-    mutable int lastSample{0};
+    vector<OrientationBinaryData> storage;
+    MappedFile file;
+
+    const OrientationBinaryData* samples{nullptr};
+    size_t nSamples{0};
+
+    // Time between keys when they are evenly spaced, zero otherwise
+    double uniformStep{0.0};
 
     enum InterpolationType
     {
@@ -115,24 +136,124 @@ void
 SampledOrientation::addSample(double t, const Eigen::Quaternionf& q)
 {
     // TODO: add a check for out of sequence samples
-    OrientationSample samp;
-    samp.t = t;
-    samp.q = q * coordSysCorrection;
-    samples.push_back(samp);
+    OrientationBinaryData samp;
+    samp.tjd = t;
+    samp.q[0] = q.w();
+    samp.q[1] = q.x();
+    samp.q[2] = q.y();
+    samp.q[3] = q.z();
+    storage.push_back(samp);
+}
+
+
+void
+SampledOrientation::finish()
+{
+    samples = storage.data();
+    nSamples = storage.size();
+    buildIndex();
+}
+
+
+bool
+SampledOrientation::mapFile(const fs::path& filename)
+{
+    if (!file.open(filename))
+        return false;
+
+    if (file.getSize() < sizeof(OrientationBinaryHeader))
+    {
+        fmt::fprintf(cerr, _("Error reading header of %s.\n"), filename);
+        return false;
+    }
+
+    OrientationBinaryHeader header;
+    memcpy(&header, file.getData(), sizeof(header));
+
+    if (memcmp(header.magic, OrientationMagic, sizeof(OrientationMagic)) != 0)
+    {
+        fmt::fprintf(cerr, _("Bad binary orientation file %s.\n"), filename);
+        return false;
+    }
+
+    if (header.byteOrder != __BYTE_ORDER__)
+    {
+        fmt::fprintf(cerr, _("Unsupported byte order %i, expected %i.\n"),
+                     header.byteOrder, __BYTE_ORDER__);
+        return false;
+    }
+
+    if (header.digits != std::numeric_limits<double>::digits)
+    {
+        fmt::fprintf(cerr, _("Unsupported digits number %i, expected %i.\n"),
+                     header.digits, std::numeric_limits<double>::digits);
+        return false;
+    }
+
+    if (header.count == 0 ||
+        header.count > (file.getSize() - sizeof(header)) / sizeof(OrientationBinaryData))
+    {
+        fmt::fprintf(cerr, _("Bad sample count in %s.\n"), filename);
+        return false;
+    }
+
+    samples = reinterpret_cast<const OrientationBinaryData*>(file.getData() + sizeof(header));
+    nSamples = (size_t) header.count;
+
+    // Checking the spacing here would page in the whole file; q2bin has
+    // done it already.
+    uniformStep = 0.0;
+    if ((header.flags & OrientationEvenlySpaced) != 0 && nSamples >= 3)
+        uniformStep = (samples[nSamples - 1].tjd - samples[0].tjd) / (double) (nSamples - 1);
+
+    return true;
+}
+
+
+// Keys of attitude histories are usually evenly spaced, in which case the
+// keys around a time can be computed instead of searched for.
+void
+SampledOrientation::buildIndex()
+{
+    uniformStep = OrientationKeysEvenlySpaced(samples, nSamples);
+}
+
+
+// Return the index of the first key at or after tjd, nSamples if there is
+// none.
+size_t
+SampledOrientation::findSample(double tjd) const
+{
+    if (uniformStep > 0.0)
+    {
+        double k = ceil((tjd - samples[0].tjd) / uniformStep);
+        auto n = (size_t) clamp(k, 0.0, (double) nSamples);
+
+        // The estimate is at most one key off
+        while (n > 0 && samples[n - 1].tjd >= tjd)
+            n--;
+        while (n < nSamples && samples[n].tjd < tjd)
+            n++;
+        return n;
+    }
+
+    auto iter = lower_bound(samples, samples + nSamples, tjd,
+                            [](const OrientationBinaryData& s, double t) { return s.tjd < t; });
+    return iter - samples;
 }
 
 
 Eigen::Quaterniond
 SampledOrientation::spin(double tjd) const
 {
-    // TODO: cache the last value returned
+    // No result is cached, so that concurrent queries are safe
     return getOrientation(tjd).cast<double>();
 }
 
 
 double SampledOrientation::getPeriod() const
 {
-    return samples[samples.size() - 1].t - samples[0].t;
+    return samples[nSamples - 1].tjd - samples[0].tjd;
 }
 
 
@@ -144,8 +265,8 @@ bool SampledOrientation::isPeriodic() const
 
 void SampledOrientation::getValidRange(double& begin, double& end) const
 {
-    begin = samples[0].t;
-    end = samples[samples.size() - 1].t;
+    begin = samples[0].tjd;
+    end = samples[nSamples - 1].tjd;
 }
 
 
@@ -153,49 +274,31 @@ Quaternionf
 SampledOrientation::getOrientation(double tjd) const
 {
     Quaternionf orientation;
-    if (samples.size() == 0)
+    if (nSamples == 0)
     {
-        orientation = Quaternionf::Identity();
+        return Quaternionf::Identity();
     }
-    else if (samples.size() == 1)
+    else if (nSamples == 1)
     {
-        orientation = samples[0].q;
+        orientation = getQuaternion(samples[0]);
     }
     else
     {
-        OrientationSample samp;
-        samp.t = tjd;
-        int n = lastSample;
-
-        // Do a binary search to find the samples that define the orientation
-        // at the current time. Cache the previous sample used and avoid
-        // the search if the covers the requested time.
-        if (n < 1 || n >= (int) samples.size() || tjd < samples[n - 1].t || tjd > samples[n].t)
-        {
-            OrientationSampleVector::const_iterator iter = lower_bound(samples.begin(),
-                                                                       samples.end(),
-                                                                       samp);
-            if (iter == samples.end())
-                n = samples.size();
-            else
-                n = iter - samples.begin();
-
-            lastSample = n;
-        }
+        size_t n = findSample(tjd);
 
         if (n == 0)
         {
-            orientation = samples[0].q;
+            orientation = getQuaternion(samples[0]);
         }
-        else if (n < (int) samples.size())
+        else if (n < nSamples)
         {
             if (interpolation == Linear)
             {
-                OrientationSample s0 = samples[n - 1];
-                OrientationSample s1 = samples[n];
+                const OrientationBinaryData& s0 = samples[n - 1];
+                const OrientationBinaryData& s1 = samples[n];
 
-                auto t = (float) ((tjd - s0.t) / (s1.t - s0.t));
-                orientation = s0.q.slerp(t, s1.q);
+                auto t = (float) ((tjd - s0.tjd) / (s1.tjd - s0.tjd));
+                orientation = getQuaternion(s0).slerp(t, getQuaternion(s1));
             }
             else if (interpolation == Cubic)
             {
@@ -210,16 +313,40 @@ SampledOrientation::getOrientation(double tjd) const
         }
         else
         {
-            orientation = samples[samples.size() - 1].q;
+            orientation = getQuaternion(samples[nSamples - 1]);
         }
     }
 
-    return orientation;
+    // Applying the correction after interpolating gives the same result as
+    // correcting the keys, since it is the same rotation for all of them.
+    return orientation * coordSysCorrection;
+}
+
+
+static RotationModel* LoadSampledOrientationBinary(const fs::path& filename)
+{
+    auto* sampOrientation = new SampledOrientation();
+    if (!sampOrientation->mapFile(filename))
+    {
+        delete sampOrientation;
+        return nullptr;
+    }
+
+    return sampOrientation;
 }
 
 
+/*! Load a sampled orientation file. A binary file with the same name
+ *  plus "bin", as written by q2bin, is used instead of the text file
+ *  when it exists.
+ */
 RotationModel* LoadSampledOrientation(const fs::path& filename)
 {
+    auto f = filename;
+    RotationModel* ret = LoadSampledOrientationBinary(f += fs::path("bin"));
+    if (ret != nullptr)
+        return ret;
+
     ifstream in(filename.string());
     if (!in.good())
         return nullptr;
@@ -243,6 +370,7 @@ RotationModel* LoadSampledOrientation(const fs::path& filename)
             nSamples++;
         }
     }
+    sampOrientation->finish();
 
     return sampOrientation;
 }
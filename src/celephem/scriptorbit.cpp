@@ -9,14 +9,25 @@
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
 
+#include <algorithm>
 #include <cstdio>
 #include <cassert>
+#include <memory>
+#include <thread>
+#include "chebyshevorbit.h"
 #include "scriptobject.h"
 #include "scriptorbit.h"
 
 using namespace Eigen;
 using namespace std;
 
+// Window sampled at a time when an orbit with an unlimited valid range is
+// sampled without an explicit SampleWindow
+constexpr double DefaultSampleWindow = 365.25;
+
+// Shortest segment of the fitted polynomials, one minute
+constexpr double MinSampleInterval = 1.0 / 1440.0;
+
 
 /*! Initialize the script orbit.
  *  moduleName is the name of a module that contains the orbit factory
@@ -41,6 +52,15 @@ using namespace std;
  *      position(time) - The position function takes a time value as input
  *         (TDB Julian day) and returns three values which are the x, y, and
  *         z coordinates. Units for the position are kilometers.
+ *
+ *  Calling into Lua for every position is slow and restricted to the main
+ *  thread. When the orbit definition has a SampleTolerance (km), the
+ *  position function is instead sampled into piecewise polynomials which
+ *  deviate from it by at most that distance. Orbits with a valid range are
+ *  sampled once over the whole range unless a SampleWindow (days) shorter
+ *  than the range is given; other orbits are sampled over a window around
+ *  the requested time, which is moved when a time outside of it is
+ *  requested.
  */
 bool
 ScriptedOrbit::initialize(const std::string& moduleName,
@@ -51,6 +71,7 @@ ScriptedOrbit::initialize(const std::string& moduleName,
         return false;
 
     luaState = GetScriptedObjectContext();
+    scriptThread = this_thread::get_id();
     if (luaState == nullptr)
     {
         clog << "ScriptedOrbits are currently disabled.\n";
@@ -153,13 +174,103 @@ ScriptedOrbit::initialize(const std::string& moduleName,
         return false;
     }
 
+    parameters->getNumber("SampleTolerance", sampleTolerance);
+    parameters->getNumber("SampleWindow", sampleWindow);
+    if (sampleTolerance > 0.0 && validRangeBegin < validRangeEnd)
+    {
+        if (sampleWindow <= 0.0 || sampleWindow >= validRangeEnd - validRangeBegin)
+        {
+            samples = sampleRange(validRangeBegin, validRangeEnd);
+            sampleWindow = 0.0;
+        }
+    }
+    else if (sampleTolerance > 0.0 && sampleWindow <= 0.0)
+    {
+        sampleWindow = DefaultSampleWindow;
+    }
+
     return true;
 }
 
 
-// Call the position method of the ScriptedOrbit object
+shared_ptr<const ChebyshevOrbit>
+ScriptedOrbit::sampleRange(double begin, double end) const
+{
+    auto position = [this](double tjd) { return callPosition(tjd); };
+    return shared_ptr<const ChebyshevOrbit>(ChebyshevOrbit::fit(position, begin, end,
+                                                                ChebyshevOrbit::DefaultDegree,
+                                                                sampleTolerance,
+                                                                MinSampleInterval));
+}
+
+
+// Return the position from the fitted polynomials if they cover the time.
+// Only moving the sample window requires calling the script, so positions
+// can be computed on any thread as long as it doesn't need to be moved.
 Vector3d
 ScriptedOrbit::computePosition(double tjd) const
+{
+    Vector3d pos;
+    bool canCallScript = this_thread::get_id() == scriptThread;
+    if (sampleTolerance > 0.0)
+    {
+        auto table = atomic_load(&samples);
+        double begin = 0.0, end = 0.0;
+        if (table != nullptr)
+            table->getValidRange(begin, end);
+
+        if (!canCallScript)
+        {
+            pos = table != nullptr ? table->evaluatePosition(tjd) : Vector3d::Zero();
+            return Vector3d(pos.x(), pos.z(), -pos.y());
+        }
+
+        // Center the window on the nearest time in the valid range, so that
+        // times past either end don't produce an empty window or resample the
+        // same window on every call.
+        double center = tjd;
+        if (validRangeBegin < validRangeEnd)
+            center = min(max(tjd, validRangeBegin), validRangeEnd);
+
+        if ((table == nullptr || center < begin || center > end) && sampleWindow > 0.0)
+        {
+            begin = center - sampleWindow / 2.0;
+            end = center + sampleWindow / 2.0;
+            if (validRangeBegin < validRangeEnd)
+            {
+                begin = max(begin, validRangeBegin);
+                end = min(end, validRangeEnd);
+            }
+
+            auto fitted = begin < end ? sampleRange(begin, end) : nullptr;
+            if (fitted != nullptr)
+            {
+                table = fitted;
+                atomic_store(&samples, table);
+            }
+            else if (table != nullptr)
+            {
+                table->getValidRange(begin, end);
+            }
+        }
+
+        if (table != nullptr && tjd >= begin && tjd <= end)
+        {
+            pos = table->evaluatePosition(tjd);
+            return Vector3d(pos.x(), pos.z(), -pos.y());
+        }
+    }
+
+    pos = canCallScript ? callPosition(tjd) : Vector3d::Zero();
+
+    // Convert to Celestia's internal coordinate system
+    return Vector3d(pos.x(), pos.z(), -pos.y());
+}
+
+
+// Call the position method of the ScriptedOrbit object
+Vector3d
+ScriptedOrbit::callPosition(double tjd) const
 {
     Vector3d pos(Vector3d::Zero());
     lua_getglobal(luaState, luaOrbitObjectName.c_str());
@@ -197,8 +308,7 @@ ScriptedOrbit::computePosition(double tjd) const
     // Pop the script orbit object
     lua_pop(luaState, 1);
 
-    // Convert to Celestia's internal coordinate system
-    return Vector3d(pos.x(), pos.z(), -pos.y());
+    return pos;
 }
 
 
@@ -12,10 +12,13 @@
 #ifndef _CELENGINE_SCRIPTORBIT_H_
 #define _CELENGINE_SCRIPTORBIT_H_
 
+#include <memory>
+#include <thread>
 #include <celengine/parser.h>
 #include "orbit.h"
 
 struct lua_State;
+class ChebyshevOrbit;
 
 class ScriptedOrbit : public CachingOrbit
 {
@@ -35,12 +38,27 @@ class ScriptedOrbit : public CachingOrbit
     virtual void getValidRange(double& begin, double& end) const;
 
  private:
+    Eigen::Vector3d callPosition(double tjd) const;
+    std::shared_ptr<const ChebyshevOrbit> sampleRange(double begin, double end) const;
+
     lua_State* luaState{ nullptr };
     std::string luaOrbitObjectName;
     double boundingRadius{ 1.0 };
     double period{ 0.0 };
     double validRangeBegin{ 0.0 };
     double validRangeEnd{ 0.0 };
+
+    // When the tolerance (km) is positive, positions come from polynomials
+    // fitted to the script function, either over the whole valid range or
+    // over a window of sampleWindow days around the requested time.
+    double sampleTolerance{ 0.0 };
+    double sampleWindow{ 0.0 };
+    mutable std::shared_ptr<const ChebyshevOrbit> samples;
+
+    // The Lua state is shared with the scripts running on the thread which
+    // created the orbit, so it's only called from there. Other threads get
+    // positions from the current samples, clamped to their range.
+    std::thread::id scriptThread;
 };
 
 #endif // _CELENGINE_SCRIPTORBIT_H_
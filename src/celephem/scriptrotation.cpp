@@ -9,14 +9,30 @@
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
 
+#include <algorithm>
 #include <cstdio>
 #include <cassert>
+#include <cmath>
+#include <thread>
+#include <celmath/mathlib.h>
 #include "scriptobject.h"
 #include "scriptrotation.h"
 
 using namespace Eigen;
 using namespace std;
 
+// Window sampled at a time when a rotation with an unlimited valid range is
+// sampled without an explicit SampleWindow
+constexpr double DefaultSampleWindow = 365.25;
+
+// Shortest interval between keys, one minute
+constexpr double MinSampleInterval = 1.0 / 1440.0;
+
+// The range is split into at least 2^MinSampleDepth intervals, so that
+// rotations that happen to agree with the interpolation at the midpoints of
+// longer intervals aren't missed.
+constexpr int MinSampleDepth = 4;
+
 
 /*! Initialize the script rotation
  *  moduleName is the name of a module that contains the rotation factory
@@ -39,6 +55,11 @@ using namespace std;
  *      orientation(time) - The orientation function takes a time value as
  *         input (TDB Julian day) and returns three values which are the the
  *         quaternion (w, x, y, z).
+ *
+ *  With a SampleTolerance (degrees) in the rotation definition, the
+ *  orientation function is sampled into keys that are interpolated with at
+ *  most that error instead of being called for every orientation. The
+ *  SampleWindow (days) works as for ScriptedOrbit.
  */
 bool
 ScriptedRotation::initialize(const std::string& moduleName,
@@ -49,6 +70,7 @@ ScriptedRotation::initialize(const std::string& moduleName,
         return false;
 
     luaState = GetScriptedObjectContext();
+    scriptThread = this_thread::get_id();
     if (luaState == nullptr)
     {
         clog << "ScriptedRotations are currently disabled.\n";
@@ -130,57 +152,189 @@ ScriptedRotation::initialize(const std::string& moduleName,
         return false;
     }
 
+    parameters->getNumber("SampleTolerance", sampleTolerance);
+    parameters->getNumber("SampleWindow", sampleWindow);
+    if (sampleTolerance > 0.0 && validRangeBegin < validRangeEnd)
+    {
+        if (sampleWindow <= 0.0 || sampleWindow >= validRangeEnd - validRangeBegin)
+        {
+            samples = sampleRange(validRangeBegin, validRangeEnd);
+            sampleWindow = 0.0;
+        }
+    }
+    else if (sampleTolerance > 0.0 && sampleWindow <= 0.0)
+    {
+        sampleWindow = DefaultSampleWindow;
+    }
+
     return true;
 }
 
 
-// Call the position method of the ScriptedRotation object
+// Bisect intervals until slerp between their ends is within the tolerance
+// of the orientation at their middle.
+shared_ptr<const ScriptedRotation::OrientationKeys>
+ScriptedRotation::sampleRange(double begin, double end) const
+{
+    struct Interval
+    {
+        double t0, t1;
+        Quaterniond q0, q1;
+        int depth;
+    };
+
+    auto keys = make_shared<OrientationKeys>();
+    Quaterniond q0 = Quaterniond::Identity();
+    Quaterniond q1 = Quaterniond::Identity();
+    callOrientation(begin, q0);
+    callOrientation(end, q1);
+    keys->times.push_back(begin);
+    keys->orientations.push_back(q0);
+
+    double maxAngle = celmath::degToRad(sampleTolerance);
+    vector<Interval, aligned_allocator<Interval>> pending;
+    pending.push_back({ begin, end, q0, q1, 0 });
+    while (!pending.empty())
+    {
+        Interval i = pending.back();
+        pending.pop_back();
+
+        double tm = 0.5 * (i.t0 + i.t1);
+        Quaterniond qm = i.q0;
+        callOrientation(tm, qm);
+
+        double angle = qm.angularDistance(i.q0.slerp(0.5, i.q1));
+        if (i.t1 - i.t0 > 2.0 * MinSampleInterval &&
+            (angle > maxAngle || i.depth < MinSampleDepth))
+        {
+            pending.push_back({ tm, i.t1, qm, i.q1, i.depth + 1 });
+            pending.push_back({ i.t0, tm, i.q0, qm, i.depth + 1 });
+            continue;
+        }
+
+        keys->times.push_back(i.t1);
+        keys->orientations.push_back(i.q1);
+    }
+
+    return keys;
+}
+
+
+// Interpolate the sampled keys if they cover the time. Only moving the
+// sample window requires calling the script, so orientations can be
+// computed on any thread as long as it doesn't need to be moved.
 Quaterniond
 ScriptedRotation::spin(double tjd) const
 {
+    bool canCallScript = this_thread::get_id() == scriptThread;
+    if (sampleTolerance > 0.0)
+    {
+        // Center the window on the nearest time in the valid range, as for
+        // scripted orbits.
+        double center = tjd;
+        if (validRangeBegin < validRangeEnd)
+            center = min(max(tjd, validRangeBegin), validRangeEnd);
+
+        auto keys = atomic_load(&samples);
+        if (!canCallScript)
+        {
+            if (keys == nullptr)
+                return Quaterniond::Identity();
+            tjd = min(max(tjd, keys->times.front()), keys->times.back());
+        }
+        else if ((keys == nullptr || center < keys->times.front() || center > keys->times.back()) &&
+                 sampleWindow > 0.0)
+        {
+            double begin = center - sampleWindow / 2.0;
+            double end = center + sampleWindow / 2.0;
+            if (validRangeBegin < validRangeEnd)
+            {
+                begin = max(begin, validRangeBegin);
+                end = min(end, validRangeEnd);
+            }
+
+            if (begin < end)
+            {
+                keys = sampleRange(begin, end);
+                atomic_store(&samples, keys);
+            }
+        }
+
+        if (keys != nullptr && tjd >= keys->times.front() && tjd <= keys->times.back())
+        {
+            auto iter = upper_bound(keys->times.begin(), keys->times.end(), tjd);
+            size_t n = min((size_t) (iter - keys->times.begin()), keys->times.size() - 1);
+            if (n == 0)
+                return keys->orientations.front();
+
+            double t0 = keys->times[n - 1];
+            double t1 = keys->times[n];
+            return keys->orientations[n - 1].slerp((tjd - t0) / (t1 - t0), keys->orientations[n]);
+        }
+    }
+
+    if (!canCallScript)
+        return Quaterniond::Identity();
+
     if (tjd != lastTime || !cacheable)
     {
-        lua_getglobal(luaState, luaRotationObjectName.c_str());
-        if (lua_istable(luaState, -1))
+        Quaterniond q;
+        if (callOrientation(tjd, q))
         {
-            lua_pushstring(luaState, "orientation");
-            lua_gettable(luaState, -2);
-            if (lua_isfunction(luaState, -1))
+            lastOrientation = q;
+            lastTime = tjd;
+        }
+    }
+
+    return lastOrientation;
+}
+
+
+// Call the orientation method of the ScriptedRotation object
+bool
+ScriptedRotation::callOrientation(double tjd, Quaterniond& q) const
+{
+    bool result = false;
+    lua_getglobal(luaState, luaRotationObjectName.c_str());
+    if (lua_istable(luaState, -1))
+    {
+        lua_pushstring(luaState, "orientation");
+        lua_gettable(luaState, -2);
+        if (lua_isfunction(luaState, -1))
+        {
+            lua_pushvalue(luaState, -2); // push 'self' on stack
+            lua_pushnumber(luaState, tjd);
+            if (lua_pcall(luaState, 2, 4, 0) == 0)
             {
-                lua_pushvalue(luaState, -2); // push 'self' on stack
-                lua_pushnumber(luaState, tjd);
-                if (lua_pcall(luaState, 2, 4, 0) == 0)
-                {
-                    lastOrientation = Quaterniond(lua_tonumber(luaState, -4),
-                                                  lua_tonumber(luaState, -3),
-                                                  lua_tonumber(luaState, -2),
-                                                  lua_tonumber(luaState, -1));
-                    lua_pop(luaState, 4);
-                    lastTime = tjd;
-                }
-                else
-                {
-                    // Function call failed for some reason
-                    //clog << "ScriptedRotation failed: " << lua_tostring(luaState, -1) << "\n";
-                    lua_pop(luaState, 1);
-                }
+                q = Quaterniond(lua_tonumber(luaState, -4),
+                                lua_tonumber(luaState, -3),
+                                lua_tonumber(luaState, -2),
+                                lua_tonumber(luaState, -1));
+                lua_pop(luaState, 4);
+                result = true;
             }
             else
             {
-                // Bad orientation function
+                // Function call failed for some reason
+                //clog << "ScriptedRotation failed: " << lua_tostring(luaState, -1) << "\n";
                 lua_pop(luaState, 1);
             }
         }
         else
         {
-            // The script rotation object disappeared. OOPS.
+            // Bad orientation function
+            lua_pop(luaState, 1);
         }
-
-        // Pop the script rotation object
-        lua_pop(luaState, 1);
+    }
+    else
+    {
+        // The script rotation object disappeared. OOPS.
     }
 
-    return lastOrientation;
+    // Pop the script rotation object
+    lua_pop(luaState, 1);
+
+    return result;
 }
 
 
@@ -12,6 +12,10 @@
 #ifndef _CELENGINE_SCRIPTROTATION_H_
 #define _CELENGINE_SCRIPTROTATION_H_
 
+#include <memory>
+#include <thread>
+#include <vector>
+#include <Eigen/StdVector>
 #include <celengine/parser.h>
 #include "rotation.h"
 
@@ -35,6 +39,16 @@ class ScriptedRotation : public RotationModel
     virtual void getValidRange(double& begin, double& end) const;
 
  private:
+    // Orientations sampled from the script, interpolated with slerp
+    struct OrientationKeys
+    {
+        std::vector<double> times;
+        std::vector<Eigen::Quaterniond, Eigen::aligned_allocator<Eigen::Quaterniond>> orientations;
+    };
+
+    bool callOrientation(double tjd, Eigen::Quaterniond& q) const;
+    std::shared_ptr<const OrientationKeys> sampleRange(double begin, double end) const;
+
     lua_State* luaState{ nullptr };
     std::string luaRotationObjectName;
     double period{ 0.0 };
@@ -46,6 +60,17 @@ class ScriptedRotation : public RotationModel
     mutable Eigen::Quaterniond lastOrientation{Eigen::Quaterniond::Identity()};
 
     bool cacheable{ true }; // non-cacheable rotations not yet supported
+
+    // When the tolerance (degrees) is positive, orientations come from keys
+    // sampled from the script, either over the whole valid range or over a
+    // window of sampleWindow days around the requested time.
+    double sampleTolerance{ 0.0 };
+    double sampleWindow{ 0.0 };
+    mutable std::shared_ptr<const OrientationKeys> samples;
+
+    // As for ScriptedOrbit, only the thread which created the rotation calls
+    // the script; other threads get orientations from the current keys.
+    std::thread::id scriptThread;
 };
 
 #endif // _CELENGINE_SCRIPTROTATION_H_
@@ -11,11 +11,13 @@
 
 #include <iostream>
 #include <cstdio>
+#include <map>
 #include <utility>
 #include "SpiceUsr.h"
 #include <celengine/astro.h>
 #include "spiceorbit.h"
 #include "spiceinterface.h"
+#include "spkreader.h"
 
 using namespace Eigen;
 using namespace std;
@@ -23,6 +25,28 @@ using namespace std;
 
 static const double MILLISEC = astro::secsToDays(0.001);
 
+// Largest difference in km between positions from SPICE and the built-in
+// reader for the latter to be used.
+static const double NativeTolerance = 1.0e-3;
+
+
+// SPK files are shared by all orbits using them, like kernels in the SPICE
+// kernel pool.
+static shared_ptr<const SpkFile> GetSpkFile(const string& filename)
+{
+    static map<string, shared_ptr<const SpkFile>> spkFiles;
+
+    auto iter = spkFiles.find(filename);
+    if (iter != spkFiles.end())
+        return iter->second;
+
+    auto file = make_shared<SpkFile>();
+    if (!file->open(filename))
+        file = nullptr;
+    spkFiles[filename] = file;
+    return file;
+}
+
 /*! Create a new SPICE orbit using with a valid interval specified
  *  by beginning and ending.
  */
@@ -119,6 +143,7 @@ SpiceOrbit::init(const fs::path& path,
 
     SpiceInt spkCount = 0;
     ktotal_c("spk", &spkCount);
+    vector<string> spkFiles;
 
     // Get coverage window for target and origin object
     const int MaxIntervals = 10;
@@ -138,6 +163,7 @@ SpiceOrbit::init(const fs::path& path,
         kdata_c(i, "spk",
                 sizeof(filename), sizeof(filetype), sizeof(source),
                 filename, filetype, source, &handle, &found);
+        spkFiles.push_back(filename);
 
         // First check the coverage window of the target. No interval
         // is required for ID 0 (the solar system barycenter) which is
@@ -228,10 +254,58 @@ SpiceOrbit::init(const fs::path& path,
         reset_c();
     }
 
+    if (!spiceErr)
+        initNativeEphemeris(spkFiles);
+
     return !spiceErr;
 }
 
 
+/*! Set up the built-in SPK reader for the loaded kernels, keeping their
+ *  order. It is only used when it agrees with SPICE at the ends and the
+ *  middle of the valid interval.
+ */
+void
+SpiceOrbit::initNativeEphemeris(const vector<string>& spkFiles)
+{
+    // The solar system barycenter has an unlimited interval
+    if (validIntervalBegin < -1.0e40 || validIntervalEnd > 1.0e40)
+        return;
+
+    auto ephemeris = make_shared<SpkEphemeris>();
+    for (const auto& filename : spkFiles)
+    {
+        auto file = GetSpkFile(filename);
+        if (file == nullptr)
+            return;
+        ephemeris->addFile(file);
+    }
+
+    double middle = (validIntervalBegin + validIntervalEnd) / 2.0;
+    for (double jd : { validIntervalBegin, middle, validIntervalEnd })
+    {
+        double t = astro::daysToSecs(jd - astro::J2000);
+        double position[3];
+        double lt = 0.0;
+        spkgps_c(targetID, t, "eclipj2000", originID, position, &lt);
+        if (failed_c())
+        {
+            reset_c();
+            return;
+        }
+
+        Vector3d nativePosition;
+        if (!ephemeris->getState(targetID, originID, t, nativePosition, nullptr) ||
+            (nativePosition - Map<Vector3d>(position)).norm() > NativeTolerance)
+        {
+            return;
+        }
+    }
+
+    nativeEphemeris = ephemeris;
+}
+
+
 Vector3d
 SpiceOrbit::computePosition(double jd) const
 {
@@ -248,6 +322,15 @@ SpiceOrbit::computePosition(double jd) const
     {
         // Input time for SPICE is seconds after J2000
         double t = astro::daysToSecs(jd - astro::J2000);
+
+        Vector3d nativePosition;
+        if (nativeEphemeris != nullptr &&
+            nativeEphemeris->getState(targetID, originID, t, nativePosition, nullptr))
+        {
+            // Transform into Celestia's coordinate system
+            return Vector3d(nativePosition.x(), nativePosition.z(), -nativePosition.y());
+        }
+
         double position[3];
         double lt;          // One way light travel time
 
@@ -293,6 +376,16 @@ SpiceOrbit::computeVelocity(double jd) const
     {
         // Input time for SPICE is seconds after J2000
         double t = astro::daysToSecs(jd - astro::J2000);
+        double d2s = astro::daysToSecs(1.0);
+
+        Vector3d nativePosition, nativeVelocity;
+        if (nativeEphemeris != nullptr &&
+            nativeEphemeris->getState(targetID, originID, t, nativePosition, &nativeVelocity))
+        {
+            // Transform into Celestia's coordinate system, and from km/s to km/day
+            return Vector3d(nativeVelocity.x(), nativeVelocity.z(), -nativeVelocity.y()) * d2s;
+        }
+
         double state[6];
         double lt;          // One way light travel time
 
@@ -317,7 +410,6 @@ SpiceOrbit::computeVelocity(double jd) const
         }
 
         // Transform into Celestia's coordinate system, and from km/s to km/day
-        double d2s = astro::daysToSecs(1.0);
         return Vector3d(state[3] * d2s, state[5] * d2s, -state[4] * d2s);
     }
 }
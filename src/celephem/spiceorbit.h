@@ -15,8 +15,12 @@
 #include "orbit.h"
 #include <string>
 #include <list>
+#include <memory>
+#include <vector>
 #include <celcompat/filesystem.h>
 
+class SpkEphemeris;
+
 
 class SpiceOrbit : public CachingOrbit
 {
@@ -50,6 +54,8 @@ class SpiceOrbit : public CachingOrbit
     virtual void getValidRange(double& begin, double& end) const;
 
  private:
+    void initNativeEphemeris(const std::vector<std::string>& spkFiles);
+
     const std::string targetBodyName;
     const std::string originName;
     double period;
@@ -64,6 +70,10 @@ class SpiceOrbit : public CachingOrbit
     double validIntervalEnd;
 
     bool useDefaultTimeInterval;
+
+    // Evaluates the kernels without SPICE when all segments needed are
+    // supported by the built-in reader
+    std::shared_ptr<const SpkEphemeris> nativeEphemeris;
 };
 
 #endif // _CELENGINE_SPICEORBIT_H_
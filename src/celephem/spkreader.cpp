@@ -0,0 +1,437 @@
+// spkreader.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// The file layout follows the DAF and SPK Required Reading documents of the
+// SPICE Toolkit.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <celengine/astro.h>
+#include <celutil/bytes.h>
+#include "spkreader.h"
+
+using namespace Eigen;
+using namespace std;
+
+// DAF files are made of 1024 byte records
+constexpr size_t RecordSize = 1024;
+constexpr size_t RecordDoubles = RecordSize / sizeof(double);
+
+constexpr int FrameJ2000 = 1;
+constexpr int FrameEclipJ2000 = 17;
+
+// SPICE allows up to 27th degree Hermite polynomials
+constexpr unsigned int MaxHermiteWindow = 32;
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr char NativeFormat[] = "BIG-IEEE";
+#else
+constexpr char NativeFormat[] = "LTL-IEEE";
+#endif
+
+namespace
+{
+// SPICE uses the J2000 obliquity of the ecliptic for the ECLIPJ2000 frame
+Vector3d equatorialToEcliptic(const Vector3d& v)
+{
+    static const double c = cos(astro::J2000Obliquity);
+    static const double s = sin(astro::J2000Obliquity);
+    return Vector3d(v.x(), c * v.y() + s * v.z(), -s * v.y() + c * v.z());
+}
+
+// Value and derivative of a Chebyshev series at x in [-1, 1]
+void chebyshev(const double* c, size_t n, double x, double& value, double& derivative)
+{
+    double t0 = 1.0, t1 = x;
+    double dt0 = 0.0, dt1 = 1.0;
+
+    value = c[0];
+    derivative = 0.0;
+    if (n > 1)
+    {
+        value += c[1] * t1;
+        derivative += c[1] * dt1;
+    }
+    for (size_t j = 2; j < n; j++)
+    {
+        double t2 = 2.0 * x * t1 - t0;
+        double dt2 = 2.0 * t1 + 2.0 * x * dt1 - dt0;
+        value += c[j] * t2;
+        derivative += c[j] * dt2;
+        t0 = t1; t1 = t2;
+        dt0 = dt1; dt1 = dt2;
+    }
+}
+
+// Value and derivative at x of the Hermite polynomial matching the values
+// f and derivatives df at the n times t, relative to t[0] to keep the
+// divided differences well conditioned.
+void hermite(const double* t, const double* f, const double* df, size_t n,
+             double x, double& value, double& derivative)
+{
+    double z[2 * MaxHermiteWindow];
+    double d[2 * MaxHermiteWindow];
+    size_t m = 2 * n;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        z[2 * i] = z[2 * i + 1] = t[i] - t[0];
+        d[2 * i] = d[2 * i + 1] = f[i];
+    }
+
+    // Divided differences in place; nodes are doubled, so first order
+    // differences of equal nodes are the derivatives.
+    for (size_t i = m - 1; i >= 1; i--)
+    {
+        if (i % 2 == 1)
+            d[i] = df[i / 2];
+        else
+            d[i] = (d[i] - d[i - 1]) / (z[i] - z[i - 1]);
+    }
+    for (size_t j = 2; j < m; j++)
+    {
+        for (size_t i = m - 1; i >= j; i--)
+            d[i] = (d[i] - d[i - 1]) / (z[i] - z[i - j]);
+    }
+
+    x -= t[0];
+    value = d[m - 1];
+    derivative = 0.0;
+    for (size_t j = m - 1; j-- > 0;)
+    {
+        derivative = derivative * (x - z[j]) + value;
+        value = value * (x - z[j]) + d[j];
+    }
+}
+}
+
+
+bool SpkFile::isSPK(const fs::path& filename)
+{
+    ifstream in(filename.string(), ios::binary);
+    char idWord[8];
+    return in.read(idWord, sizeof(idWord)) && memcmp(idWord, "DAF/SPK ", sizeof(idWord)) == 0;
+}
+
+
+const double* SpkFile::getData(size_t offset) const
+{
+    return reinterpret_cast<const double*>(file.getData()) + offset;
+}
+
+
+bool SpkFile::open(const fs::path& filename)
+{
+    segments.clear();
+    if (!file.open(filename) || file.getSize() < RecordSize)
+        return false;
+
+    const char* header = file.getData();
+    if (memcmp(header, "DAF/SPK ", 8) != 0 || memcmp(header + 88, NativeFormat, 8) != 0)
+        return false;
+
+    int32_t nd, ni, forward;
+    memcpy(&nd, header + 8, sizeof(nd));
+    memcpy(&ni, header + 12, sizeof(ni));
+    memcpy(&forward, header + 76, sizeof(forward));
+    if (nd != 2 || ni != 6)
+        return false;
+
+    size_t summarySize = nd + (ni + 1) / 2;
+    size_t nRecords = file.getSize() / RecordSize;
+
+    // Follow the linked list of summary records; the count guards against
+    // cycles in damaged files.
+    size_t record = (size_t) forward;
+    for (size_t count = 0; record != 0 && count < nRecords; count++)
+    {
+        if (record > nRecords)
+            return false;
+
+        const double* summaries = getData((record - 1) * RecordDoubles);
+        auto nSummaries = (size_t) summaries[2];
+        if (3 + nSummaries * summarySize > RecordDoubles)
+            return false;
+
+        for (size_t i = 0; i < nSummaries; i++)
+        {
+            if (!readSegment(summaries + 3 + i * summarySize, nd, ni))
+                return false;
+        }
+
+        record = (size_t) summaries[0];
+    }
+
+    return true;
+}
+
+
+bool SpkFile::readSegment(const double* summary, int nd, int /* ni */)
+{
+    int32_t ints[6];
+    memcpy(ints, summary + nd, sizeof(ints));
+
+    Segment s;
+    s.begin = summary[0];
+    s.end = summary[1];
+    s.target = ints[0];
+    s.center = ints[1];
+    s.frame = ints[2];
+    s.type = ints[3];
+    s.first = (size_t) ints[4] - 1;
+    s.last = (size_t) ints[5] - 1;
+    s.init = s.intervalLength = 0.0;
+    s.recordSize = s.nRecords = s.nStates = 0;
+    s.windowSize = 0;
+    s.supported = false;
+
+    if (ints[4] < 1 || s.last < s.first || (s.last + 1) * sizeof(double) > file.getSize())
+        return false;
+
+    size_t length = s.last - s.first + 1;
+    bool knownFrame = s.frame == FrameJ2000 || s.frame == FrameEclipJ2000;
+
+    if ((s.type == 2 || s.type == 3) && length >= 4)
+    {
+        const double* trailer = getData(s.last - 3);
+        s.init = trailer[0];
+        s.intervalLength = trailer[1];
+        s.recordSize = (size_t) trailer[2];
+        s.nRecords = (size_t) trailer[3];
+
+        size_t nComponents = s.type == 2 ? 3 : 6;
+        s.supported = knownFrame &&
+                      s.intervalLength > 0.0 &&
+                      s.nRecords > 0 &&
+                      s.recordSize > 2 + nComponents &&
+                      (s.recordSize - 2) % nComponents == 0 &&
+                      s.nRecords * s.recordSize + 4 <= length;
+    }
+    else if (s.type == 13 && length >= 2)
+    {
+        const double* trailer = getData(s.last - 1);
+        s.windowSize = (unsigned int) trailer[0] + 1;
+        s.nStates = (size_t) trailer[1];
+
+        s.supported = knownFrame &&
+                      s.nStates >= 2 &&
+                      s.windowSize >= 2 && s.windowSize <= MaxHermiteWindow &&
+                      7 * s.nStates + (s.nStates - 1) / 100 + 2 <= length;
+    }
+
+    segments.push_back(s);
+    return true;
+}
+
+
+bool SpkFile::evaluate(const Segment& s, double et, Vector3d& position, Vector3d* velocity) const
+{
+    if (!s.supported)
+        return false;
+
+    Vector3d pos, vel;
+
+    if (s.type == 2 || s.type == 3)
+    {
+        // Records cover consecutive intervals of equal length
+        double k = floor((et - s.init) / s.intervalLength);
+        auto n = (size_t) max(0.0, min(k, (double) (s.nRecords - 1)));
+        const double* r = getData(s.first + n * s.recordSize);
+
+        double mid = r[0];
+        double radius = r[1];
+        size_t nCoeffs = (s.recordSize - 2) / (s.type == 2 ? 3 : 6);
+        double x = (et - mid) / radius;
+
+        for (int i = 0; i < 3; i++)
+        {
+            double value, derivative;
+            chebyshev(r + 2 + i * nCoeffs, nCoeffs, x, value, derivative);
+            pos[i] = value;
+            if (s.type == 2)
+            {
+                vel[i] = derivative / radius;
+            }
+            else if (velocity != nullptr)
+            {
+                chebyshev(r + 2 + (i + 3) * nCoeffs, nCoeffs, x, value, derivative);
+                vel[i] = value;
+            }
+        }
+    }
+    else
+    {
+        const double* states = getData(s.first);
+        const double* epochs = states + 6 * s.nStates;
+        size_t window = min((size_t) s.windowSize, s.nStates);
+
+        // Choose the window so that it is centered on et as far as possible,
+        // as SPICE does.
+        size_t upper = upper_bound(epochs, epochs + s.nStates, et) - epochs;
+        ptrdiff_t first;
+        if (window % 2 == 1)
+        {
+            size_t nearest = upper;
+            if (upper == s.nStates || (upper > 0 && et - epochs[upper - 1] <= epochs[upper] - et))
+                nearest = upper - 1;
+            first = (ptrdiff_t) nearest - (ptrdiff_t) (window / 2);
+        }
+        else
+        {
+            first = (ptrdiff_t) upper - (ptrdiff_t) (window / 2);
+        }
+        first = max((ptrdiff_t) 0, min(first, (ptrdiff_t) (s.nStates - window)));
+
+        double f[MaxHermiteWindow];
+        double df[MaxHermiteWindow];
+        for (int i = 0; i < 3; i++)
+        {
+            for (size_t j = 0; j < window; j++)
+            {
+                f[j] = states[(first + j) * 6 + i];
+                df[j] = states[(first + j) * 6 + i + 3];
+            }
+
+            double value, derivative;
+            hermite(epochs + first, f, df, window, et, value, derivative);
+            pos[i] = value;
+            vel[i] = derivative;
+        }
+    }
+
+    if (s.frame == FrameJ2000)
+    {
+        position = equatorialToEcliptic(pos);
+        if (velocity != nullptr)
+            *velocity = equatorialToEcliptic(vel);
+    }
+    else
+    {
+        position = pos;
+        if (velocity != nullptr)
+            *velocity = vel;
+    }
+
+    return true;
+}
+
+
+void SpkEphemeris::addFile(const shared_ptr<const SpkFile>& file)
+{
+    files.push_back(file);
+
+    for (const auto& segment : file->getSegments())
+    {
+        auto& refs = segmentsByTarget[segment.target];
+        refs.insert(refs.begin(), SegmentRef { file.get(), &segment });
+    }
+}
+
+
+const SpkEphemeris::SegmentRef* SpkEphemeris::findSegment(int body, double et) const
+{
+    auto iter = segmentsByTarget.find(body);
+    if (iter == segmentsByTarget.end())
+        return nullptr;
+
+    for (const auto& ref : iter->second)
+    {
+        if (et >= ref.segment->begin && et <= ref.segment->end)
+            return &ref;
+    }
+
+    return nullptr;
+}
+
+
+// Collect the bodies from body along the chain of segment centers, with
+// the positions of each relative to body.
+bool SpkEphemeris::getChain(int body, double et, vector<int>& bodies,
+                            vector<Vector3d>& positions,
+                            vector<Vector3d>* velocities) const
+{
+    Vector3d pos = Vector3d::Zero();
+    Vector3d vel = Vector3d::Zero();
+
+    // Chains in real kernels are only a few segments long
+    for (int depth = 0; depth < 32; depth++)
+    {
+        bodies.push_back(body);
+        positions.push_back(pos);
+        if (velocities != nullptr)
+            velocities->push_back(vel);
+
+        const SegmentRef* ref = findSegment(body, et);
+        if (ref == nullptr)
+            return true;
+
+        Vector3d p, v;
+        if (!ref->file->evaluate(*ref->segment, et, p, velocities != nullptr ? &v : nullptr))
+            return false;
+
+        // Position of the center relative to the first body
+        pos -= p;
+        if (velocities != nullptr)
+            vel -= v;
+        body = ref->segment->center;
+    }
+
+    return false;
+}
+
+
+bool SpkEphemeris::getState(int target, int observer, double et,
+                            Vector3d& position, Vector3d* velocity) const
+{
+    vector<int> targetBodies, observerBodies;
+    vector<Vector3d> targetPositions, observerPositions;
+    vector<Vector3d> targetVelocities, observerVelocities;
+
+    if (!getChain(target, et, targetBodies, targetPositions,
+                  velocity != nullptr ? &targetVelocities : nullptr) ||
+        !getChain(observer, et, observerBodies, observerPositions,
+                  velocity != nullptr ? &observerVelocities : nullptr))
+    {
+        return false;
+    }
+
+    // Find the first body of the target chain that the observer chain
+    // reaches too, and compute both positions relative to it.
+    for (size_t i = 0; i < targetBodies.size(); i++)
+    {
+        auto iter = find(observerBodies.begin(), observerBodies.end(), targetBodies[i]);
+        if (iter == observerBodies.end())
+            continue;
+
+        size_t j = iter - observerBodies.begin();
+        position = observerPositions[j] - targetPositions[i];
+        if (velocity != nullptr)
+            *velocity = observerVelocities[j] - targetVelocities[i];
+        return true;
+    }
+
+    return false;
+}
+
+
+bool SpkEphemeris::getPositions(int target, int observer,
+                                const double* et, size_t count,
+                                Vector3d* positions) const
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!getState(target, observer, et[i], positions[i], nullptr))
+            return false;
+    }
+
+    return true;
+}
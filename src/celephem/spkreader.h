@@ -0,0 +1,111 @@
+// spkreader.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// Reader for SPICE SPK kernels which works without the SPICE Toolkit.
+// Kernels are memory mapped and segments of types 2, 3 (Chebyshev
+// polynomials) and 13 (Hermite interpolation of unequally spaced states)
+// are evaluated directly. All queries are reentrant.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <Eigen/Core>
+#include <celcompat/filesystem.h>
+#include <celutil/mappedfile.h>
+
+class SpkFile
+{
+ public:
+    struct Segment
+    {
+        double begin;           // seconds past J2000 TDB
+        double end;
+        int target;             // NAIF ID codes
+        int center;
+        int frame;
+        int type;
+        size_t first;           // offsets of the segment data in doubles
+        size_t last;
+
+        // Chebyshev segments (types 2 and 3)
+        double init;
+        double intervalLength;
+        size_t recordSize;
+        size_t nRecords;
+
+        // Hermite segments (type 13)
+        size_t nStates;
+        unsigned int windowSize;
+
+        bool supported;
+    };
+
+    SpkFile() = default;
+    SpkFile(const SpkFile&) = delete;
+    SpkFile& operator=(const SpkFile&) = delete;
+
+    // Fails for files which aren't SPK kernels in the native byte order.
+    bool open(const fs::path& filename);
+
+    const std::vector<Segment>& getSegments() const { return segments; }
+
+    // Position (km) and velocity (km/s) of the segment target relative to
+    // its center in the J2000 ecliptic frame. Velocity may be null.
+    bool evaluate(const Segment& segment, double et,
+                  Eigen::Vector3d& position, Eigen::Vector3d* velocity) const;
+
+    static bool isSPK(const fs::path& filename);
+
+ private:
+    bool readSegment(const double* summary, int nd, int ni);
+    const double* getData(size_t offset) const;
+
+    MappedFile file;
+    std::vector<Segment> segments;
+};
+
+
+// A set of SPK files searched like the SPICE kernel pool: segments of files
+// added later take precedence, as do later segments of the same file.
+class SpkEphemeris
+{
+ public:
+    void addFile(const std::shared_ptr<const SpkFile>& file);
+
+    // State of target relative to observer at et seconds past J2000 TDB, in
+    // km and km/s in the J2000 ecliptic frame. This follows the chains of
+    // segment centers of both bodies up to a common body, and fails if
+    // there is no such body or a segment on the way can't be evaluated.
+    bool getState(int target, int observer, double et,
+                  Eigen::Vector3d& position, Eigen::Vector3d* velocity) const;
+
+    // Positions for a batch of times; false if any of them fails.
+    bool getPositions(int target, int observer,
+                      const double* et, size_t count,
+                      Eigen::Vector3d* positions) const;
+
+ private:
+    struct SegmentRef
+    {
+        const SpkFile* file;
+        const SpkFile::Segment* segment;
+    };
+
+    const SegmentRef* findSegment(int body, double et) const;
+    bool getChain(int body, double et, std::vector<int>& bodies,
+                  std::vector<Eigen::Vector3d>& positions,
+                  std::vector<Eigen::Vector3d>* velocities) const;
+
+    std::vector<std::shared_ptr<const SpkFile>> files;
+
+    // Segments of each target body, highest priority first
+    std::map<int, std::vector<SegmentRef>> segmentsByTarget;
+};
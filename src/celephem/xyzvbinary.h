@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 
 struct XYZVBinaryHeader
 {
@@ -17,3 +18,6 @@ struct XYZVBinaryData
     double position[3];
     double velocity[3];
 };
+
+// Receives the samples of an xyzv file in time order, with velocities in km/s
+using XYZVSampleProc = std::function<void(const XYZVBinaryData&)>;
@@ -23,6 +23,7 @@
 #include <celengine/console.h>
 #include <celscript/legacy/execution.h>
 #include <celscript/legacy/cmdparser.h>
+#include <celengine/meshmanager.h>
 #include <celengine/multitexture.h>
 #ifdef USE_SPICE
 #include <celephem/spiceinterface.h>
@@ -36,7 +37,9 @@
 #include <celutil/formatnum.h>
 #include <celutil/debug.h>
 #include <celutil/gettext.h>
+#include <celutil/profiler.h>
 #include <celutil/utf8.h>
+#include <celutil/workerpool.h>
 #include <celcompat/filesystem.h>
 #include <celcompat/memory.h>
 #include <Eigen/Geometry>
@@ -89,6 +92,8 @@ static float KeyRotationAccel = degToRad(120.0f);
 static float MouseRotationSensitivity = degToRad(1.0f);
 
 static const int ConsolePageRows = 10;
+// Screenshots waiting to be compressed before saveScreenShotAsync blocks
+static const size_t MaxPendingScreenShots = 4;
 static Console console(200, 120);
 
 static void warning(string s)
@@ -172,6 +177,9 @@ CelestiaCore::~CelestiaCore()
     if (movieCapture != nullptr)
         recordEnd();
 
+    for (auto& screenshot : pendingScreenShots)
+        screenshot.result.wait();
+
     delete timer;
     delete renderer;
 }
@@ -1887,6 +1895,8 @@ void CelestiaCore::setStartURL(string url)
 
 void CelestiaCore::tick()
 {
+    CEL_PROFILE_ZONE("CelestiaCore::tick");
+
     double lastTime = sysTime;
     sysTime = timer->getTime();
 
@@ -2060,9 +2070,12 @@ void CelestiaCore::tick()
         sim->orbit(q);
     }
 
+    reportScreenShots();
+
     // If there's a script running, tick it
     if (m_script != nullptr)
     {
+        CEL_PROFILE_ZONE("script");
         m_script->handleTickEvent(dt);
         if (scriptState == ScriptRunning)
         {
@@ -2074,7 +2087,10 @@ void CelestiaCore::tick()
     if (m_scriptHook != nullptr)
         m_scriptHook->call("tick", dt);
 
-    sim->update(dt);
+    {
+        CEL_PROFILE_ZONE("Simulation::update");
+        sim->update(dt);
+    }
 }
 
 
@@ -2082,6 +2098,7 @@ void CelestiaCore::draw()
 {
     if (!viewUpdateRequired())
         return;
+    CEL_PROFILE_ZONE("CelestiaCore::draw");
     viewChanged = false;
 
     if (views.size() == 1)
@@ -2946,6 +2963,8 @@ void CelestiaCore::setScriptImage(std::unique_ptr<OverlayImage> &&_image)
 
 void CelestiaCore::renderOverlay()
 {
+    CEL_PROFILE_ZONE("CelestiaCore::renderOverlay");
+
     if (m_scriptHook != nullptr)
         m_scriptHook->call("renderoverlay");
 
@@ -3596,6 +3615,14 @@ bool CelestiaCore::initSimulation(const fs::path& configFileName,
     if (config->consoleLogRows > 100)
         console.setRowCount(config->consoleLogRows);
 
+    if (!InitWorkerPool(config->workerThreads))
+        warning(_("Worker threads already started, WorkerThreads setting ignored.\n"));
+
+    SetModelCacheDirectory(config->modelCacheDirectory);
+
+    if (config->profiling)
+        Profiler::setEnabled(true);
+
 #ifdef USE_SPICE
     if (!InitializeSpice())
     {
@@ -3839,6 +3866,9 @@ bool CelestiaCore::initRenderer()
         return false;
     }
 
+    renderer->setStarImpostorSize(config->starImpostorSize);
+    renderer->setLabelDeclutter(config->labelDeclutter);
+
     if ((renderer->getRenderFlags() & Renderer::ShowAutoMag) != 0)
     {
         renderer->setFaintestAM45deg(renderer->getFaintestAM45deg());
@@ -4525,3 +4555,54 @@ bool CelestiaCore::saveScreenShot(const fs::path& filename, ContentType type) co
 
     return false;
 }
+
+bool CelestiaCore::saveScreenShotAsync(const fs::path& filename, ContentType type)
+{
+    if (type == Content_Unknown)
+        type = DetermineFileType(filename);
+    if (type != Content_JPEG && type != Content_PNG)
+        return false;
+
+    // Get the dimensions of the current viewport
+    array<int, 4> viewport;
+    getRenderer()->getViewport(viewport);
+
+    auto image = make_shared<CapturedImage>();
+    if (!CaptureGLBuffer(viewport[0], viewport[1],
+                         viewport[2], viewport[3],
+                         getRenderer(), *image))
+    {
+        return false;
+    }
+
+    // Bound the memory held by images waiting to be compressed
+    if (pendingScreenShots.size() >= MaxPendingScreenShots)
+        pendingScreenShots[pendingScreenShots.size() - MaxPendingScreenShots].result.wait();
+
+    PendingScreenShot screenshot;
+    screenshot.filename = filename;
+    if (!WriteImageAsync(filename, type, image, screenshot.result))
+        return false;
+
+    pendingScreenShots.push_back(move(screenshot));
+    return true;
+}
+
+// Report the screenshots written in the background since the last call, in
+// the order they were taken.
+void CelestiaCore::reportScreenShots()
+{
+    while (!pendingScreenShots.empty() &&
+           pendingScreenShots.front().result.wait_for(chrono::seconds(0)) == future_status::ready)
+    {
+        bool success = pendingScreenShots.front().result.get();
+        if (!success)
+        {
+            DPRINTF(LOG_LEVEL_ERROR, "Error writing screen capture file '%s'\n", pendingScreenShots.front().filename);
+            flash(fmt::sprintf(_("Error writing screenshot %s"), pendingScreenShots.front().filename));
+        }
+        if (m_script != nullptr)
+            m_script->handleScreenShotEvent(pendingScreenShots.front().filename, success);
+        pendingScreenShots.pop_front();
+    }
+}
@@ -10,6 +10,8 @@
 #ifndef _CELESTIACORE_H_
 #define _CELESTIACORE_H_
 
+#include <deque>
+#include <future>
 #include <celutil/filetype.h>
 #include <celutil/timer.h>
 #include <celutil/watcher.h>
@@ -346,6 +348,10 @@ class CelestiaCore // : public Watchable<CelestiaCore>
     const std::shared_ptr<celestia::scripts::ScriptMaps>& scriptMaps() const { return m_scriptMaps; }
 
     bool saveScreenShot(const fs::path&, ContentType = Content_Unknown) const;
+    // Compress and write the image in the background. Returns false if the
+    // file can't be created; errors writing it are flashed, and the running
+    // script is told when the file is complete.
+    bool saveScreenShotAsync(const fs::path&, ContentType = Content_Unknown);
 
  protected:
     bool readStars(const CelestiaConfig&, ProgressNotifier*);
@@ -355,6 +361,8 @@ class CelestiaCore // : public Watchable<CelestiaCore>
 #endif // CELX
 
  private:
+    void reportScreenShots();
+
     CelestiaConfig* config{ nullptr };
 
     Universe* universe{ nullptr };
@@ -449,6 +457,13 @@ class CelestiaCore // : public Watchable<CelestiaCore>
     MovieCapture* movieCapture{ nullptr };
     bool recording{ false };
 
+    struct PendingScreenShot
+    {
+        fs::path filename;
+        std::future<bool> result;
+    };
+    std::deque<PendingScreenShot> pendingScreenShots;
+
     Alerter* alerter{ nullptr };
     std::vector<CelestiaWatcher*> watchers;
     CursorHandler* cursorHandler{ nullptr };
@@ -98,6 +98,12 @@ CelestiaConfig* ReadCelestiaConfig(const fs::path& filename, CelestiaConfig *con
     configParams->getNumber("SolarSystemMaxDistance", maxDist);
     config->SolarSystemMaxDistance = min(max(maxDist, 1.0f), 10.0f);
 
+    config->starImpostorSize = 0.0f;
+    configParams->getNumber("StarImpostorSize", config->starImpostorSize);
+
+    config->labelDeclutter = false;
+    configParams->getBoolean("LabelDeclutter", config->labelDeclutter);
+
     config->ShadowMapSize = getUint(configParams, "ShadowMapSize", 0);
 
     double aaSamples = 1;
@@ -114,6 +120,7 @@ CelestiaConfig* ReadCelestiaConfig(const fs::path& filename, CelestiaConfig *con
     config->reverseMouseWheel = false;
     configParams->getBoolean("ReverseMouseWheel", config->reverseMouseWheel);
     configParams->getPath("ScriptScreenshotDirectory", config->scriptScreenshotDirectory);
+    configParams->getPath("ModelCacheDirectory", config->modelCacheDirectory);
     config->scriptSystemAccessPolicy = "ask";
     configParams->getString("ScriptSystemAccessPolicy", config->scriptSystemAccessPolicy);
 
@@ -130,6 +137,11 @@ CelestiaConfig* ReadCelestiaConfig(const fs::path& filename, CelestiaConfig *con
 
     config->consoleLogRows = getUint(configParams, "LogSize", 200);
 
+    config->workerThreads = getUint(configParams, "WorkerThreads", 0);
+
+    config->profiling = false;
+    configParams->getBoolean("Profiling", config->profiling);
+
     Value* solarSystemsVal = configParams->getValue("SolarSystemCatalogs");
     if (solarSystemsVal != nullptr)
     {
@@ -47,6 +47,7 @@ public:
     double orbitPeriodsShown;
     double linearFadeFraction;
     fs::path scriptScreenshotDirectory;
+    fs::path modelCacheDirectory;
     std::string scriptSystemAccessPolicy;
 #ifdef CELX
     fs::path luaHook;
@@ -70,12 +71,20 @@ public:
 
     unsigned int consoleLogRows;
 
+    // Number of threads used for parallel work, 0 = one per core
+    unsigned int workerThreads;
+
+    // Record profiling zones from startup on
+    bool profiling;
+
     Hash* params;
 
     float getFloatValue(const std::string& name);
     const std::string getStringValue(const std::string& name);
 
     float SolarSystemMaxDistance;
+    float starImpostorSize;
+    bool labelDeclutter;
     unsigned ShadowMapSize;
 };
 
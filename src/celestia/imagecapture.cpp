@@ -8,180 +8,506 @@
 // of the License, or (at your option) any later version.
 
 #include <config.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
 #include <celutil/debug.h>
+#include <celutil/workerpool.h>
 #include "imagecapture.h"
 
 extern "C" {
 #include <jpeglib.h>
 }
-#include <png.h>
 #include <zlib.h>
 
 using namespace std;
 
+// PNG rows are deflated in bands of about this many bytes. Each band but
+// the first is primed with the last 32K of the band before it, so the loss
+// of compression is small.
+constexpr const size_t PNGBandSize = 256 * 1024;
+constexpr const size_t DeflateWindowSize = 32768;
 
-bool CaptureGLBufferToJPEG(const fs::path& filename,
-                           int x, int y,
-                           int width, int height,
-                           const Renderer *renderer)
+// JPEG images are compressed in bands of this many rows, a multiple of the
+// 16 row MCUs of 4:2:0 subsampled images. Bands are separated by restart
+// markers.
+constexpr const int JPEGBandRows = 128;
+constexpr const int JPEGMCUSize = 16;
+constexpr const unsigned int MaxRestartInterval = 65535;
+
+
+bool CaptureGLBuffer(int x, int y,
+                     int width, int height,
+                     const Renderer *renderer,
+                     CapturedImage& image)
 {
-    int rowStride = (width * 3 + 3) & ~0x3;
-    int imageSize = height * rowStride;
-    auto* pixels = new unsigned char[imageSize];
+    image.width = width;
+    image.height = height;
+    image.rowStride = (width * 3 + 3) & ~0x3;
+    image.pixels.resize((size_t) height * image.rowStride);
+
+    return renderer->captureFrame(x, y, width, height,
+                                  Renderer::PixelFormat::RGB,
+                                  image.pixels.data(), true);
+}
+
+
+namespace
+{
+const unsigned char* GetRow(const CapturedImage& image, int row)
+{
+    return image.pixels.data() + (size_t) (image.height - 1 - row) * image.rowStride;
+}
 
-    if (!renderer->captureFrame(x, y, width, height,
-                                Renderer::PixelFormat::RGB,
-                                pixels, true))
-    {
-        return false;
-    }
 
-    FILE* out;
+FILE* OpenImageFile(const fs::path& filename)
+{
 #ifdef _WIN32
-    out = _wfopen(filename.c_str(), L"wb");
+    FILE* out = _wfopen(filename.c_str(), L"wb");
 #else
-    out = fopen(filename.c_str(), "wb");
+    FILE* out = fopen(filename.c_str(), "wb");
 #endif
     if (out == nullptr)
-    {
         DPRINTF(LOG_LEVEL_ERROR, "Can't open screen capture file '%s'\n", filename);
-        delete[] pixels;
-        return false;
-    }
+    return out;
+}
 
-    struct jpeg_compress_struct cinfo;
 
+bool WriteImageData(FILE* out, const vector<unsigned char>& data)
+{
+    bool ok = fwrite(data.data(), 1, data.size(), out) == data.size();
+    ok = fclose(out) == 0 && ok;
+    return ok;
+}
+
+
+bool WriteImageFile(const fs::path& filename, const vector<unsigned char>& data)
+{
+    FILE* out = OpenImageFile(filename);
+    return out != nullptr && WriteImageData(out, data);
+}
+
+
+// libjpeg destination writing into a vector
+struct JPEGDestination
+{
+    jpeg_destination_mgr pub;
+    vector<unsigned char>* data;
+};
+
+void JPEGInitDestination(j_compress_ptr cinfo)
+{
+    auto* dest = reinterpret_cast<JPEGDestination*>(cinfo->dest);
+    dest->data->resize(65536);
+    dest->pub.next_output_byte = dest->data->data();
+    dest->pub.free_in_buffer = dest->data->size();
+}
+
+boolean JPEGEmptyOutputBuffer(j_compress_ptr cinfo)
+{
+    auto* dest = reinterpret_cast<JPEGDestination*>(cinfo->dest);
+    size_t size = dest->data->size();
+    dest->data->resize(size * 2);
+    dest->pub.next_output_byte = dest->data->data() + size;
+    dest->pub.free_in_buffer = size;
+    return TRUE;
+}
+
+void JPEGTermDestination(j_compress_ptr cinfo)
+{
+    auto* dest = reinterpret_cast<JPEGDestination*>(cinfo->dest);
+    dest->data->resize(dest->data->size() - dest->pub.free_in_buffer);
+}
+
+
+void CompressJPEGBand(const CapturedImage& image,
+                      int firstRow, int nRows,
+                      unsigned int restartInterval,
+                      int quality,
+                      vector<unsigned char>& data)
+{
+    struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
+    JPEGDestination dest;
     JSAMPROW row[1];
 
     cinfo.err = jpeg_std_error(&jerr);
     jpeg_create_compress(&cinfo);
 
-    jpeg_stdio_dest(&cinfo, out);
+    dest.pub.init_destination = JPEGInitDestination;
+    dest.pub.empty_output_buffer = JPEGEmptyOutputBuffer;
+    dest.pub.term_destination = JPEGTermDestination;
+    dest.data = &data;
+    cinfo.dest = &dest.pub;
 
-    cinfo.image_width = width;
-    cinfo.image_height = height;
+    cinfo.image_width = image.width;
+    cinfo.image_height = nRows;
     cinfo.input_components = 3;
     cinfo.in_color_space = JCS_RGB;
 
     jpeg_set_defaults(&cinfo);
-
-    jpeg_set_quality(&cinfo, 90, TRUE);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.restart_interval = restartInterval;
 
     jpeg_start_compress(&cinfo, TRUE);
 
     while (cinfo.next_scanline < cinfo.image_height)
     {
-        row[0] = &pixels[rowStride * (cinfo.image_height - cinfo.next_scanline - 1)];
+        row[0] = const_cast<JSAMPROW>(GetRow(image, firstRow + (int) cinfo.next_scanline));
         (void) jpeg_write_scanlines(&cinfo, row, 1);
     }
 
     jpeg_finish_compress(&cinfo);
-    fclose(out);
     jpeg_destroy_compress(&cinfo);
-
-    delete[] pixels;
-
-    return true;
 }
 
 
-void PNGWriteData(png_structp png_ptr, png_bytep data, png_size_t length)
+// Walk the marker segments of a JPEG stream written by libjpeg up to the
+// start of scan. Returns the offset of the entropy coded data, or 0 for a
+// malformed stream. The image height in the frame header is replaced if
+// height isn't negative.
+size_t FindJPEGScanData(vector<unsigned char>& data, int height)
 {
-    auto* fp = (FILE*) png_get_io_ptr(png_ptr);
-    fwrite((void*) data, 1, length, fp);
+    size_t pos = 2;     // skip SOI
+    while (pos + 4 <= data.size())
+    {
+        if (data[pos] != 0xff)
+            return 0;
+
+        unsigned char marker = data[pos + 1];
+        size_t length = ((size_t) data[pos + 2] << 8) | data[pos + 3];
+        bool isFrameHeader = marker >= 0xc0 && marker <= 0xcf &&
+                             marker != 0xc4 && marker != 0xc8 && marker != 0xcc;
+        if (isFrameHeader && height >= 0 && pos + 7 <= data.size())
+        {
+            data[pos + 5] = (unsigned char) (height >> 8);
+            data[pos + 6] = (unsigned char) (height & 0xff);
+        }
+
+        pos += 2 + length;
+        if (marker == 0xda)
+            return pos <= data.size() ? pos : 0;
+    }
+
+    return 0;
 }
 
 
-bool CaptureGLBufferToPNG(const fs::path& filename,
-                           int x, int y,
-                           int width, int height,
-                           const Renderer *renderer)
+// Choose a filter for each row as libpng does: the filter with the
+// smallest sum of absolute differences, taking the bytes as signed.
+void FilterPNGRow(const unsigned char* row,
+                  const unsigned char* prev,
+                  size_t rowBytes,
+                  unsigned char* out,
+                  unsigned char* scratch)
 {
-    int rowStride = (width * 3 + 3) & ~0x3;
-    int imageSize = height * rowStride;
-    auto* pixels = new unsigned char[imageSize];
+    const size_t bpp = 3;
+    unsigned char* filtered[5];
+    for (int f = 0; f < 5; f++)
+        filtered[f] = scratch + f * rowBytes;
 
-    if (!renderer->captureFrame(x, y, width, height,
-                                Renderer::PixelFormat::RGB,
-                                pixels, true))
+    for (size_t i = 0; i < rowBytes; i++)
     {
-        return false;
+        int a = i >= bpp ? row[i - bpp] : 0;
+        int b = prev[i];
+        int c = i >= bpp ? prev[i - bpp] : 0;
+
+        int p = a + b - c;
+        int pa = abs(p - a);
+        int pb = abs(p - b);
+        int pc = abs(p - c);
+        int paeth = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+
+        filtered[0][i] = row[i];
+        filtered[1][i] = (unsigned char) (row[i] - a);
+        filtered[2][i] = (unsigned char) (row[i] - b);
+        filtered[3][i] = (unsigned char) (row[i] - ((a + b) >> 1));
+        filtered[4][i] = (unsigned char) (row[i] - paeth);
     }
 
-#ifdef _WIN32
-    FILE* out = _wfopen(filename.c_str(), L"wb");
-#else
-    FILE* out = fopen(filename.c_str(), "wb");
-#endif
-    if (out == nullptr)
+    int best = 0;
+    size_t bestSum = ~(size_t) 0;
+    for (int f = 0; f < 5; f++)
     {
-        DPRINTF(LOG_LEVEL_ERROR, "Can't open screen capture file '%s'\n", filename);
-        delete[] pixels;
-        return false;
+        size_t sum = 0;
+        for (size_t i = 0; i < rowBytes; i++)
+        {
+            unsigned int v = filtered[f][i];
+            sum += v < 128 ? v : 256 - v;
+        }
+        if (sum < bestSum)
+        {
+            best = f;
+            bestSum = sum;
+        }
     }
 
-    auto* row_pointers = new png_bytep[height];
-    for (int i = 0; i < height; i++)
-        row_pointers[i] = (png_bytep) &pixels[rowStride * (height - i - 1)];
+    out[0] = (unsigned char) best;
+    copy(filtered[best], filtered[best] + rowBytes, out + 1);
+}
+
 
-    png_structp png_ptr;
-    png_infop info_ptr;
+// Deflate one band to a raw deflate stream which ends on a byte boundary,
+// so that the bands can be concatenated.
+bool DeflateBand(const unsigned char* in, size_t size,
+                 const unsigned char* dictionary, size_t dictionarySize,
+                 bool last,
+                 vector<unsigned char>& out)
+{
+    z_stream zs;
+    zs.zalloc = nullptr;
+    zs.zfree = nullptr;
+    zs.opaque = nullptr;
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 8, Z_FILTERED) != Z_OK)
+        return false;
 
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
-                                      nullptr, nullptr, nullptr);
+    if (dictionarySize > 0)
+        deflateSetDictionary(&zs, dictionary, (uInt) dictionarySize);
+
+    // Leave room for the empty block of the sync flush
+    out.resize(deflateBound(&zs, size) + 64);
+    zs.next_in = const_cast<Bytef*>(in);
+    zs.avail_in = (uInt) size;
+    zs.next_out = out.data();
+    zs.avail_out = (uInt) out.size();
+
+    int result = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    bool ok = last ? result == Z_STREAM_END
+                   : result == Z_OK && zs.avail_in == 0 && zs.avail_out > 0;
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ok;
+}
 
-    if (png_ptr == nullptr)
-    {
-        DPRINTF(LOG_LEVEL_ERROR, "Screen capture: error allocating png_ptr\n");
-        fclose(out);
-        delete[] pixels;
-        delete[] row_pointers;
+
+void AppendUint32(vector<unsigned char>& data, uint32_t value)
+{
+    data.push_back((unsigned char) (value >> 24));
+    data.push_back((unsigned char) (value >> 16));
+    data.push_back((unsigned char) (value >> 8));
+    data.push_back((unsigned char) value);
+}
+
+
+void AppendPNGChunk(vector<unsigned char>& data,
+                    const char* type,
+                    const unsigned char* body,
+                    size_t length)
+{
+    AppendUint32(data, (uint32_t) length);
+    size_t start = data.size();
+    data.insert(data.end(), type, type + 4);
+    data.insert(data.end(), body, body + length);
+    AppendUint32(data, (uint32_t) crc32(0, data.data() + start, (uInt) (length + 4)));
+}
+} // end unnamed namespace
+
+
+bool CompressImageToJPEG(const CapturedImage& image,
+                         vector<unsigned char>& data,
+                         int quality)
+{
+    if (image.width <= 0 || image.height <= 0 || image.height > 65535)
         return false;
+
+    unsigned int mcusPerRow = (image.width + JPEGMCUSize - 1) / JPEGMCUSize;
+    int nBands = (image.height + JPEGBandRows - 1) / JPEGBandRows;
+    unsigned int restartInterval = mcusPerRow * (JPEGBandRows / JPEGMCUSize);
+    if (nBands == 1 || restartInterval > MaxRestartInterval)
+    {
+        CompressJPEGBand(image, 0, image.height, 0, quality, data);
+        return true;
     }
 
-    info_ptr = png_create_info_struct(png_ptr);
-    if (info_ptr == nullptr)
+    // Every band is a complete JPEG stream with the same tables and restart
+    // interval. The first band contributes the headers, the others only
+    // their entropy coded data. A band ends exactly at the restart boundary,
+    // so the bands joined by restart markers are the stream libjpeg would
+    // write for the whole image.
+    vector<vector<unsigned char>> bands(nBands);
+    vector<size_t> scanStart(nBands);
+    GetWorkerPool()->parallelFor(nBands, 1, [&](size_t begin, size_t end)
     {
-        DPRINTF(LOG_LEVEL_ERROR, "Screen capture: error allocating info_ptr\n");
-        fclose(out);
-        delete[] pixels;
-        delete[] row_pointers;
-        png_destroy_write_struct(&png_ptr, (png_infopp) nullptr);
-        return false;
+        for (size_t i = begin; i < end; i++)
+        {
+            int firstRow = (int) i * JPEGBandRows;
+            int nRows = min(JPEGBandRows, image.height - firstRow);
+            CompressJPEGBand(image, firstRow, nRows, restartInterval, quality, bands[i]);
+            scanStart[i] = FindJPEGScanData(bands[i], i == 0 ? image.height : -1);
+        }
+    });
+
+    for (const auto& band : bands)
+    {
+        if (band.size() < 2 || band[band.size() - 2] != 0xff || band.back() != 0xd9)
+            return false;
+    }
+    for (size_t start : scanStart)
+    {
+        if (start == 0)
+            return false;
     }
 
-    if (setjmp(png_jmpbuf(png_ptr)))
+    data.assign(bands[0].begin(), bands[0].end() - 2);
+    for (int i = 1; i < nBands; i++)
     {
-        DPRINTF(LOG_LEVEL_ERROR, "Error writing PNG file '%s'\n", filename);
-        fclose(out);
-        delete[] pixels;
-        delete[] row_pointers;
-        png_destroy_write_struct(&png_ptr, &info_ptr);
+        data.push_back(0xff);
+        data.push_back((unsigned char) (0xd0 + ((i - 1) & 7)));
+        data.insert(data.end(), bands[i].begin() + scanStart[i], bands[i].end() - 2);
+    }
+    data.push_back(0xff);
+    data.push_back(0xd9);
+
+    return true;
+}
+
+
+bool CompressImageToPNG(const CapturedImage& image,
+                        vector<unsigned char>& data)
+{
+    if (image.width <= 0 || image.height <= 0)
+        return false;
+
+    WorkerPool* pool = GetWorkerPool();
+    size_t rowBytes = (size_t) image.width * 3;
+    size_t filteredRowBytes = rowBytes + 1;
+    size_t height = image.height;
+
+    // Filtering a row only depends on the row itself and the one above it
+    vector<unsigned char> filtered(filteredRowBytes * height);
+    pool->parallelFor(height, 16, [&](size_t begin, size_t end)
+    {
+        vector<unsigned char> scratch(rowBytes * 5);
+        vector<unsigned char> zeros(rowBytes, 0);
+        for (size_t row = begin; row < end; row++)
+        {
+            const unsigned char* prev = row > 0 ? GetRow(image, (int) row - 1) : zeros.data();
+            FilterPNGRow(GetRow(image, (int) row), prev, rowBytes,
+                         filtered.data() + row * filteredRowBytes, scratch.data());
+        }
+    });
+
+    size_t rowsPerBand = max((size_t) 1, PNGBandSize / filteredRowBytes);
+    size_t nBands = (height + rowsPerBand - 1) / rowsPerBand;
+    vector<vector<unsigned char>> bands(nBands);
+    vector<uLong> checksums(nBands);
+    atomic<bool> failed{ false };
+    pool->parallelFor(nBands, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            size_t start = i * rowsPerBand * filteredRowBytes;
+            size_t size = min(rowsPerBand * filteredRowBytes, filtered.size() - start);
+            size_t dictionarySize = min(start, DeflateWindowSize);
+            if (!DeflateBand(filtered.data() + start, size,
+                             filtered.data() + start - dictionarySize, dictionarySize,
+                             i == nBands - 1, bands[i]))
+            {
+                failed = true;
+            }
+            checksums[i] = adler32(adler32(0, nullptr, 0), filtered.data() + start, (uInt) size);
+        }
+    });
+
+    if (failed)
         return false;
+
+    uLong checksum = adler32(0, nullptr, 0);
+    for (size_t i = 0; i < nBands; i++)
+    {
+        size_t start = i * rowsPerBand * filteredRowBytes;
+        size_t size = min(rowsPerBand * filteredRowBytes, filtered.size() - start);
+        checksum = adler32_combine(checksum, checksums[i], (z_off_t) size);
     }
 
-    // png_init_io(png_ptr, out);
-    png_set_write_fn(png_ptr, (void*) out, PNGWriteData, nullptr);
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    data.assign(signature, signature + 8);
+
+    vector<unsigned char> header;
+    AppendUint32(header, (uint32_t) image.width);
+    AppendUint32(header, (uint32_t) image.height);
+    header.push_back(8);    // bit depth
+    header.push_back(2);    // RGB
+    header.push_back(0);    // deflate
+    header.push_back(0);    // adaptive filtering
+    header.push_back(0);    // no interlace
+    AppendPNGChunk(data, "IHDR", header.data(), header.size());
+
+    // zlib header for the best compression level, then one IDAT chunk for
+    // each band, the last one followed by the Adler-32 checksum
+    static const unsigned char zlibHeader[2] = { 0x78, 0xda };
+    bands.front().insert(bands.front().begin(), zlibHeader, zlibHeader + 2);
+    AppendUint32(bands.back(), (uint32_t) checksum);
+    for (const auto& band : bands)
+        AppendPNGChunk(data, "IDAT", band.data(), band.size());
+
+    AppendPNGChunk(data, "IEND", nullptr, 0);
 
-    png_set_compression_level(png_ptr, Z_BEST_COMPRESSION);
-    png_set_IHDR(png_ptr, info_ptr,
-                 width, height,
-                 8,
-                 PNG_COLOR_TYPE_RGB,
-                 PNG_INTERLACE_NONE,
-                 PNG_COMPRESSION_TYPE_DEFAULT,
-                 PNG_FILTER_TYPE_DEFAULT);
+    return true;
+}
 
-    png_write_info(png_ptr, info_ptr);
-    png_write_image(png_ptr, row_pointers);
-    png_write_end(png_ptr, info_ptr);
 
-    // Clean up everything . . .
-    png_destroy_write_struct(&png_ptr, &info_ptr);
-    delete[] row_pointers;
-    delete[] pixels;
-    fclose(out);
+bool WriteImageAsync(const fs::path& filename,
+                     ContentType type,
+                     const shared_ptr<CapturedImage>& image,
+                     future<bool>& result)
+{
+    if (type != Content_JPEG && type != Content_PNG)
+        return false;
+
+    // Errors in the file name are reported right away
+    FILE* out = OpenImageFile(filename);
+    if (out == nullptr)
+        return false;
+
+    auto task = make_shared<packaged_task<bool()>>([image, type, out]
+    {
+        vector<unsigned char> data;
+        bool ok = type == Content_JPEG ? CompressImageToJPEG(*image, data)
+                                       : CompressImageToPNG(*image, data);
+        if (!ok)
+        {
+            fclose(out);
+            return false;
+        }
+        return WriteImageData(out, data);
+    });
+    result = task->get_future();
+    GetWorkerPool()->submit([task] { (*task)(); });
 
     return true;
 }
+
+
+bool CaptureGLBufferToJPEG(const fs::path& filename,
+                           int x, int y,
+                           int width, int height,
+                           const Renderer *renderer)
+{
+    CapturedImage image;
+    if (!CaptureGLBuffer(x, y, width, height, renderer, image))
+        return false;
+
+    vector<unsigned char> data;
+    return CompressImageToJPEG(image, data) && WriteImageFile(filename, data);
+}
+
+
+bool CaptureGLBufferToPNG(const fs::path& filename,
+                          int x, int y,
+                          int width, int height,
+                          const Renderer *renderer)
+{
+    CapturedImage image;
+    if (!CaptureGLBuffer(x, y, width, height, renderer, image))
+        return false;
+
+    vector<unsigned char> data;
+    if (!CompressImageToPNG(image, data))
+    {
+        DPRINTF(LOG_LEVEL_ERROR, "Error writing PNG file '%s'\n", filename);
+        return false;
+    }
+    return WriteImageFile(filename, data);
+}
@@ -10,9 +10,45 @@
 #ifndef _IMAGECAPTURE_H_
 #define _IMAGECAPTURE_H_
 
+#include <future>
+#include <memory>
+#include <vector>
 #include <celcompat/filesystem.h>
+#include <celutil/filetype.h>
 #include <celengine/render.h>
 
+// RGB pixels read back from the frame buffer. As in OpenGL, the bottom row
+// of the image is stored first.
+struct CapturedImage
+{
+    int width{ 0 };
+    int height{ 0 };
+    int rowStride{ 0 };
+    std::vector<unsigned char> pixels;
+};
+
+extern bool CaptureGLBuffer(int x, int y,
+                            int width, int height,
+                            const Renderer *renderer,
+                            CapturedImage& image);
+
+// Compress an image to the contents of a JPEG or PNG file. Bands of rows
+// are compressed in parallel on the shared worker pool; the output doesn't
+// depend on the number of threads.
+extern bool CompressImageToJPEG(const CapturedImage& image,
+                                std::vector<unsigned char>& data,
+                                int quality = 90);
+extern bool CompressImageToPNG(const CapturedImage& image,
+                               std::vector<unsigned char>& data);
+
+// Open a JPEG or PNG file for writing, then compress and write the image on
+// the worker pool. Returns false if the file can't be created; otherwise
+// result becomes ready once the file is complete, telling whether writing
+// it succeeded.
+extern bool WriteImageAsync(const fs::path& filename,
+                            ContentType type,
+                            const std::shared_ptr<CapturedImage>& image,
+                            std::future<bool>& result);
 
 extern bool CaptureGLBufferToJPEG(const fs::path& filename,
                                   int x, int y,
@@ -67,6 +67,7 @@
 #include <cmath>
 #include <celutil/debug.h>
 #include <celutil/gettext.h>
+#include <cstring>
 #include <string>
 #include <theora/theora.h>
 
@@ -100,11 +101,9 @@ OggTheoraCapture::OggTheoraCapture(const Renderer *r):
     video_frame_count(0),
     video_bytesout(0),
     rowStride(0),
-    pixels(nullptr),
+    encodedFrameCount(0),
     outfile(nullptr)
 {
-    yuvframe[0] = nullptr;
-    yuvframe[1] = nullptr;
     // Just being anal
     memset(&yuv, 0, sizeof(yuv));
     memset(&to, 0, sizeof(to));
@@ -280,33 +279,29 @@ bool OggTheoraCapture::start(const std::string& filename,
         fwrite(videopage.header,1,videopage.header_len,outfile);
         fwrite(videopage.body,1,  videopage.body_len,outfile);
     }
-    /* Initialize the double frame buffer.
-     * We allocate enough for a 4:4:4 color sampling
-     */
-    yuvframe[0]= new unsigned char[video_x*video_y*3];
-    yuvframe[1]= new unsigned char[video_x*video_y*3];
-
-    // Now the buffer for reading the GL RGB pixels
-    rowStride = (frame_x * 3 + 3) & ~0x3;
-    pixels = new unsigned char[rowStride*frame_y];
+    /* Initialize the double frame buffer of 4:2:0 frames */
+    yuvframe[0].resize(video_x*video_y*3/2);
+    yuvframe[1].resize(video_x*video_y*3/2);
 
-        /* clear initial frame as it may be larger than actual video data */
-        /* fill Y plane with 0x10 and UV planes with 0x80, for black data */
-    // The UV plane must be 4:2:0
-    memset(yuvframe[0],0x10,video_x*video_y);
-    memset(yuvframe[0]+video_x*video_y,0x80,video_x*video_y*2);
-    memset(yuvframe[1],0x10,video_x*video_y);
-    memset(yuvframe[1]+video_x*video_y,0x80,video_x*video_y*2);
+    /* clear initial frame as it may be larger than actual video data */
+    /* fill Y plane with 0x10 and UV planes with 0x80, for black data */
+    for (auto& frame : yuvframe)
+    {
+        memset(frame.data(),0x10,video_x*video_y);
+        memset(frame.data()+video_x*video_y,0x80,video_x*video_y/2);
+    }
 
     yuv.y_width=video_x;
     yuv.y_height=video_y;
     yuv.y_stride=video_x;
 
-    // Note we lie here by saying it's 4:2:0 and we will convert 4:4:4 to 4:2;0 later
     yuv.uv_width=video_x/2;
     yuv.uv_height=video_y/2;
     yuv.uv_stride=video_x/2;
 
+    // Now the buffers for reading the GL RGB pixels
+    rowStride = (frame_x * 3 + 3) & ~0x3;
+
     DPRINTF(LOG_LEVEL_VERBOSE,
             _("OggTheoraCapture::start() - Theora video: %s %.2f(%d/%d) fps quality %d %dx%d offset (%dx%d)\n"),
             filename.c_str(),
@@ -316,6 +311,11 @@ bool OggTheoraCapture::start(const std::string& filename,
             video_x,video_y,
             frame_x_offset,frame_y_offset);
 
+    video_frame_count = 0;
+    encodedFrameCount = 0;
+    frameQueue.reset(new FrameQueue(rowStride * frame_y, MaxQueuedBytes,
+                                    [this](const unsigned char* pixels) { encodeFrame(pixels); }));
+
     capturing = true;
     return true;
 }
@@ -325,14 +325,8 @@ bool OggTheoraCapture::captureFrame()
     if (!capturing)
         return false;
 
-    while (ogg_stream_pageout(&to,&videopage)>0)
-    {
-        /* flush a video page */
-        video_bytesout+=fwrite(videopage.header,1,videopage.header_len,outfile);
-        video_bytesout+=fwrite(videopage.body,1,videopage.body_len,outfile);
-
-    }
-    if(ogg_stream_eos(&to)) return false;
+    // Only waits for the encoder when it has fallen behind by all buffers
+    unsigned char* pixels = frameQueue->acquire();
 
     // Get the dimensions of the current viewport
     int x, y, w, h;
@@ -343,27 +337,29 @@ bool OggTheoraCapture::captureFrame()
     renderer->captureFrame(x, y, frame_x, frame_y,
                            Renderer::PixelFormat::RGB,
                            pixels);
+    frameQueue->submit(pixels);
 
-    unsigned char *ybase = yuvframe[0];
-    unsigned char *ubase = yuvframe[0]+ video_x*video_y;
-    unsigned char *vbase = yuvframe[0]+ video_x*video_y*2;
-    // We go ahead and build 4:4:4 frames
-    for (int y=0; y<frame_y; y++)
-    {
-        unsigned char *yptr = ybase + (video_x*(y+frame_y_offset))+frame_x_offset;
-        unsigned char *uptr = ubase + (video_x*(y+frame_y_offset))+frame_x_offset;
-        unsigned char *vptr = vbase + (video_x*(y+frame_y_offset))+frame_x_offset;
-        unsigned char *rgb = pixels + ((frame_y-1-y)*rowStride); // The video is inverted
-        for (int x=0; x<frame_x; x++)
-        {
-            unsigned char r = *rgb++;
-            unsigned char g = *rgb++;
-            unsigned char b = *rgb++;
-            *yptr++ = min(abs(r * 2104 + g * 4130 + b * 802 + 4096 + 131072) >> 13,235);
-            *uptr++ = min(abs(r * -1214 + g * -2384 + b * 3598 + 4096 + 1048576) >> 13,240);
-            *vptr++ = min(abs(r * 3598 + g * -3013 + b * -585 + 4096 + 1048576) >> 13,240);
-        }
-    }
+    video_frame_count += 1;
+    //if ((video_frame_count % 10) == 0)
+    //    DPRINTF(LOG_LEVEL_VERBOSE, "Writing frame %d\n", video_frame_count);
+    frameCaptured();
+
+    return true;
+}
+
+void OggTheoraCapture::encodeFrame(const unsigned char* pixels)
+{
+    // The image starts on an even row and column of the frame, see start()
+    unsigned char *ybase = yuvframe[0].data();
+    unsigned char *ubase = ybase + video_x*video_y;
+    unsigned char *vbase = ubase + video_x*video_y/4;
+    YUVConverter::Planes planes;
+    planes.y = ybase + video_x*frame_y_offset + frame_x_offset;
+    planes.u = ubase + (video_x/2)*(frame_y_offset/2) + frame_x_offset/2;
+    planes.v = vbase + (video_x/2)*(frame_y_offset/2) + frame_x_offset/2;
+    planes.yStride = video_x;
+    planes.uvStride = video_x/2;
+    converter.convert(pixels, frame_x, frame_y, rowStride, true, planes); // The video is inverted
 
     /*
      * The video strategy is to capture one frame ahead so when we're at end of
@@ -371,100 +367,49 @@ bool OggTheoraCapture::captureFrame()
      * encoding. Theora is a one-frame-in,one-frame-out system; submit a frame
      * for compression and pull out the packet
      */
+    if (encodedFrameCount > 0)
+        submitFrame(yuvframe[1], 0);
+    encodedFrameCount += 1;
+    std::swap(yuvframe[0], yuvframe[1]);
+
+    writePages();
+}
+
+void OggTheoraCapture::submitFrame(std::vector<unsigned char>& frame, int lastFrame)
+{
+    yuv.y= frame.data();
+    yuv.u= frame.data()+ video_x*video_y;
+    yuv.v= frame.data()+ video_x*video_y*5/4;
+    theora_encode_YUVin(&td,&yuv);
+    theora_encode_packetout(&td,lastFrame,&op);
+    ogg_stream_packetin(&to,&op);
+}
 
-    if (video_frame_count > 0)
+void OggTheoraCapture::writePages()
+{
+    while (ogg_stream_pageout(&to,&videopage)>0)
     {
-        yuv.y= yuvframe[1];
-        yuv.u= yuvframe[1]+ video_x*video_y;
-        yuv.v= yuvframe[1]+ video_x*video_y*2;
-        // Convert to 4:2:0
-        unsigned char * uin0 = yuv.u;
-        unsigned char * uin1 = yuv.u + video_x;
-        unsigned char * uout = yuv.u;
-        unsigned char * vin0 = yuv.v;
-        unsigned char * vin1 = yuv.v + video_x;
-        unsigned char * vout = yuv.v;
-        for (int y = 0; y < video_y; y += 2)
-        {
-            for (int x = 0; x < video_x; x += 2)
-            {
-                *uout = (uin0[0] + uin0[1] + uin1[0] + uin1[1]) >> 2;
-                uin0 += 2;
-                uin1 += 2;
-                uout++;
-                *vout = (vin0[0] + vin0[1] + vin1[0] + vin1[1]) >> 2;
-                vin0 += 2;
-                vin1 += 2;
-                vout++;
-            }
-            uin0 += video_x;
-            uin1 += video_x;
-            vin0 += video_x;
-            vin1 += video_x;
-        }
-        theora_encode_YUVin(&td,&yuv);
-        theora_encode_packetout(&td,0,&op);
-        ogg_stream_packetin(&to,&op);
+        /* flush a video page */
+        video_bytesout+=fwrite(videopage.header,1,videopage.header_len,outfile);
+        video_bytesout+=fwrite(videopage.body,1,videopage.body_len,outfile);
     }
-    video_frame_count += 1;
-    //if ((video_frame_count % 10) == 0)
-    //    DPRINTF(LOG_LEVEL_VERBOSE, "Writing frame %d\n", video_frame_count);
-    unsigned char *temp = yuvframe[0];
-    yuvframe[0] = yuvframe[1];
-    yuvframe[1] = temp;
-    frameCaptured();
-
-    return true;
 }
+
 void OggTheoraCapture::cleanup()
 {
     capturing = false;
+
+    // Let the encoder finish the queued frames
+    frameQueue.reset();
+
     /* clear out state */
 
     if(outfile)
     {
         DPRINTF(LOG_LEVEL_VERBOSE, _("OggTheoraCapture::cleanup() - wrote %d frames\n"), video_frame_count);
-        if (video_frame_count > 0)
-        {
-            yuv.y= yuvframe[1];
-            yuv.u= yuvframe[1]+ video_x*video_y;
-            yuv.v= yuvframe[1]+ video_x*video_y*2 ;
-            // Convert to 4:2:0
-            unsigned char * uin0 = yuv.u;
-            unsigned char * uin1 = yuv.u + video_x;
-            unsigned char * uout = yuv.u;
-            unsigned char * vin0 = yuv.v;
-            unsigned char * vin1 = yuv.v + video_x;
-            unsigned char * vout = yuv.v;
-            for (int y = 0; y < video_y; y += 2)
-            {
-                for (int x = 0; x < video_x; x += 2)
-                {
-                    *uout = (uin0[0] + uin0[1] + uin1[0] + uin1[1]) >> 2;
-                    uin0 += 2;
-                    uin1 += 2;
-                    uout++;
-                    *vout = (vin0[0] + vin0[1] + vin1[0] + vin1[1]) >> 2;
-                    vin0 += 2;
-                    vin1 += 2;
-                    vout++;
-                }
-                uin0 += video_x;
-                uin1 += video_x;
-                vin0 += video_x;
-                vin1 += video_x;
-            }
-            theora_encode_YUVin(&td,&yuv);
-            theora_encode_packetout(&td,1,&op);
-            ogg_stream_packetin(&to,&op);
-        }
-        while(ogg_stream_pageout(&to,&videopage)>0)
-        {
-            /* flush a video page */
-            video_bytesout+=fwrite(videopage.header,1,videopage.header_len,outfile);
-            video_bytesout+=fwrite(videopage.body,1,videopage.body_len,outfile);
-
-        }
+        if (encodedFrameCount > 0)
+            submitFrame(yuvframe[1], 1);
+        writePages();
         if(ogg_stream_flush(&to,&videopage)>0)
         {
             /* flush a video page */
@@ -478,9 +423,8 @@ void OggTheoraCapture::cleanup()
 
         std::fclose(outfile);
         outfile = nullptr;
-        delete [] yuvframe[0];
-        delete [] yuvframe[1];
-        delete [] pixels;
+        for (auto& frame : yuvframe)
+            std::vector<unsigned char>().swap(frame);
     }
 }
 
@@ -2,7 +2,12 @@
 #ifndef _OGGTHEORACAPTURE_H_
 #define _OGGTHEORACAPTURE_H_
 
+#include <atomic>
+#include <memory>
+#include <vector>
 #include "theora/theora.h"
+#include <celutil/framequeue.h>
+#include <celutil/yuvconvert.h>
 #include "moviecapture.h"
 
 class OggTheoraCapture : public MovieCapture
@@ -26,6 +31,9 @@ public:
 
 private:
     void cleanup();
+    void encodeFrame(const unsigned char* pixels);
+    void submitFrame(std::vector<unsigned char>& frame, int lastFrame);
+    void writePages();
 
 private:
     int video_x;
@@ -43,15 +51,22 @@ private:
 
     bool       capturing;
     int        video_frame_count;
-    int        video_bytesout;
+    std::atomic<int> video_bytesout;
 
-    // Consider RGB to YUV Color converstion table - jpeglib has one
-    // but according the standards it's incorrect (generates values 0-255,
-    // instead of clamped to 16-240).
+    // Frames read back by the render thread wait in a queue until the
+    // encoder thread converts and encodes them. The queue grows while the
+    // encoder falls behind, up to MaxQueuedBytes of frames (but at least
+    // three); only then does rendering wait for the encoder. That's about
+    // 40 frames at 1920x1080.
+    static constexpr size_t MaxQueuedBytes = 256 * 1024 * 1024;
 
     int            rowStride;
-    unsigned char  *pixels;
-    unsigned char  *yuvframe[2];
+    std::unique_ptr<FrameQueue> frameQueue;
+
+    // Everything below is only used by the encoder thread while capturing
+    int            encodedFrameCount;
+    YUVConverter   converter;
+    std::vector<unsigned char> yuvframe[2]; // 4:2:0 planes
     yuv_buffer     yuv;
     FILE           *outfile;
     ogg_stream_state to; /* take physical pages, weld into a logical
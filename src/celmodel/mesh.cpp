@@ -9,9 +9,11 @@
 // of the License, or (at your option) any later version.
 
 #include "mesh.h"
+#include "vertexpack.h"
 #include <cassert>
 #include <iostream>
 #include <algorithm>
+#include <cstring>
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 
@@ -27,9 +29,167 @@ static size_t VertexAttributeFormatSizes[Mesh::FormatMax] =
      12, // Float3
      16, // Float4,
      4,  // UByte4
+     4,  // Half2
+     8,  // Half4
+     8,  // Short4N
+     4,  // Octahedral
 };
 
 
+// Read an attribute as four floats. Missing components are zero, except w
+// which is one. Short4N values are mapped to the bounds if there are any.
+static void
+readAttribute(const char* data,
+              Mesh::VertexAttributeFormat format,
+              const AlignedBox<float, 3>* bounds,
+              float value[4])
+{
+    value[0] = value[1] = value[2] = 0.0f;
+    value[3] = 1.0f;
+
+    uint16_t h[4];
+    int16_t s[4];
+    switch (format)
+    {
+    case Mesh::Float1:
+    case Mesh::Float2:
+    case Mesh::Float3:
+    case Mesh::Float4:
+        memcpy(value, data, VertexAttributeFormatSizes[format]);
+        break;
+    case Mesh::UByte4:
+        for (int k = 0; k < 4; k++)
+            value[k] = (float) reinterpret_cast<const unsigned char*>(data)[k] / 255.0f;
+        break;
+    case Mesh::Half2:
+    case Mesh::Half4:
+        memcpy(h, data, VertexAttributeFormatSizes[format]);
+        for (size_t k = 0; k < VertexAttributeFormatSizes[format] / 2; k++)
+            value[k] = HalfToFloat(h[k]);
+        break;
+    case Mesh::Short4N:
+        memcpy(s, data, sizeof s);
+        for (int k = 0; k < 4; k++)
+            value[k] = Snorm16ToFloat(s[k]);
+        if (bounds != nullptr)
+        {
+            Vector3f center = bounds->center();
+            Vector3f halfSize = bounds->sizes() * 0.5f;
+            for (int k = 0; k < 3; k++)
+                value[k] = center[k] + halfSize[k] * value[k];
+        }
+        break;
+    case Mesh::Octahedral:
+        {
+            memcpy(s, data, 2 * sizeof(int16_t));
+            Vector3f v = DecodeOctahedral(s);
+            value[0] = v.x();
+            value[1] = v.y();
+            value[2] = v.z();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+
+static void
+writeAttribute(char* data,
+               Mesh::VertexAttributeFormat format,
+               const AlignedBox<float, 3>* bounds,
+               const float value[4])
+{
+    uint16_t h[4];
+    int16_t s[4];
+    switch (format)
+    {
+    case Mesh::Float1:
+    case Mesh::Float2:
+    case Mesh::Float3:
+    case Mesh::Float4:
+        memcpy(data, value, VertexAttributeFormatSizes[format]);
+        break;
+    case Mesh::UByte4:
+        for (int k = 0; k < 4; k++)
+        {
+            float c = max(0.0f, min(1.0f, value[k]));
+            reinterpret_cast<unsigned char*>(data)[k] = (unsigned char) (c * 255.0f + 0.5f);
+        }
+        break;
+    case Mesh::Half2:
+    case Mesh::Half4:
+        for (size_t k = 0; k < VertexAttributeFormatSizes[format] / 2; k++)
+            h[k] = FloatToHalf(value[k]);
+        memcpy(data, h, VertexAttributeFormatSizes[format]);
+        break;
+    case Mesh::Short4N:
+        for (int k = 0; k < 4; k++)
+            s[k] = FloatToSnorm16(value[k]);
+        if (bounds != nullptr)
+        {
+            Vector3f center = bounds->center();
+            Vector3f halfSize = bounds->sizes() * 0.5f;
+            for (int k = 0; k < 3; k++)
+                s[k] = halfSize[k] > 0.0f ? FloatToSnorm16((value[k] - center[k]) / halfSize[k]) : 0;
+        }
+        memcpy(data, s, sizeof s);
+        break;
+    case Mesh::Octahedral:
+        EncodeOctahedral(Vector3f(value[0], value[1], value[2]), s);
+        memcpy(data, s, 2 * sizeof(int16_t));
+        break;
+    default:
+        break;
+    }
+}
+
+
+// Copy vertices between descriptions, matching attributes by semantic.
+// Attributes missing from the source are set to zero.
+static void
+convertVertexData(const Mesh::VertexDescription& srcDesc,
+                  const char* src,
+                  const AlignedBox<float, 3>& srcBounds,
+                  const Mesh::VertexDescription& destDesc,
+                  char* dest,
+                  const AlignedBox<float, 3>& destBounds,
+                  unsigned int nVertices)
+{
+    for (unsigned int attr = 0; attr < destDesc.nAttributes; attr++)
+    {
+        const Mesh::VertexAttribute& to = destDesc.attributes[attr];
+        const Mesh::VertexAttribute& from = srcDesc.getAttribute(to.semantic);
+        size_t size = VertexAttributeFormatSizes[to.format];
+        const char* in = src + from.offset;
+        char* out = dest + to.offset;
+
+        bool isPosition = to.semantic == Mesh::Position;
+        if (from.format == Mesh::InvalidFormat)
+        {
+            for (unsigned int i = 0; i < nVertices; i++, out += destDesc.stride)
+                memset(out, 0, size);
+        }
+        else if (from.format == to.format &&
+                 (!isPosition || to.format != Mesh::Short4N ||
+                  (srcBounds.min() == destBounds.min() && srcBounds.max() == destBounds.max())))
+        {
+            for (unsigned int i = 0; i < nVertices; i++, in += srcDesc.stride, out += destDesc.stride)
+                memcpy(out, in, size);
+        }
+        else
+        {
+            float value[4];
+            for (unsigned int i = 0; i < nVertices; i++, in += srcDesc.stride, out += destDesc.stride)
+            {
+                readAttribute(in, from.format, isPosition ? &srcBounds : nullptr, value);
+                writeAttribute(out, to.format, isPosition ? &destBounds : nullptr, value);
+            }
+        }
+    }
+}
+
+
 Mesh::VertexDescription::VertexDescription(unsigned int _stride,
                                            unsigned int _nAttributes,
                                            VertexAttribute* _attributes) :
@@ -328,14 +488,8 @@ Mesh::pick(const Vector3d& rayOrigin, const Vector3d& rayDirection, PickResult*
 
     // Pick will automatically fail without vertex positions--no reasonable
     // mesh should lack these.
-    if (vertexDesc.getAttribute(Position).semantic != Position ||
-        vertexDesc.getAttribute(Position).format != Float3)
-    {
+    if (!hasPositions())
         return false;
-    }
-
-    unsigned int posOffset = vertexDesc.getAttribute(Position).offset;
-    auto* vdata = reinterpret_cast<char*>(vertices);
 
     // Iterate over all primitive groups in the mesh
     for (const auto group : groups)
@@ -350,7 +504,9 @@ Mesh::pick(const Vector3d& rayOrigin, const Vector3d& rayDirection, PickResult*
             !(primType == TriList && nIndices % 3 != 0))
         {
             unsigned int primitiveIndex = 0;
-            index32 index = 0;
+            // Index of the first vertex of the current triangle in a list,
+            // and of its last vertex in a strip or fan
+            index32 index = primType == TriList ? 0 : 2;
             index32 i0 = group->indices[0];
             index32 i1 = group->indices[1];
             index32 i2 = group->indices[2];
@@ -359,9 +515,9 @@ Mesh::pick(const Vector3d& rayOrigin, const Vector3d& rayDirection, PickResult*
             do
             {
                 // Get the triangle vertices v0, v1, and v2
-                Vector3d v0 = Map<Vector3f>(reinterpret_cast<float*>(vdata + i0 * vertexDesc.stride + posOffset)).cast<double>();
-                Vector3d v1 = Map<Vector3f>(reinterpret_cast<float*>(vdata + i1 * vertexDesc.stride + posOffset)).cast<double>();
-                Vector3d v2 = Map<Vector3f>(reinterpret_cast<float*>(vdata + i2 * vertexDesc.stride + posOffset)).cast<double>();
+                Vector3d v0 = getPosition(i0).cast<double>();
+                Vector3d v1 = getPosition(i1).cast<double>();
+                Vector3d v2 = getPosition(i2).cast<double>();
 
                 // Compute the edge vectors e0 and e1, and the normal n
                 Vector3d e0 = v1 - v0;
@@ -434,7 +590,6 @@ Mesh::pick(const Vector3d& rayOrigin, const Vector3d& rayDirection, PickResult*
                     index += 1;
                     if (index < nIndices)
                     {
-                        index += 1;
                         i1 = i2;
                         i2 = group->indices[index];
                     }
@@ -470,22 +625,19 @@ Mesh::getBoundingBox() const
     AlignedBox<float, 3> bbox;
 
     // Return an empty box if there's no position info
-    if (vertexDesc.getAttribute(Position).format != Float3)
+    if (!hasPositions())
         return bbox;
 
-    char* vdata = reinterpret_cast<char*>(vertices) + vertexDesc.getAttribute(Position).offset;
-
     if (vertexDesc.getAttribute(PointSize).format == Float1)
     {
         // Handle bounding box calculation for point sprites. Unlike other
         // primitives, point sprite vertices have a non-zero size.
-        int pointSizeOffset = (int) vertexDesc.getAttribute(PointSize).offset -
-            (int) vertexDesc.getAttribute(Position).offset;
+        char* vdata = reinterpret_cast<char*>(vertices) + vertexDesc.getAttribute(PointSize).offset;
 
         for (unsigned int i = 0; i < nVertices; i++, vdata += vertexDesc.stride)
         {
-            Vector3f center = Map<Vector3f>(reinterpret_cast<float*>(vdata));
-            float pointSize = (reinterpret_cast<float*>(vdata + pointSizeOffset))[0];
+            Vector3f center = getPosition(i);
+            float pointSize = (reinterpret_cast<float*>(vdata))[0];
             Vector3f offsetVec = Vector3f::Constant(pointSize);
 
             AlignedBox<float, 3> pointbox(center - offsetVec, center + offsetVec);
@@ -494,8 +646,8 @@ Mesh::getBoundingBox() const
     }
     else
     {
-        for (unsigned int i = 0; i < nVertices; i++, vdata += vertexDesc.stride)
-            bbox.extend(Map<Vector3f>(reinterpret_cast<float*>(vdata)));
+        for (unsigned int i = 0; i < nVertices; i++)
+            bbox.extend(getPosition(i));
     }
 
     return bbox;
@@ -505,17 +657,38 @@ Mesh::getBoundingBox() const
 void
 Mesh::transform(const Vector3f& translation, float scale)
 {
-    if (vertexDesc.getAttribute(Position).format != Float3)
-        return;
-
-    char* vdata = reinterpret_cast<char*>(vertices) + vertexDesc.getAttribute(Position).offset;
+    const VertexAttribute& position = vertexDesc.getAttribute(Position);
+    char* vdata = reinterpret_cast<char*>(vertices) + position.offset;
     unsigned int i;
 
     // Scale and translate the vertex positions
-    for (i = 0; i < nVertices; i++, vdata += vertexDesc.stride)
+    switch (position.format)
     {
-        const Vector3f tv = (Map<Vector3f>(reinterpret_cast<float*>(vdata)) + translation) * scale;
-        Map<Vector3f>(reinterpret_cast<float*>(vdata)) = tv;
+    case Float3:
+        for (i = 0; i < nVertices; i++, vdata += vertexDesc.stride)
+        {
+            const Vector3f tv = (Map<Vector3f>(reinterpret_cast<float*>(vdata)) + translation) * scale;
+            Map<Vector3f>(reinterpret_cast<float*>(vdata)) = tv;
+        }
+        break;
+    case Half4:
+        for (i = 0; i < nVertices; i++, vdata += vertexDesc.stride)
+        {
+            float value[4];
+            readAttribute(vdata, Half4, nullptr, value);
+            for (int k = 0; k < 3; k++)
+                value[k] = (value[k] + translation[k]) * scale;
+            writeAttribute(vdata, Half4, nullptr, value);
+        }
+        break;
+    case Short4N:
+        // Quantized positions are relative to the bounds, so only the
+        // bounds need to be transformed.
+        positionBounds = AlignedBox<float, 3>((positionBounds.min() + translation) * scale,
+                                              (positionBounds.max() + translation) * scale);
+        break;
+    default:
+        return;
     }
 
     // Point sizes need to be scaled as well
@@ -528,6 +701,120 @@ Mesh::transform(const Vector3f& translation, float scale)
 }
 
 
+bool
+Mesh::hasPositions() const
+{
+    switch (vertexDesc.getAttribute(Position).format)
+    {
+    case Float3:
+    case Half4:
+    case Short4N:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+Vector3f
+Mesh::getPosition(index32 vertex) const
+{
+    const VertexAttribute& position = vertexDesc.getAttribute(Position);
+    const char* vdata = reinterpret_cast<const char*>(vertices) + vertex * vertexDesc.stride + position.offset;
+    if (position.format == Float3)
+        return Map<const Vector3f>(reinterpret_cast<const float*>(vdata));
+
+    float value[4];
+    readAttribute(vdata, position.format, &positionBounds, value);
+    return Vector3f(value[0], value[1], value[2]);
+}
+
+
+bool
+Mesh::hasPackedVertices() const
+{
+    for (unsigned int i = 0; i < vertexDesc.nAttributes; i++)
+    {
+        if (isPackedFormat(vertexDesc.attributes[i].format))
+            return true;
+    }
+
+    return false;
+}
+
+
+bool
+Mesh::convertVertices(const VertexDescription& newDesc)
+{
+    if (!newDesc.validate())
+        return false;
+
+    AlignedBox<float, 3> newBounds = positionBounds;
+    if (newDesc.getAttribute(Position).format == Short4N &&
+        vertexDesc.getAttribute(Position).format != Short4N)
+    {
+        newBounds = AlignedBox<float, 3>(Vector3f::Zero(), Vector3f::Zero());
+        if (hasPositions() && nVertices > 0)
+        {
+            newBounds = AlignedBox<float, 3>(getPosition(0));
+            for (unsigned int i = 1; i < nVertices; i++)
+                newBounds.extend(getPosition(i));
+        }
+    }
+
+    auto* newVertexData = new char[nVertices * newDesc.stride];
+    convertVertexData(vertexDesc, reinterpret_cast<const char*>(vertices), positionBounds,
+                      newDesc, newVertexData, newBounds,
+                      nVertices);
+
+    setVertices(nVertices, newVertexData);
+    vertexDesc = newDesc;
+    positionBounds = newBounds;
+
+    return true;
+}
+
+
+Mesh::VertexDescription
+Mesh::getUnpackedVertexDescription() const
+{
+    vector<VertexAttribute> attributes(vertexDesc.attributes,
+                                       vertexDesc.attributes + vertexDesc.nAttributes);
+    unsigned int offset = 0;
+    for (auto& attr : attributes)
+    {
+        switch (attr.format)
+        {
+        case Half2:
+            attr.format = Float2;
+            break;
+        case Half4:
+        case Short4N:
+            attr.format = attr.semantic == Position ? Float3 : Float4;
+            break;
+        case Octahedral:
+            attr.format = Float3;
+            break;
+        default:
+            break;
+        }
+        attr.offset = offset;
+        offset += getVertexAttributeSize(attr.format);
+    }
+
+    return VertexDescription(offset, attributes.size(), attributes.data());
+}
+
+
+void
+Mesh::unpackVertices(void* vertexData) const
+{
+    convertVertexData(vertexDesc, reinterpret_cast<const char*>(vertices), positionBounds,
+                      getUnpackedVertexDescription(), reinterpret_cast<char*>(vertexData), positionBounds,
+                      nVertices);
+}
+
+
 unsigned int
 Mesh::getPrimitiveCount() const
 {
@@ -603,6 +890,14 @@ Mesh::parseVertexAttributeFormat(const string& name)
         return Float4;
     if (name == "ub4")
         return UByte4;
+    if (name == "h2")
+        return Half2;
+    if (name == "h4")
+        return Half4;
+    if (name == "s4n")
+        return Short4N;
+    if (name == "oct")
+        return Octahedral;
     return InvalidFormat;
 }
 
@@ -622,6 +917,22 @@ Mesh::parseTextureSemantic(const string& name)
 }
 
 
+bool
+Mesh::isPackedFormat(VertexAttributeFormat fmt)
+{
+    switch (fmt)
+    {
+    case Half2:
+    case Half4:
+    case Short4N:
+    case Octahedral:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
 unsigned int
 Mesh::getVertexAttributeSize(VertexAttributeFormat fmt)
 {
@@ -629,8 +940,12 @@ Mesh::getVertexAttributeSize(VertexAttributeFormat fmt)
     {
     case Float1:
     case UByte4:
+    case Half2:
+    case Octahedral:
         return 4;
     case Float2:
+    case Half4:
+    case Short4N:
         return 8;
     case Float3:
         return 12;
@@ -53,7 +53,13 @@ class Mesh
         Float3    = 2,
         Float4    = 3,
         UByte4    = 4,
-        FormatMax = 5,
+        // Packed formats
+        Half2     = 5,  // half precision floats
+        Half4     = 6,
+        Short4N   = 7,  // signed normalized shorts; positions are relative
+                        // to the position bounds of the mesh
+        Octahedral = 8, // unit vector as two signed normalized shorts
+        FormatMax = 9,
         InvalidFormat = -1,
     };
 
@@ -182,6 +188,30 @@ class Mesh
     Eigen::AlignedBox<float, 3> getBoundingBox() const;
     void transform(const Eigen::Vector3f& translation, float scale);
 
+    /*! Positions stored as Short4N are mapped from -1..1 to the extent of
+     *  this box.
+     */
+    const Eigen::AlignedBox<float, 3>& getPositionBounds() const { return positionBounds; }
+    void setPositionBounds(const Eigen::AlignedBox<float, 3>& bounds) { positionBounds = bounds; }
+
+    //! True if the mesh has vertex positions in a format getPosition() reads
+    bool hasPositions() const;
+    Eigen::Vector3f getPosition(index32 vertex) const;
+
+    bool hasPackedVertices() const;
+
+    /*! Convert the vertices to another description; attributes are matched
+     *  by semantic. Packed positions are quantized relative to the bounds of
+     *  the current positions.
+     */
+    bool convertVertices(const VertexDescription& newDesc);
+
+    /*! Description and copy of the vertices with the packed attributes
+     *  expanded to floats, for code which can't handle them.
+     */
+    VertexDescription getUnpackedVertexDescription() const;
+    void unpackVertices(void* vertexData) const;
+
     const void* getVertexData() const { return vertices; }
     unsigned int getVertexCount() const { return nVertices; }
     unsigned int getVertexStride() const { return vertexDesc.stride; }
@@ -192,6 +222,7 @@ class Mesh
     static VertexAttributeFormat     parseVertexAttributeFormat(const std::string&);
     static Material::TextureSemantic parseTextureSemantic(const std::string&);
     static unsigned int              getVertexAttributeSize(VertexAttributeFormat);
+    static bool                      isPackedFormat(VertexAttributeFormat);
 
  private:
     void recomputeBoundingBox();
@@ -201,6 +232,7 @@ class Mesh
 
     unsigned int nVertices{ 0 };
     void* vertices{ nullptr };
+    Eigen::AlignedBox<float, 3> positionBounds{ Eigen::Vector3f::Zero(), Eigen::Vector3f::Zero() };
     mutable BufferResource* vbResource{ nullptr };
 
     std::vector<PrimitiveGroup*> groups;
@@ -0,0 +1,93 @@
+// modelcache.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include "modelcache.h"
+#include <cstdint>
+#include <fstream>
+#include <fmt/format.h>
+#include <celutil/cachefile.h>
+#include <celutil/debug.h>
+
+using namespace cmod;
+using namespace std;
+
+
+// A cache file is this header, the key of the entry terminated by a null
+// character, and the model in binary cmod format.
+static const char CacheFileHeader[] = "#celmodel_cache\n";
+
+
+
+
+ModelCache::ModelCache(const fs::path& _directory) :
+    directory(_directory)
+{
+}
+
+
+fs::path
+ModelCache::getCacheFile(const fs::path& source,
+                         const string& parameters) const
+{
+    // Hash of the path and parameters; the full key stored in the file
+    // guards against collisions.
+    string name = source.string();
+    name += '\0';
+    name += parameters;
+
+    return directory / fmt::format("{:016x}.cmod", HashFNV1a(name));
+}
+
+
+Model*
+ModelCache::load(const fs::path& source,
+                 const string& parameters,
+                 TextureLoader* textureLoader) const
+{
+    string key;
+    if (!MakeCacheKey(source, parameters, key))
+        return nullptr;
+
+    ifstream in(getCacheFile(source, parameters).string(), ios::in | ios::binary);
+    if (!in.good())
+        return nullptr;
+
+    char header[sizeof(CacheFileHeader) - 1];
+    if (!in.read(header, sizeof(header)) || !equal(header, header + sizeof(header), CacheFileHeader))
+        return nullptr;
+
+    string cachedKey;
+    if (!getline(in, cachedKey, '\0') || cachedKey != key)
+    {
+        DPRINTF(LOG_LEVEL_INFO, "Model cache entry for %s is out of date\n", source);
+        return nullptr;
+    }
+
+    return LoadModel(in, textureLoader);
+}
+
+
+bool
+ModelCache::save(const fs::path& source,
+                 const string& parameters,
+                 const Model& model) const
+{
+    string key;
+    if (!MakeCacheKey(source, parameters, key) || !CreateDirectories(directory))
+        return false;
+
+    // A failed write or another instance reading the cache never sees a
+    // partial entry.
+    return ReplaceFileContents(getCacheFile(source, parameters), [&](ostream& out)
+    {
+        out.write(CacheFileHeader, sizeof(CacheFileHeader) - 1);
+        out.write(key.c_str(), key.size() + 1);
+        return SaveModelBinary(&model, out);
+    });
+}
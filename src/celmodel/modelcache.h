@@ -0,0 +1,45 @@
+// modelcache.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// On-disk cache of models converted from other file formats, stored as
+// binary cmod files.
+
+#pragma once
+
+#include <string>
+#include <celcompat/filesystem.h>
+#include <celmodel/modelfile.h>
+
+namespace cmod
+{
+
+class ModelCache
+{
+ public:
+    explicit ModelCache(const fs::path& directory);
+
+    // Entries are keyed by the source path and the conversion parameters,
+    // and are stale once the size or modification time of the source file
+    // changes. Returns nullptr if there's no up to date entry.
+    Model* load(const fs::path& source,
+                const std::string& parameters,
+                TextureLoader* textureLoader = nullptr) const;
+    bool save(const fs::path& source,
+              const std::string& parameters,
+              const Model& model) const;
+
+    fs::path getCacheFile(const fs::path& source,
+                          const std::string& parameters) const;
+    const fs::path& getDirectory() const { return directory; }
+
+ private:
+    fs::path directory;
+};
+
+} // namespace cmod
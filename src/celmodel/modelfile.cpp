@@ -9,6 +9,7 @@
 // of the License, or (at your option) any later version.
 
 #include "modelfile.h"
+#include "vertexpack.h"
 #include <celutil/bytes.h>
 #include <cassert>
 #include <cmath>
@@ -16,6 +17,7 @@
 
 
 using namespace cmod;
+using namespace Eigen;
 using namespace std;
 
 
@@ -631,6 +633,7 @@ static Token EndMeshToken = Token::NameToken("end_mesh");
 static Token VertexDescToken = Token::NameToken("vertexdesc");
 static Token EndVertexDescToken = Token::NameToken("end_vertexdesc");
 static Token VerticesToken = Token::NameToken("vertices");
+static Token BoundsToken = Token::NameToken("bounds");
 static Token MaterialToken = Token::NameToken("material");
 static Token EndMaterialToken = Token::NameToken("end_material");
 
@@ -1078,6 +1081,8 @@ AsciiModelLoader::loadVertices(const Mesh::VertexDescription& vertexDesc,
                 readCount = 1;
                 break;
             case Mesh::Float2:
+            case Mesh::Half2:
+            case Mesh::Octahedral:
                 readCount = 2;
                 break;
             case Mesh::Float3:
@@ -1085,6 +1090,8 @@ AsciiModelLoader::loadVertices(const Mesh::VertexDescription& vertexDesc,
                 break;
             case Mesh::Float4:
             case Mesh::UByte4:
+            case Mesh::Half4:
+            case Mesh::Short4N:
                 readCount = 4;
                 break;
             default:
@@ -1116,6 +1123,21 @@ AsciiModelLoader::loadVertices(const Mesh::VertexDescription& vertexDesc,
                         (unsigned char) (data[k]);
                 }
             }
+            else if (fmt == Mesh::Half2 || fmt == Mesh::Half4)
+            {
+                // Half floats are written as their float values
+                for (int k = 0; k < readCount; k++)
+                    reinterpret_cast<uint16_t*>(vertexData + base)[k] = FloatToHalf((float) data[k]);
+            }
+            else if (fmt == Mesh::Short4N || fmt == Mesh::Octahedral)
+            {
+                // Normalized shorts are written as integers
+                for (int k = 0; k < readCount; k++)
+                {
+                    reinterpret_cast<int16_t*>(vertexData + base)[k] =
+                        (int16_t) max(-32767.0, min(32767.0, data[k]));
+                }
+            }
             else
             {
                 for (int k = 0; k < readCount; k++)
@@ -1141,6 +1163,29 @@ AsciiModelLoader::loadMesh()
     if (vertexDesc == nullptr)
         return nullptr;
 
+    // Optional bounds of quantized positions
+    AlignedBox<float, 3> positionBounds(Vector3f::Zero(), Vector3f::Zero());
+    if (tok.nextToken() == BoundsToken)
+    {
+        double bounds[6];
+        for (double& b : bounds)
+        {
+            if (!tok.nextToken().isNumber())
+            {
+                reportError("Bad position bounds");
+                delete vertexDesc;
+                return nullptr;
+            }
+            b = tok.currentToken().numberValue();
+        }
+        positionBounds = AlignedBox<float, 3>(Vector3d(bounds[0], bounds[1], bounds[2]).cast<float>(),
+                                              Vector3d(bounds[3], bounds[4], bounds[5]).cast<float>());
+    }
+    else
+    {
+        tok.pushBack();
+    }
+
     unsigned int vertexCount = 0;
     char* vertexData = loadVertices(*vertexDesc, vertexCount);
     if (vertexData == nullptr)
@@ -1152,6 +1197,7 @@ AsciiModelLoader::loadMesh()
     auto* mesh = new Mesh();
     mesh->setVertexDescription(*vertexDesc);
     mesh->setVertices(vertexCount, vertexData);
+    mesh->setPositionBounds(positionBounds);
     delete vertexDesc;
 
     while (tok.nextToken().isName() && tok.currentToken() != EndMeshToken)
@@ -1365,6 +1411,14 @@ AsciiModelWriter::writeMesh(const Mesh& mesh)
     writeVertexDescription(mesh.getVertexDescription());
     out << '\n';
 
+    if (mesh.getVertexDescription().getAttribute(Mesh::Position).format == Mesh::Short4N)
+    {
+        const AlignedBox<float, 3>& bounds = mesh.getPositionBounds();
+        out << "bounds " <<
+            bounds.min().x() << ' ' << bounds.min().y() << ' ' << bounds.min().z() << ' ' <<
+            bounds.max().x() << ' ' << bounds.max().y() << ' ' << bounds.max().z() << "\n\n";
+    }
+
     writeVertices(mesh.getVertexData(),
                   mesh.getVertexCount(),
                   mesh.getVertexStride(),
@@ -1396,6 +1450,8 @@ AsciiModelWriter::writeVertices(const void* vertexData,
         {
             const unsigned char* ubdata = vertex + desc.attributes[attr].offset;
             const auto* fdata = reinterpret_cast<const float*>(ubdata);
+            const auto* hdata = reinterpret_cast<const uint16_t*>(ubdata);
+            const auto* sdata = reinterpret_cast<const int16_t*>(ubdata);
 
             switch (desc.attributes[attr].format)
             {
@@ -1416,6 +1472,20 @@ AsciiModelWriter::writeVertices(const void* vertexData,
                 out << (int) ubdata[0] << ' ' << (int) ubdata[1] << ' ' <<
                        (int) ubdata[2] << ' ' << (int) ubdata[3];
                 break;
+            case Mesh::Half2:
+                out << HalfToFloat(hdata[0]) << ' ' << HalfToFloat(hdata[1]);
+                break;
+            case Mesh::Half4:
+                out << HalfToFloat(hdata[0]) << ' ' << HalfToFloat(hdata[1]) << ' ' <<
+                       HalfToFloat(hdata[2]) << ' ' << HalfToFloat(hdata[3]);
+                break;
+            case Mesh::Short4N:
+                out << sdata[0] << ' ' << sdata[1] << ' ' <<
+                       sdata[2] << ' ' << sdata[3];
+                break;
+            case Mesh::Octahedral:
+                out << sdata[0] << ' ' << sdata[1];
+                break;
             default:
                 assert(0);
                 break;
@@ -1494,6 +1564,18 @@ AsciiModelWriter::writeVertexDescription(const Mesh::VertexDescription& desc)
         case Mesh::UByte4:
             out << "ub4";
             break;
+        case Mesh::Half2:
+            out << "h2";
+            break;
+        case Mesh::Half4:
+            out << "h4";
+            break;
+        case Mesh::Short4N:
+            out << "s4n";
+            break;
+        case Mesh::Octahedral:
+            out << "oct";
+            break;
         default:
             assert(0);
             break;
@@ -1662,6 +1744,17 @@ static bool readTypeFloat1(istream& in, float& f)
 }
 
 
+static bool readTypeFloat3(istream& in, Vector3f& v)
+{
+    if (readType(in) != CMOD_Float3)
+        return false;
+    v.x() = readFloat(in);
+    v.y() = readFloat(in);
+    v.z() = readFloat(in);
+    return true;
+}
+
+
 static bool readTypeColor(istream& in, Material::Color& c)
 {
     if (readType(in) != CMOD_Color)
@@ -2010,6 +2103,30 @@ BinaryModelLoader::loadMesh()
     if (vertexDesc == nullptr)
         return nullptr;
 
+    // Optional bounds of quantized positions
+    AlignedBox<float, 3> positionBounds(Vector3f::Zero(), Vector3f::Zero());
+    ModelFileToken tok = readToken(in);
+    if (tok == CMOD_Bounds)
+    {
+        Vector3f boundsMin;
+        Vector3f boundsMax;
+        if (!readTypeFloat3(in, boundsMin) || !readTypeFloat3(in, boundsMax))
+        {
+            reportError("Bad position bounds");
+            delete vertexDesc;
+            return nullptr;
+        }
+        positionBounds = AlignedBox<float, 3>(boundsMin, boundsMax);
+        tok = readToken(in);
+    }
+
+    if (tok != CMOD_Vertices)
+    {
+        reportError("Vertex data expected");
+        delete vertexDesc;
+        return nullptr;
+    }
+
     unsigned int vertexCount = 0;
     char* vertexData = loadVertices(*vertexDesc, vertexCount);
     if (vertexData == nullptr)
@@ -2021,6 +2138,7 @@ BinaryModelLoader::loadMesh()
     auto* mesh = new Mesh();
     mesh->setVertexDescription(*vertexDesc);
     mesh->setVertices(vertexCount, vertexData);
+    mesh->setPositionBounds(positionBounds);
     delete vertexDesc;
 
     for (;;)
@@ -2044,19 +2162,25 @@ BinaryModelLoader::loadMesh()
         unsigned int indexCount = readUint(in);
 
         auto* indices = new uint32_t[indexCount];
+        in.read(reinterpret_cast<char*>(indices), indexCount * sizeof(uint32_t));
+        if (!in.good())
+        {
+            reportError("Index data truncated");
+            delete[] indices;
+            delete mesh;
+            return nullptr;
+        }
 
         for (unsigned int i = 0; i < indexCount; i++)
         {
-            uint32_t index = readUint(in);
-            if (index >= vertexCount)
+            LE_TO_CPU_INT32(indices[i], indices[i]);
+            if (indices[i] >= vertexCount)
             {
                 reportError("Index out of range");
                 delete[] indices;
                 delete mesh;
                 return nullptr;
             }
-
-            indices[i] = index;
         }
 
         mesh->addGroup(type, materialIndex, indexCount, indices);
@@ -2070,56 +2194,56 @@ char*
 BinaryModelLoader::loadVertices(const Mesh::VertexDescription& vertexDesc,
                                 unsigned int& vertexCount)
 {
-    if (readToken(in) != CMOD_Vertices)
-    {
-        reportError("Vertex data expected");
-        return nullptr;
-    }
-
     vertexCount = readUint(in);
     unsigned int vertexDataSize = vertexDesc.stride * vertexCount;
+
+    // The attributes are stored in the order of the vertex description,
+    // packed as in memory, so the vertices are read in one go.
     auto* vertexData = new char[vertexDataSize];
+    in.read(vertexData, vertexDataSize);
+    if (!in.good())
+    {
+        reportError("Vertex data truncated");
+        delete[] vertexData;
+        return nullptr;
+    }
 
+#if defined(WORDS_BIGENDIAN) || defined(__BIG_ENDIAN__)
     unsigned int offset = 0;
-
     for (unsigned int i = 0; i < vertexCount; i++, offset += vertexDesc.stride)
     {
-        assert(offset < vertexDataSize);
         for (unsigned int attr = 0; attr < vertexDesc.nAttributes; attr++)
         {
-            unsigned int base = offset + vertexDesc.attributes[attr].offset;
-            Mesh::VertexAttributeFormat fmt = vertexDesc.attributes[attr].format;
-            /*int readCount = 0;    Unused*/
-            switch (fmt)
+            char* data = vertexData + offset + vertexDesc.attributes[attr].offset;
+            unsigned int size = Mesh::getVertexAttributeSize(vertexDesc.attributes[attr].format);
+            switch (vertexDesc.attributes[attr].format)
             {
             case Mesh::Float1:
-                reinterpret_cast<float*>(vertexData + base)[0] = readFloat(in);
-                break;
             case Mesh::Float2:
-                reinterpret_cast<float*>(vertexData + base)[0] = readFloat(in);
-                reinterpret_cast<float*>(vertexData + base)[1] = readFloat(in);
-                break;
             case Mesh::Float3:
-                reinterpret_cast<float*>(vertexData + base)[0] = readFloat(in);
-                reinterpret_cast<float*>(vertexData + base)[1] = readFloat(in);
-                reinterpret_cast<float*>(vertexData + base)[2] = readFloat(in);
-                break;
             case Mesh::Float4:
-                reinterpret_cast<float*>(vertexData + base)[0] = readFloat(in);
-                reinterpret_cast<float*>(vertexData + base)[1] = readFloat(in);
-                reinterpret_cast<float*>(vertexData + base)[2] = readFloat(in);
-                reinterpret_cast<float*>(vertexData + base)[3] = readFloat(in);
+                for (unsigned int k = 0; k < size; k += 4)
+                {
+                    auto* f = reinterpret_cast<float*>(data + k);
+                    LE_TO_CPU_FLOAT(*f, *f);
+                }
                 break;
-            case Mesh::UByte4:
-                in.get(reinterpret_cast<char*>(vertexData + base), 4);
+            case Mesh::Half2:
+            case Mesh::Half4:
+            case Mesh::Short4N:
+            case Mesh::Octahedral:
+                for (unsigned int k = 0; k < size; k += 2)
+                {
+                    auto* s = reinterpret_cast<int16_t*>(data + k);
+                    LE_TO_CPU_INT16(*s, *s);
+                }
                 break;
             default:
-                assert(0);
-                delete[] vertexData;
-                return nullptr;
+                break;
             }
         }
     }
+#endif
 
     return vertexData;
 }
@@ -2170,6 +2294,15 @@ static void writeTypeFloat1(ostream& out, float f)
 }
 
 
+static void writeTypeFloat3(ostream& out, const Vector3f& v)
+{
+    writeType(out, CMOD_Float3);
+    writeFloat(out, v.x());
+    writeFloat(out, v.y());
+    writeFloat(out, v.z());
+}
+
+
 static void writeTypeColor(ostream& out, const Material::Color& c)
 {
     writeType(out, CMOD_Color);
@@ -2223,6 +2356,14 @@ BinaryModelWriter::writeMesh(const Mesh& mesh)
 
     writeVertexDescription(mesh.getVertexDescription());
 
+    if (mesh.getVertexDescription().getAttribute(Mesh::Position).format == Mesh::Short4N)
+    {
+        const AlignedBox<float, 3>& bounds = mesh.getPositionBounds();
+        writeToken(out, CMOD_Bounds);
+        writeTypeFloat3(out, bounds.min());
+        writeTypeFloat3(out, bounds.max());
+    }
+
     writeVertices(mesh.getVertexData(),
                   mesh.getVertexCount(),
                   mesh.getVertexStride(),
@@ -2276,6 +2417,13 @@ BinaryModelWriter::writeVertices(const void* vertexData,
             case Mesh::UByte4:
                 out.write(cdata, 4);
                 break;
+            case Mesh::Half2:
+            case Mesh::Half4:
+            case Mesh::Short4N:
+            case Mesh::Octahedral:
+                for (unsigned int k = 0; k < Mesh::getVertexAttributeSize(desc.attributes[attr].format); k += 2)
+                    writeInt16(out, *reinterpret_cast<const int16_t*>(cdata + k));
+                break;
             default:
                 assert(0);
                 break;
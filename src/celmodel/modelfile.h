@@ -91,6 +91,7 @@ enum ModelFileToken
     CMOD_Vertices       = 1013,
     CMOD_Emissive       = 1014,
     CMOD_Blend          = 1015,
+    CMOD_Bounds         = 1016,
 };
 
 enum ModelFileType
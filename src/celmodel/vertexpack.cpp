@@ -0,0 +1,176 @@
+// vertexpack.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include "vertexpack.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace Eigen;
+using namespace std;
+
+
+uint16_t
+cmod::FloatToHalf(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof x);
+    auto sign = (uint16_t) ((x >> 16) & 0x8000);
+    uint32_t absx = x & 0x7fffffff;
+
+    // Infinity and NaN; keep NaNs quiet
+    if (absx >= 0x7f800000)
+        return sign | 0x7c00 | (absx > 0x7f800000 ? 0x200 : 0);
+    // 65520 and above round to infinity
+    if (absx >= 0x477ff000)
+        return sign | 0x7c00;
+
+    uint32_t h;
+    uint32_t rem;
+    uint32_t halfway;
+    if (absx < 0x38800000)
+    {
+        // Denormal half, in units of 2^-24
+        if (absx < 0x33000000)
+            return sign;
+        uint32_t mantissa = (absx & 0x7fffff) | 0x800000;
+        uint32_t shift = 126 - (absx >> 23);
+        h = mantissa >> shift;
+        rem = mantissa & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    }
+    else
+    {
+        // Rebias the exponent from 127 to 15; a carry out of the mantissa
+        // when rounding correctly increments the exponent.
+        h = (absx - 0x38000000) >> 13;
+        rem = absx & 0x1fff;
+        halfway = 0x1000;
+    }
+
+    if (rem > halfway || (rem == halfway && (h & 1) != 0))
+        h++;
+
+    return sign | (uint16_t) h;
+}
+
+
+float
+cmod::HalfToFloat(uint16_t h)
+{
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    if (exponent == 0)
+    {
+        float f = (float) mantissa * 5.9604645e-8f;  // 2^-24
+        return sign != 0 ? -f : f;
+    }
+
+    uint32_t x;
+    if (exponent == 31)
+        x = sign | 0x7f800000 | (mantissa << 13);
+    else
+        x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+    float f;
+    memcpy(&f, &x, sizeof f);
+    return f;
+}
+
+
+int16_t
+cmod::FloatToSnorm16(float f)
+{
+    f = max(-1.0f, min(1.0f, f));
+    return (int16_t) lround(f * 32767.0f);
+}
+
+
+float
+cmod::Snorm16ToFloat(int16_t s)
+{
+    return max(-1.0f, (float) s / 32767.0f);
+}
+
+
+namespace
+{
+inline float signNotZero(float x)
+{
+    return x < 0.0f ? -1.0f : 1.0f;
+}
+
+Vector2f octahedralProject(const Vector3f& v)
+{
+    Vector3f n = v / (abs(v.x()) + abs(v.y()) + abs(v.z()));
+    if (n.z() >= 0.0f)
+        return Vector2f(n.x(), n.y());
+
+    return Vector2f((1.0f - abs(n.y())) * signNotZero(n.x()),
+                    (1.0f - abs(n.x())) * signNotZero(n.y()));
+}
+} // end unnamed namespace
+
+
+void
+cmod::EncodeOctahedral(const Vector3f& v, int16_t oct[2])
+{
+    if (v.x() == 0.0f && v.y() == 0.0f && v.z() == 0.0f)
+    {
+        oct[0] = 0;
+        oct[1] = 0;
+        return;
+    }
+
+    Vector2f p = octahedralProject(v) * 32767.0f;
+    Vector3f n = v.normalized();
+    float rx = round(p.x());
+    float ry = round(p.y());
+
+    // Plain rounding can be far from the best choice, especially in the
+    // folded half, so try the neighboring points. Distances are compared
+    // rather than dot products, which are all 1 in float precision.
+    float bestDistance = 4.0f;
+    for (int dy = -1; dy <= 1; dy++)
+    {
+        for (int dx = -1; dx <= 1; dx++)
+        {
+            int16_t candidate[2] =
+            {
+                (int16_t) max(-32767.0f, min(32767.0f, rx + (float) dx)),
+                (int16_t) max(-32767.0f, min(32767.0f, ry + (float) dy))
+            };
+            float distance = (DecodeOctahedral(candidate) - n).squaredNorm();
+            if (distance < bestDistance)
+            {
+                bestDistance = distance;
+                oct[0] = candidate[0];
+                oct[1] = candidate[1];
+            }
+        }
+    }
+}
+
+
+Vector3f
+cmod::DecodeOctahedral(const int16_t oct[2])
+{
+    float x = Snorm16ToFloat(oct[0]);
+    float y = Snorm16ToFloat(oct[1]);
+    Vector3f v(x, y, 1.0f - abs(x) - abs(y));
+    if (v.z() < 0.0f)
+    {
+        v.x() = (1.0f - abs(y)) * signNotZero(x);
+        v.y() = (1.0f - abs(x)) * signNotZero(y);
+    }
+
+    return v.normalized();
+}
@@ -0,0 +1,34 @@
+// vertexpack.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Conversions between floats and the packed vertex attribute formats.
+
+#pragma once
+
+#include <cstdint>
+#include <Eigen/Core>
+
+namespace cmod
+{
+
+// IEEE 754 half precision floats, rounded to nearest even
+uint16_t FloatToHalf(float f);
+float HalfToFloat(uint16_t h);
+
+// Signed normalized 16-bit values: -32767..32767 maps to -1..1
+int16_t FloatToSnorm16(float f);
+float Snorm16ToFloat(int16_t s);
+
+// Unit vectors mapped to the octahedron and unfolded to a square, stored
+// as two signed normalized values. The encoding picks the rounding with the
+// smallest angular error, under 5e-5 radians.
+void EncodeOctahedral(const Eigen::Vector3f& v, int16_t oct[2]);
+Eigen::Vector3f DecodeOctahedral(const int16_t oct[2]);
+
+} // namespace cmod
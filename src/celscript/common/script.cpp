@@ -34,5 +34,10 @@ bool IScript::handleTickEvent(double dt)
     return false;
 }
 
+bool IScript::handleScreenShotEvent(const fs::path& filename, bool success)
+{
+    return false;
+}
+
 }
 }
@@ -28,6 +28,7 @@ class IScript
     virtual bool charEntered(const char*);
     virtual bool handleKeyEvent(const char* key);
     virtual bool handleTickEvent(double dt);
+    virtual bool handleScreenShotEvent(const fs::path& filename, bool success);
     virtual bool tick(double) = 0;
 };
 
@@ -79,6 +79,7 @@ const char* KeyHandler        = "key";
 const char* TickHandler       = "tick";
 const char* MouseDownHandler  = "mousedown";
 const char* MouseUpHandler    = "mouseup";
+const char* ScreenShotHandler = "screenshot";
 
 
 #if LUA_VERSION_NUM < 503
@@ -623,6 +624,60 @@ bool LuaState::handleTickEvent(double dt)
 }
 
 
+// Returns true if a handler is registered for the screenshot event, which
+// is sent once the file of a screenshot has been written.
+bool LuaState::handleScreenShotEvent(const char* filename, bool success)
+{
+    if (!costate)
+        return false;
+
+    CelestiaCore* appCore = getAppCore(costate, NoErrors);
+    if (appCore == nullptr)
+        return false;
+
+    // get the registered event table
+    lua_getfield(costate, LUA_REGISTRYINDEX, EventHandlers);
+    if (!lua_istable(costate, -1))
+    {
+        cerr << "Missing event handler table";
+        lua_pop(costate, 1);
+        return false;
+    }
+
+    bool handled = false;
+    lua_getfield(costate, -1, ScreenShotHandler);
+    if (lua_isfunction(costate, -1))
+    {
+        lua_remove(costate, -2);        // remove the event handler table from the stack
+
+        lua_newtable(costate);
+        lua_pushstring(costate, "filename");
+        lua_pushstring(costate, filename);
+        lua_settable(costate, -3);
+        lua_pushstring(costate, "success");
+        lua_pushboolean(costate, success);
+        lua_settable(costate, -3);
+
+        timeout = getTime() + 1.0;
+        if (lua_pcall(costate, 1, 1, 0) != 0)
+        {
+            cerr << "Error while executing screenshot callback: " << lua_tostring(costate, -1) << "\n";
+        }
+        else
+        {
+           handled = lua_toboolean(costate, -1) == 1 ? true : false;
+        }
+        lua_pop(costate, 1);             // pop the return value
+    }
+    else
+    {
+        lua_pop(costate, 2);
+    }
+
+    return handled;
+}
+
+
 int LuaState::loadScript(istream& in, const fs::path& streamname)
 {
     char buf[4096];
@@ -62,6 +62,7 @@ public:
     bool handleKeyEvent(const char* key);
     bool handleMouseButtonEvent(float x, float y, int button, bool down);
     bool handleTickEvent(double dt);
+    bool handleScreenShotEvent(const char* filename, bool success);
 
     // Lua hook handling
     void setLuaPath(const string& s);
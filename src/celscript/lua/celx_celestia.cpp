@@ -11,12 +11,14 @@
 
 #include <celutil/debug.h>
 #include <celutil/gettext.h>
+#include <celutil/profiler.h>
 #if NO_TTF
 #include "celtxf/texturefont.h"
 #else
 #include "celttf/truetypefont.h"
 #endif
 #include <fmt/printf.h>
+#include <fstream>
 #include <celengine/category.h>
 #include <celengine/texture.h>
 #include <celcompat/filesystem.h>
@@ -48,6 +50,7 @@ extern const char* KeyHandler;
 extern const char* TickHandler;
 extern const char* MouseDownHandler;
 extern const char* MouseUpHandler;
+extern const char* ScreenShotHandler;
 
 LuaState *getLuaStateObject(lua_State*);
 
@@ -1376,6 +1379,266 @@ static int celestia_dsos(lua_State* l)
     return 1;
 }
 
+// Parameters of celestia:findstars() and celestia:finddsos()
+struct SpatialQuery
+{
+    UniversalCoord position;
+    Vector3d direction { Vector3d::UnitZ() };
+    double angle { PI };                                // radians
+    double radius { numeric_limits<double>::max() };    // light years
+    float maxMag { 100.0f };
+    size_t maxCount { numeric_limits<size_t>::max() };
+    bool asTable { false };
+};
+
+struct SpatialQueryMatch
+{
+    AstroCatalog::IndexNumber catalogNumber;
+    Vector3d position;                                  // light years
+    double distance;
+    float appMag;
+};
+
+class StarQueryHandler : public StarHandler
+{
+ public:
+    StarQueryHandler(vector<SpatialQueryMatch>& _matches) : matches(_matches) {};
+    void process(const Star& star, float distance, float appMag) override
+    {
+        matches.push_back({ star.getIndex(), star.getPosition().cast<double>(), distance, appMag });
+    }
+
+ private:
+    vector<SpatialQueryMatch>& matches;
+};
+
+class DSOQueryHandler : public DSOHandler
+{
+ public:
+    DSOQueryHandler(vector<SpatialQueryMatch>& _matches, const Vector3d& _obsPosition) :
+        matches(_matches), obsPosition(_obsPosition) {};
+    void process(DeepSkyObject* const& dso, double distance, float absMag) override
+    {
+        // Same apparent magnitude as used by the DSO octree traversal
+        float appMag = (float) ((distance >= 32.6167) ? astro::absToAppMag((double) absMag, distance) : absMag);
+        matches.push_back({ dso->getIndex(), dso->getPosition(), (dso->getPosition() - obsPosition).norm(), appMag });
+    }
+
+ private:
+    vector<SpatialQueryMatch>& matches;
+    Vector3d obsPosition;
+};
+
+// Read the optional query table argument; the default is all objects as
+// seen from the position of the active observer.
+static bool getSpatialQuery(lua_State* l, const char* function, SpatialQuery& query)
+{
+    Celx_CheckArgs(l, 1, 2, fmt::sprintf("One or no arguments expected to function celestia:%s", function).c_str());
+
+    CelxLua celx(l);
+    CelestiaCore* appCore = this_celestia(l);
+    query.position = appCore->getSimulation()->getActiveObserver()->getPosition();
+
+    if (lua_gettop(l) < 2)
+        return true;
+    if (!lua_istable(l, 2))
+    {
+        Celx_DoError(l, fmt::sprintf("Argument to celestia:%s must be a table", function).c_str());
+        return false;
+    }
+
+    lua_pushstring(l, "position");
+    lua_gettable(l, 2);
+    UniversalCoord* position = celx.toPosition(3);
+    if (position != nullptr)
+        query.position = *position;
+    lua_settop(l, 2);
+
+    lua_pushstring(l, "direction");
+    lua_gettable(l, 2);
+    Vector3d* direction = celx.toVector(3);
+    if (direction != nullptr && direction->norm() > 0.0)
+        query.direction = direction->normalized();
+    lua_settop(l, 2);
+
+    lua_pushstring(l, "angle");
+    lua_gettable(l, 2);
+    double angle = celx.safeGetNumber(3, NoErrors, "", 180.0);
+    query.angle = celmath::degToRad(max(0.0, min(180.0, angle)));
+    lua_settop(l, 2);
+
+    lua_pushstring(l, "radius");
+    lua_gettable(l, 2);
+    query.radius = celx.safeGetNumber(3, NoErrors, "", query.radius);
+    lua_settop(l, 2);
+
+    lua_pushstring(l, "maxmag");
+    lua_gettable(l, 2);
+    query.maxMag = (float) celx.safeGetNumber(3, NoErrors, "", query.maxMag);
+    lua_settop(l, 2);
+
+    lua_pushstring(l, "maxcount");
+    lua_gettable(l, 2);
+    double maxCount = celx.safeGetNumber(3, NoErrors, "", -1.0);
+    if (maxCount >= 0.0)
+        query.maxCount = (size_t) maxCount;
+    lua_settop(l, 2);
+
+    lua_pushstring(l, "format");
+    lua_gettable(l, 2);
+    const char* format = celx.safeGetString(3, NoErrors, "");
+    if (format != nullptr)
+    {
+        if (strcmp(format, "table") == 0)
+        {
+            query.asTable = true;
+        }
+        else if (strcmp(format, "catalog") != 0)
+        {
+            Celx_DoError(l, fmt::sprintf("Unknown format '%s' in celestia:%s", format, function).c_str());
+            return false;
+        }
+    }
+    lua_settop(l, 2);
+
+    return true;
+}
+
+// Push the brightest maxCount matches, either as an array of catalog
+// numbers or as a table of arrays with the catalog numbers, positions,
+// distances and apparent magnitudes.
+static void pushSpatialQueryResult(lua_State* l, const SpatialQuery& query, vector<SpatialQueryMatch>& matches)
+{
+    auto brighter = [](const SpatialQueryMatch& a, const SpatialQueryMatch& b) { return a.appMag < b.appMag; };
+    if (matches.size() > query.maxCount)
+    {
+        partial_sort(matches.begin(), matches.begin() + query.maxCount, matches.end(), brighter);
+        matches.resize(query.maxCount);
+    }
+    else
+    {
+        sort(matches.begin(), matches.end(), brighter);
+    }
+
+    auto n = (int) matches.size();
+    if (!query.asTable)
+    {
+        lua_createtable(l, n, 0);
+        for (int i = 0; i < n; i++)
+        {
+            lua_pushnumber(l, matches[i].catalogNumber);
+            lua_rawseti(l, -2, i + 1);
+        }
+        return;
+    }
+
+    auto pushArray = [l, n, &matches](const char* name, const function<lua_Number(const SpatialQueryMatch&)>& get)
+    {
+        lua_createtable(l, n, 0);
+        for (int i = 0; i < n; i++)
+        {
+            lua_pushnumber(l, get(matches[i]));
+            lua_rawseti(l, -2, i + 1);
+        }
+        lua_setfield(l, -2, name);
+    };
+
+    lua_createtable(l, 0, 6);
+    pushArray("catalog",  [](const SpatialQueryMatch& m) { return (lua_Number) m.catalogNumber; });
+    pushArray("x",        [](const SpatialQueryMatch& m) { return m.position.x(); });
+    pushArray("y",        [](const SpatialQueryMatch& m) { return m.position.y(); });
+    pushArray("z",        [](const SpatialQueryMatch& m) { return m.position.z(); });
+    pushArray("distance", [](const SpatialQueryMatch& m) { return m.distance; });
+    pushArray("appmag",   [](const SpatialQueryMatch& m) { return (lua_Number) m.appMag; });
+}
+
+static int celestia_findstars(lua_State* l)
+{
+    SpatialQuery query;
+    if (!getSpatialQuery(l, "findstars", query))
+        return 0;
+
+    CelestiaCore* appCore = this_celestia(l);
+    Universe* u = appCore->getSimulation()->getUniverse();
+
+    vector<SpatialQueryMatch> matches;
+    StarQueryHandler handler(matches);
+    u->getStarCatalog()->findStarsInCone(handler,
+                                         query.position.toLy().cast<float>(),
+                                         query.direction.cast<float>(),
+                                         (float) query.angle,
+                                         (float) min(query.radius, (double) numeric_limits<float>::max()),
+                                         query.maxMag);
+
+    pushSpatialQueryResult(l, query, matches);
+    return 1;
+}
+
+static int celestia_finddsos(lua_State* l)
+{
+    SpatialQuery query;
+    if (!getSpatialQuery(l, "finddsos", query))
+        return 0;
+
+    CelestiaCore* appCore = this_celestia(l);
+    Universe* u = appCore->getSimulation()->getUniverse();
+
+    vector<SpatialQueryMatch> matches;
+    Vector3d obsPosition = query.position.toLy();
+    DSOQueryHandler handler(matches, obsPosition);
+    u->getDSOCatalog()->findDSOsInCone(handler,
+                                       obsPosition,
+                                       query.direction,
+                                       query.angle,
+                                       query.radius,
+                                       query.maxMag);
+
+    pushSpatialQueryResult(l, query, matches);
+    return 1;
+}
+
+// celestia:addstar(names, position, spectraltype, absmag) adds a star to the
+// catalog with the next automatic catalog number and returns it, or nil if
+// it couldn't be added. Names are delimited by ':' as in star catalogs.
+static int celestia_addstar(lua_State* l)
+{
+    Celx_CheckArgs(l, 5, 5, "Four arguments expected for celestia:addstar");
+
+    const char* names = Celx_SafeGetString(l, 2, AllErrors, "First argument to celestia:addstar must be a string");
+    UniversalCoord* position = to_position(l, 3);
+    if (position == nullptr)
+    {
+        Celx_DoError(l, "Second argument to celestia:addstar must be a position");
+        return 0;
+    }
+    const char* spectralType = Celx_SafeGetString(l, 4, AllErrors, "Third argument to celestia:addstar must be a string");
+    double absMag = Celx_SafeGetNumber(l, 5, AllErrors, "Fourth argument to celestia:addstar must be a number");
+    if (names == nullptr || spectralType == nullptr)
+        return 0;
+
+    StarDetails* details = StarDetails::GetStarDetails(StellarClass::parse(spectralType));
+    if (details == nullptr)
+    {
+        Celx_DoError(l, "Bad spectral type in celestia:addstar");
+        return 0;
+    }
+
+    Star star;
+    star.setPosition(position->toLy().cast<float>());
+    star.setDetails(details);
+    star.setAbsoluteMagnitude((float) absMag);
+
+    CelestiaCore* appCore = this_celestia(l);
+    Universe* u = appCore->getSimulation()->getUniverse();
+    Star* addedStar = u->getStarCatalog()->addStar(star, names);
+    if (addedStar == nullptr)
+        lua_pushnil(l);
+    else
+        object_new(l, Selection(addedStar));
+
+    return 1;
+}
+
 static int celestia_setambient(lua_State* l)
 {
     Celx_CheckArgs(l, 2, 2, "One argument expected in celestia:setambient");
@@ -1882,6 +2145,20 @@ static int celestia_geteventhandler(lua_State* l)
     return 1;
 }
 
+static bool hasEventHandler(lua_State* l, const char* name)
+{
+    bool found = false;
+    lua_getfield(l, LUA_REGISTRYINDEX, EventHandlers);
+    if (lua_istable(l, -1))
+    {
+        lua_getfield(l, -1, name);
+        found = lua_isfunction(l, -1);
+        lua_pop(l, 1);
+    }
+    lua_pop(l, 1);
+    return found;
+}
+
 static int celestia_takescreenshot(lua_State* l)
 {
     Celx_CheckArgs(l, 1, 3, "Need 0 to 2 arguments for celestia:takescreenshot");
@@ -1922,7 +2199,13 @@ static int celestia_takescreenshot(lua_State* l)
 
     fs::path path = appCore->getConfig()->scriptScreenshotDirectory;
     fs::path filepath = path / fmt::sprintf("%s.%s", filenamestem, filetype);
-    success = appCore->saveScreenShot(filepath);
+    // Scripts with a "screenshot" event handler get the result there, and
+    // the file is written in the background. Otherwise it's complete when
+    // takescreenshot returns.
+    if (hasEventHandler(l, ScreenShotHandler))
+        success = appCore->saveScreenShotAsync(filepath);
+    else
+        success = appCore->saveScreenShot(filepath);
     lua_pushboolean(l, success);
 
     // no matter how long it really took, make it look like 0.1s to timeout check:
@@ -1930,6 +2213,81 @@ static int celestia_takescreenshot(lua_State* l)
     return 1;
 }
 
+static int celestia_setprofiling(lua_State* l)
+{
+    Celx_CheckArgs(l, 2, 2, "One argument expected for celestia:setprofiling()");
+    this_celestia(l);
+    bool enable = Celx_SafeGetBoolean(l, 2, AllErrors, "Argument to celestia:setprofiling() must be a boolean");
+    if (enable && !Profiler::isEnabled())
+        Profiler::clear();
+    Profiler::setEnabled(enable);
+    return 0;
+}
+
+static int celestia_getprofiling(lua_State* l)
+{
+    Celx_CheckArgs(l, 1, 1, "No arguments expected for celestia:getprofiling()");
+    this_celestia(l);
+    lua_pushboolean(l, Profiler::isEnabled());
+    return 1;
+}
+
+// Return a table with a "zones" table mapping zone paths to their call
+// count, total and maximum time in milliseconds, and a "counters" table
+// mapping counter names to their sample count, last and maximum value.
+static int celestia_getprofile(lua_State* l)
+{
+    Celx_CheckArgs(l, 1, 1, "No arguments expected for celestia:getprofile()");
+    this_celestia(l);
+
+    lua_newtable(l);
+
+    lua_newtable(l);
+    for (const auto& zone : Profiler::getZoneStats())
+    {
+        lua_newtable(l);
+        lua_pushnumber(l, zone.calls);
+        lua_setfield(l, -2, "calls");
+        lua_pushnumber(l, zone.totalTime);
+        lua_setfield(l, -2, "total");
+        lua_pushnumber(l, zone.maxTime);
+        lua_setfield(l, -2, "max");
+        lua_setfield(l, -2, zone.path.c_str());
+    }
+    lua_setfield(l, -2, "zones");
+
+    lua_newtable(l);
+    for (const auto& counter : Profiler::getCounterStats())
+    {
+        lua_newtable(l);
+        lua_pushnumber(l, counter.samples);
+        lua_setfield(l, -2, "samples");
+        lua_pushnumber(l, counter.lastValue);
+        lua_setfield(l, -2, "value");
+        lua_pushnumber(l, counter.maxValue);
+        lua_setfield(l, -2, "max");
+        lua_setfield(l, -2, counter.name.c_str());
+    }
+    lua_setfield(l, -2, "counters");
+
+    return 1;
+}
+
+static int celestia_saveprofile(lua_State* l)
+{
+    Celx_CheckArgs(l, 2, 2, "One argument expected for celestia:saveprofile()");
+    CelestiaCore* appCore = this_celestia(l);
+    const char* filename = Celx_SafeGetString(l, 2, AllErrors, "Argument to celestia:saveprofile() must be a string");
+    if (filename == nullptr)
+        return 0;
+
+    // Like screenshots, the trace can only go to the screenshot directory.
+    fs::path filepath = appCore->getConfig()->scriptScreenshotDirectory / fs::path(filename).filename();
+    std::ofstream out(filepath.string());
+    lua_pushboolean(l, out.good() && Profiler::exportChromeTrace(out));
+    return 1;
+}
+
 static int celestia_createcelscript(lua_State* l)
 {
     Celx_CheckArgs(l, 2, 2, "Need one argument for celestia:createcelscript()");
@@ -2223,6 +2581,10 @@ void CreateCelestiaMetaTable(lua_State* l)
     Celx_RegisterMethod(l, "getscripttime", celestia_getscripttime);
     Celx_RegisterMethod(l, "requestkeyboard", celestia_requestkeyboard);
     Celx_RegisterMethod(l, "takescreenshot", celestia_takescreenshot);
+    Celx_RegisterMethod(l, "setprofiling", celestia_setprofiling);
+    Celx_RegisterMethod(l, "getprofiling", celestia_getprofiling);
+    Celx_RegisterMethod(l, "getprofile", celestia_getprofile);
+    Celx_RegisterMethod(l, "saveprofile", celestia_saveprofile);
     Celx_RegisterMethod(l, "createcelscript", celestia_createcelscript);
     Celx_RegisterMethod(l, "requestsystemaccess", celestia_requestsystemaccess);
     Celx_RegisterMethod(l, "getscriptpath", celestia_getscriptpath);
@@ -2231,6 +2593,9 @@ void CreateCelestiaMetaTable(lua_State* l)
     Celx_RegisterMethod(l, "geteventhandler", celestia_geteventhandler);
     Celx_RegisterMethod(l, "stars", celestia_stars);
     Celx_RegisterMethod(l, "dsos", celestia_dsos);
+    Celx_RegisterMethod(l, "findstars", celestia_findstars);
+    Celx_RegisterMethod(l, "finddsos", celestia_finddsos);
+    Celx_RegisterMethod(l, "addstar", celestia_addstar);
     Celx_RegisterMethod(l, "windowbordersvisible", celestia_windowbordersvisible);
     Celx_RegisterMethod(l, "setwindowbordersvisible", celestia_setwindowbordersvisible);
     Celx_RegisterMethod(l, "seturl", celestia_seturl);
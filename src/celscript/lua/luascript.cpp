@@ -69,6 +69,11 @@ bool LuaScript::handleTickEvent(double dt)
     return m_celxScript->handleTickEvent(dt);
 }
 
+bool LuaScript::handleScreenShotEvent(const fs::path& filename, bool success)
+{
+    return m_celxScript->handleScreenShotEvent(filename.string().c_str(), success);
+}
+
 bool LuaScript::tick(double dt)
 {
     return m_celxScript->tick(dt);
@@ -34,6 +34,7 @@ class LuaScript : public IScript
     bool charEntered(const char*) override;
     bool handleKeyEvent(const char* key) override;
     bool handleTickEvent(double dt) override;
+    bool handleScreenShotEvent(const fs::path& filename, bool success) override;
     bool tick(double) override;
 
  private:
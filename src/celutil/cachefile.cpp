@@ -0,0 +1,151 @@
+// cachefile.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include "cachefile.h"
+#include <cstdio>
+#include <fstream>
+#include <fmt/format.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+
+namespace
+{
+bool replaceFile(const fs::path& from, const fs::path& to)
+{
+#ifdef _WIN32
+    return MoveFileExW(from.wstring().c_str(), to.wstring().c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+
+void removeFile(const fs::path& filename)
+{
+#ifdef _WIN32
+    _wremove(filename.wstring().c_str());
+#else
+    remove(filename.c_str());
+#endif
+}
+} // end unnamed namespace
+
+
+uint64_t HashFNV1a(const void* data, size_t size, uint64_t hash)
+{
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+
+uint64_t HashFNV1a(const string& s, uint64_t hash)
+{
+    return HashFNV1a(s.data(), s.size(), hash);
+}
+
+
+bool GetFileStamp(const fs::path& filename, uint64_t& size, int64_t& mtime)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExW(filename.wstring().c_str(), GetFileExInfoStandard, &attr))
+        return false;
+    size = ((uint64_t) attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    mtime = (int64_t) (((uint64_t) attr.ftLastWriteTime.dwHighDateTime << 32) |
+                       attr.ftLastWriteTime.dwLowDateTime);
+#else
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return false;
+    size = (uint64_t) st.st_size;
+#ifdef __APPLE__
+    const struct timespec& mtim = st.st_mtimespec;
+#else
+    const struct timespec& mtim = st.st_mtim;
+#endif
+    mtime = (int64_t) mtim.tv_sec * 1000000000 + (int64_t) mtim.tv_nsec;
+#endif
+    return true;
+}
+
+
+bool MakeCacheKey(const fs::path& source, const string& parameters, string& key)
+{
+    uint64_t size;
+    int64_t mtime;
+    if (!GetFileStamp(source, size, mtime))
+        return false;
+
+    key = fmt::format("{}\n{}\n{}\n{}", source.string(), size, mtime, parameters);
+    return true;
+}
+
+
+bool CreateDirectories(const fs::path& dir)
+{
+    if (dir.empty() || fs::is_directory(dir))
+        return true;
+    if (!CreateDirectories(dir.parent_path()))
+        return false;
+#ifdef _WIN32
+    if (_wmkdir(dir.wstring().c_str()) != 0)
+#else
+    if (mkdir(dir.c_str(), 0777) != 0)
+#endif
+        return fs::is_directory(dir);
+    return true;
+}
+
+
+bool ReplaceFileContents(const fs::path& filename,
+                         const function<bool(ostream&)>& write)
+{
+    // Another instance writing the same file uses its own temporary file;
+    // whichever is renamed last wins, but both are complete.
+    fs::path tempFilename = filename;
+#ifdef _WIN32
+    tempFilename += fmt::format(".{}.tmp", GetCurrentProcessId());
+#else
+    tempFilename += fmt::format(".{}.tmp", getpid());
+#endif
+
+    {
+        ofstream out(tempFilename.string(), ios::out | ios::binary);
+        if (!out.good())
+            return false;
+
+        if (!write(out) || !out.flush())
+        {
+            out.close();
+            removeFile(tempFilename);
+            return false;
+        }
+    }
+
+    if (!replaceFile(tempFilename, filename))
+    {
+        removeFile(tempFilename);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,44 @@
+// cachefile.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// Helpers for files caching data derived from other files. An entry is
+// keyed by the path, size and modification time of its source file plus
+// the parameters of the derivation, and is written through a temporary
+// file so that readers never see a partial entry.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <celcompat/filesystem.h>
+
+constexpr const uint64_t FNV1aOffsetBasis = UINT64_C(0xcbf29ce484222325);
+
+// 64-bit FNV-1a hash, which can be continued by passing the previous result
+uint64_t HashFNV1a(const void* data, size_t size, uint64_t hash = FNV1aOffsetBasis);
+uint64_t HashFNV1a(const std::string& s, uint64_t hash = FNV1aOffsetBasis);
+
+// Size and modification time of a file. Times are in nanoseconds, or in
+// 100 ns units on Windows, so a file rewritten within the same second with
+// the same size still gets a different stamp.
+bool GetFileStamp(const fs::path& filename, uint64_t& size, int64_t& mtime);
+
+// Key identifying the contents of source (as far as size and modification
+// time tell) and the parameters of the data derived from it.
+bool MakeCacheKey(const fs::path& source, const std::string& parameters, std::string& key);
+
+bool CreateDirectories(const fs::path& dir);
+
+// Write filename with write through a temporary file which replaces it
+// only if write returns true and all output succeeded.
+bool ReplaceFileContents(const fs::path& filename,
+                         const std::function<bool(std::ostream&)>& write);
@@ -0,0 +1,103 @@
+// framequeue.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include "framequeue.h"
+
+using namespace std;
+
+constexpr size_t FrameQueue::MinFrames;
+
+
+FrameQueue::FrameQueue(size_t _frameSize, size_t maxBytes, ProcessFunction _process) :
+    frameSize(_frameSize),
+    maxFrames(max(MinFrames, maxBytes / max(_frameSize, (size_t) 1))),
+    process(std::move(_process))
+{
+    worker = std::thread(&FrameQueue::run, this);
+}
+
+
+FrameQueue::~FrameQueue()
+{
+    finish();
+}
+
+
+unsigned char* FrameQueue::acquire()
+{
+    unique_lock<mutex> lock(queueMutex);
+    if (freeFrames.empty() && buffers.size() < maxFrames)
+    {
+        buffers.emplace_back(new unsigned char[frameSize]);
+        return buffers.back().get();
+    }
+
+    queueCond.wait(lock, [this] { return !freeFrames.empty(); });
+    unsigned char* frame = freeFrames.front();
+    freeFrames.pop_front();
+    return frame;
+}
+
+
+void FrameQueue::submit(unsigned char* frame)
+{
+    {
+        lock_guard<mutex> lock(queueMutex);
+        queuedFrames.push_back(frame);
+    }
+    queueCond.notify_all();
+}
+
+
+void FrameQueue::finish()
+{
+    if (!worker.joinable())
+        return;
+
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueCond.notify_all();
+    worker.join();
+}
+
+
+size_t FrameQueue::getFrameCount() const
+{
+    lock_guard<mutex> lock(queueMutex);
+    return buffers.size();
+}
+
+
+// Runs until finish() stops it, after it has processed every queued frame
+void FrameQueue::run()
+{
+    for (;;)
+    {
+        unsigned char* frame;
+        {
+            unique_lock<mutex> lock(queueMutex);
+            queueCond.wait(lock, [this] { return stopping || !queuedFrames.empty(); });
+            if (queuedFrames.empty())
+                return;
+            frame = queuedFrames.front();
+            queuedFrames.pop_front();
+        }
+
+        process(frame);
+
+        {
+            lock_guard<mutex> lock(queueMutex);
+            freeFrames.push_back(frame);
+        }
+        queueCond.notify_all();
+    }
+}
@@ -0,0 +1,66 @@
+// framequeue.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// Frames filled on one thread and processed in order on a thread of their
+// own, as done by movie capture: the render thread reads back frames and
+// the encoder works through them at its own pace.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class FrameQueue
+{
+ public:
+    using ProcessFunction = std::function<void(const unsigned char*)>;
+
+    // Frames are frameSize bytes. Buffers are allocated when the producer
+    // needs one and all are queued, until maxBytes of them exist; at least
+    // MinFrames are allocated whatever the frame size.
+    FrameQueue(size_t frameSize, size_t maxBytes, ProcessFunction process);
+    ~FrameQueue();
+
+    FrameQueue(const FrameQueue&) = delete;
+    FrameQueue& operator=(const FrameQueue&) = delete;
+
+    // Return a buffer for the next frame. The producer only waits when all
+    // getMaxFrameCount() buffers are queued.
+    unsigned char* acquire();
+    // Queue a buffer returned by acquire() for processing
+    void submit(unsigned char* frame);
+    // Process the queued frames and stop the thread
+    void finish();
+
+    size_t getFrameCount() const;
+    size_t getMaxFrameCount() const { return maxFrames; }
+
+    static constexpr size_t MinFrames = 3;
+
+ private:
+    void run();
+
+    size_t frameSize;
+    size_t maxFrames;
+    ProcessFunction process;
+
+    std::vector<std::unique_ptr<unsigned char[]>> buffers;
+    std::deque<unsigned char*> freeFrames;
+    std::deque<unsigned char*> queuedFrames;
+    mutable std::mutex queueMutex;
+    std::condition_variable queueCond;
+    bool stopping { false };
+    std::thread worker;
+};
@@ -0,0 +1,40 @@
+// mappedfile.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// Read-only memory mapping of a whole file.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <cstddef>
+#include <celcompat/filesystem.h>
+
+class MappedFile
+{
+ public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Map the file, replacing any previous mapping. Empty files fail to map.
+    bool open(const fs::path& filename);
+    void close();
+
+    bool isOpen() const { return data != nullptr; }
+    const char* getData() const { return data; }
+    size_t getSize() const { return size; }
+
+ private:
+    const char* data { nullptr };
+    size_t size { 0 };
+#ifdef _WIN32
+    void* mapping { nullptr };
+#endif
+};
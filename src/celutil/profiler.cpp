@@ -0,0 +1,272 @@
+// profiler.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <fmt/format.h>
+#include "profiler.h"
+
+using namespace std;
+
+// Events kept per thread; older ones are overwritten.
+constexpr const size_t ThreadBufferCapacity = 32768;
+
+namespace
+{
+struct Event
+{
+    const char* name;
+    int64_t start;
+    int64_t end;        // same as start for counters
+    double value;
+    unsigned int depth;
+    bool isCounter;
+};
+
+// The owning thread is the only writer; the mutex is only ever contended
+// while the buffer is being read or cleared.
+struct ThreadBuffer
+{
+    mutex eventsMutex;
+    vector<Event> events;
+    size_t next { 0 };
+    unsigned int threadId { 0 };
+
+    void add(const Event& event)
+    {
+        lock_guard<mutex> lock(eventsMutex);
+        if (events.size() < ThreadBufferCapacity)
+        {
+            events.push_back(event);
+        }
+        else
+        {
+            events[next] = event;
+            next = (next + 1) % ThreadBufferCapacity;
+        }
+    }
+
+    // Copy the events, oldest first.
+    vector<Event> snapshot()
+    {
+        lock_guard<mutex> lock(eventsMutex);
+        vector<Event> result;
+        result.reserve(events.size());
+        result.insert(result.end(), events.begin() + next, events.end());
+        result.insert(result.end(), events.begin(), events.begin() + next);
+        return result;
+    }
+
+    void clear()
+    {
+        lock_guard<mutex> lock(eventsMutex);
+        events.clear();
+        next = 0;
+    }
+};
+
+// Buffers are never released, so that the events of threads which have
+// already exited can still be exported.
+mutex buffersMutex;
+vector<shared_ptr<ThreadBuffer>> buffers;
+
+ThreadBuffer* getThreadBuffer()
+{
+    static thread_local ThreadBuffer* buffer = nullptr;
+    if (buffer == nullptr)
+    {
+        auto newBuffer = make_shared<ThreadBuffer>();
+        lock_guard<mutex> lock(buffersMutex);
+        newBuffer->threadId = (unsigned int) buffers.size() + 1;
+        buffers.push_back(newBuffer);
+        buffer = newBuffer.get();
+    }
+    return buffer;
+}
+
+vector<shared_ptr<ThreadBuffer>> getBuffers()
+{
+    lock_guard<mutex> lock(buffersMutex);
+    return buffers;
+}
+
+string escapeJSON(const char* s)
+{
+    string result;
+    for (; *s != '\0'; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            result += '\\';
+        if ((unsigned char) *s >= 0x20)
+            result += *s;
+    }
+    return result;
+}
+}
+
+
+atomic<bool> Profiler::enabled { false };
+thread_local unsigned int ProfileZone::currentDepth = 0;
+
+
+void Profiler::setEnabled(bool enable)
+{
+    enabled.store(enable, memory_order_relaxed);
+}
+
+
+void Profiler::clear()
+{
+    for (const auto& buffer : getBuffers())
+        buffer->clear();
+}
+
+
+int64_t Profiler::now()
+{
+    auto t = chrono::steady_clock::now().time_since_epoch();
+    return chrono::duration_cast<chrono::nanoseconds>(t).count();
+}
+
+
+void Profiler::recordZone(const char* name, int64_t start, int64_t end, unsigned int depth)
+{
+    getThreadBuffer()->add({ name, start, end, 0.0, depth, false });
+}
+
+
+void Profiler::recordCounter(const char* name, double value)
+{
+    int64_t t = now();
+    getThreadBuffer()->add({ name, t, t, value, 0, true });
+}
+
+
+vector<Profiler::ZoneStats> Profiler::getZoneStats()
+{
+    map<string, ZoneStats> stats;
+
+    for (const auto& buffer : getBuffers())
+    {
+        vector<Event> events = buffer->snapshot();
+        events.erase(remove_if(events.begin(), events.end(),
+                               [](const Event& e) { return e.isCounter; }),
+                     events.end());
+
+        // Zones are recorded when they end; sorting them by start time puts
+        // every zone after the zones enclosing it.
+        sort(events.begin(), events.end(),
+             [](const Event& a, const Event& b)
+             {
+                 return a.start < b.start || (a.start == b.start && a.depth < b.depth);
+             });
+
+        struct OpenZone
+        {
+            const Event* event;
+            string path;
+        };
+        vector<OpenZone> enclosing;
+
+        for (const auto& e : events)
+        {
+            while (!enclosing.empty() &&
+                   (enclosing.back().event->depth >= e.depth ||
+                    enclosing.back().event->end < e.end))
+            {
+                enclosing.pop_back();
+            }
+
+            string path = enclosing.empty() ? string(e.name)
+                                            : enclosing.back().path + '/' + e.name;
+            double time = (double) (e.end - e.start) * 1.0e-6;
+
+            ZoneStats& s = stats[path];
+            s.path = path;
+            s.calls++;
+            s.totalTime += time;
+            s.maxTime = max(s.maxTime, time);
+
+            enclosing.push_back({ &e, path });
+        }
+    }
+
+    vector<ZoneStats> result;
+    for (const auto& s : stats)
+        result.push_back(s.second);
+    return result;
+}
+
+
+vector<Profiler::CounterStats> Profiler::getCounterStats()
+{
+    map<string, CounterStats> stats;
+    map<string, int64_t> lastTimes;
+
+    for (const auto& buffer : getBuffers())
+    {
+        for (const auto& e : buffer->snapshot())
+        {
+            if (!e.isCounter)
+                continue;
+
+            CounterStats& s = stats[e.name];
+            if (s.samples == 0 || e.start >= lastTimes[e.name])
+            {
+                s.lastValue = e.value;
+                lastTimes[e.name] = e.start;
+            }
+            s.maxValue = s.samples == 0 ? e.value : max(s.maxValue, e.value);
+            s.name = e.name;
+            s.samples++;
+        }
+    }
+
+    vector<CounterStats> result;
+    for (const auto& s : stats)
+        result.push_back(s.second);
+    return result;
+}
+
+
+bool Profiler::exportChromeTrace(ostream& out)
+{
+    out << "{\"traceEvents\":[";
+
+    bool first = true;
+    for (const auto& buffer : getBuffers())
+    {
+        for (const auto& e : buffer->snapshot())
+        {
+            out << (first ? "\n" : ",\n");
+            first = false;
+
+            // Chrome trace timestamps are in microseconds.
+            string name = escapeJSON(e.name);
+            if (e.isCounter)
+            {
+                out << fmt::format("{{\"name\":\"{}\",\"ph\":\"C\",\"ts\":{:.3f},\"pid\":1,\"tid\":{},\"args\":{{\"value\":{}}}}}",
+                                   name, (double) e.start * 1.0e-3, buffer->threadId, e.value);
+            }
+            else
+            {
+                out << fmt::format("{{\"name\":\"{}\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":1,\"tid\":{}}}",
+                                   name, (double) e.start * 1.0e-3, (double) (e.end - e.start) * 1.0e-3,
+                                   buffer->threadId);
+            }
+        }
+    }
+
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return out.good();
+}
@@ -0,0 +1,115 @@
+// profiler.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// Lightweight instrumentation for finding out where frame time goes.
+// Scoped zones and counters are always compiled in but only record
+// anything while profiling is enabled at run time. Each thread writes to
+// its own ring buffer, so only the most recent events are kept.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+class Profiler
+{
+ public:
+    // Accumulated timings of all recorded zones sharing a path. The path
+    // joins the names of the enclosing zones with '/', e.g. "tick/draw".
+    struct ZoneStats
+    {
+        std::string path;
+        unsigned int calls { 0 };
+        double totalTime   { 0.0 };   // milliseconds
+        double maxTime     { 0.0 };   // milliseconds
+    };
+
+    struct CounterStats
+    {
+        std::string name;
+        unsigned int samples { 0 };
+        double lastValue     { 0.0 };
+        double maxValue      { 0.0 };
+    };
+
+    static bool isEnabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+    static void setEnabled(bool);
+
+    // Discard everything recorded so far.
+    static void clear();
+
+    // Names must be string literals or otherwise outlive the recorded
+    // events; only the pointer is stored.
+    static void recordZone(const char* name, int64_t start, int64_t end, unsigned int depth);
+    static void recordCounter(const char* name, double value);
+
+    // Nanoseconds on a monotonic clock.
+    static int64_t now();
+
+    static std::vector<ZoneStats> getZoneStats();
+    static std::vector<CounterStats> getCounterStats();
+
+    // Write the recorded events in the Chrome trace event format, suitable
+    // for chrome://tracing and similar viewers.
+    static bool exportChromeTrace(std::ostream&);
+
+ private:
+    static std::atomic<bool> enabled;
+};
+
+
+class ProfileZone
+{
+ public:
+    explicit ProfileZone(const char* _name) :
+        name(Profiler::isEnabled() ? _name : nullptr)
+    {
+        if (name != nullptr)
+        {
+            depth = currentDepth++;
+            start = Profiler::now();
+        }
+    }
+
+    ~ProfileZone()
+    {
+        if (name != nullptr)
+        {
+            currentDepth--;
+            Profiler::recordZone(name, start, Profiler::now(), depth);
+        }
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+ private:
+    const char* name;
+    int64_t start { 0 };
+    unsigned int depth { 0 };
+
+    static thread_local unsigned int currentDepth;
+};
+
+
+#define CEL_PROFILE_CONCAT_(a, b) a ## b
+#define CEL_PROFILE_CONCAT(a, b) CEL_PROFILE_CONCAT_(a, b)
+
+// Time the rest of the enclosing scope.
+#define CEL_PROFILE_ZONE(name) \
+    ProfileZone CEL_PROFILE_CONCAT(profileZone_, __LINE__)(name)
+
+#define CEL_PROFILE_COUNTER(name, value) \
+    do { if (Profiler::isEnabled()) Profiler::recordCounter((name), (double) (value)); } while (false)
@@ -12,6 +12,7 @@
 
 #include <vector>
 #include <map>
+#include <celutil/profiler.h>
 #include <celutil/reshandle.h>
 #include <celcompat/filesystem.h>
 
@@ -100,6 +101,7 @@ template<class T> class ResourceManager
                 }
                 else
                 {
+                    CEL_PROFILE_ZONE("ResourceManager::load");
                     resources[h].resource = resources[h].load(resources[h].resolvedName);
                     if (resources[h].resource == nullptr)
                     {
@@ -0,0 +1,211 @@
+// workerpool.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include "workerpool.h"
+
+using namespace std;
+
+// Each thread gets a few chunks so that uneven chunks still balance out.
+constexpr const size_t ChunksPerThread = 4;
+
+namespace
+{
+struct ParallelForState
+{
+    const function<void(size_t, size_t)>* fn { nullptr };
+    size_t count        { 0 };
+    size_t nChunks      { 0 };
+    atomic<size_t> nextChunk { 0 };
+    size_t nDone        { 0 };
+    atomic<bool> failed { false };
+    exception_ptr error;
+    mutex doneMutex;
+    condition_variable doneCond;
+
+    // Process chunks until none are left. An exception thrown by a chunk is
+    // kept for the calling thread and the chunks not yet started are skipped.
+    void work()
+    {
+        size_t processed = 0;
+        exception_ptr chunkError;
+        for (;;)
+        {
+            size_t chunk = nextChunk.fetch_add(1);
+            if (chunk >= nChunks)
+                break;
+            processed++;
+            if (failed)
+                continue;
+
+            try
+            {
+                (*fn)(chunk * count / nChunks, (chunk + 1) * count / nChunks);
+            }
+            catch (...)
+            {
+                failed = true;
+                if (chunkError == nullptr)
+                    chunkError = current_exception();
+            }
+        }
+
+        if (processed > 0)
+        {
+            lock_guard<mutex> lock(doneMutex);
+            if (error == nullptr)
+                error = chunkError;
+            nDone += processed;
+            if (nDone == nChunks)
+                doneCond.notify_all();
+        }
+    }
+};
+
+unique_ptr<WorkerPool> sharedPool;
+mutex sharedPoolMutex;
+}
+
+
+WorkerPool::WorkerPool(unsigned int nThreads)
+{
+    if (nThreads == 0)
+        nThreads = max(thread::hardware_concurrency(), 1u);
+
+    // The thread calling parallelFor takes part in the work, so one thread
+    // less than requested is spawned.
+    for (unsigned int i = 1; i < nThreads; i++)
+        workers.emplace_back(&WorkerPool::run, this);
+}
+
+
+WorkerPool::~WorkerPool()
+{
+    {
+        lock_guard<std::mutex> lock(tasksMutex);
+        stopping = true;
+    }
+    tasksCond.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+
+void WorkerPool::run()
+{
+    for (;;)
+    {
+        function<void()> task;
+        {
+            unique_lock<std::mutex> lock(tasksMutex);
+            tasksCond.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+            task = move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+
+size_t WorkerPool::getChunkCount(size_t count, size_t minChunkSize) const
+{
+    if (count == 0)
+        return 0;
+
+    minChunkSize = max(minChunkSize, (size_t) 1);
+    size_t maxChunks = (count + minChunkSize - 1) / minChunkSize;
+    return min(maxChunks, (size_t) getConcurrency() * ChunksPerThread);
+}
+
+
+void WorkerPool::parallelFor(size_t count,
+                             size_t minChunkSize,
+                             const function<void(size_t, size_t)>& fn)
+{
+    size_t nChunks = getChunkCount(count, minChunkSize);
+    if (nChunks == 0)
+        return;
+
+    if (nChunks == 1 || workers.empty())
+    {
+        for (size_t chunk = 0; chunk < nChunks; chunk++)
+            fn(chunk * count / nChunks, (chunk + 1) * count / nChunks);
+        return;
+    }
+
+    // Helpers may start after all chunks have been claimed, so the state is
+    // shared with them rather than living on this stack frame.
+    auto state = make_shared<ParallelForState>();
+    state->fn = &fn;
+    state->count = count;
+    state->nChunks = nChunks;
+
+    size_t nHelpers = min(nChunks - 1, workers.size());
+    {
+        lock_guard<std::mutex> lock(tasksMutex);
+        for (size_t i = 0; i < nHelpers; i++)
+            tasks.emplace_back([state] { state->work(); });
+    }
+    tasksCond.notify_all();
+
+    state->work();
+
+    unique_lock<std::mutex> lock(state->doneMutex);
+    state->doneCond.wait(lock, [&state] { return state->nDone == state->nChunks; });
+
+    if (state->error != nullptr)
+        rethrow_exception(state->error);
+}
+
+
+future<void> WorkerPool::submit(function<void()> task)
+{
+    auto packaged = make_shared<packaged_task<void()>>(move(task));
+    future<void> result = packaged->get_future();
+
+    if (workers.empty())
+    {
+        (*packaged)();
+        return result;
+    }
+
+    {
+        lock_guard<std::mutex> lock(tasksMutex);
+        tasks.emplace_back([packaged] { (*packaged)(); });
+    }
+    tasksCond.notify_one();
+
+    return result;
+}
+
+
+WorkerPool* GetWorkerPool()
+{
+    lock_guard<mutex> lock(sharedPoolMutex);
+    if (sharedPool == nullptr)
+        sharedPool.reset(new WorkerPool());
+    return sharedPool.get();
+}
+
+
+bool InitWorkerPool(unsigned int nThreads)
+{
+    lock_guard<mutex> lock(sharedPoolMutex);
+    if (sharedPool != nullptr)
+        return false;
+
+    sharedPool.reset(new WorkerPool(nThreads));
+    return true;
+}
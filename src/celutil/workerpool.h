@@ -0,0 +1,69 @@
+// workerpool.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// A small pool of worker threads shared by the CPU heavy parts of
+// Celestia (culling, catalog building, image compression.)
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool
+{
+ public:
+    // A thread count of zero selects the number of hardware threads.
+    explicit WorkerPool(unsigned int nThreads = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Number of threads taking part in a parallelFor, counting the caller.
+    unsigned int getConcurrency() const { return (unsigned int) workers.size() + 1; }
+
+    // Split [0, count) into consecutive chunks of at least minChunkSize
+    // items and call fn(begin, end) once for each chunk. The calling thread
+    // works on chunks too, and the method returns when all of them are done.
+    // Callers needing results in a deterministic order should split the work
+    // into their own slots and run parallelFor over the slot indices.
+    // If fn throws, the chunks not yet started are skipped and the first
+    // exception is rethrown on the calling thread once all workers are done.
+    void parallelFor(size_t count,
+                     size_t minChunkSize,
+                     const std::function<void(size_t, size_t)>& fn);
+
+    // Run a task asynchronously on one of the worker threads. With an
+    // empty pool the task is executed immediately on the calling thread.
+    std::future<void> submit(std::function<void()> task);
+
+ private:
+    void run();
+    size_t getChunkCount(size_t count, size_t minChunkSize) const;
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex tasksMutex;
+    std::condition_variable tasksCond;
+    bool stopping { false };
+};
+
+// The pool shared by the whole application. It is created on first use
+// with one thread per core unless InitWorkerPool() was called before, and
+// lives until exit, so the pointer and the futures of submitted tasks stay
+// valid. InitWorkerPool() returns false and leaves the pool unchanged once
+// it exists.
+extern WorkerPool* GetWorkerPool();
+extern bool InitWorkerPool(unsigned int nThreads);
@@ -0,0 +1,112 @@
+// yuvconvert.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include "yuvconvert.h"
+
+using namespace std;
+
+// Fixed point Rec. 601 coefficients scaled by 2^13, see
+// http://en.wikipedia.org/wiki/YUV/RGB_conversion_formulas
+//     Y := min((r * 2104 + g * 4130 + b * 802 + 4096 + 131072) >> 13, 235)
+//     U := min((r * -1214 + g * -2384 + b * 3598 + 4096 + 1048576) >> 13, 240)
+//     V := min((r * 3598 + g * -3013 + b * -585 + 4096 + 1048576) >> 13, 240)
+// The sums are positive for all 8 bit inputs.
+constexpr const int32_t LumaBias = 4096 + 131072;
+constexpr const int32_t ChromaBias = 4096 + 1048576;
+constexpr const uint16_t NeutralChroma = 128;
+
+namespace
+{
+// The loops below only use plain integer arithmetic on arrays, so that
+// they can be vectorized by the compiler. Pixels are split into separate
+// channels first, as the interleaved loads keep the arithmetic from being
+// vectorized otherwise.
+void SplitChannels(const uint8_t* __restrict rgb, size_t width,
+                   int16_t* __restrict r,
+                   int16_t* __restrict g,
+                   int16_t* __restrict b)
+{
+    for (size_t x = 0; x < width; x++)
+    {
+        r[x] = rgb[x * 3];
+        g[x] = rgb[x * 3 + 1];
+        b[x] = rgb[x * 3 + 2];
+    }
+}
+
+
+void ConvertRow(const int16_t* __restrict r,
+                const int16_t* __restrict g,
+                const int16_t* __restrict b,
+                size_t width,
+                uint8_t* __restrict y,
+                uint16_t* __restrict u,
+                uint16_t* __restrict v)
+{
+    for (size_t x = 0; x < width; x++)
+    {
+        int32_t R = r[x];
+        int32_t G = g[x];
+        int32_t B = b[x];
+        y[x] = (uint8_t) min((R * 2104 + G * 4130 + B * 802 + LumaBias) >> 13, 235);
+        u[x] = (uint16_t) min((R * -1214 + G * -2384 + B * 3598 + ChromaBias) >> 13, 240);
+        v[x] = (uint16_t) min((R * 3598 + G * -3013 + B * -585 + ChromaBias) >> 13, 240);
+    }
+}
+
+
+void AverageChroma(const uint16_t* __restrict c0,
+                   const uint16_t* __restrict c1,
+                   size_t chromaWidth,
+                   uint8_t* __restrict out)
+{
+    for (size_t x = 0; x < chromaWidth; x++)
+        out[x] = (uint8_t) ((c0[x * 2] + c0[x * 2 + 1] + c1[x * 2] + c1[x * 2 + 1]) >> 2);
+}
+} // end unnamed namespace
+
+
+void YUVConverter::convert(const uint8_t* rgb, int width, int height, int rowStride,
+                           bool flip, const Planes& planes)
+{
+    int chromaWidth = (width + 1) / 2;
+    for (auto& channel : channels)
+        channel.resize(width);
+    for (int i = 0; i < 2; i++)
+    {
+        // The padding sample of odd widths is never written by ConvertRow
+        rowU[i].assign(chromaWidth * 2, NeutralChroma);
+        rowV[i].assign(chromaWidth * 2, NeutralChroma);
+    }
+
+    for (int row = 0; row < height; row += 2)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            int r = row + i;
+            if (r == height)
+            {
+                fill(rowU[i].begin(), rowU[i].end(), NeutralChroma);
+                fill(rowV[i].begin(), rowV[i].end(), NeutralChroma);
+                break;
+            }
+
+            const uint8_t* src = rgb + (size_t) (flip ? height - 1 - r : r) * rowStride;
+            SplitChannels(src, width, channels[0].data(), channels[1].data(), channels[2].data());
+            ConvertRow(channels[0].data(), channels[1].data(), channels[2].data(), width,
+                       planes.y + (size_t) r * planes.yStride,
+                       rowU[i].data(), rowV[i].data());
+        }
+
+        size_t chromaOffset = (size_t) (row / 2) * planes.uvStride;
+        AverageChroma(rowU[0].data(), rowU[1].data(), chromaWidth, planes.u + chromaOffset);
+        AverageChroma(rowV[0].data(), rowV[1].data(), chromaWidth, planes.v + chromaOffset);
+    }
+}
@@ -0,0 +1,47 @@
+// yuvconvert.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// Conversion of RGB images to the planes of Y'CbCr 4:2:0 video frames.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class YUVConverter
+{
+ public:
+    // Destination planes. The chroma planes have half the width and height
+    // of the luma plane; pointers point at the first sample of the image,
+    // which has to start on an even row and column of the frame.
+    struct Planes
+    {
+        uint8_t* y;
+        uint8_t* u;
+        uint8_t* v;
+        int yStride;
+        int uvStride;
+    };
+
+    // Convert a width x height RGB image with rows rowStride bytes apart.
+    // Images read back from OpenGL are stored bottom row first, so those
+    // have to be flipped. Luma is limited to [16, 235] and chroma to
+    // [16, 240]. Chroma samples are the averages of the 2x2 pixel blocks;
+    // for images with odd dimensions the missing pixels count as neutral
+    // chroma.
+    void convert(const uint8_t* rgb, int width, int height, int rowStride,
+                 bool flip, const Planes& planes);
+
+ private:
+    // Buffers reused between calls: the channels of the current row and
+    // the chroma of the two rows of a block row
+    std::vector<int16_t> channels[3];
+    std::vector<uint16_t> rowU[2];
+    std::vector<uint16_t> rowV[2];
+};
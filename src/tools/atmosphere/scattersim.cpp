@@ -14,12 +14,15 @@
 #include <cstdlib>
 #include <cmath>
 #include <algorithm>
+#include <atomic>
 #include <map>
+#include <vector>
 #include <celmath/mathlib.h>
 #include <celmath/geomutil.h>
 #include <celmath/ray.h>
 #include <celmath/sphere.h>
 #include <celmath/intersect.h>
+#include <celutil/workerpool.h>
 #include <zlib.h>
 #include <png.h>
 
@@ -52,6 +55,15 @@ enum LUTUsageType
 static LUTUsageType LUTUsage = NoLUT;
 static bool UseFisheyeCameras = false;
 static double CameraExposure = 0.0;
+static bool ExactIntegration = false;
+static unsigned int ThreadCount = 0;
+
+// Images are rendered in square tiles of this size, one task per tile
+constexpr const unsigned int RenderTileSize = 16;
+
+// Integration steps for the optical depth towards the eye within each half
+// of a scattering interval when it's accumulated along the view path
+constexpr const unsigned int EyeDepthHalfIntervalSteps = 4;
 
 
 typedef map<string, double> ParameterSet;
@@ -299,8 +311,9 @@ public:
 
     double sunAngularDiameter;
 
-    LUT2* extinctionLUT;
-    LUT3* scatteringLUT;
+    LUT2* extinctionLUT{ nullptr };
+    LUT3* scatteringLUT{ nullptr };
+    LUT2* opticalDepthLUT{ nullptr };
 };
 
 
@@ -377,6 +390,9 @@ void usage()
     cerr << "           set the number of integration steps for depth\n";
     cerr << "   --scattersteps <value> (or -s)\n";
     cerr << "           set the number of integration steps for scattering\n";
+    cerr << "   --exact (or -x)            : integrate the optical depth towards the light\n";
+    cerr << "           and the eye for every sample instead of using a table\n";
+    cerr << "   --threads <value> (or -t)  : number of threads, 0 = one per core\n";
 }
 
 
@@ -816,10 +832,9 @@ double phaseSchlick(double cosTheta, double k)
 
 OpticalDepths integrateOpticalDepth(const Scene& scene,
                                     const Vector3d& atmStart,
-                                    const Vector3d& atmEnd)
+                                    const Vector3d& atmEnd,
+                                    unsigned int nSteps = IntegrateDepthSteps)
 {
-    unsigned int nSteps = IntegrateDepthSteps;
-
     OpticalDepths depth;
     depth.rayleigh   = 0.0;
     depth.mie        = 0.0;
@@ -834,21 +849,133 @@ OpticalDepths integrateOpticalDepth(const Scene& scene,
     dir = dir * (1.0 / length);
     Vector3d samplePoint = atmStart + (0.5 * stepDist * dir);
 
+    // The sample heights are computed first and each density is summed in
+    // its own loop. The sums are in-order double reductions over exp(), so
+    // they aren't vectorized, but the loops run faster than a single loop
+    // computing all three. The sums are accumulated in the same order as a
+    // single loop would.
+    static thread_local vector<double> heights;
+    heights.resize(nSteps);
+    for (unsigned int i = 0; i < nSteps; i++)
+    {
+        heights[i] = samplePoint.norm() - scene.planet.radius;
+        samplePoint += stepDist * dir;
+    }
+
+    // Optical depth due to two phenomena:
+    //   Outscattering by Rayleigh and Mie scattering particles
+    //   Absorption by absorbing particles
+    for (unsigned int i = 0; i < nSteps; i++)
+        depth.rayleigh   += scene.atmosphere.rayleighDensity(heights[i]) * stepDist;
+    for (unsigned int i = 0; i < nSteps; i++)
+        depth.mie        += scene.atmosphere.mieDensity(heights[i])      * stepDist;
+    for (unsigned int i = 0; i < nSteps; i++)
+        depth.absorption += scene.atmosphere.absorbDensity(heights[i])   * stepDist;
+
+    return depth;
+}
+
+
+OpticalDepths lookupOpticalDepth(const Scene& scene,
+                                 const Vector3d& atmStart,
+                                 const Vector3d& atmEnd);
+
+
+// Integrate the light scattered towards the eye along the view path from
+// atmStart to atmEnd. The optical depths towards the light and the eye are
+// integrated separately for each sample unless there is a table of optical
+// depths; then the depth towards the light is looked up and the depth
+// towards the eye is accumulated interval by interval along the path.
+void integrateScatteringPath(const Scene& scene,
+                             const Vector3d& atmStart,
+                             const Vector3d& atmEnd,
+                             const Vector3d& lightDir,
+                             Vector3d& rayleighScatter,
+                             Vector3d& mieScatter)
+{
+    const unsigned int nSteps = IntegrateScatterSteps;
+
+    Vector3d dir = atmEnd - atmStart;
+    Vector3d origin = Vector3d::Zero() + (atmStart - scene.planet.center);
+    double stepDist = dir.norm() / (double) nSteps;
+    dir.normalize();
+
+    // Start at the midpoint of the first interval
+    Vector3d samplePoint = origin + 0.5 * stepDist * dir;
+
+    rayleighScatter = Vector3d::Zero();
+    mieScatter = Vector3d::Zero();
+
+    Sphered shell = Sphered(Vector3d::Zero(),
+                            scene.planet.radius + scene.atmosphereShellHeight);
+
+    OpticalDepths pathDepth = { 0.0, 0.0, 0.0 };
+
     for (unsigned int i = 0; i < nSteps; i++)
     {
+        Ray3d sunRay(samplePoint, lightDir);
+        double sunDist = 0.0;
+        testIntersection(sunRay, shell, sunDist);
+
         double h = samplePoint.norm() - scene.planet.radius;
+        double rayleighDensity = scene.atmosphere.rayleighDensity(h);
+        double mieDensity = scene.atmosphere.mieDensity(h);
 
-        // Optical depth due to two phenomena:
-        //   Outscattering by Rayleigh and Mie scattering particles
-        //   Absorption by absorbing particles
-        depth.rayleigh   += scene.atmosphere.rayleighDensity(h) * stepDist;
-        depth.mie        += scene.atmosphere.mieDensity(h)      * stepDist;
-        depth.absorption += scene.atmosphere.absorbDensity(h)   * stepDist;
+        OpticalDepths totalDepth;
+        if (scene.opticalDepthLUT == nullptr)
+        {
+            // Compute the optical depth along path from sample point to the sun
+            OpticalDepths sunDepth = integrateOpticalDepth(scene, samplePoint, sunRay.point(sunDist));
+            // Compute the optical depth along the path from the sample point to the eye
+            OpticalDepths eyeDepth = integrateOpticalDepth(scene, samplePoint, atmStart);
+
+            // Sum the optical depths to get the depth on the complete path from sun
+            // to sample point to eye.
+            totalDepth = sumOpticalDepths(sunDepth, eyeDepth);
+            totalDepth.rayleigh *= 4.0 * PI;
+            totalDepth.mie      *= 4.0 * PI;
+        }
+        else
+        {
+            // The table only covers heights above the surface; view paths
+            // of the scattering table may pass through the planet.
+            OpticalDepths sunDepth;
+            if (h >= 0.0)
+            {
+                // The table values are already scaled like totalDepth above
+                sunDepth = lookupOpticalDepth(scene, samplePoint, sunRay.point(sunDist));
+            }
+            else
+            {
+                sunDepth = integrateOpticalDepth(scene, samplePoint, sunRay.point(sunDist));
+                sunDepth.rayleigh *= 4.0 * PI;
+                sunDepth.mie      *= 4.0 * PI;
+            }
+
+            // The depth to the eye covers the intervals of the previous
+            // samples and the first half of the current one.
+            Vector3d halfStep = 0.5 * stepDist * dir;
+            pathDepth = sumOpticalDepths(pathDepth,
+                                         integrateOpticalDepth(scene, samplePoint - halfStep, samplePoint,
+                                                               EyeDepthHalfIntervalSteps));
+            OpticalDepths eyeDepth = pathDepth;
+            eyeDepth.rayleigh *= 4.0 * PI;
+            eyeDepth.mie      *= 4.0 * PI;
+            totalDepth = sumOpticalDepths(sunDepth, eyeDepth);
+
+            pathDepth = sumOpticalDepths(pathDepth,
+                                         integrateOpticalDepth(scene, samplePoint, samplePoint + halfStep,
+                                                               EyeDepthHalfIntervalSteps));
+        }
+
+        Vector3d extinction = scene.atmosphere.computeExtinction(totalDepth);
+
+        // Add the inscattered light from Rayleigh and Mie scattering particles
+        rayleighScatter += rayleighDensity * stepDist * extinction;
+        mieScatter +=      mieDensity      * stepDist * extinction;
 
         samplePoint += stepDist * dir;
     }
-
-    return depth;
 }
 
 
@@ -894,50 +1021,14 @@ Vector3d integrateInscattering(const Scene& scene,
                             const Vector3d& atmStart,
                             const Vector3d& atmEnd)
 {
-    const unsigned int nSteps = IntegrateScatterSteps;
-
     Vector3d dir = atmEnd - atmStart;
-    Vector3d origin = Vector3d::Zero() + (atmStart - scene.planet.center);
-    double stepDist = dir.norm() / (double) nSteps;
     dir.normalize();
 
-    // Start at the midpoint of the first interval
-    Vector3d samplePoint = origin + 0.5 * stepDist * dir;
-
-    Vector3d rayleighScatter = Vector3d::Zero();
-    Vector3d mieScatter = Vector3d::Zero();
-
     Vector3d lightDir = -scene.light.direction;
-    Sphered shell = Sphered(Vector3d::Zero(),
-                            scene.planet.radius + scene.atmosphereShellHeight);
-
-    for (unsigned int i = 0; i < nSteps; i++)
-    {
-        Ray3d sunRay(samplePoint, lightDir);
-        double sunDist = 0.0;
-        testIntersection(sunRay, shell, sunDist);
-
-        // Compute the optical depth along path from sample point to the sun
-        OpticalDepths sunDepth = integrateOpticalDepth(scene, samplePoint, sunRay.point(sunDist));
-        // Compute the optical depth along the path from the sample point to the eye
-        OpticalDepths eyeDepth = integrateOpticalDepth(scene, samplePoint, atmStart);
-
-        // Sum the optical depths to get the depth on the complete path from sun
-        // to sample point to eye.
-        OpticalDepths totalDepth = sumOpticalDepths(sunDepth, eyeDepth);
-        totalDepth.rayleigh *= 4.0 * PI;
-        totalDepth.mie      *= 4.0 * PI;
-
-        Vector3d extinction = scene.atmosphere.computeExtinction(totalDepth);
-
-        double h = samplePoint.norm() - scene.planet.radius;
 
-        // Add the inscattered light from Rayleigh and Mie scattering particles
-        rayleighScatter += scene.atmosphere.rayleighDensity(h) * stepDist * extinction;
-        mieScatter +=      scene.atmosphere.mieDensity(h)      * stepDist * extinction;
-
-        samplePoint += stepDist * dir;
-    }
+    Vector3d rayleighScatter;
+    Vector3d mieScatter;
+    integrateScatteringPath(scene, atmStart, atmEnd, lightDir, rayleighScatter, mieScatter);
 
     double cosSunAngle = lightDir.dot(dir);
 
@@ -953,49 +1044,9 @@ Vector4d integrateInscatteringFactors(const Scene& scene,
                                    const Vector3d& atmEnd,
                                    const Vector3d& lightDir)
 {
-    const unsigned int nSteps = IntegrateScatterSteps;
-
-    Vector3d dir = atmEnd - atmStart;
-    Vector3d origin = Vector3d::Zero() + (atmStart - scene.planet.center);
-    double stepDist = dir.norm() / (double) nSteps;
-    dir.normalize();
-
-    // Start at the midpoint of the first interval
-    Vector3d samplePoint = origin + 0.5 * stepDist * dir;
-
-    Vector3d rayleighScatter = Vector3d::Zero();
-    Vector3d mieScatter = Vector3d::Zero();
-
-    Sphered shell = Sphered(Vector3d::Zero(),
-                            scene.planet.radius + scene.atmosphereShellHeight);
-
-    for (unsigned int i = 0; i < nSteps; i++)
-    {
-        Ray3d sunRay(samplePoint, lightDir);
-        double sunDist = 0.0;
-        testIntersection(sunRay, shell, sunDist);
-
-        // Compute the optical depth along path from sample point to the sun
-        OpticalDepths sunDepth = integrateOpticalDepth(scene, samplePoint, sunRay.point(sunDist));
-        // Compute the optical depth along the path from the sample point to the eye
-        OpticalDepths eyeDepth = integrateOpticalDepth(scene, samplePoint, atmStart);
-
-        // Sum the optical depths to get the depth on the complete path from sun
-        // to sample point to eye.
-        OpticalDepths totalDepth = sumOpticalDepths(sunDepth, eyeDepth);
-        totalDepth.rayleigh *= 4.0 * PI;
-        totalDepth.mie      *= 4.0 * PI;
-
-        Vector3d extinction = scene.atmosphere.computeExtinction(totalDepth);
-
-        double h = samplePoint.norm() - scene.planet.radius;
-
-        // Add the inscattered light from Rayleigh and Mie scattering particles
-        rayleighScatter += scene.atmosphere.rayleighDensity(h) * stepDist * extinction;
-        mieScatter +=      scene.atmosphere.mieDensity(h)      * stepDist * extinction;
-
-        samplePoint += stepDist * dir;
-    }
+    Vector3d rayleighScatter;
+    Vector3d mieScatter;
+    integrateScatteringPath(scene, atmStart, atmEnd, lightDir, rayleighScatter, mieScatter);
 
     Vector4d r = Vector4d::Zero();
     r.head(3) = rayleighScatter;
@@ -1030,34 +1081,39 @@ buildExtinctionLUT(const Scene& scene)
     //Sphered planet = Sphered(scene.planet.radius);
     Sphered shell = Sphered(scene.planet.radius + scene.atmosphereShellHeight);
 
-    for (unsigned int i = 0; i < ExtinctionLUTHeightSteps; i++)
+    // Every entry is computed independently, so the table doesn't depend on
+    // the number of threads.
+    GetWorkerPool()->parallelFor(ExtinctionLUTHeightSteps, 1, [&](size_t begin, size_t end)
     {
-        double h = (double) i / (double) (ExtinctionLUTHeightSteps - 1) *
-            scene.atmosphereShellHeight * 0.9999;
-        Vector3d atmStart = Vector3d::Zero() +
-            Vector3d::UnitX() * (h + scene.planet.radius);
-
-        for (unsigned int j = 0; j < ExtinctionLUTViewAngleSteps; j++)
+        for (auto i = (unsigned int) begin; i < end; i++)
         {
-            double cosAngle = (double) j / (ExtinctionLUTViewAngleSteps - 1) * 2.0 - 1.0;
-            double sinAngle = sqrt(1.0 - min(1.0, cosAngle * cosAngle));
-            Vector3d viewDir(cosAngle, sinAngle, 0.0);
+            double h = (double) i / (double) (ExtinctionLUTHeightSteps - 1) *
+                scene.atmosphereShellHeight * 0.9999;
+            Vector3d atmStart = Vector3d::Zero() +
+                Vector3d::UnitX() * (h + scene.planet.radius);
 
-            Ray3d ray(atmStart, viewDir);
-            double dist = 0.0;
+            for (unsigned int j = 0; j < ExtinctionLUTViewAngleSteps; j++)
+            {
+                double cosAngle = (double) j / (ExtinctionLUTViewAngleSteps - 1) * 2.0 - 1.0;
+                double sinAngle = sqrt(1.0 - min(1.0, cosAngle * cosAngle));
+                Vector3d viewDir(cosAngle, sinAngle, 0.0);
 
-            if (!testIntersection(ray, shell, dist))
-                dist = 0.0;
+                Ray3d ray(atmStart, viewDir);
+                double dist = 0.0;
+
+                if (!testIntersection(ray, shell, dist))
+                    dist = 0.0;
 
-            OpticalDepths depth = integrateOpticalDepth(scene, atmStart,
-                                                        ray.point(dist));
-            depth.rayleigh *= 4.0 * PI;
-            depth.mie      *= 4.0 * PI;
-            Vector3d ext = scene.atmosphere.computeExtinction(depth);
+                OpticalDepths depth = integrateOpticalDepth(scene, atmStart,
+                                                            ray.point(dist));
+                depth.rayleigh *= 4.0 * PI;
+                depth.mie      *= 4.0 * PI;
+                Vector3d ext = scene.atmosphere.computeExtinction(depth);
 
-            lut->setValue(i, j, ext.cwiseMax(1.0e-18));
+                lut->setValue(i, j, ext.cwiseMax(1.0e-18));
+            }
         }
-    }
+    });
 
     return lut;
 }
@@ -1090,33 +1146,36 @@ buildOpticalDepthLUT(const Scene& scene)
     //Sphered planet = Sphered(scene.planet.radius);
     Sphered shell = Sphered(scene.planet.radius + scene.atmosphereShellHeight);
 
-    for (unsigned int i = 0; i < ExtinctionLUTHeightSteps; i++)
+    GetWorkerPool()->parallelFor(ExtinctionLUTHeightSteps, 1, [&](size_t begin, size_t end)
     {
-        double h = (double) i / (double) (ExtinctionLUTHeightSteps - 1) *
-            scene.atmosphereShellHeight;
-        Vector3d atmStart = Vector3d::Zero() +
-            Vector3d::UnitX() * (h + scene.planet.radius);
-
-        for (unsigned int j = 0; j < ExtinctionLUTViewAngleSteps; j++)
+        for (auto i = (unsigned int) begin; i < end; i++)
         {
-            double cosAngle = (double) j / (ExtinctionLUTViewAngleSteps - 1) * 2.0 - 1.0;
-            double sinAngle = sqrt(1.0 - min(1.0, cosAngle * cosAngle));
-            Vector3d dir(cosAngle, sinAngle, 0.0);
+            double h = (double) i / (double) (ExtinctionLUTHeightSteps - 1) *
+                scene.atmosphereShellHeight;
+            Vector3d atmStart = Vector3d::Zero() +
+                Vector3d::UnitX() * (h + scene.planet.radius);
 
-            Ray3d ray(atmStart, dir);
-            double dist = 0.0;
+            for (unsigned int j = 0; j < ExtinctionLUTViewAngleSteps; j++)
+            {
+                double cosAngle = (double) j / (ExtinctionLUTViewAngleSteps - 1) * 2.0 - 1.0;
+                double sinAngle = sqrt(1.0 - min(1.0, cosAngle * cosAngle));
+                Vector3d dir(cosAngle, sinAngle, 0.0);
 
-            if (!testIntersection(ray, shell, dist))
-                dist = 0.0;
+                Ray3d ray(atmStart, dir);
+                double dist = 0.0;
 
-            OpticalDepths depth = integrateOpticalDepth(scene, atmStart,
-                                                        ray.point(dist));
-            depth.rayleigh *= 4.0 * PI;
-            depth.mie      *= 4.0 * PI;
+                if (!testIntersection(ray, shell, dist))
+                    dist = 0.0;
 
-            lut->setValue(i, j, Vector3d(depth.rayleigh, depth.mie, depth.absorption));
+                OpticalDepths depth = integrateOpticalDepth(scene, atmStart,
+                                                            ray.point(dist));
+                depth.rayleigh *= 4.0 * PI;
+                depth.mie      *= 4.0 * PI;
+
+                lut->setValue(i, j, Vector3d(depth.rayleigh, depth.mie, depth.absorption));
+            }
         }
-    }
+    });
 
     return lut;
 }
@@ -1128,6 +1187,9 @@ lookupOpticalDepth(const Scene& scene,
                    const Vector3d& atmEnd)
 {
     Vector3d dir = atmEnd - atmStart;
+    if (dir.squaredNorm() == 0.0)
+        return { 0.0, 0.0, 0.0 };
+
     Vector3d toCenter = atmStart - Vector3d::Zero();
     dir.normalize();
     toCenter.normalize();
@@ -1135,7 +1197,7 @@ lookupOpticalDepth(const Scene& scene,
         scene.atmosphereShellHeight;
     double cosViewAngle = dir.dot(toCenter);
 
-    Vector3d v = scene.extinctionLUT->lookup(h, (cosViewAngle + 1.0) * 0.5);
+    Vector3d v = scene.opticalDepthLUT->lookup(h, (cosViewAngle + 1.0) * 0.5);
     OpticalDepths depth;
     depth.rayleigh = v.x();
     depth.mie = v.y();
@@ -1307,15 +1369,21 @@ buildScatteringLUT(const Scene& scene)
 
     Sphered shell = Sphered(scene.planet.radius + scene.atmosphereShellHeight);
 
-    for (unsigned int i = 0; i < ScatteringLUTHeightSteps; i++)
+    // One task per combination of height and view angle; the light angles
+    // are integrated by the task.
+    GetWorkerPool()->parallelFor(ScatteringLUTHeightSteps * ScatteringLUTViewAngleSteps, 1,
+                                 [&](size_t begin, size_t end)
     {
-        double h = (double) i / (double) (ScatteringLUTHeightSteps - 1) *
-            scene.atmosphereShellHeight * 0.9999;
-        Vector3d atmStart = Vector3d::Zero() +
-            Vector3d::UnitX() * (h + scene.planet.radius);
-
-        for (unsigned int j = 0; j < ScatteringLUTViewAngleSteps; j++)
+        for (size_t index = begin; index < end; index++)
         {
+            auto i = (unsigned int) (index / ScatteringLUTViewAngleSteps);
+            auto j = (unsigned int) (index % ScatteringLUTViewAngleSteps);
+
+            double h = (double) i / (double) (ScatteringLUTHeightSteps - 1) *
+                scene.atmosphereShellHeight * 0.9999;
+            Vector3d atmStart = Vector3d::Zero() +
+                Vector3d::UnitX() * (h + scene.planet.radius);
+
             double cosAngle = unpackSNorm((double) j / (ScatteringLUTViewAngleSteps - 1));
             double sinAngle = sqrt(1.0 - min(1.0, cosAngle * cosAngle));
             Vector3d viewDir(cosAngle, sinAngle, 0.0);
@@ -1348,7 +1416,7 @@ buildScatteringLUT(const Scene& scene)
                 lut->setValue(i, j, k, inscatter);
             }
         }
-    }
+    });
 
     return lut;
 }
@@ -1599,34 +1667,51 @@ void render(const Scene& scene,
     unsigned int right = min(image.width, viewport.x + viewport.width);
     unsigned int bottom = min(image.height, viewport.y + viewport.height);
 
+    unsigned int tilesX = (right - viewport.x + RenderTileSize - 1) / RenderTileSize;
+    unsigned int tilesY = (bottom - viewport.y + RenderTileSize - 1) / RenderTileSize;
+    unsigned int nTiles = tilesX * tilesY;
+    atomic<unsigned int> tilesDone{ 0 };
+
+    // Every pixel is computed independently, so the image doesn't depend
+    // on the number of threads.
     cout << "Rendering " << viewport.width << "x" << viewport.height << " view" << endl;
-    for (unsigned int i = viewport.y; i < bottom; i++)
+    GetWorkerPool()->parallelFor(nTiles, 1, [&](size_t begin, size_t end)
     {
-        unsigned int row = i - viewport.y;
-        if (row % 50 == 49)
-            cout << row + 1 << endl;
-        else if (row % 10 == 0)
-            cout << ".";
-
-        for (unsigned int j = viewport.x; j < right; j++)
+        for (size_t tile = begin; tile < end; tile++)
         {
-            double viewportX = ((double) (j - viewport.x) / (double) (viewport.width - 1) - 0.5) * aspectRatio;
-            double viewportY ((double) (i - viewport.y) / (double) (viewport.height - 1) - 0.5);
+            unsigned int tileX = viewport.x + (unsigned int) (tile % tilesX) * RenderTileSize;
+            unsigned int tileY = viewport.y + (unsigned int) (tile / tilesX) * RenderTileSize;
+            unsigned int tileRight = min(right, tileX + RenderTileSize);
+            unsigned int tileBottom = min(bottom, tileY + RenderTileSize);
 
-            Ray3d viewRay = camera.getViewRay(viewportX, viewportY);
+            for (unsigned int i = tileY; i < tileBottom; i++)
+            {
+                for (unsigned int j = tileX; j < tileRight; j++)
+                {
+                    double viewportX = ((double) (j - viewport.x) / (double) (viewport.width - 1) - 0.5) * aspectRatio;
+                    double viewportY ((double) (i - viewport.y) / (double) (viewport.height - 1) - 0.5);
 
-            Color color;
-            if (LUTUsage != NoLUT)
-                color = scene.raytrace_LUT(viewRay);
-            else
-                color = scene.raytrace(viewRay);
+                    Ray3d viewRay = camera.getViewRay(viewportX, viewportY);
+
+                    Color color;
+                    if (LUTUsage != NoLUT)
+                        color = scene.raytrace_LUT(viewRay);
+                    else
+                        color = scene.raytrace(viewRay);
+
+                    if (CameraExposure != 0.0)
+                        color = color.exposure((float) CameraExposure);
 
-            if (CameraExposure != 0.0)
-                color = color.exposure((float) CameraExposure);
+                    image.setPixel(j, i, color);
+                }
+            }
 
-            image.setPixel(j, i, color);
+            // Print a dot for every 2% of the tiles
+            unsigned int done = ++tilesDone;
+            if (done * 50 / nTiles != (done - 1) * 50 / nTiles)
+                cout << "." << flush;
         }
-    }
+    });
     cout << endl << "Complete" << endl;
 }
 
@@ -1823,6 +1908,19 @@ bool parseCommandLine(int argc, char* argv[])
             {
                 LUTUsage = UseScatteringLUT;
             }
+            else if (!strcmp(argv[i], "-x") || !strcmp(argv[i], "--exact"))
+            {
+                ExactIntegration = true;
+            }
+            else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--threads"))
+            {
+                if (i == argc - 1)
+                    return false;
+
+                if (sscanf(argv[i + 1], " %u", &ThreadCount) != 1)
+                    return false;
+                i++;
+            }
             else if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "--fisheye"))
             {
                 UseFisheyeCameras = true;
@@ -1918,6 +2016,8 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
+    InitWorkerPool(ThreadCount);
+
     ParameterSet sceneParams;
     setSceneDefaults(sceneParams);
     if (!LoadParameterSet(sceneParams, configFilename))
@@ -1950,6 +2050,13 @@ int main(int argc, char* argv[])
     cout << "attenuation coeffs: " << scene.atmosphere.rayleighCoeff.transpose() * 4 * PI << '\n';
 
 
+    if (!ExactIntegration)
+    {
+        cout << "Building optical depth LUT...\n";
+        scene.opticalDepthLUT = buildOpticalDepthLUT(scene);
+        cout << "Complete!\n";
+    }
+
     if (LUTUsage != NoLUT)
     {
         cout << "Building extinction LUT...\n";
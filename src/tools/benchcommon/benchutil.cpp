@@ -0,0 +1,259 @@
+// benchutil.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include "benchutil.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <fmt/format.h>
+
+using namespace std;
+
+
+BenchCommandLine::BenchCommandLine(const string& _toolName, const string& _arguments) :
+    toolName(_toolName),
+    arguments(_arguments)
+{
+}
+
+
+void BenchCommandLine::add(const string& option, const string& description, unsigned int* value, unsigned int minValue)
+{
+    add(option, description, 1, [=](char** values)
+        {
+            *value = (unsigned int) max(atoi(values[0]), (int) minValue);
+        });
+}
+
+
+void BenchCommandLine::add(const string& option, const string& description, int* value, int minValue)
+{
+    add(option, description, 1, [=](char** values) { *value = max(atoi(values[0]), minValue); });
+}
+
+
+void BenchCommandLine::add(const string& option, const string& description, float* value)
+{
+    add(option, description, 1, [=](char** values) { *value = (float) atof(values[0]); });
+}
+
+
+void BenchCommandLine::add(const string& option, const string& description, string* value)
+{
+    add(option, description, 1, [=](char** values) { *value = values[0]; });
+}
+
+
+void BenchCommandLine::add(const string& option, const string& description, vector<string>* values)
+{
+    add(option, description, 1, [=](char** v) { values->push_back(v[0]); });
+}
+
+
+void BenchCommandLine::add(const string& option, const string& description,
+                           int nValues, const function<void(char**)>& parse)
+{
+    options.push_back({ option.substr(0, option.find(' ')), option, description, nValues, parse });
+}
+
+
+void BenchCommandLine::setArgument(string* _argument)
+{
+    argument = _argument;
+}
+
+
+bool BenchCommandLine::parse(int argc, char* argv[])
+{
+    add("--threads <n>", "worker threads, 0 = one per core", &threads, 0);
+    add("--output <file>", "write the JSON report to a file", &outputFile);
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        auto option = find_if(options.begin(), options.end(),
+                              [&arg](const Option& o) { return o.name == arg; });
+
+        if (option != options.end() && i + option->nValues < argc)
+        {
+            option->parse(argv + i + 1);
+            i += option->nValues;
+        }
+        else if (option == options.end() && argument != nullptr && arg[0] != '-')
+        {
+            if (!argument->empty())
+            {
+                cerr << "Too many arguments given\n";
+                usage();
+                return false;
+            }
+            *argument = arg;
+        }
+        else
+        {
+            cerr << "Unknown command line switch: " << arg << '\n';
+            usage();
+            return false;
+        }
+    }
+
+    if (argument != nullptr && argument->empty())
+    {
+        usage();
+        return false;
+    }
+
+    return true;
+}
+
+
+void BenchCommandLine::usage() const
+{
+    cerr << "Usage: " << toolName << " [options]";
+    if (!arguments.empty())
+        cerr << ' ' << arguments;
+    cerr << '\n';
+
+    for (const auto& option : options)
+        cerr << fmt::format("  {:<21} {}\n", option.usage, option.description);
+}
+
+
+JsonWriter::JsonWriter(ostream& _out) :
+    out(_out)
+{
+}
+
+
+void JsonWriter::beginObject(const char* name, bool inlined)
+{
+    key(name);
+    out << '{';
+    levels.push_back({ inlined || (!levels.empty() && levels.back().inlined), true });
+}
+
+
+void JsonWriter::endObject()
+{
+    end('}');
+}
+
+
+void JsonWriter::beginArray(const char* name, bool inlined)
+{
+    key(name);
+    out << '[';
+    levels.push_back({ inlined || (!levels.empty() && levels.back().inlined), true });
+}
+
+
+void JsonWriter::endArray()
+{
+    end(']');
+}
+
+
+void JsonWriter::value(const char* name, double value, int precision)
+{
+    key(name);
+    if (precision >= 0)
+        out << fmt::format("{:.{}f}", value, precision);
+    else
+        out << fmt::format("{}", value);
+}
+
+
+void JsonWriter::value(const char* name, unsigned int value)
+{
+    key(name);
+    out << value;
+}
+
+
+void JsonWriter::value(const char* name, int value)
+{
+    key(name);
+    out << value;
+}
+
+
+void JsonWriter::value(const char* name, uint64_t value)
+{
+    key(name);
+    out << value;
+}
+
+
+void JsonWriter::value(const char* name, bool value)
+{
+    key(name);
+    out << (value ? "true" : "false");
+}
+
+
+void JsonWriter::key(const char* name)
+{
+    if (levels.empty())
+        return;
+
+    Level& level = levels.back();
+    if (!level.empty)
+        out << ',';
+    level.empty = false;
+
+    if (level.inlined)
+        out << ' ';
+    else
+        out << '\n' << string(2 * levels.size(), ' ');
+
+    // Array elements have no names
+    if (name != nullptr)
+        out << '"' << name << "\": ";
+}
+
+
+void JsonWriter::end(char close)
+{
+    Level level = levels.back();
+    levels.pop_back();
+    if (!level.empty)
+    {
+        if (level.inlined)
+            out << ' ';
+        else
+            out << '\n' << string(2 * levels.size(), ' ');
+    }
+    out << close;
+
+    if (levels.empty())
+        out << '\n';
+}
+
+
+bool WriteBenchReport(const string& outputFile, const function<void(JsonWriter&)>& write)
+{
+    if (outputFile.empty())
+    {
+        JsonWriter writer(cout);
+        write(writer);
+        return true;
+    }
+
+    ofstream out(outputFile);
+    if (!out.good())
+    {
+        cerr << "Error opening output file " << outputFile << '\n';
+        return false;
+    }
+
+    JsonWriter writer(out);
+    write(writer);
+    return out.good();
+}
@@ -0,0 +1,120 @@
+// benchutil.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Scaffolding shared by the benchmark tools: command line parsing with the
+// common --threads and --output options, and the JSON report writer.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <celengine/staroctree.h>
+
+// Command line of a benchmark tool. Options are registered with a pointer
+// to the variable they set, which holds the default value, and are named
+// with their values as shown by the usage, e.g. "--stars <n>".
+class BenchCommandLine
+{
+ public:
+    BenchCommandLine(const std::string& toolName, const std::string& arguments = std::string());
+
+    void add(const std::string& option, const std::string& description, unsigned int* value, unsigned int minValue = 1);
+    void add(const std::string& option, const std::string& description, int* value, int minValue = 1);
+    void add(const std::string& option, const std::string& description, float* value);
+    void add(const std::string& option, const std::string& description, std::string* value);
+    // Option that may be repeated, each value is appended
+    void add(const std::string& option, const std::string& description, std::vector<std::string>* values);
+    // Option with nValues values, which are passed to parse
+    void add(const std::string& option, const std::string& description,
+             int nValues, const std::function<void(char**)>& parse);
+
+    // Set the required argument which isn't the value of an option; without
+    // one any such argument is an error.
+    void setArgument(std::string* argument);
+
+    // Parse the command line, printing the usage on errors
+    bool parse(int argc, char* argv[]);
+    void usage() const;
+
+    // Worker threads, 0 = one per core
+    unsigned int threads { 0 };
+    // File for the JSON report, standard output if empty
+    std::string outputFile;
+
+ private:
+    struct Option
+    {
+        std::string name;
+        std::string usage;
+        std::string description;
+        int nValues;
+        std::function<void(char**)> parse;
+    };
+
+    std::string toolName;
+    std::string arguments;
+    std::string* argument { nullptr };
+    std::vector<Option> options;
+};
+
+
+// Writer of the JSON reports. Objects and arrays opened as inline are
+// written on one line, the others with one member per line.
+class JsonWriter
+{
+ public:
+    JsonWriter(std::ostream& out);
+
+    // Names are ignored for the top level object and the elements of arrays
+    void beginObject(const char* name = nullptr, bool inlined = false);
+    void endObject();
+    void beginArray(const char* name, bool inlined = false);
+    void endArray();
+
+    // Fixed point with precision digits, or the shortest representation if
+    // precision is negative
+    void value(const char* name, double value, int precision = -1);
+    void value(const char* name, unsigned int value);
+    void value(const char* name, int value);
+    void value(const char* name, uint64_t value);
+    void value(const char* name, bool value);
+
+ private:
+    void key(const char* name);
+    void end(char close);
+
+    struct Level
+    {
+        bool inlined;
+        bool empty;
+    };
+
+    std::ostream& out;
+    std::vector<Level> levels;
+};
+
+// Write the report to outputFile, or to standard output if it's empty
+bool WriteBenchReport(const std::string& outputFile, const std::function<void(JsonWriter&)>& write);
+
+
+// Star handler which only counts the stars of a query
+class StarCounter : public StarHandler
+{
+ public:
+    void process(const Star& /*star*/, float /*distance*/, float /*appMag*/) override
+    {
+        count++;
+    }
+
+    size_t count { 0 };
+};
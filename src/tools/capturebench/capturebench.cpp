@@ -0,0 +1,353 @@
+// capturebench.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Headless benchmark of the screenshot compression. A synthetic frame is
+// compressed to PNG and JPEG by the banded compressors in imagecapture.cpp
+// and by single stream libpng and libjpeg, as screenshots used to be
+// written. Throughputs, file sizes and whether the decoded images are
+// identical are reported as JSON. Run with different --threads values to
+// see the scaling with the number of cores.
+
+#include <algorithm>
+#include <cmath>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <celestia/imagecapture.h>
+#include <celutil/timer.h>
+#include <celutil/workerpool.h>
+#include <tools/benchcommon/benchutil.h>
+
+extern "C" {
+#include <jpeglib.h>
+}
+#include <png.h>
+
+using namespace std;
+
+static int imageWidth = 3840;
+static int imageHeight = 2160;
+static unsigned int nIterations = 3;
+
+
+struct BenchResult
+{
+    const char* name;
+    double time { 0.0 };            // best of the iterations
+    double referenceTime { 0.0 };
+    size_t size { 0 };
+    size_t referenceSize { 0 };
+    bool identical { false };
+};
+
+
+// Something like a rendered frame: a dark sky with stars, a shaded planet
+// and a little noise.
+static void createImage(CapturedImage& image)
+{
+    image.width = imageWidth;
+    image.height = imageHeight;
+    image.rowStride = (imageWidth * 3 + 3) & ~0x3;
+    image.pixels.assign((size_t) image.rowStride * image.height, 0);
+
+    uint32_t seed = 12345;
+    auto random = [&seed]()
+    {
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    };
+
+    float cx = imageWidth * 0.6f;
+    float cy = imageHeight * 0.45f;
+    float radius = imageHeight * 0.3f;
+    for (int y = 0; y < imageHeight; y++)
+    {
+        unsigned char* row = image.pixels.data() + (size_t) y * image.rowStride;
+        for (int x = 0; x < imageWidth; x++)
+        {
+            float dx = (x - cx) / radius;
+            float dy = (y - cy) / radius;
+            float r2 = dx * dx + dy * dy;
+            int r, g, b;
+            if (r2 < 1.0f)
+            {
+                float light = max(0.0f, -0.6f * dx + 0.5f * dy + 0.6f * sqrt(1.0f - r2));
+                float bands = 0.8f + 0.2f * sin(dy * 25.0f + sin(dx * 4.0f));
+                r = (int) (220.0f * light * bands);
+                g = (int) (180.0f * light * bands);
+                b = (int) (140.0f * light);
+            }
+            else
+            {
+                r = g = b = 2 + y * 12 / imageHeight;
+                b += 4;
+            }
+
+            int noise = (int) (random() & 3);
+            row[x * 3]     = (unsigned char) min(r + noise, 255);
+            row[x * 3 + 1] = (unsigned char) min(g + noise, 255);
+            row[x * 3 + 2] = (unsigned char) min(b + noise, 255);
+        }
+    }
+
+    int nStars = imageWidth * imageHeight / 1000;
+    for (int i = 0; i < nStars; i++)
+    {
+        int x = (int) (random() % imageWidth);
+        int y = (int) (random() % imageHeight);
+        unsigned char brightness = (unsigned char) (64 + random() % 192);
+        unsigned char* p = image.pixels.data() + (size_t) y * image.rowStride + x * 3;
+        p[0] = p[1] = p[2] = brightness;
+    }
+}
+
+
+static void pngWrite(png_structp png, png_bytep data, png_size_t length)
+{
+    auto* out = (vector<unsigned char>*) png_get_io_ptr(png);
+    out->insert(out->end(), data, data + length);
+}
+
+static void pngFlush(png_structp)
+{
+}
+
+// The screenshot code before the compression was split into bands
+static bool referencePNG(const CapturedImage& image, vector<unsigned char>& data)
+{
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png_create_info_struct(png);
+    vector<png_bytep> rows(image.height);
+    for (int i = 0; i < image.height; i++)
+        rows[i] = (png_bytep) &image.pixels[(size_t) image.rowStride * (image.height - i - 1)];
+
+    if (setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_write_struct(&png, &info);
+        return false;
+    }
+
+    png_set_write_fn(png, &data, pngWrite, pngFlush);
+    png_set_compression_level(png, 9);
+    png_set_IHDR(png, info, image.width, image.height, 8,
+                 PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    png_write_image(png, rows.data());
+    png_write_end(png, info);
+    png_destroy_write_struct(&png, &info);
+    return true;
+}
+
+
+static bool referenceJPEG(const CapturedImage& image, vector<unsigned char>& data)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+
+    unsigned char* buffer = nullptr;
+    unsigned long size = 0;
+    jpeg_mem_dest(&cinfo, &buffer, &size);
+
+    cinfo.image_width = image.width;
+    cinfo.image_height = image.height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    JSAMPROW row[1];
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        row[0] = (JSAMPROW) &image.pixels[(size_t) image.rowStride * (cinfo.image_height - cinfo.next_scanline - 1)];
+        jpeg_write_scanlines(&cinfo, row, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    data.assign(buffer, buffer + size);
+    free(buffer);
+    return true;
+}
+
+
+struct PNGSource
+{
+    const vector<unsigned char>* data;
+    size_t offset;
+};
+
+static void pngRead(png_structp png, png_bytep out, png_size_t length)
+{
+    auto* source = (PNGSource*) png_get_io_ptr(png);
+    if (source->offset + length > source->data->size())
+        png_error(png, "Read past the end of the data");
+    memcpy(out, source->data->data() + source->offset, length);
+    source->offset += length;
+}
+
+// Decode to tightly packed RGB rows, top row first
+static bool decodePNG(const vector<unsigned char>& data, vector<unsigned char>& pixels)
+{
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png_create_info_struct(png);
+    if (setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return false;
+    }
+
+    PNGSource source { &data, 0 };
+    png_set_read_fn(png, &source, pngRead);
+    png_read_info(png, info);
+    png_uint_32 width = png_get_image_width(png, info);
+    png_uint_32 height = png_get_image_height(png, info);
+    pixels.resize((size_t) width * height * 3);
+    vector<png_bytep> rows(height);
+    for (png_uint_32 i = 0; i < height; i++)
+        rows[i] = &pixels[(size_t) i * width * 3];
+    png_read_image(png, rows.data());
+    png_read_end(png, nullptr);
+    png_destroy_read_struct(&png, &info, nullptr);
+    return true;
+}
+
+
+static bool decodeJPEG(const vector<unsigned char>& data, vector<unsigned char>& pixels)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(data.data()), data.size());
+    jpeg_read_header(&cinfo, TRUE);
+    jpeg_start_decompress(&cinfo);
+
+    size_t rowBytes = (size_t) cinfo.output_width * cinfo.output_components;
+    pixels.resize(rowBytes * cinfo.output_height);
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        JSAMPROW row[1] = { &pixels[cinfo.output_scanline * rowBytes] };
+        jpeg_read_scanlines(&cinfo, row, 1);
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+
+static void runBenchmark(const CapturedImage& image,
+                         bool (*compress)(const CapturedImage&, vector<unsigned char>&),
+                         bool (*reference)(const CapturedImage&, vector<unsigned char>&),
+                         bool (*decode)(const vector<unsigned char>&, vector<unsigned char>&),
+                         BenchResult& result)
+{
+    vector<unsigned char> data;
+    vector<unsigned char> referenceData;
+    result.time = result.referenceTime = 1.0e30;
+    for (unsigned int i = 0; i < nIterations; i++)
+    {
+        data.clear();
+        Timer timer;
+        compress(image, data);
+        result.time = min(result.time, timer.getTime());
+
+        referenceData.clear();
+        Timer referenceTimer;
+        reference(image, referenceData);
+        result.referenceTime = min(result.referenceTime, referenceTimer.getTime());
+    }
+
+    result.size = data.size();
+    result.referenceSize = referenceData.size();
+
+    vector<unsigned char> decoded;
+    vector<unsigned char> referenceDecoded;
+    result.identical = decode(data, decoded) &&
+                       decode(referenceData, referenceDecoded) &&
+                       decoded == referenceDecoded;
+}
+
+
+static bool compressPNG(const CapturedImage& image, vector<unsigned char>& data)
+{
+    return CompressImageToPNG(image, data);
+}
+
+static bool compressJPEG(const CapturedImage& image, vector<unsigned char>& data)
+{
+    return CompressImageToJPEG(image, data);
+}
+
+
+static void writeReport(JsonWriter& out, const vector<BenchResult>& results)
+{
+    double megapixels = (double) imageWidth * imageHeight * 1.0e-6;
+
+    out.beginObject();
+    out.value("width", imageWidth);
+    out.value("height", imageHeight);
+    out.value("iterations", nIterations);
+    out.value("threads", GetWorkerPool()->getConcurrency());
+    out.beginObject("formats");
+    for (const BenchResult& r : results)
+    {
+        out.beginObject(r.name, true);
+        out.value("timeMs", r.time * 1000.0, 2);
+        out.value("megapixelsPerSecond", megapixels / r.time, 2);
+        out.value("bytes", (uint64_t) r.size);
+        out.value("referenceTimeMs", r.referenceTime * 1000.0, 2);
+        out.value("referenceMegapixelsPerSecond", megapixels / r.referenceTime, 2);
+        out.value("referenceBytes", (uint64_t) r.referenceSize);
+        out.value("speedup", r.referenceTime / r.time, 2);
+        out.value("identical", r.identical);
+        out.endObject();
+    }
+    out.endObject();
+    out.endObject();
+}
+
+
+int main(int argc, char* argv[])
+{
+    BenchCommandLine commandLine("capturebench");
+    commandLine.add("--width <n>", "image width (default 3840)", &imageWidth);
+    commandLine.add("--height <n>", "image height (default 2160)", &imageHeight);
+    commandLine.add("--iterations <n>", "compressions of each image, the best is reported (default 3)", &nIterations);
+    if (!commandLine.parse(argc, argv))
+        return 1;
+    if (imageHeight > 65535)
+    {
+        commandLine.usage();
+        return 1;
+    }
+
+    InitWorkerPool(commandLine.threads);
+
+    CapturedImage image;
+    createImage(image);
+
+    vector<BenchResult> results(2);
+    results[0].name = "png";
+    runBenchmark(image, compressPNG, referencePNG, decodePNG, results[0]);
+    results[1].name = "jpeg";
+    runBenchmark(image, compressJPEG, referenceJPEG, decodeJPEG, results[1]);
+
+    bool written = WriteBenchReport(commandLine.outputFile, [&](JsonWriter& out)
+    {
+        writeReport(out, results);
+    });
+
+    return written ? 0 : 1;
+}
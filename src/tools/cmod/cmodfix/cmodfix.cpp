@@ -19,6 +19,7 @@
 #include <cstdio>
 #include <algorithm>
 #include <vector>
+#include "meshoptimize.h"
 #ifdef TRISTRIP
 #include <NvTriStrip.h>
 #endif
@@ -37,6 +38,10 @@ bool genTangents = false;
 bool weldVertices = false;
 bool mergeMeshes = false;
 bool stripify = false;
+bool optimizeCache = false;
+bool optimizeFetch = false;
+bool quantize = false;
+bool halfPositions = false;
 unsigned int vertexCacheSize = 16;
 float smoothAngle = 60.0f;
 
@@ -52,6 +57,11 @@ void usage()
     cerr << "   --smooth (or -s) <angle> : smoothing angle for normal generation\n";
     cerr << "   --weld (or -w)        : join identical vertices before normal generation\n";
     cerr << "   --merge (or -m)       : merge submeshes to improve rendering performance\n";
+    cerr << "   --cache (or -c)       : reorder triangles for the post-transform vertex cache\n";
+    cerr << "   --fetch (or -f)       : reorder vertices in the order they are drawn\n";
+    cerr << "   --cachesize <n>       : vertex cache size for reordering (default 16)\n";
+    cerr << "   --quantize (or -q)    : store vertices in packed formats\n";
+    cerr << "   --half                : quantize positions to half floats instead of shorts\n";
 #ifdef TRISTRIP
     cerr << "   --optimize (or -o)    : optimize by converting triangle lists to strips\n";
 #endif
@@ -91,68 +101,6 @@ public:
 };
 
 
-class FullComparator : public VertexComparator
-{
-public:
-    FullComparator(int _vertexSize) :
-        vertexSize(_vertexSize)
-    {
-    }
-
-    bool compare(const Vertex& a, const Vertex& b) const override
-    {
-        const auto* s0 = reinterpret_cast<const char*>(a.attributes);
-        const auto* s1 = reinterpret_cast<const char*>(b.attributes);
-        for (int i = 0; i < vertexSize; i++)
-        {
-            if (s0[i] < s1[i])
-                return true;
-            if (s0[i] > s1[i])
-                return false;
-        }
-
-        return false;
-    }
-
-private:
-    int vertexSize;
-};
-
-
-class PointOrderingPredicate : public VertexComparator
-{
-public:
-    PointOrderingPredicate() = default;
-
-    bool compare(const Vertex& a, const Vertex& b) const override
-    {
-        const Vector3f* p0 = reinterpret_cast<const Vector3f*>(a.attributes);
-        const Vector3f* p1 = reinterpret_cast<const Vector3f*>(b.attributes);
-
-        if (p0->x() < p1->x())
-        {
-            return true;
-        }
-        if (p0->x() > p1->x())
-        {
-            return false;
-        }
-        else
-        {
-            if (p0->y() < p1->y())
-                return true;
-            if (p0->y() > p1->y())
-                return false;
-            else
-                return p0->z() < p1->z();
-        }
-    }
-
-private:
-    int ignore;
-};
-
-
 class PointTexCoordOrderingPredicate : public VertexComparator
 {
 public:
@@ -227,34 +175,6 @@ bool approxEqual(float x, float y, float prec)
 }
 
 
-class PointEquivalencePredicate : public VertexComparator
-{
-public:
-    PointEquivalencePredicate(uint32_t _posOffset,
-                              float _tolerance) :
-        posOffset(_posOffset),
-        tolerance(_tolerance)
-    {
-    }
-
-    bool compare(const Vertex& a, const Vertex& b) const override
-    {
-        const auto* adata = reinterpret_cast<const char*>(a.attributes);
-        const auto* bdata = reinterpret_cast<const char*>(b.attributes);
-        const Vector3f* p0 = reinterpret_cast<const Vector3f*>(adata + posOffset);
-        const Vector3f* p1 = reinterpret_cast<const Vector3f*>(bdata + posOffset);
-
-        return (approxEqual(p0->x(),  p1->x(), tolerance) &&
-                approxEqual(p0->y(),  p1->y(), tolerance) &&
-                approxEqual(p0->z(),  p1->z(), tolerance));
-    }
-
-private:
-    uint32_t posOffset;
-    float tolerance;
-};
-
-
 class PointTexCoordEquivalencePredicate : public VertexComparator
 {
 public:
@@ -293,30 +213,6 @@ private:
 };
 
 
-bool equal(const Vertex& a, const Vertex& b, uint32_t vertexSize)
-{
-    const auto* s0 = reinterpret_cast<const char*>(a.attributes);
-    const auto* s1 = reinterpret_cast<const char*>(b.attributes);
-
-    for (uint32_t i = 0; i < vertexSize; i++)
-    {
-        if (s0[i] != s1[i])
-            return false;
-    }
-
-    return true;
-}
-
-
-bool equalPoint(const Vertex& a, const Vertex& b)
-{
-    const Vector3f* p0 = reinterpret_cast<const Vector3f*>(a.attributes);
-    const Vector3f* p1 = reinterpret_cast<const Vector3f*>(b.attributes);
-
-    return *p0 == *p1;
-}
-
-
 bool operator==(const Mesh::VertexAttribute& a,
                 const Mesh::VertexAttribute& b)
 {
@@ -400,69 +296,6 @@ struct MeshVertexDescComparator
 
 
 
-bool uniquifyVertices(Mesh& mesh)
-{
-    uint32_t nVertices = mesh.getVertexCount();
-    const Mesh::VertexDescription& desc = mesh.getVertexDescription();
-
-    if (nVertices == 0)
-        return false;
-
-    const char* vertexData = reinterpret_cast<const char*>(mesh.getVertexData());
-    if (vertexData == nullptr)
-        return false;
-
-    // Initialize the array of vertices
-    vector<Vertex> vertices(nVertices);
-    uint32_t i;
-    for (i = 0; i < nVertices; i++)
-    {
-        vertices[i] = Vertex(i, vertexData + i * desc.stride);
-    }
-
-    // Sort the vertices so that identical ones will be ordered consecutively
-    sort(vertices.begin(), vertices.end(), FullComparator(desc.stride));
-
-    // Count the number of unique vertices
-    uint32_t uniqueVertexCount = 0;
-    for (i = 0; i < nVertices; i++)
-    {
-        if (i == 0 || !equal(vertices[i - 1], vertices[i], desc.stride))
-            uniqueVertexCount++;
-    }
-
-    // No work left to do if we couldn't eliminate any vertices
-    if (uniqueVertexCount == nVertices)
-        return true;
-
-    // Build the vertex map and the uniquified vertex data
-    vector<uint32_t> vertexMap(nVertices);
-    auto* newVertexData = new char[uniqueVertexCount * desc.stride];
-    const char* oldVertexData = reinterpret_cast<const char*>(mesh.getVertexData());
-    uint32_t j = 0;
-    for (i = 0; i < nVertices; i++)
-    {
-        if (i == 0 || !equal(vertices[i - 1], vertices[i], desc.stride))
-        {
-            if (i != 0)
-                j++;
-            assert(j < uniqueVertexCount);
-            memcpy(newVertexData + j * desc.stride,
-                   oldVertexData + vertices[i].index * desc.stride,
-                   desc.stride);
-        }
-        vertexMap[vertices[i].index] = j;
-    }
-
-    // Replace the vertex data with the compacted data
-    mesh.setVertices(uniqueVertexCount, newVertexData);
-
-    mesh.remapIndices(vertexMap);
-
-    return true;
-}
-
-
 Vector3f
 getVertex(const void* vertexData,
           int positionOffset,
@@ -791,9 +624,14 @@ generateNormals(Mesh& mesh,
     // as the attribute indices.
     if (weld)
     {
-        joinVertices(faces, vertexData, desc,
-                     PointOrderingPredicate(),
-                     PointEquivalencePredicate(0, 0.0f));
+        vector<uint32_t> representative;
+        FindIdenticalPositions(vertexData, nVertices, desc.stride, posOffset, representative);
+        for (f = 0; f < nFaces; f++)
+        {
+            faces[f].vi[0] = representative[faces[f].i[0]];
+            faces[f].vi[1] = representative[faces[f].i[1]];
+            faces[f].vi[2] = representative[faces[f].i[2]];
+        }
     }
     else
     {
@@ -1426,6 +1264,49 @@ convertToStrips(Mesh& mesh)
 #endif
 
 
+/*! Convert the vertex attributes to packed formats: positions to shorts
+ *  relative to the mesh bounds (or half floats), normals and tangents to
+ *  octahedral vectors and texture coordinates to half floats.
+ */
+bool
+quantizeVertices(Mesh& mesh, bool halfPositions)
+{
+    const Mesh::VertexDescription& desc = mesh.getVertexDescription();
+    vector<Mesh::VertexAttribute> attributes(desc.attributes, desc.attributes + desc.nAttributes);
+
+    uint32_t offset = 0;
+    for (auto& attr : attributes)
+    {
+        switch (attr.semantic)
+        {
+        case Mesh::Position:
+            if (attr.format == Mesh::Float3)
+                attr.format = halfPositions ? Mesh::Half4 : Mesh::Short4N;
+            break;
+        case Mesh::Normal:
+        case Mesh::Tangent:
+            if (attr.format == Mesh::Float3)
+                attr.format = Mesh::Octahedral;
+            break;
+        case Mesh::Texture0:
+        case Mesh::Texture1:
+        case Mesh::Texture2:
+        case Mesh::Texture3:
+            if (attr.format == Mesh::Float2)
+                attr.format = Mesh::Half2;
+            break;
+        default:
+            break;
+        }
+
+        attr.offset = offset;
+        offset += Mesh::getVertexAttributeSize(attr.format);
+    }
+
+    return mesh.convertVertices(Mesh::VertexDescription(offset, attributes.size(), attributes.data()));
+}
+
+
 bool parseCommandLine(int argc, char* argv[])
 {
     int i = 1;
@@ -1467,6 +1348,35 @@ bool parseCommandLine(int argc, char* argv[])
             {
                 stripify = true;
             }
+            else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--cache"))
+            {
+                optimizeCache = true;
+            }
+            else if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "--fetch"))
+            {
+                optimizeFetch = true;
+            }
+            else if (!strcmp(argv[i], "-q") || !strcmp(argv[i], "--quantize"))
+            {
+                quantize = true;
+            }
+            else if (!strcmp(argv[i], "--half"))
+            {
+                halfPositions = true;
+            }
+            else if (!strcmp(argv[i], "--cachesize"))
+            {
+                if (i == argc - 1)
+                {
+                    return false;
+                }
+                else
+                {
+                    if (sscanf(argv[i + 1], " %u", &vertexCacheSize) != 1 || vertexCacheSize < 4)
+                        return false;
+                    i++;
+                }
+            }
             else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--smooth"))
             {
                 if (i == argc - 1)
@@ -1540,6 +1450,14 @@ int main(int argc, char* argv[])
     if (model == nullptr)
         return 1;
 
+    // All operations work on float vertices
+    for (uint32_t i = 0; model->getMesh(i) != nullptr; i++)
+    {
+        Mesh* mesh = model->getMesh(i);
+        if (mesh->hasPackedVertices())
+            mesh->convertVertices(mesh->getUnpackedVertexDescription());
+    }
+
     if (genNormals || genTangents)
     {
         Model* newModel = new Model();
@@ -1600,7 +1518,26 @@ int main(int argc, char* argv[])
         for (uint32_t i = 0; model->getMesh(i) != nullptr; i++)
         {
             Mesh* mesh = model->getMesh(i);
-            uniquifyVertices(*mesh);
+            WeldVertices(*mesh);
+        }
+    }
+
+    if (optimizeCache || optimizeFetch)
+    {
+        for (uint32_t i = 0; model->getMesh(i) != nullptr; i++)
+        {
+            Mesh* mesh = model->getMesh(i);
+            VertexCacheStats before = GetVertexCacheStats(*mesh, vertexCacheSize);
+
+            if (optimizeCache)
+                OptimizeVertexCache(*mesh, vertexCacheSize);
+            if (optimizeFetch)
+                OptimizeVertexFetch(*mesh);
+
+            VertexCacheStats after = GetVertexCacheStats(*mesh, vertexCacheSize);
+            cerr << "Mesh " << i << ": " << after.triangles << " triangles, "
+                 << "ACMR " << before.acmr() << " -> " << after.acmr() << ", "
+                 << "ATVR " << before.atvr() << " -> " << after.atvr() << '\n';
         }
     }
 
@@ -1616,6 +1553,21 @@ int main(int argc, char* argv[])
     }
 #endif
 
+    if (quantize)
+    {
+        for (uint32_t i = 0; model->getMesh(i) != nullptr; i++)
+        {
+            Mesh* mesh = model->getMesh(i);
+            unsigned int oldStride = mesh->getVertexStride();
+            if (!quantizeVertices(*mesh, halfPositions))
+            {
+                cerr << "Error quantizing vertices\n";
+                return 1;
+            }
+            cerr << "Mesh " << i << ": vertex size " << oldStride << " -> " << mesh->getVertexStride() << " bytes\n";
+        }
+    }
+
     if (outputFilename.empty())
     {
         if (outputBinary)
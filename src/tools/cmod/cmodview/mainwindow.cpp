@@ -467,6 +467,14 @@ MainWindow::openModel(const QString& fileName)
                 return;
             }
 
+            // The viewer and the editing operations work on float vertices
+            for (unsigned int i = 0; i < model->getMeshCount(); i++)
+            {
+                Mesh* mesh = model->getMesh(i);
+                if (mesh->hasPackedVertices())
+                    mesh->convertVertices(mesh->getUnpackedVertexDescription());
+            }
+
             setModel(fileName, model);
         }
         else
@@ -0,0 +1,604 @@
+// meshoptimize.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include "meshoptimize.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <celutil/workerpool.h>
+
+using namespace cmod;
+using namespace std;
+
+
+namespace
+{
+constexpr const uint32_t NoVertex = ~0u;
+constexpr const uint32_t NoTriangle = ~0u;
+
+// Scoring parameters from Forsyth's paper
+constexpr const float CacheDecayPower = 1.5f;
+constexpr const float LastTriangleScore = 0.75f;
+constexpr const float ValenceBoostScale = 2.0f;
+constexpr const float ValenceBoostPower = 0.5f;
+
+// Number of shards the vertices are split into for welding, by hash
+constexpr const unsigned int WeldShardBits = 6;
+constexpr const unsigned int WeldShardCount = 1u << WeldShardBits;
+constexpr const size_t WeldChunkSize = 16384;
+
+
+class VertexScorer
+{
+ public:
+    explicit VertexScorer(unsigned int _cacheSize) :
+        cacheSize(_cacheSize),
+        cacheScores(_cacheSize),
+        valenceScores(MaxTabulatedValence + 1)
+    {
+        for (unsigned int i = 0; i < cacheSize; i++)
+        {
+            if (i < 3)
+            {
+                // The vertices of the last triangle get a fixed score so
+                // that the next triangle doesn't just reuse its edge.
+                cacheScores[i] = LastTriangleScore;
+            }
+            else
+            {
+                float scale = 1.0f / (float) (cacheSize - 3);
+                cacheScores[i] = pow(1.0f - (float) (i - 3) * scale, CacheDecayPower);
+            }
+        }
+        for (unsigned int i = 1; i <= MaxTabulatedValence; i++)
+            valenceScores[i] = ValenceBoostScale * pow((float) i, -ValenceBoostPower);
+    }
+
+    float score(int cachePosition, uint32_t remainingValence) const
+    {
+        if (remainingValence == 0)
+            return -1.0f;
+
+        float s = cachePosition >= 0 ? cacheScores[cachePosition] : 0.0f;
+        // Boost vertices with few triangles left, to finish them off
+        if (remainingValence <= MaxTabulatedValence)
+            s += valenceScores[remainingValence];
+        else
+            s += ValenceBoostScale * pow((float) remainingValence, -ValenceBoostPower);
+        return s;
+    }
+
+ private:
+    static constexpr const uint32_t MaxTabulatedValence = 32;
+
+    unsigned int cacheSize;
+    vector<float> cacheScores;
+    vector<float> valenceScores;
+};
+
+
+inline uint64_t mixHash(uint64_t h, uint32_t word)
+{
+    h ^= word;
+    h *= 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 29);
+}
+
+
+// Key of whole vertices, compared byte by byte
+struct VertexKey
+{
+    const char* data;
+    uint32_t stride;
+
+    uint64_t hash(uint32_t i) const
+    {
+        const char* v = data + (size_t) i * stride;
+        uint64_t h = stride;
+        uint32_t j = 0;
+        for (; j + 4 <= stride; j += 4)
+        {
+            uint32_t word;
+            memcpy(&word, v + j, sizeof word);
+            h = mixHash(h, word);
+        }
+        for (; j < stride; j++)
+            h = mixHash(h, (unsigned char) v[j]);
+        return h;
+    }
+
+    bool equal(uint32_t a, uint32_t b) const
+    {
+        return memcmp(data + (size_t) a * stride, data + (size_t) b * stride, stride) == 0;
+    }
+};
+
+
+// Key of vertex positions, compared as floats so that 0 and -0 are equal
+struct PositionKey
+{
+    const char* data;
+    uint32_t stride;
+
+    void position(uint32_t i, float p[3]) const
+    {
+        memcpy(p, data + (size_t) i * stride, 3 * sizeof(float));
+    }
+
+    uint64_t hash(uint32_t i) const
+    {
+        float p[3];
+        position(i, p);
+        uint64_t h = 0;
+        for (float c : p)
+        {
+            c += 0.0f;  // -0 becomes 0
+            uint32_t word;
+            memcpy(&word, &c, sizeof word);
+            h = mixHash(h, word);
+        }
+        return h;
+    }
+
+    bool equal(uint32_t a, uint32_t b) const
+    {
+        float pa[3], pb[3];
+        position(a, pa);
+        position(b, pb);
+        return pa[0] == pb[0] && pa[1] == pb[1] && pa[2] == pb[2];
+    }
+};
+
+
+// Weld vertices with a hash table. The vertices are distributed to shards
+// by their hash, and each shard is welded separately with its own table.
+// Vertices are inserted in index order, so the first of a group of equal
+// vertices becomes the representative whatever the number of threads.
+template<typename Key> uint32_t
+weld(const Key& key, uint32_t nVertices, vector<uint32_t>& representative)
+{
+    WorkerPool* pool = GetWorkerPool();
+    representative.resize(nVertices);
+
+    vector<uint64_t> hashes(nVertices);
+    pool->parallelFor(nVertices, WeldChunkSize, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+            hashes[i] = key.hash((uint32_t) i);
+    });
+
+    // Count the vertices of each shard per chunk, then list them by shard
+    // keeping the index order.
+    size_t nChunks = (nVertices + WeldChunkSize - 1) / WeldChunkSize;
+    vector<uint32_t> counts(nChunks * WeldShardCount, 0);
+    pool->parallelFor(nChunks, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t chunk = begin; chunk < end; chunk++)
+        {
+            size_t last = min((chunk + 1) * WeldChunkSize, (size_t) nVertices);
+            for (size_t i = chunk * WeldChunkSize; i < last; i++)
+                counts[chunk * WeldShardCount + (hashes[i] >> (64 - WeldShardBits))]++;
+        }
+    });
+
+    vector<uint32_t> shardStart(WeldShardCount + 1);
+    vector<uint32_t> offsets(nChunks * WeldShardCount);
+    uint32_t total = 0;
+    for (unsigned int shard = 0; shard < WeldShardCount; shard++)
+    {
+        shardStart[shard] = total;
+        for (size_t chunk = 0; chunk < nChunks; chunk++)
+        {
+            offsets[chunk * WeldShardCount + shard] = total;
+            total += counts[chunk * WeldShardCount + shard];
+        }
+    }
+    shardStart[WeldShardCount] = total;
+
+    vector<uint32_t> order(nVertices);
+    pool->parallelFor(nChunks, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t chunk = begin; chunk < end; chunk++)
+        {
+            uint32_t* offset = &offsets[chunk * WeldShardCount];
+            size_t last = min((chunk + 1) * WeldChunkSize, (size_t) nVertices);
+            for (size_t i = chunk * WeldChunkSize; i < last; i++)
+                order[offset[hashes[i] >> (64 - WeldShardBits)]++] = (uint32_t) i;
+        }
+    });
+
+    pool->parallelFor(WeldShardCount, 1, [&](size_t begin, size_t end)
+    {
+        vector<uint32_t> table;
+        for (size_t shard = begin; shard < end; shard++)
+        {
+            uint32_t first = shardStart[shard];
+            uint32_t count = shardStart[shard + 1] - first;
+            if (count == 0)
+                continue;
+
+            // Open addressing with linear probing, at most half full
+            size_t tableSize = 16;
+            while (tableSize < (size_t) count * 2)
+                tableSize *= 2;
+            size_t mask = tableSize - 1;
+            table.assign(tableSize, NoVertex);
+
+            for (uint32_t k = first; k < first + count; k++)
+            {
+                uint32_t v = order[k];
+                uint64_t h = hashes[v];
+                size_t slot = (size_t) h & mask;
+                for (;;)
+                {
+                    uint32_t other = table[slot];
+                    if (other == NoVertex)
+                    {
+                        table[slot] = v;
+                        representative[v] = v;
+                        break;
+                    }
+                    if (hashes[other] == h && key.equal(other, v))
+                    {
+                        representative[v] = other;
+                        break;
+                    }
+                    slot = (slot + 1) & mask;
+                }
+            }
+        }
+    });
+
+    uint32_t uniqueCount = 0;
+    for (uint32_t i = 0; i < nVertices; i++)
+    {
+        if (representative[i] == i)
+            uniqueCount++;
+    }
+    return uniqueCount;
+}
+
+
+// Replace the vertices of a mesh with the ones listed by newOrder, which
+// gives the old index of each new vertex, and remap the indices.
+void reorderVertices(Mesh& mesh, const vector<uint32_t>& newOrder, const vector<uint32_t>& remap)
+{
+    uint32_t stride = mesh.getVertexStride();
+    const char* oldVertexData = reinterpret_cast<const char*>(mesh.getVertexData());
+    auto* newVertexData = new char[newOrder.size() * stride];
+    for (size_t i = 0; i < newOrder.size(); i++)
+        memcpy(newVertexData + i * stride, oldVertexData + (size_t) newOrder[i] * stride, stride);
+
+    mesh.setVertices((unsigned int) newOrder.size(), newVertexData);
+    mesh.remapIndices(remap);
+}
+} // end unnamed namespace
+
+
+VertexCacheStats
+SimulateVertexCache(const uint32_t* indices,
+                    size_t nIndices,
+                    uint32_t nVertices,
+                    unsigned int cacheSize)
+{
+    VertexCacheStats stats;
+
+    // A vertex is in the cache if fewer than cacheSize vertices were
+    // transformed after it; stamps count transforms starting from 1.
+    vector<uint32_t> stamps(nVertices, 0);
+    for (size_t i = 0; i < nIndices; i++)
+    {
+        uint32_t v = indices[i];
+        if (stamps[v] == 0)
+            stats.vertices++;
+        if (stamps[v] == 0 || stats.transforms - stamps[v] >= cacheSize)
+        {
+            stats.transforms++;
+            stamps[v] = stats.transforms;
+        }
+    }
+    stats.triangles = (uint32_t) (nIndices / 3);
+
+    return stats;
+}
+
+
+void
+OptimizeVertexCache(uint32_t* indices,
+                    size_t nIndices,
+                    uint32_t nVertices,
+                    unsigned int cacheSize)
+{
+    uint32_t nTriangles = (uint32_t) (nIndices / 3);
+    if (nTriangles < 2 || cacheSize < 4)
+        return;
+
+    // List the triangles using each vertex. The lists only keep the
+    // triangles not yet emitted, at the front.
+    vector<uint32_t> valence(nVertices, 0);
+    for (size_t i = 0; i < nTriangles * 3; i++)
+        valence[indices[i]]++;
+    vector<uint32_t> firstTriangle(nVertices + 1);
+    uint32_t total = 0;
+    for (uint32_t v = 0; v < nVertices; v++)
+    {
+        firstTriangle[v] = total;
+        total += valence[v];
+    }
+    firstTriangle[nVertices] = total;
+    vector<uint32_t> vertexTriangles(total);
+    {
+        vector<uint32_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+        for (uint32_t t = 0; t < nTriangles; t++)
+        {
+            for (unsigned int j = 0; j < 3; j++)
+            {
+                uint32_t v = indices[t * 3 + j];
+                vertexTriangles[fill[v]++] = t;
+            }
+        }
+    }
+
+    VertexScorer scorer(cacheSize);
+    vector<int> cachePosition(nVertices, -1);
+    vector<float> vertexScore(nVertices);
+    for (uint32_t v = 0; v < nVertices; v++)
+        vertexScore[v] = scorer.score(-1, valence[v]);
+
+    vector<float> triangleScore(nTriangles);
+    vector<bool> emitted(nTriangles, false);
+    for (uint32_t t = 0; t < nTriangles; t++)
+    {
+        triangleScore[t] = vertexScore[indices[t * 3]] +
+                           vertexScore[indices[t * 3 + 1]] +
+                           vertexScore[indices[t * 3 + 2]];
+    }
+
+    // The simulated LRU cache, with room for the vertices pushed out by a
+    // new triangle
+    vector<uint32_t> cache;
+    vector<uint32_t> newCache;
+    cache.reserve(cacheSize + 3);
+    newCache.reserve(cacheSize + 3);
+
+    vector<uint32_t> output(nTriangles * 3);
+    uint32_t nextUnemitted = 0;
+    uint32_t bestTriangle = NoTriangle;
+    for (uint32_t n = 0; n < nTriangles; n++)
+    {
+        if (bestTriangle == NoTriangle)
+        {
+            // Nothing in the cache is usable; continue with the first
+            // triangle not emitted yet.
+            while (emitted[nextUnemitted])
+                nextUnemitted++;
+            bestTriangle = nextUnemitted;
+        }
+
+        uint32_t t = bestTriangle;
+        const uint32_t* tri = &indices[t * 3];
+        output[n * 3] = tri[0];
+        output[n * 3 + 1] = tri[1];
+        output[n * 3 + 2] = tri[2];
+        emitted[t] = true;
+
+        // Remove the triangle from the lists of its vertices
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            uint32_t v = tri[j];
+            uint32_t* list = &vertexTriangles[firstTriangle[v]];
+            for (uint32_t k = 0; k < valence[v]; k++)
+            {
+                if (list[k] == t)
+                {
+                    list[k] = list[valence[v] - 1];
+                    break;
+                }
+            }
+            valence[v]--;
+        }
+
+        // Move the vertices of the triangle to the front of the cache
+        newCache.clear();
+        newCache.push_back(tri[0]);
+        newCache.push_back(tri[1]);
+        newCache.push_back(tri[2]);
+        for (uint32_t v : cache)
+        {
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                newCache.push_back(v);
+        }
+        cache.swap(newCache);
+
+        // Update the scores of the vertices in the cache, including the ones
+        // falling out of it, and of their remaining triangles.
+        bestTriangle = NoTriangle;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < cache.size(); i++)
+        {
+            uint32_t v = cache[i];
+            int position = i < cacheSize ? (int) i : -1;
+            cachePosition[v] = position;
+            float score = scorer.score(position, valence[v]);
+            float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+
+            const uint32_t* list = &vertexTriangles[firstTriangle[v]];
+            for (uint32_t k = 0; k < valence[v]; k++)
+            {
+                uint32_t other = list[k];
+                triangleScore[other] += delta;
+                if (triangleScore[other] > bestScore)
+                {
+                    bestScore = triangleScore[other];
+                    bestTriangle = other;
+                }
+            }
+        }
+        if (cache.size() > cacheSize)
+            cache.resize(cacheSize);
+    }
+
+    copy(output.begin(), output.end(), indices);
+}
+
+
+uint32_t
+BuildVertexFetchRemap(const uint32_t* indices,
+                      size_t nIndices,
+                      uint32_t nVertices,
+                      vector<uint32_t>& remap)
+{
+    remap.assign(nVertices, NoVertex);
+    uint32_t next = 0;
+    for (size_t i = 0; i < nIndices; i++)
+    {
+        uint32_t v = indices[i];
+        if (remap[v] == NoVertex)
+            remap[v] = next++;
+    }
+
+    return next;
+}
+
+
+uint32_t
+FindIdenticalVertices(const void* vertexData,
+                      uint32_t nVertices,
+                      uint32_t stride,
+                      vector<uint32_t>& representative)
+{
+    VertexKey key { reinterpret_cast<const char*>(vertexData), stride };
+    return weld(key, nVertices, representative);
+}
+
+
+uint32_t
+FindIdenticalPositions(const void* vertexData,
+                       uint32_t nVertices,
+                       uint32_t stride,
+                       uint32_t positionOffset,
+                       vector<uint32_t>& representative)
+{
+    PositionKey key { reinterpret_cast<const char*>(vertexData) + positionOffset, stride };
+    return weld(key, nVertices, representative);
+}
+
+
+VertexCacheStats
+GetVertexCacheStats(const Mesh& mesh, unsigned int cacheSize)
+{
+    VertexCacheStats stats;
+    vector<bool> used(mesh.getVertexCount(), false);
+
+    for (unsigned int i = 0; i < mesh.getGroupCount(); i++)
+    {
+        const Mesh::PrimitiveGroup* group = mesh.getGroup(i);
+        if (group->prim != Mesh::TriList)
+            continue;
+
+        VertexCacheStats groupStats = SimulateVertexCache(group->indices, group->nIndices,
+                                                          mesh.getVertexCount(), cacheSize);
+        stats.triangles += groupStats.triangles;
+        stats.transforms += groupStats.transforms;
+        for (unsigned int j = 0; j < group->nIndices; j++)
+        {
+            if (!used[group->indices[j]])
+            {
+                used[group->indices[j]] = true;
+                stats.vertices++;
+            }
+        }
+    }
+
+    return stats;
+}
+
+
+void
+OptimizeVertexCache(Mesh& mesh, unsigned int cacheSize)
+{
+    // Groups are independent, so they're optimized in parallel
+    vector<Mesh::PrimitiveGroup*> groups;
+    for (unsigned int i = 0; i < mesh.getGroupCount(); i++)
+    {
+        if (mesh.getGroup(i)->prim == Mesh::TriList)
+            groups.push_back(mesh.getGroup(i));
+    }
+
+    uint32_t nVertices = mesh.getVertexCount();
+    GetWorkerPool()->parallelFor(groups.size(), 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+            OptimizeVertexCache(groups[i]->indices, groups[i]->nIndices, nVertices, cacheSize);
+    });
+}
+
+
+void
+OptimizeVertexFetch(Mesh& mesh)
+{
+    uint32_t nVertices = mesh.getVertexCount();
+    vector<uint32_t> remap(nVertices, NoVertex);
+    vector<uint32_t> newOrder;
+    newOrder.reserve(nVertices);
+
+    // Number the vertices across all groups, in drawing order
+    for (unsigned int i = 0; i < mesh.getGroupCount(); i++)
+    {
+        const Mesh::PrimitiveGroup* group = mesh.getGroup(i);
+        for (unsigned int j = 0; j < group->nIndices; j++)
+        {
+            uint32_t v = group->indices[j];
+            if (remap[v] == NoVertex)
+            {
+                remap[v] = (uint32_t) newOrder.size();
+                newOrder.push_back(v);
+            }
+        }
+    }
+
+    reorderVertices(mesh, newOrder, remap);
+}
+
+
+bool
+WeldVertices(Mesh& mesh)
+{
+    uint32_t nVertices = mesh.getVertexCount();
+    if (nVertices == 0 || mesh.getVertexData() == nullptr)
+        return false;
+
+    vector<uint32_t> representative;
+    uint32_t uniqueCount = FindIdenticalVertices(mesh.getVertexData(), nVertices,
+                                                 mesh.getVertexStride(), representative);
+    if (uniqueCount == nVertices)
+        return true;
+
+    // Representatives come before the vertices equal to them
+    vector<uint32_t> remap(nVertices);
+    vector<uint32_t> newOrder;
+    newOrder.reserve(uniqueCount);
+    for (uint32_t i = 0; i < nVertices; i++)
+    {
+        if (representative[i] == i)
+        {
+            remap[i] = (uint32_t) newOrder.size();
+            newOrder.push_back(i);
+        }
+        else
+        {
+            remap[i] = remap[representative[i]];
+        }
+    }
+
+    reorderVertices(mesh, newOrder, remap);
+
+    return true;
+}
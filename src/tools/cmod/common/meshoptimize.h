@@ -0,0 +1,82 @@
+// meshoptimize.h
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Mesh optimizations for the GPU: triangle ordering for the post-transform
+// vertex cache, vertex ordering for fetch locality and welding of identical
+// vertices.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <celmodel/mesh.h>
+
+// Post-transform vertex cache efficiency of a triangle list, measured with
+// a FIFO cache like the one in most GPUs.
+struct VertexCacheStats
+{
+    uint32_t triangles { 0 };
+    uint32_t vertices { 0 };        // distinct vertices referenced
+    uint32_t transforms { 0 };      // cache misses
+
+    // Average cache miss ratio: transformed vertices per triangle. Ranges
+    // from 3 down to about 0.5 for large regular meshes.
+    float acmr() const { return triangles == 0 ? 0.0f : (float) transforms / (float) triangles; }
+    // Average transform to vertex ratio; 1 is optimal.
+    float atvr() const { return vertices == 0 ? 0.0f : (float) transforms / (float) vertices; }
+};
+
+// Simulate a FIFO vertex cache of cacheSize entries over a triangle list.
+extern VertexCacheStats SimulateVertexCache(const uint32_t* indices,
+                                            size_t nIndices,
+                                            uint32_t nVertices,
+                                            unsigned int cacheSize);
+
+// Reorder the triangles of a triangle list in place so that they reuse the
+// vertices transformed for the previous triangles, after Tom Forsyth's
+// "Linear-Speed Vertex Cache Optimisation". The vertices of each triangle
+// keep their order, so the winding is unchanged.
+extern void OptimizeVertexCache(uint32_t* indices,
+                                size_t nIndices,
+                                uint32_t nVertices,
+                                unsigned int cacheSize);
+
+// Number vertices in the order of their first use by the index list, so
+// that vertex fetches go through memory sequentially. Unused vertices map
+// to ~0; returns the number of vertices used.
+extern uint32_t BuildVertexFetchRemap(const uint32_t* indices,
+                                      size_t nIndices,
+                                      uint32_t nVertices,
+                                      std::vector<uint32_t>& remap);
+
+// Find identical vertices with a hash table, in parallel on the worker
+// pool. representative[i] is set to the lowest index of a vertex equal to
+// vertex i; returns the number of distinct vertices. Whole vertices are
+// compared byte by byte, positions by value.
+extern uint32_t FindIdenticalVertices(const void* vertexData,
+                                      uint32_t nVertices,
+                                      uint32_t stride,
+                                      std::vector<uint32_t>& representative);
+extern uint32_t FindIdenticalPositions(const void* vertexData,
+                                       uint32_t nVertices,
+                                       uint32_t stride,
+                                       uint32_t positionOffset,
+                                       std::vector<uint32_t>& representative);
+
+// Mesh operations. Only triangle list groups are reordered; the cache of
+// the statistics is flushed at the start of each group, as for separate
+// draw calls. Fetch optimization drops the vertices not used by any group.
+extern VertexCacheStats GetVertexCacheStats(const cmod::Mesh& mesh, unsigned int cacheSize);
+extern void OptimizeVertexCache(cmod::Mesh& mesh, unsigned int cacheSize);
+extern void OptimizeVertexFetch(cmod::Mesh& mesh);
+
+// Merge identical vertices of a mesh. Unlike the sort based implementation
+// this replaces, the remaining vertices keep their original order.
+extern bool WeldVertices(cmod::Mesh& mesh);
@@ -0,0 +1,403 @@
+// framebench.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Headless benchmark of the CPU side of a Celestia frame. Catalogs are
+// loaded as by CelestiaCore, then an observer path is replayed through a
+// Renderer running only the culling and list building stages of
+// Renderer::draw; none of them touches OpenGL, so the tool works on
+// machines without a GPU. Per-stage timings, object counts and heap
+// allocations are reported as JSON.
+//
+// Observer path files contain one frame per line:
+//     <tdb> <x> <y> <z> <qw> <qx> <qy> <qz> <fov>
+// with the position in light years, the orientation as a quaternion and
+// the vertical field of view in degrees. Lines starting with # are
+// ignored.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <celengine/dsodb.h>
+#include <celengine/observer.h>
+#include <celengine/render.h>
+#include <celengine/solarsys.h>
+#include <celengine/stardb.h>
+#include <celengine/univcoord.h>
+#include <celengine/universe.h>
+#include <celmath/frustum.h>
+#include <celmath/mathlib.h>
+#include <celutil/timer.h>
+#include <celutil/workerpool.h>
+#include <tools/benchcommon/benchutil.h>
+
+using namespace Eigen;
+using namespace std;
+using namespace celmath;
+
+
+// Heap allocation counters; all allocations of the process go through
+// the replaced global operator new below.
+static atomic<uint64_t> allocationCount { 0 };
+static atomic<uint64_t> allocatedBytes { 0 };
+
+void* operator new(size_t size)
+{
+    allocationCount++;
+    allocatedBytes += size;
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+
+static string starDatabaseFile;
+static vector<string> starCatalogFiles;
+static vector<string> dsoCatalogFiles;
+static vector<string> solarSystemFiles;
+static string pathFile;
+static unsigned int nRepeats = 1;
+static float faintestMag = 6.0f;
+static float starImpostorSize = 0.0f;
+static int windowWidth = 1920;
+static int windowHeight = 1080;
+
+
+struct PathFrame
+{
+    double tdb;
+    Vector3d position;
+    Quaternionf orientation;
+    float fov;
+};
+
+
+struct StageStats
+{
+    StageStats(const char* _name) : name(_name) {}
+
+    const char* name;
+    double totalTime { 0.0 };
+    double maxTime   { 0.0 };
+    uint64_t objects { 0 };
+    uint64_t allocations { 0 };
+    uint64_t bytes   { 0 };
+};
+
+
+// Measures one stage of one frame and accumulates the results.
+class StageTimer
+{
+ public:
+    StageTimer(StageStats& _stats) :
+        stats(_stats),
+        allocs0(allocationCount),
+        bytes0(allocatedBytes)
+    {
+    }
+
+    void stop(uint64_t objects)
+    {
+        double t = timer.getTime();
+        stats.totalTime += t;
+        stats.maxTime = max(stats.maxTime, t);
+        stats.objects += objects;
+        stats.allocations += allocationCount - allocs0;
+        stats.bytes += allocatedBytes - bytes0;
+    }
+
+ private:
+    StageStats& stats;
+    uint64_t allocs0;
+    uint64_t bytes0;
+    Timer timer;
+};
+
+
+static bool readPath(const string& filename, vector<PathFrame>& frames)
+{
+    ifstream in(filename);
+    if (!in.good())
+    {
+        cerr << "Error opening path file " << filename << '\n';
+        return false;
+    }
+
+    string line;
+    unsigned int lineNumber = 0;
+    while (getline(in, line))
+    {
+        lineNumber++;
+        auto first = line.find_first_not_of(" \t\r");
+        if (first == string::npos || line[first] == '#')
+            continue;
+
+        PathFrame frame;
+        double x, y, z;
+        float qw, qx, qy, qz;
+        if (sscanf(line.c_str(), "%lf %lf %lf %lf %f %f %f %f %f",
+                   &frame.tdb, &x, &y, &z, &qw, &qx, &qy, &qz, &frame.fov) != 9)
+        {
+            cerr << filename << ':' << lineNumber << ": bad path frame\n";
+            return false;
+        }
+        frame.position = Vector3d(x, y, z);
+        frame.orientation = Quaternionf(qw, qx, qy, qz).normalized();
+        frames.push_back(frame);
+    }
+
+    if (frames.empty())
+    {
+        cerr << "Path file " << filename << " contains no frames\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+static bool loadCatalogs(Universe& universe)
+{
+    auto* starDB = new StarDatabase();
+    if (!starDatabaseFile.empty())
+    {
+        ifstream starFile(starDatabaseFile, ios::in | ios::binary);
+        if (!starFile.good() || !starDB->loadBinary(starFile))
+        {
+            cerr << "Error reading star database " << starDatabaseFile << '\n';
+            return false;
+        }
+    }
+    starDB->setNameDatabase(new StarNameDatabase());
+
+    for (const auto& file : starCatalogFiles)
+    {
+        ifstream starFile(file, ios::in);
+        if (!starFile.good() || !starDB->load(starFile))
+            cerr << "Error reading star catalog " << file << '\n';
+    }
+    starDB->finish();
+    universe.setStarCatalog(starDB);
+
+    auto* dsoDB = new DSODatabase();
+    dsoDB->setNameDatabase(new DSONameDatabase());
+    for (const auto& file : dsoCatalogFiles)
+    {
+        ifstream dsoFile(file, ios::in);
+        if (!dsoFile.good() || !dsoDB->load(dsoFile, ""))
+            cerr << "Error reading deep sky catalog " << file << '\n';
+    }
+    dsoDB->finish();
+    universe.setDSOCatalog(dsoDB);
+
+    universe.setSolarSystemCatalog(new SolarSystemCatalog());
+    for (const auto& file : solarSystemFiles)
+    {
+        ifstream solarSysFile(file, ios::in);
+        if (!solarSysFile.good() ||
+            !LoadSolarSystemObjects(solarSysFile, universe, fs::path(file).parent_path()))
+        {
+            cerr << "Error reading solar system catalog " << file << '\n';
+        }
+    }
+
+    return true;
+}
+
+
+static void runBenchmark(const Universe& universe,
+                         const vector<PathFrame>& path,
+                         vector<StageStats>& stages,
+                         vector<double>& frameTimes)
+{
+    enum { CloseStars, SolarSystems, Orbits, Labels, VisibleDSOs, VisibleStars, StageCount };
+    stages = { { "closeStars" }, { "solarSystems" }, { "orbits" }, { "labels" },
+               { "visibleDSOs" }, { "visibleStars" } };
+
+    // The renderer keeps its per-frame containers between frames, so
+    // allocations only show up when they grow.
+    Renderer renderer;
+    renderer.resize(windowWidth, windowHeight);
+    renderer.setRenderFlags((Renderer::DefaultRenderFlags | Renderer::ShowOrbits) & ~Renderer::ShowAutoMag);
+    renderer.setLabelMode(Renderer::StarLabels | Renderer::BodyLabelMask);
+    renderer.setStarImpostorSize(starImpostorSize);
+
+    Observer observer;
+    Selection selection;
+
+    for (unsigned int repeat = 0; repeat < nRepeats; repeat++)
+    {
+        for (const auto& frame : path)
+        {
+            observer.setTime(frame.tdb);
+            observer.setPosition(UniversalCoord::CreateLy(frame.position));
+            observer.setOrientation(frame.orientation);
+            observer.setFOV(degToRad(frame.fov));
+
+            Timer frameTimer;
+            Frustum xfrustum = renderer.beginFrame(observer, faintestMag, selection);
+
+            {
+                StageTimer timer(stages[CloseStars]);
+                timer.stop(renderer.findNearStars(universe, observer));
+            }
+
+            {
+                StageTimer timer(stages[SolarSystems]);
+                timer.stop(renderer.buildSolarSystemRenderLists(universe, observer, xfrustum));
+            }
+
+            {
+                StageTimer timer(stages[Orbits]);
+                timer.stop(renderer.buildSolarSystemOrbitLists(universe, observer, xfrustum));
+            }
+
+            {
+                StageTimer timer(stages[Labels]);
+                timer.stop(renderer.buildLabelLists(xfrustum, frame.tdb));
+            }
+
+            renderer.setupStarBrightness(frame.tdb);
+
+            {
+                StageTimer timer(stages[VisibleDSOs]);
+                timer.stop(renderer.cullDeepSkyObjects(universe, observer, faintestMag));
+            }
+
+            {
+                StageTimer timer(stages[VisibleStars]);
+                timer.stop(renderer.cullPointStars(*universe.getStarCatalog(), faintestMag, observer));
+            }
+
+            frameTimes.push_back(frameTimer.getTime());
+        }
+    }
+}
+
+
+static void writeReport(JsonWriter& out,
+                        const Universe& universe,
+                        const vector<StageStats>& stages,
+                        const vector<double>& frameTimes)
+{
+    size_t nFrames = frameTimes.size();
+    double total = 0.0;
+    for (double t : frameTimes)
+        total += t;
+
+    vector<double> sorted = frameTimes;
+    sort(sorted.begin(), sorted.end());
+
+    out.beginObject();
+    out.value("frames", (uint64_t) nFrames);
+    out.value("threads", GetWorkerPool()->getConcurrency());
+    out.beginObject("catalogs", true);
+    out.value("stars", universe.getStarCatalog()->size());
+    out.value("dsos", universe.getDSOCatalog()->size());
+    out.value("solarSystems", (uint64_t) universe.getSolarSystemCatalog()->size());
+    out.endObject();
+    out.beginObject("frameTimeMs", true);
+    out.value("mean", 1000.0 * total / nFrames, 4);
+    out.value("median", 1000.0 * sorted[nFrames / 2], 4);
+    out.value("p95", 1000.0 * sorted[min(nFrames - 1, nFrames * 95 / 100)], 4);
+    out.value("max", 1000.0 * sorted.back(), 4);
+    out.endObject();
+    out.beginObject("stages");
+    for (const StageStats& s : stages)
+    {
+        out.beginObject(s.name, true);
+        out.value("meanMs", 1000.0 * s.totalTime / nFrames, 4);
+        out.value("maxMs", 1000.0 * s.maxTime, 4);
+        out.value("objectsPerFrame", (double) s.objects / nFrames, 1);
+        out.value("allocationsPerFrame", (double) s.allocations / nFrames, 1);
+        out.value("allocatedBytesPerFrame", (double) s.bytes / nFrames, 1);
+        out.endObject();
+    }
+    out.endObject();
+    out.endObject();
+}
+
+
+int main(int argc, char* argv[])
+{
+    BenchCommandLine commandLine("framebench", "<observer path file>");
+    commandLine.add("--stars <file>", "binary star database (stars.dat)", &starDatabaseFile);
+    commandLine.add("--stc <file>", "star catalog, may be repeated", &starCatalogFiles);
+    commandLine.add("--dsc <file>", "deep sky catalog, may be repeated", &dsoCatalogFiles);
+    commandLine.add("--ssc <file>", "solar system catalog, may be repeated", &solarSystemFiles);
+    commandLine.add("--repeat <n>", "replay the path n times", &nRepeats);
+    commandLine.add("--mag <m>", "faintest visible magnitude (default 6)", &faintestMag);
+    commandLine.add("--size <w> <h>", "window size in pixels (default 1920 1080)", 2, [](char** values)
+                    {
+                        windowWidth = max(atoi(values[0]), 1);
+                        windowHeight = max(atoi(values[1]), 1);
+                    });
+    commandLine.add("--impostors <pixels>", "merge star octree nodes smaller than this", &starImpostorSize);
+    commandLine.setArgument(&pathFile);
+    if (!commandLine.parse(argc, argv))
+        return 1;
+    starImpostorSize = max(starImpostorSize, 0.0f);
+
+    vector<PathFrame> path;
+    if (!readPath(pathFile, path))
+        return 1;
+
+    InitWorkerPool(commandLine.threads);
+
+    Universe universe;
+    Timer loadTimer;
+    if (!loadCatalogs(universe))
+        return 1;
+    clog << "Catalogs loaded in " << loadTimer.getTime() << " s\n";
+
+    vector<StageStats> stages;
+    vector<double> frameTimes;
+    runBenchmark(universe, path, stages, frameTimes);
+
+    bool written = WriteBenchReport(commandLine.outputFile, [&](JsonWriter& out)
+    {
+        writeReport(out, universe, stages, frameTimes);
+    });
+
+    return written ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+// motionbench.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Benchmark of star motion. A synthetic catalog of stars with proper
+// motions and radial velocities is loaded, then the stars are moved to
+// a series of times, and visibility queries are timed at several times
+// to show the cost of the octree node bounds growing with the time from
+// the catalog epoch. The results are reported as JSON.
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fmt/format.h>
+#include <celengine/astro.h>
+#include <celengine/stardb.h>
+#include <celutil/timer.h>
+#include <celutil/workerpool.h>
+#include <tools/benchcommon/benchutil.h>
+
+using namespace Eigen;
+using namespace std;
+
+static unsigned int nStars = 1000000;
+static unsigned int nRuns = 20;
+
+// Number of views each query measurement is averaged over
+static const int nViews = 20;
+
+
+struct QueryResult
+{
+    double years;
+    double secondsPerQuery;
+    size_t starsPerQuery;
+};
+
+
+// Stars within a few thousand light years, as in the Hipparcos and Gaia
+// catalogs, with the velocity dispersion of the disk.
+static string createCatalog()
+{
+    mt19937 gen(2020);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    exponential_distribution<double> distance(1.0 / 1000.0);
+    normal_distribution<double> properMotion(0.0, 50.0);
+    normal_distribution<double> radialVelocity(0.0, 30.0);
+
+    string stc;
+    for (unsigned int i = 0; i < nStars; i++)
+    {
+        double d = 1.0 + distance(gen);
+        // Velocities of tens of km/s appear as proper motions
+        // decreasing with distance.
+        double scale = 1000.0 / d;
+        stc += fmt::format("{} {{ RA {:.6f} Dec {:.6f} Distance {:.4f} SpectralType \"G2V\" AbsMag {:.2f} "
+                           "ProperMotionRA {:.3f} ProperMotionDec {:.3f} RadialVelocity {:.2f} }}\n",
+                           i + 1,
+                           unit(gen) * 360.0,
+                           asin(unit(gen) * 2.0 - 1.0) * 180.0 / PI,
+                           d,
+                           -5.0 + unit(gen) * 21.0,
+                           properMotion(gen) * scale,
+                           properMotion(gen) * scale,
+                           radialVelocity(gen));
+    }
+    return stc;
+}
+
+
+static QueryResult measureQueries(StarDatabase& db, double years)
+{
+    db.setTime(astro::J2000 + years * DAYS_PER_YEAR);
+
+    mt19937 gen(50);
+    normal_distribution<float> normal;
+    StarCounter counter;
+    double time = 0.0;
+    for (int i = 0; i < nViews; i++)
+    {
+        Quaternionf orientation(normal(gen), normal(gen), normal(gen), normal(gen));
+        orientation.normalize();
+        Vector3f position = Vector3f(normal(gen), normal(gen), normal(gen)) * 10.0f;
+
+        Timer timer;
+        db.findVisibleStars(counter, position, orientation, 0.8f, 1.5f, 8.0f);
+        time += timer.getTime();
+    }
+
+    return { years, time / nViews, counter.count / nViews };
+}
+
+
+static void writeReport(JsonWriter& out,
+                        size_t nMovingStars,
+                        double bestPropagation,
+                        const vector<QueryResult>& queries)
+{
+    out.beginObject();
+    out.value("stars", nStars);
+    out.value("movingStars", (uint64_t) nMovingStars);
+    out.value("runs", nRuns);
+    out.value("threads", GetWorkerPool()->getConcurrency());
+    out.beginObject("propagation", true);
+    out.value("seconds", bestPropagation, 5);
+    out.value("starsPerSecond", nMovingStars / bestPropagation, 0);
+    out.endObject();
+    out.beginArray("queries");
+    for (const QueryResult& r : queries)
+    {
+        out.beginObject(nullptr, true);
+        out.value("years", r.years, 0);
+        out.value("msPerQuery", r.secondsPerQuery * 1000.0, 4);
+        out.value("starsPerQuery", (uint64_t) r.starsPerQuery);
+        out.endObject();
+    }
+    out.endArray();
+    out.endObject();
+}
+
+
+int main(int argc, char* argv[])
+{
+    BenchCommandLine commandLine("motionbench");
+    commandLine.add("--stars <n>", "number of stars in the catalog (default 1000000)", &nStars);
+    commandLine.add("--runs <n>", "propagations, the best time is reported (default 20)", &nRuns);
+    if (!commandLine.parse(argc, argv))
+        return 1;
+
+    InitWorkerPool(commandLine.threads);
+
+    StarDatabase db;
+    db.setNameDatabase(new StarNameDatabase());
+    {
+        istringstream in(createCatalog());
+        if (!db.load(in))
+        {
+            cerr << "Error loading the generated star catalog\n";
+            return 1;
+        }
+    }
+    db.finish();
+
+    // Every run moves the stars to a different time
+    double bestPropagation = 1.0e30;
+    for (unsigned int run = 0; run < nRuns; run++)
+    {
+        Timer timer;
+        db.setTime(astro::J2000 + (run + 1) * 10.0 * DAYS_PER_YEAR);
+        bestPropagation = min(bestPropagation, timer.getTime());
+    }
+
+    vector<QueryResult> queries;
+    for (double years : { 0.0, 100.0, 1000.0, 10000.0, 100000.0 })
+        queries.push_back(measureQueries(db, years));
+
+    bool written = WriteBenchReport(commandLine.outputFile, [&](JsonWriter& out)
+    {
+        writeReport(out, db.getMovingStarCount(), bestPropagation, queries);
+    });
+
+    return written ? 0 : 1;
+}
@@ -0,0 +1,177 @@
+// octreebench.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Benchmark of star octree construction. A synthetic catalog shaped like
+// a galactic disk with a halo is sorted into an octree both by inserting
+// the stars into a DynamicOctree one at a time, as the star database used
+// to, and with the parallel OctreeBuilder. Build times and the shapes of
+// the resulting trees are reported as JSON.
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+#include <celengine/astro.h>
+#include <celengine/octreebuilder.h>
+#include <celengine/staroctree.h>
+#include <celutil/timer.h>
+#include <celutil/workerpool.h>
+#include <tools/benchcommon/benchutil.h>
+
+using namespace Eigen;
+using namespace std;
+
+static unsigned int nStars = 2000000;
+static unsigned int nRuns = 3;
+
+// Same parameters as the star database
+static const float RootSize = 1.0e9f;
+static const Vector3f RootCenter(1000.0f, 1000.0f, 1000.0f);
+
+
+struct BuildResult
+{
+    double bestTime { 1.0e30 };
+    int nodes { 0 };
+    int objects { 0 };
+};
+
+
+static void createStars(vector<Star>& stars, StarDetails* details, StarDetails* binaryDetails)
+{
+    mt19937 gen(2020);
+    normal_distribution<float> normal;
+    exponential_distribution<float> diskRadius(1.0f / 10000.0f);
+    uniform_real_distribution<float> angle(0.0f, 2.0f * (float) PI);
+    uniform_real_distribution<float> absMag(-5.0f, 16.0f);
+    uniform_int_distribution<int> kind(0, 99);
+
+    // The observer is in the disk, 26000 ly from the galactic center
+    Vector3f galacticCenter(26000.0f, 0.0f, 0.0f);
+
+    stars.resize(nStars);
+    for (auto& star : stars)
+    {
+        int k = kind(gen);
+        Vector3f position;
+        if (k < 90)
+        {
+            float r = diskRadius(gen);
+            float theta = angle(gen);
+            position = galacticCenter + Vector3f(r * cos(theta), r * sin(theta), normal(gen) * 300.0f);
+        }
+        else
+        {
+            position = galacticCenter + Vector3f(normal(gen), normal(gen), normal(gen)) * 20000.0f;
+        }
+        star.setPosition(position);
+        star.setAbsoluteMagnitude(absMag(gen));
+        star.setDetails(k == 0 ? binaryDetails : details);
+    }
+}
+
+
+static void buildDynamic(const vector<Star>& stars, float absMag, BuildResult& result)
+{
+    unique_ptr<Star[]> sortedStars(new Star[stars.size()]);
+
+    Timer timer;
+    unique_ptr<DynamicStarOctree> root(new DynamicStarOctree(RootCenter, absMag));
+    for (const auto& star : stars)
+        root->insertObject(star, RootSize);
+    Star* firstStar = sortedStars.get();
+    StarOctree* octreeRoot = nullptr;
+    root->rebuildAndSort(octreeRoot, firstStar);
+    root.reset();
+    result.bestTime = min(result.bestTime, timer.getTime());
+
+    result.nodes = 1 + octreeRoot->countChildren();
+    result.objects = octreeRoot->countObjects();
+    delete octreeRoot;
+}
+
+
+static void buildParallel(vector<Star>& stars, float absMag, BuildResult& result)
+{
+    unique_ptr<Star[]> sortedStars(new Star[stars.size()]);
+
+    Timer timer;
+    StarOctree* octreeRoot = OctreeBuilder<Star, float>::build(stars,
+                                                               stars.size(),
+                                                               sortedStars.get(),
+                                                               RootCenter,
+                                                               RootSize,
+                                                               absMag);
+    result.bestTime = min(result.bestTime, timer.getTime());
+
+    result.nodes = 1 + octreeRoot->countChildren();
+    result.objects = octreeRoot->countObjects();
+    delete octreeRoot;
+}
+
+
+static void writeResult(JsonWriter& out, const char* name, const BuildResult& r)
+{
+    out.beginObject(name, true);
+    out.value("seconds", r.bestTime, 4);
+    out.value("starsPerSecond", nStars / r.bestTime, 0);
+    out.value("nodes", r.nodes);
+    out.value("stars", r.objects);
+    out.endObject();
+}
+
+
+static void writeReport(JsonWriter& out, const BuildResult& dynamic, const BuildResult& parallel)
+{
+    out.beginObject();
+    out.value("stars", nStars);
+    out.value("runs", nRuns);
+    out.value("threads", GetWorkerPool()->getConcurrency());
+    out.beginObject("builders");
+    writeResult(out, "dynamic", dynamic);
+    writeResult(out, "parallel", parallel);
+    out.endObject();
+    out.value("speedup", dynamic.bestTime / parallel.bestTime, 2);
+    out.endObject();
+}
+
+
+int main(int argc, char* argv[])
+{
+    BenchCommandLine commandLine("octreebench");
+    commandLine.add("--stars <n>", "number of stars in the catalog (default 2000000)", &nStars);
+    commandLine.add("--runs <n>", "builds per method, the best time is reported (default 3)", &nRuns);
+    if (!commandLine.parse(argc, argv))
+        return 1;
+
+    InitWorkerPool(commandLine.threads);
+
+    StarDetails details;
+    StarDetails binaryDetails;
+    binaryDetails.setOrbitalRadius(1.0f);
+    vector<Star> stars;
+    createStars(stars, &details, &binaryDetails);
+
+    float absMag = astro::appToAbsMag(6.0f, RootSize * (float) sqrt(3.0));
+    BuildResult dynamic;
+    BuildResult parallel;
+    for (unsigned int run = 0; run < nRuns; run++)
+    {
+        buildDynamic(stars, absMag, dynamic);
+        buildParallel(stars, absMag, parallel);
+    }
+
+    bool written = WriteBenchReport(commandLine.outputFile, [&](JsonWriter& out)
+    {
+        writeReport(out, dynamic, parallel);
+    });
+
+    return written ? 0 : 1;
+}
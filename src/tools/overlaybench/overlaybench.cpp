@@ -0,0 +1,234 @@
+// overlaybench.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Benchmark of stars added to a loaded star database. Stars are added one
+// at a time without merging, and the cost of a visibility query is
+// measured at several sizes of the unmerged overlay. Finally the overlay
+// is merged into an octree in the background, and the merge and the
+// queries after it are timed too. The results are reported as JSON.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <celengine/stardb.h>
+#include <celengine/stellarclass.h>
+#include <celutil/timer.h>
+#include <celutil/workerpool.h>
+#include <tools/benchcommon/benchutil.h>
+
+using namespace Eigen;
+using namespace std;
+
+static unsigned int nStars = 1000000;
+static unsigned int nAddedStars = 65536;
+
+// Number of views each query measurement is averaged over
+static const int nViews = 20;
+
+
+struct View
+{
+    Vector3f position;
+    Quaternionf orientation;
+};
+
+
+struct QueryResult
+{
+    size_t unmergedStars;
+    double secondsPerQuery;
+    size_t starsPerQuery;
+};
+
+
+// The stars are shaped like a galactic disk with a halo, as in octreebench
+static void createStar(mt19937& gen, Vector3f& position, float& absMag)
+{
+    normal_distribution<float> normal;
+    exponential_distribution<float> diskRadius(1.0f / 10000.0f);
+    uniform_real_distribution<float> angle(0.0f, 2.0f * (float) PI);
+    uniform_real_distribution<float> magnitude(-5.0f, 16.0f);
+    uniform_int_distribution<int> kind(0, 9);
+
+    Vector3f galacticCenter(26000.0f, 0.0f, 0.0f);
+    if (kind(gen) != 0)
+    {
+        float r = diskRadius(gen);
+        float theta = angle(gen);
+        position = galacticCenter + Vector3f(r * cos(theta), r * sin(theta), normal(gen) * 300.0f);
+    }
+    else
+    {
+        position = galacticCenter + Vector3f(normal(gen), normal(gen), normal(gen)) * 20000.0f;
+    }
+    absMag = magnitude(gen);
+}
+
+
+static string createStarFile(mt19937& gen)
+{
+    uint16_t spectralType = StellarClass(StellarClass::NormalStar,
+                                         StellarClass::Spectral_G,
+                                         2,
+                                         StellarClass::Lum_V).packV1();
+
+    ostringstream out;
+    uint16_t version = 0x0100;
+    out.write("CELSTARS", 8);
+    out.write((const char*) &version, sizeof version);
+    out.write((const char*) &nStars, sizeof nStars);
+    for (uint32_t catalogNumber = 1; catalogNumber <= nStars; catalogNumber++)
+    {
+        Vector3f position;
+        float absMag;
+        createStar(gen, position, absMag);
+        int16_t packedMag = (int16_t) (absMag * 256.0f);
+        out.write((const char*) &catalogNumber, sizeof catalogNumber);
+        out.write((const char*) position.data(), 3 * sizeof(float));
+        out.write((const char*) &packedMag, sizeof packedMag);
+        out.write((const char*) &spectralType, sizeof spectralType);
+    }
+    return out.str();
+}
+
+
+static QueryResult measureQueries(const StarDatabase& db, const vector<View>& views)
+{
+    StarCounter counter;
+    Timer timer;
+    for (const auto& view : views)
+        db.findVisibleStars(counter, view.position, view.orientation, 0.8f, 1.5f, 8.0f);
+
+    return { db.getUnmergedStarCount(), timer.getTime() / views.size(), counter.count / views.size() };
+}
+
+
+static void writeQueries(JsonWriter& out, const char* name, const vector<QueryResult>& results)
+{
+    out.beginArray(name);
+    for (const QueryResult& r : results)
+    {
+        out.beginObject(nullptr, true);
+        out.value("unmergedStars", (uint64_t) r.unmergedStars);
+        out.value("msPerQuery", r.secondsPerQuery * 1000.0, 4);
+        out.value("starsPerQuery", (uint64_t) r.starsPerQuery);
+        out.endObject();
+    }
+    out.endArray();
+}
+
+
+static void writeReport(JsonWriter& out,
+                        double meanInsert,
+                        double maxInsert,
+                        const vector<QueryResult>& queries,
+                        double mergeTime,
+                        const QueryResult& merged)
+{
+    out.beginObject();
+    out.value("stars", nStars);
+    out.value("addedStars", nAddedStars);
+    out.value("threads", GetWorkerPool()->getConcurrency());
+    out.beginObject("insertMicroseconds", true);
+    out.value("mean", meanInsert * 1.0e6, 3);
+    out.value("max", maxInsert * 1.0e6, 3);
+    out.endObject();
+    writeQueries(out, "queries", queries);
+    out.value("mergeSeconds", mergeTime, 4);
+    writeQueries(out, "queriesAfterMerge", { merged });
+    out.endObject();
+}
+
+
+int main(int argc, char* argv[])
+{
+    BenchCommandLine commandLine("overlaybench");
+    commandLine.add("--stars <n>", "number of stars in the catalog (default 1000000)", &nStars);
+    commandLine.add("--added <n>", "number of stars added after loading (default 65536)", &nAddedStars);
+    if (!commandLine.parse(argc, argv))
+        return 1;
+
+    InitWorkerPool(commandLine.threads);
+
+    mt19937 gen(2020);
+    StarDatabase db;
+    {
+        istringstream in(createStarFile(gen));
+        if (!db.loadBinary(in))
+        {
+            cerr << "Error loading the generated star database\n";
+            return 1;
+        }
+    }
+    db.finish();
+
+    // Observers in the disk looking in random directions
+    vector<View> views;
+    normal_distribution<float> normal;
+    for (int i = 0; i < nViews; i++)
+    {
+        Quaternionf orientation(normal(gen), normal(gen), normal(gen), normal(gen));
+        orientation.normalize();
+        views.push_back({ Vector3f(normal(gen), normal(gen), normal(gen)) * 100.0f, orientation });
+    }
+
+    vector<QueryResult> queries;
+    queries.push_back(measureQueries(db, views));
+
+    // The overlay isn't merged while the stars are added, as update() is
+    // never called.
+    StarDetails* details = StarDetails::GetStarDetails(StellarClass(StellarClass::NormalStar,
+                                                                    StellarClass::Spectral_G,
+                                                                    2,
+                                                                    StellarClass::Lum_V));
+    double totalInsert = 0.0;
+    double maxInsert = 0.0;
+    unsigned int nextMeasurement = 1024;
+    for (unsigned int i = 1; i <= nAddedStars; i++)
+    {
+        Vector3f position;
+        float absMag;
+        createStar(gen, position, absMag);
+        Star star;
+        star.setPosition(position);
+        star.setAbsoluteMagnitude(absMag);
+        star.setDetails(details);
+        star.setIndex(AstroCatalog::InvalidIndex);
+
+        Timer timer;
+        db.addStar(star);
+        double t = timer.getTime();
+        totalInsert += t;
+        maxInsert = max(maxInsert, t);
+
+        if (i == nextMeasurement || i == nAddedStars)
+        {
+            queries.push_back(measureQueries(db, views));
+            nextMeasurement *= 4;
+        }
+    }
+
+    Timer mergeTimer;
+    db.update();
+    db.update(true);
+    double mergeTime = mergeTimer.getTime();
+    QueryResult merged = measureQueries(db, views);
+
+    bool written = WriteBenchReport(commandLine.outputFile, [&](JsonWriter& out)
+    {
+        writeReport(out, totalInsert / nAddedStars, maxInsert, queries, mergeTime, merged);
+    });
+
+    return written ? 0 : 1;
+}
@@ -0,0 +1,256 @@
+// particlebench.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Headless benchmark of the particle system emitter kernel. A few typical
+// emitters are evaluated over a sequence of frames, both with
+// GenerateParticles and with a scalar loop that generates one particle at
+// a time like the old renderer did. Particle rates and the largest
+// difference between the two paths are reported as JSON. No OpenGL
+// context is needed.
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <Eigen/Core>
+#include <celengine/particlekernel.h>
+#include <celmath/mathlib.h>
+#include <celutil/timer.h>
+#include <celutil/workerpool.h>
+#include <tools/benchcommon/benchutil.h>
+
+using namespace Eigen;
+using namespace std;
+
+static float emissionRate = 20000.0f;
+static float lifetime = 5.0f;
+static unsigned int nFrames = 120;
+
+static const uint64_t scrambleMask = (uint64_t(0xcccccccc) << 32) | 0xcccccccc;
+
+
+struct BenchEmitter
+{
+    const char* name;
+    ParticleEmitterParams params;
+    unique_ptr<VectorGenerator> positionGenerator;
+    unique_ptr<VectorGenerator> velocityGenerator;
+};
+
+
+struct BenchResult
+{
+    const char* name;
+    uint64_t particles { 0 };
+    double kernelTime { 0.0 };
+    double scalarTime { 0.0 };
+    float maxError { 0.0f };
+};
+
+
+static ParticleEmitterParams defaultParams()
+{
+    ParticleEmitterParams params;
+    params.startTime = -numeric_limits<double>::infinity();
+    params.endTime = numeric_limits<double>::infinity();
+    params.rate = emissionRate;
+    params.lifetime = lifetime;
+    params.startColor = Color(1.0f, 0.9f, 0.7f, 1.0f);
+    params.startSize = 1.0f;
+    params.endColor = Color(0.5f, 0.5f, 1.0f, 0.0f);
+    params.endSize = 10.0f;
+    params.positionGenerator = nullptr;
+    params.velocityGenerator = nullptr;
+    params.acceleration = Vector3f::Zero();
+    params.nonZeroAcceleration = false;
+    params.minRotationRate = 0.0f;
+    params.rotationRateVariance = 0.0f;
+    params.rotationEnabled = false;
+    return params;
+}
+
+
+static void addEmitter(vector<BenchEmitter>& emitters,
+                       const char* name,
+                       VectorGenerator* positionGenerator,
+                       VectorGenerator* velocityGenerator)
+{
+    emitters.emplace_back();
+    BenchEmitter& e = emitters.back();
+    e.name = name;
+    e.params = defaultParams();
+    e.positionGenerator.reset(positionGenerator);
+    e.velocityGenerator.reset(velocityGenerator);
+    e.params.positionGenerator = positionGenerator;
+    e.params.velocityGenerator = velocityGenerator;
+}
+
+
+static void createEmitters(vector<BenchEmitter>& emitters)
+{
+    // Dust from a box shaped region with box distributed velocities
+    addEmitter(emitters, "box",
+               new BoxGenerator(Vector3f::Zero(), Vector3f(2.0f, 2.0f, 2.0f)),
+               new BoxGenerator(Vector3f(0.0f, 0.0f, 1.0f), Vector3f(0.2f, 0.2f, 0.2f)));
+
+    // Comet tail: particles leave the nucleus surface and are pushed away
+    addEmitter(emitters, "comet",
+               new EllipsoidSurfaceGenerator(Vector3f::Zero(), Vector3f(1.0f, 1.0f, 1.0f)),
+               new LineGenerator(Vector3f(0.0f, 0.0f, 0.1f), Vector3f(0.0f, 0.0f, 0.5f)));
+    emitters.back().params.acceleration = Vector3f(0.0f, 0.0f, 0.2f);
+    emitters.back().params.nonZeroAcceleration = true;
+
+    // Rotating particles of a jet leaving a point
+    addEmitter(emitters, "jet",
+               new ConstantGenerator(Vector3f::Zero()),
+               new ConeGenerator(0.0f, (float) celmath::degToRad(10.0), 1.0f, 2.0f));
+    emitters.back().params.minRotationRate = -1.0f;
+    emitters.back().params.rotationRateVariance = 2.0f;
+    emitters.back().params.rotationEnabled = true;
+}
+
+
+// Particle generation as done per particle by the old emitter renderer
+static unsigned int generateScalar(const ParticleEmitterParams& emitter,
+                                   double tsec,
+                                   ParticleArrays& particles)
+{
+    double emissionInterval = 1.0 / emitter.rate;
+    double dserial = std::fmod(tsec * emitter.rate, 2147483648.0);
+    auto serial = (int) dserial;
+    double age0 = (dserial - serial) * emissionInterval;
+    auto invLifetime = (float) (1.0 / emitter.lifetime);
+
+    unsigned int n = 0;
+    for (double age = age0; age < emitter.lifetime; age = age0 + n * emissionInterval)
+    {
+        particles.resize(n + 1);
+
+        float alpha = (float) age * invLifetime;
+        float beta = 1.0f - alpha;
+        LCGRandomGenerator gen(uint64_t(serial) * uint64_t(0x128ef719) ^ scrambleMask);
+
+        Vector3f v = emitter.velocityGenerator->generate(gen);
+        Vector3f center = emitter.positionGenerator->generate(gen) + v * (float) age;
+        if (emitter.nonZeroAcceleration)
+            center += emitter.acceleration * (float) (age * age);
+
+        particles.x[n] = center.x();
+        particles.y[n] = center.y();
+        particles.z[n] = center.z();
+        particles.size[n] = alpha * emitter.endSize + beta * emitter.startSize;
+        particles.color[n * 4 + 3] = (unsigned char) ((alpha * emitter.endColor.alpha() +
+                                                       beta * emitter.startColor.alpha()) * 255.99f);
+        if (emitter.rotationEnabled)
+        {
+            float rotationRate = emitter.minRotationRate + emitter.rotationRateVariance * gen.randFloat();
+            particles.rotation[n] = rotationRate * (float) age;
+        }
+
+        n++;
+        serial--;
+    }
+
+    return n;
+}
+
+
+static void runBenchmark(const BenchEmitter& emitter, BenchResult& result)
+{
+    ParticleArrays kernelParticles;
+    ParticleArrays scalarParticles;
+
+    for (unsigned int frame = 0; frame < nFrames; frame++)
+    {
+        double tsec = 1000.0 + frame / 60.0;
+
+        Timer kernelTimer;
+        unsigned int n = GenerateParticles(emitter.params, tsec, kernelParticles);
+        result.kernelTime += kernelTimer.getTime();
+
+        Timer scalarTimer;
+        unsigned int nScalar = generateScalar(emitter.params, tsec, scalarParticles);
+        result.scalarTime += scalarTimer.getTime();
+
+        result.particles += n;
+        if (n != nScalar)
+        {
+            result.maxError = numeric_limits<float>::infinity();
+            continue;
+        }
+
+        for (unsigned int i = 0; i < n; i++)
+        {
+            Vector3f d(kernelParticles.x[i] - scalarParticles.x[i],
+                       kernelParticles.y[i] - scalarParticles.y[i],
+                       kernelParticles.z[i] - scalarParticles.z[i]);
+            result.maxError = max(result.maxError, d.norm());
+        }
+    }
+}
+
+
+static void writeReport(JsonWriter& out, const vector<BenchResult>& results)
+{
+    out.beginObject();
+    out.value("frames", nFrames);
+    out.value("threads", GetWorkerPool()->getConcurrency());
+    out.value("rate", emissionRate, 1);
+    out.value("lifetime", lifetime, 3);
+    out.beginObject("emitters");
+    for (const BenchResult& r : results)
+    {
+        out.beginObject(r.name, true);
+        out.value("particlesPerFrame", (double) r.particles / nFrames, 1);
+        out.value("kernelParticlesPerSecond", r.particles / r.kernelTime, 0);
+        out.value("scalarParticlesPerSecond", r.particles / r.scalarTime, 0);
+        out.value("speedup", r.scalarTime / r.kernelTime, 2);
+        out.value("maxError", r.maxError);
+        out.endObject();
+    }
+    out.endObject();
+    out.endObject();
+}
+
+
+int main(int argc, char* argv[])
+{
+    BenchCommandLine commandLine("particlebench");
+    commandLine.add("--rate <n>", "particles emitted per second (default 20000)", &emissionRate);
+    commandLine.add("--lifetime <s>", "particle lifetime in seconds (default 5)", &lifetime);
+    commandLine.add("--frames <n>", "number of frames (default 120)", &nFrames);
+    if (!commandLine.parse(argc, argv))
+        return 1;
+    if (emissionRate <= 0.0f || lifetime <= 0.0f)
+    {
+        commandLine.usage();
+        return 1;
+    }
+
+    InitWorkerPool(commandLine.threads);
+
+    vector<BenchEmitter> emitters;
+    createEmitters(emitters);
+
+    vector<BenchResult> results;
+    for (const auto& emitter : emitters)
+    {
+        results.emplace_back();
+        results.back().name = emitter.name;
+        runBenchmark(emitter, results.back());
+    }
+
+    bool written = WriteBenchReport(commandLine.outputFile, [&](JsonWriter& out)
+    {
+        writeReport(out, results);
+    });
+
+    return written ? 0 : 1;
+}
@@ -0,0 +1,1217 @@
+// ingeststardb.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Convert large star catalogs in CSV or ECSV format, like the Gaia source
+// tables, to a Celestia star database and cross index files. The input is
+// read in blocks which are parsed in parallel. Stars are collected into
+// runs of bounded size which are sorted by catalog number and spilled to
+// temporary files, then the runs are merged into the output; memory use
+// doesn't depend on the size of the catalog.
+//
+// With --generate the tool writes a synthetic Gaia like catalog instead,
+// which is useful for testing and for measuring ingestion rates.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+#include <Eigen/Geometry>
+#include <fmt/printf.h>
+#include <celengine/astro.h>
+#include <celengine/astroobj.h>
+#include <celengine/stellarclass.h>
+#include <celmath/mathlib.h>
+#include <celutil/bytes.h>
+#include <celutil/timer.h>
+#include <celutil/workerpool.h>
+
+using namespace Eigen;
+using namespace std;
+
+
+constexpr const unsigned int MaxCrossIndexes = 4;
+
+// Size of the blocks of text handed to the parsing tasks
+constexpr const size_t InputBlockSize = 4 << 20;
+
+// Records read at once from each sorted run while merging
+constexpr const size_t MergeBufferRecords = 1 << 15;
+
+// Rows per task when generating synthetic catalogs
+constexpr const uint64_t GenerateBlockRows = 1 << 16;
+
+// Number of rejected rows reported individually
+constexpr const size_t MaxReportedErrors = 10;
+
+// Marks stars whose spectral class has to be derived from their color
+constexpr const uint16_t DeriveSpectralClass = 0xffff;
+
+constexpr const uint32_t InvalidCatalogNumber = AstroCatalog::InvalidIndex;
+
+static string inputFilename;
+static string outputFilename;
+static string tmpDir;
+static string idColumn;
+static vector<pair<string, string>> crossIndexes;
+static bool renumber = false;
+static uint32_t firstCatalogNumber = 1;
+static size_t memoryLimit = (size_t) 512 << 20;
+static unsigned int nThreads = 0;
+static string reportFile;
+static uint64_t generateCount = 0;
+static uint64_t generateSeed = 1;
+
+
+// A star as it's stored in the sorted runs
+struct StarRecord
+{
+    uint64_t key;
+    float x, y, z;
+    float absMag;
+    uint16_t spectralClass;
+    uint32_t xindex[MaxCrossIndexes];
+};
+
+
+static bool operator<(const StarRecord& a, const StarRecord& b)
+{
+    return a.key < b.key;
+}
+
+
+// Indices of the input columns used, -1 for missing columns
+struct ColumnLayout
+{
+    char delimiter { ',' };
+    int fieldCount { 0 };
+    int id { -1 };
+    int ra { -1 };
+    int dec { -1 };
+    int parallax { -1 };
+    int distance { -1 };
+    int appMag { -1 };
+    int bpRp { -1 };
+    int spectralType { -1 };
+    int xindex[MaxCrossIndexes] { -1, -1, -1, -1 };
+};
+
+
+// A block of input lines and the stars parsed from it
+struct InputBlock
+{
+    vector<char> text;
+    size_t lines { 0 };
+    size_t rows { 0 };
+    size_t rejected { 0 };
+    vector<pair<size_t, string>> errors;
+    vector<StarRecord> stars;
+};
+
+
+struct IngestStats
+{
+    uint64_t rows { 0 };
+    uint64_t rejected { 0 };
+    uint64_t duplicates { 0 };
+    uint64_t stars { 0 };
+    uint64_t crossIndexEntries { 0 };
+    unsigned int runs { 0 };
+    double parseTime { 0.0 };
+    double sortTime { 0.0 };
+    double mergeTime { 0.0 };
+    double totalTime { 0.0 };
+};
+
+
+static void Usage()
+{
+    cerr << "Usage: ingeststardb [options] <input catalog> <output star database>\n"
+         << "       ingeststardb --generate <count> [--seed <n>] <output catalog>\n"
+         << "  Options:\n"
+         << "    --id <column>            column with the catalog numbers (default: the\n"
+         << "                             first of source_id, hip, catalog_number, id)\n"
+         << "    --xindex <column>=<file> write a cross index from another catalog's\n"
+         << "                             numbers in <column> to the star numbers\n"
+         << "    --renumber <first>       number the stars consecutively in catalog\n"
+         << "                             order, for catalog numbers of more than 32 bits\n"
+         << "    --memory <MB>            memory for sorting before spilling (default 512)\n"
+         << "    --tmpdir <dir>           directory for the sorted runs\n"
+         << "    --threads <n>            worker threads, 0 = one per core\n"
+         << "    --report <file>          write statistics as JSON\n"
+         << "  Input columns: ra and dec in degrees, parallax in mas or distance in\n"
+         << "  light years, phot_g_mean_mag or appmag, and optionally spectral_type or\n"
+         << "  bp_rp to derive the spectral class.\n";
+}
+
+
+static bool parseCommandLine(int argc, char* argv[])
+{
+    int fileCount = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg[0] == '-')
+        {
+            if (arg == "--id" && hasValue)
+            {
+                idColumn = argv[++i];
+            }
+            else if (arg == "--xindex" && hasValue)
+            {
+                string value = argv[++i];
+                size_t eq = value.find('=');
+                if (eq == string::npos || eq == 0 || eq + 1 == value.size())
+                    return false;
+                if (crossIndexes.size() == MaxCrossIndexes)
+                {
+                    cerr << "At most " << MaxCrossIndexes << " cross indexes can be written\n";
+                    return false;
+                }
+                crossIndexes.emplace_back(value.substr(0, eq), value.substr(eq + 1));
+            }
+            else if (arg == "--renumber" && hasValue)
+            {
+                renumber = true;
+                firstCatalogNumber = (uint32_t) strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--memory" && hasValue)
+            {
+                memoryLimit = (size_t) max(atoi(argv[++i]), 1) << 20;
+            }
+            else if (arg == "--tmpdir" && hasValue)
+            {
+                tmpDir = argv[++i];
+            }
+            else if (arg == "--threads" && hasValue)
+            {
+                nThreads = (unsigned int) max(atoi(argv[++i]), 0);
+            }
+            else if (arg == "--report" && hasValue)
+            {
+                reportFile = argv[++i];
+            }
+            else if (arg == "--generate" && hasValue)
+            {
+                generateCount = strtoull(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--seed" && hasValue)
+            {
+                generateSeed = strtoull(argv[++i], nullptr, 10);
+            }
+            else
+            {
+                cerr << "Unknown command line switch: " << arg << '\n';
+                return false;
+            }
+        }
+        else
+        {
+            if (fileCount == 0)
+                inputFilename = arg;
+            else if (fileCount == 1)
+                outputFilename = arg;
+            else
+                return false;
+            fileCount++;
+        }
+    }
+
+    // When generating a catalog the only file is the output
+    if (generateCount != 0)
+        return fileCount == 1;
+    return fileCount == 2;
+}
+
+
+/*** Parsing ***/
+
+static string lowerCase(string s)
+{
+    for (auto& c : s)
+        c = (char) tolower((unsigned char) c);
+    return s;
+}
+
+
+// Split a line into fields. Space delimited files (the ECSV default) may
+// have runs of spaces between fields; quotes around fields are removed.
+static void splitFields(const char* line, const char* end, char delimiter,
+                        vector<pair<const char*, const char*>>& fields)
+{
+    fields.clear();
+    const char* p = line;
+    if (delimiter == ' ')
+    {
+        for (;;)
+        {
+            while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+            if (p == end)
+                break;
+            const char* start = p;
+            while (p < end && *p != ' ' && *p != '\t')
+                p++;
+            fields.emplace_back(start, p);
+        }
+    }
+    else
+    {
+        for (;;)
+        {
+            const char* start = p;
+            while (p < end && *p != delimiter)
+                p++;
+            fields.emplace_back(start, p);
+            if (p == end)
+                break;
+            p++;
+        }
+    }
+
+    for (auto& field : fields)
+    {
+        if (field.second - field.first >= 2 && *field.first == '"' && *(field.second - 1) == '"')
+        {
+            field.first++;
+            field.second--;
+        }
+    }
+}
+
+
+static bool isMissing(const pair<const char*, const char*>& field)
+{
+    size_t length = field.second - field.first;
+    return length == 0 ||
+           (length == 4 && (!strncmp(field.first, "null", 4) || !strncmp(field.first, "NULL", 4))) ||
+           (length == 3 && (!strncmp(field.first, "nan", 3) || !strncmp(field.first, "NaN", 3)));
+}
+
+
+// Parse a floating point field, NaN when it's missing or malformed. The
+// fields aren't null terminated, but they are always followed by a
+// delimiter or line end which stops strtod.
+static double parseDouble(const pair<const char*, const char*>& field)
+{
+    if (isMissing(field))
+        return numeric_limits<double>::quiet_NaN();
+    char* end = nullptr;
+    double value = strtod(field.first, &end);
+    if (end != field.second)
+        return numeric_limits<double>::quiet_NaN();
+    return value;
+}
+
+
+static bool parseInteger(const pair<const char*, const char*>& field, uint64_t& value)
+{
+    if (isMissing(field) || *field.first == '-')
+        return false;
+    char* end = nullptr;
+    value = strtoull(field.first, &end, 10);
+    return end == field.second;
+}
+
+
+static int findColumn(const vector<string>& names, const vector<string>& candidates)
+{
+    for (const auto& candidate : candidates)
+    {
+        auto iter = find(names.begin(), names.end(), candidate);
+        if (iter != names.end())
+            return (int) (iter - names.begin());
+    }
+    return -1;
+}
+
+
+// Read the ECSV metadata if there is any and the line of column names,
+// leaving the stream at the first row.
+static bool readHeader(istream& in, ColumnLayout& layout, size_t& lineNumber)
+{
+    string line;
+    bool ecsv = false;
+    for (;;)
+    {
+        if (!getline(in, line))
+        {
+            cerr << "Missing column names in input file\n";
+            return false;
+        }
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if (line.compare(0, 7, "# %ECSV") == 0)
+        {
+            // The default ECSV delimiter is a space
+            ecsv = true;
+            layout.delimiter = ' ';
+        }
+        else if (ecsv && line.compare(0, 2, "# ") == 0 && line.find("delimiter:") != string::npos)
+        {
+            size_t quote = line.find('\'');
+            if (quote != string::npos && quote + 1 < line.size())
+                layout.delimiter = line[quote + 1];
+        }
+        else if (!line.empty() && line[0] != '#')
+        {
+            break;
+        }
+    }
+
+    vector<pair<const char*, const char*>> fields;
+    splitFields(line.data(), line.data() + line.size(), layout.delimiter, fields);
+    vector<string> names;
+    for (const auto& field : fields)
+        names.push_back(lowerCase(string(field.first, field.second)));
+    layout.fieldCount = (int) names.size();
+
+    if (idColumn.empty())
+        layout.id = findColumn(names, { "source_id", "hip", "catalog_number", "id" });
+    else
+        layout.id = findColumn(names, { lowerCase(idColumn) });
+    layout.ra = findColumn(names, { "ra" });
+    layout.dec = findColumn(names, { "dec" });
+    layout.parallax = findColumn(names, { "parallax", "plx" });
+    layout.distance = findColumn(names, { "distance" });
+    layout.appMag = findColumn(names, { "phot_g_mean_mag", "appmag", "vmag", "mag" });
+    layout.bpRp = findColumn(names, { "bp_rp" });
+    layout.spectralType = findColumn(names, { "spectral_type", "sptype", "spectype" });
+    for (size_t i = 0; i < crossIndexes.size(); i++)
+    {
+        layout.xindex[i] = findColumn(names, { lowerCase(crossIndexes[i].first) });
+        if (layout.xindex[i] < 0)
+        {
+            cerr << "Missing cross index column " << crossIndexes[i].first << '\n';
+            return false;
+        }
+    }
+
+    if (layout.id < 0 || layout.ra < 0 || layout.dec < 0 ||
+        (layout.parallax < 0 && layout.distance < 0) || layout.appMag < 0)
+    {
+        cerr << "Input file needs catalog number, ra, dec, parallax or distance, and magnitude columns\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+// Main sequence spectral types by Gaia BP-RP color, after Pecaut & Mamajek,
+// "A Modern Mean Dwarf Stellar Color and Effective Temperature Sequence".
+// Types are numbered as ten times the spectral class plus the subclass.
+static const struct
+{
+    float bpRp;
+    unsigned int type;
+} ColorSpectralTypes[] =
+{
+    { -0.33f,  9 }, { -0.30f, 10 }, { -0.24f, 12 }, { -0.12f, 15 },
+    { -0.07f, 18 }, {  0.00f, 20 }, {  0.04f, 22 }, {  0.14f, 25 },
+    {  0.38f, 30 }, {  0.47f, 32 }, {  0.59f, 35 }, {  0.68f, 38 },
+    {  0.74f, 40 }, {  0.82f, 42 }, {  0.86f, 45 }, {  0.92f, 48 },
+    {  0.98f, 50 }, {  1.15f, 52 }, {  1.45f, 55 }, {  1.67f, 57 },
+    {  1.84f, 60 }, {  2.19f, 62 }, {  2.75f, 64 }, {  3.04f, 65 },
+    {  3.50f, 66 }, {  4.30f, 68 }, {  4.60f, 69 },
+};
+
+
+static uint16_t spectralClassFromColor(float bpRp)
+{
+    if (std::isnan(bpRp))
+    {
+        StellarClass sc(StellarClass::NormalStar, StellarClass::Spectral_Unknown,
+                        StellarClass::Subclass_Unknown, StellarClass::Lum_Unknown);
+        return sc.packV1();
+    }
+
+    const auto& table = ColorSpectralTypes;
+    const size_t n = sizeof(ColorSpectralTypes) / sizeof(ColorSpectralTypes[0]);
+    unsigned int type;
+    if (bpRp <= table[0].bpRp)
+    {
+        type = table[0].type;
+    }
+    else if (bpRp >= table[n - 1].bpRp)
+    {
+        type = table[n - 1].type;
+    }
+    else
+    {
+        size_t i = 1;
+        while (bpRp > table[i].bpRp)
+            i++;
+        float t = (bpRp - table[i - 1].bpRp) / (table[i].bpRp - table[i - 1].bpRp);
+        type = table[i - 1].type +
+            (unsigned int) (t * (float) (table[i].type - table[i - 1].type) + 0.5f);
+    }
+
+    // The luminosity class can't be told from the color alone
+    StellarClass sc(StellarClass::NormalStar,
+                    (StellarClass::SpectralClass) (StellarClass::Spectral_O + type / 10),
+                    type % 10,
+                    StellarClass::Lum_Unknown);
+    return sc.packV1();
+}
+
+
+static void rejectRow(InputBlock& block, size_t line, const char* reason)
+{
+    block.rejected++;
+    if (block.errors.size() < MaxReportedErrors)
+        block.errors.emplace_back(line, reason);
+}
+
+
+// Parse the rows of a block into columns, then derive the positions,
+// absolute magnitudes and spectral classes of all its stars at once.
+static void parseBlock(const ColumnLayout& layout, InputBlock& block)
+{
+    vector<uint64_t> ids;
+    vector<double> ra, dec, parallax, appMag;
+    vector<float> bpRp;
+    vector<uint16_t> spectralClasses;
+    vector<uint32_t> xindex[MaxCrossIndexes];
+
+    vector<pair<const char*, const char*>> fields;
+    const char* p = block.text.data();
+    const char* textEnd = p + block.text.size();
+    size_t line = 0;
+    while (p < textEnd)
+    {
+        const char* lineEnd = (const char*) memchr(p, '\n', textEnd - p);
+        if (lineEnd == nullptr)
+            lineEnd = textEnd;
+        const char* next = lineEnd + 1;
+        if (lineEnd > p && *(lineEnd - 1) == '\r')
+            lineEnd--;
+
+        size_t lineIndex = line++;
+        if (lineEnd == p || *p == '#')
+        {
+            p = next;
+            continue;
+        }
+
+        block.rows++;
+        splitFields(p, lineEnd, layout.delimiter, fields);
+        p = next;
+        if ((int) fields.size() != layout.fieldCount)
+        {
+            rejectRow(block, lineIndex, "wrong number of fields");
+            continue;
+        }
+
+        uint64_t id;
+        if (!parseInteger(fields[layout.id], id))
+        {
+            rejectRow(block, lineIndex, "bad catalog number");
+            continue;
+        }
+        if (!renumber && id >= InvalidCatalogNumber)
+        {
+            rejectRow(block, lineIndex, "catalog number too large, use --renumber");
+            continue;
+        }
+
+        double starRA = parseDouble(fields[layout.ra]);
+        double starDec = parseDouble(fields[layout.dec]);
+        if (std::isnan(starRA) || std::isnan(starDec))
+        {
+            rejectRow(block, lineIndex, "missing position");
+            continue;
+        }
+
+        // Distances in light years are converted to parallaxes so that
+        // all stars are handled alike below.
+        double plx;
+        if (layout.parallax >= 0)
+        {
+            plx = parseDouble(fields[layout.parallax]);
+        }
+        else
+        {
+            double distance = parseDouble(fields[layout.distance]);
+            plx = 1000.0 * LY_PER_PARSEC / distance;
+        }
+        if (!(plx > 0.0) || std::isinf(plx))
+        {
+            rejectRow(block, lineIndex, "no positive parallax");
+            continue;
+        }
+
+        double mag = parseDouble(fields[layout.appMag]);
+        if (std::isnan(mag))
+        {
+            rejectRow(block, lineIndex, "missing magnitude");
+            continue;
+        }
+
+        uint16_t spectralClass = DeriveSpectralClass;
+        if (layout.spectralType >= 0 && !isMissing(fields[layout.spectralType]))
+        {
+            string spectralType(fields[layout.spectralType].first, fields[layout.spectralType].second);
+            spectralClass = StellarClass::parse(spectralType).packV1();
+        }
+
+        ids.push_back(id);
+        ra.push_back(starRA);
+        dec.push_back(starDec);
+        parallax.push_back(plx);
+        appMag.push_back(mag);
+        bpRp.push_back(layout.bpRp >= 0 ? (float) parseDouble(fields[layout.bpRp])
+                                        : numeric_limits<float>::quiet_NaN());
+        spectralClasses.push_back(spectralClass);
+        for (size_t i = 0; i < crossIndexes.size(); i++)
+        {
+            uint64_t value;
+            if (!parseInteger(fields[layout.xindex[i]], value) || value >= InvalidCatalogNumber)
+                value = InvalidCatalogNumber;
+            xindex[i].push_back((uint32_t) value);
+        }
+    }
+    block.lines = line;
+
+    // The derived values are computed by plain loops over the columns, which
+    // the compiler can vectorize.
+    size_t n = ids.size();
+    vector<double> x(n), y(n), z(n), absMag(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        // Same as astro::equatorialToCelestialCart() before the rotation
+        // to the ecliptic frame
+        double distance = 1000.0 / parallax[i] * LY_PER_PARSEC;
+        double theta = ra[i] * (PI / 180.0) + PI;
+        double phi = (dec[i] / 90.0 - 1.0) * PI / 2;
+        x[i] = cos(theta) * sin(phi) * distance;
+        y[i] = cos(phi) * distance;
+        z[i] = -sin(theta) * sin(phi) * distance;
+    }
+    for (size_t i = 0; i < n; i++)
+        absMag[i] = appMag[i] + 5.0 * log10(parallax[i]) - 10.0;
+
+    Matrix3d toEcliptic = AngleAxisd(-astro::J2000Obliquity, Vector3d::UnitX()).toRotationMatrix();
+    block.stars.resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        StarRecord& star = block.stars[i];
+        star.key = ids[i];
+        star.x = (float) (toEcliptic(0, 0) * x[i] + toEcliptic(0, 1) * y[i] + toEcliptic(0, 2) * z[i]);
+        star.y = (float) (toEcliptic(1, 0) * x[i] + toEcliptic(1, 1) * y[i] + toEcliptic(1, 2) * z[i]);
+        star.z = (float) (toEcliptic(2, 0) * x[i] + toEcliptic(2, 1) * y[i] + toEcliptic(2, 2) * z[i]);
+        star.absMag = (float) absMag[i];
+        star.spectralClass = spectralClasses[i] == DeriveSpectralClass ?
+            spectralClassFromColor(bpRp[i]) : spectralClasses[i];
+        for (unsigned int j = 0; j < MaxCrossIndexes; j++)
+            star.xindex[j] = j < crossIndexes.size() ? xindex[j][i] : InvalidCatalogNumber;
+    }
+
+    // The text isn't needed anymore; release it before the next round
+    vector<char>().swap(block.text);
+}
+
+
+// Read the next block of complete lines. Text after the last line break is
+// kept in carry and starts the following block.
+static bool readBlock(istream& in, vector<char>& carry, InputBlock& block)
+{
+    block.text.swap(carry);
+    carry.clear();
+    size_t start = block.text.size();
+    block.text.resize(start + InputBlockSize);
+    in.read(block.text.data() + start, InputBlockSize);
+    block.text.resize(start + (size_t) in.gcount());
+
+    if (!in.eof())
+    {
+        auto lastBreak = find(block.text.rbegin(), block.text.rend(), '\n');
+        if (lastBreak == block.text.rend())
+        {
+            // A line longer than a block; let it grow with the next read
+            carry.swap(block.text);
+            return true;
+        }
+        size_t end = block.text.rend() - lastBreak;
+        carry.assign(block.text.begin() + end, block.text.end());
+        block.text.resize(end);
+    }
+    else if (!block.text.empty() && block.text.back() != '\n')
+    {
+        // The number parsers rely on every line being terminated
+        block.text.push_back('\n');
+    }
+
+    return !block.text.empty();
+}
+
+
+/*** Sorting ***/
+
+// Stable sort, so that among stars with the same catalog number the one
+// read first comes first.
+static void sortRun(vector<StarRecord>& stars)
+{
+    WorkerPool* pool = GetWorkerPool();
+    size_t nChunks = min((size_t) pool->getConcurrency(), max(stars.size() / 4096, (size_t) 1));
+    vector<size_t> bounds(nChunks + 1);
+    for (size_t i = 0; i <= nChunks; i++)
+        bounds[i] = stars.size() * i / nChunks;
+
+    pool->parallelFor(nChunks, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+            stable_sort(stars.begin() + bounds[i], stars.begin() + bounds[i + 1]);
+    });
+
+    // Merge neighboring chunks pairwise until one is left
+    for (size_t width = 1; width < nChunks; width *= 2)
+    {
+        size_t nMerges = (nChunks + 2 * width - 1) / (2 * width);
+        pool->parallelFor(nMerges, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                size_t first = i * 2 * width;
+                size_t middle = min(first + width, nChunks);
+                size_t last = min(first + 2 * width, nChunks);
+                if (middle < last)
+                {
+                    inplace_merge(stars.begin() + bounds[first],
+                                  stars.begin() + bounds[middle],
+                                  stars.begin() + bounds[last]);
+                }
+            }
+        });
+    }
+}
+
+
+static string runFilename(unsigned int run)
+{
+    string base = outputFilename;
+    if (!tmpDir.empty())
+    {
+        size_t slash = base.find_last_of("/\\");
+        if (slash != string::npos)
+            base = base.substr(slash + 1);
+        base = tmpDir + "/" + base;
+    }
+    return fmt::sprintf("%s.run%u", base, run);
+}
+
+
+static bool writeRun(const vector<StarRecord>& stars, unsigned int run)
+{
+    ofstream out(runFilename(run), ios::out | ios::binary);
+    out.write(reinterpret_cast<const char*>(stars.data()), stars.size() * sizeof(StarRecord));
+    if (!out.good())
+    {
+        cerr << "Error writing temporary file " << runFilename(run) << '\n';
+        return false;
+    }
+    return true;
+}
+
+
+// A sorted run, read back from its temporary file in pieces. The last run
+// is merged straight from memory.
+class SortedRun
+{
+ public:
+    SortedRun() = default;
+    SortedRun(vector<StarRecord>&& stars) : buffer(std::move(stars)) {}
+
+    bool open(const string& filename)
+    {
+        file.open(filename, ios::in | ios::binary);
+        return file.good() && refill();
+    }
+
+    bool empty() const { return position == buffer.size(); }
+    const StarRecord& front() const { return buffer[position]; }
+
+    // Advance to the next star; false if the run is exhausted
+    bool next()
+    {
+        position++;
+        return position < buffer.size() || refill();
+    }
+
+ private:
+    bool refill()
+    {
+        if (!file.is_open())
+            return false;
+        buffer.resize(MergeBufferRecords);
+        file.read(reinterpret_cast<char*>(buffer.data()), MergeBufferRecords * sizeof(StarRecord));
+        buffer.resize((size_t) file.gcount() / sizeof(StarRecord));
+        position = 0;
+        return !buffer.empty();
+    }
+
+    ifstream file;
+    vector<StarRecord> buffer;
+    size_t position { 0 };
+};
+
+
+/*** Output ***/
+
+static void putUint(char* p, uint32_t n)
+{
+    LE_TO_CPU_INT32(n, n);
+    memcpy(p, &n, sizeof n);
+}
+
+static void putFloat(char* p, float f)
+{
+    LE_TO_CPU_FLOAT(f, f);
+    memcpy(p, &f, sizeof f);
+}
+
+static void putUshort(char* p, uint16_t n)
+{
+    LE_TO_CPU_INT16(n, n);
+    memcpy(p, &n, sizeof n);
+}
+
+static void putShort(char* p, int16_t n)
+{
+    LE_TO_CPU_INT16(n, n);
+    memcpy(p, &n, sizeof n);
+}
+
+
+// Writes star database or cross index records through a buffer; the star
+// count in the header is filled in when the file is closed.
+class DatabaseWriter
+{
+ public:
+    DatabaseWriter(size_t _recordSize) : recordSize(_recordSize) {}
+
+    bool open(const string& filename, const char* header, bool hasCount)
+    {
+        out.open(filename, ios::out | ios::binary);
+        if (!out.good())
+        {
+            cerr << "Error opening output file " << filename << '\n';
+            return false;
+        }
+
+        char version[2];
+        putShort(version, 0x0100);
+        out.write(header, 8);
+        out.write(version, sizeof version);
+        if (hasCount)
+        {
+            countOffset = out.tellp();
+            char count[4] = { 0, 0, 0, 0 };
+            out.write(count, sizeof count);
+        }
+        buffer.reserve(MergeBufferRecords * recordSize);
+        return out.good();
+    }
+
+    char* append()
+    {
+        if (buffer.size() + recordSize > buffer.capacity())
+            flush();
+        buffer.resize(buffer.size() + recordSize);
+        count++;
+        return buffer.data() + buffer.size() - recordSize;
+    }
+
+    bool close()
+    {
+        flush();
+        if (countOffset >= 0)
+        {
+            char n[4];
+            putUint(n, count);
+            out.seekp(countOffset);
+            out.write(n, sizeof n);
+        }
+        out.close();
+        return !out.fail();
+    }
+
+    uint32_t getCount() const { return count; }
+
+ private:
+    void flush()
+    {
+        out.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    ofstream out;
+    vector<char> buffer;
+    size_t recordSize;
+    streamoff countOffset { -1 };
+    uint32_t count { 0 };
+};
+
+
+// Merge the sorted runs into the star database and cross indexes. Of the
+// stars with the same catalog number only the first one read is kept.
+static bool mergeRuns(vector<SortedRun>& runs, IngestStats& stats)
+{
+    DatabaseWriter starWriter(20);
+    if (!starWriter.open(outputFilename, "CELSTARS", true))
+        return false;
+
+    vector<unique_ptr<DatabaseWriter>> xindexWriters;
+    for (const auto& xindex : crossIndexes)
+    {
+        xindexWriters.emplace_back(new DatabaseWriter(8));
+        if (!xindexWriters.back()->open(xindex.second, "CELINDEX", false))
+            return false;
+    }
+
+    // Ties are broken by run number, as earlier runs hold earlier rows
+    typedef pair<uint64_t, size_t> QueueEntry;
+    priority_queue<QueueEntry, vector<QueueEntry>, greater<QueueEntry>> queue;
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        if (!runs[i].empty())
+            queue.emplace(runs[i].front().key, i);
+    }
+
+    bool first = true;
+    uint64_t lastKey = 0;
+    uint64_t nextNumber = firstCatalogNumber;
+    while (!queue.empty())
+    {
+        size_t runIndex = queue.top().second;
+        queue.pop();
+        SortedRun& run = runs[runIndex];
+        const StarRecord& star = run.front();
+
+        if (!first && star.key == lastKey)
+        {
+            stats.duplicates++;
+        }
+        else if (renumber && nextNumber >= InvalidCatalogNumber)
+        {
+            cerr << "Too many stars for --renumber " << firstCatalogNumber << '\n';
+            return false;
+        }
+        else
+        {
+            uint32_t catalogNumber = renumber ? (uint32_t) nextNumber++ : (uint32_t) star.key;
+
+            char* p = starWriter.append();
+            putUint(p, catalogNumber);
+            putFloat(p + 4, star.x);
+            putFloat(p + 8, star.y);
+            putFloat(p + 12, star.z);
+            putShort(p + 16, (int16_t) (star.absMag * 256.0f));
+            putUshort(p + 18, star.spectralClass);
+
+            for (size_t i = 0; i < xindexWriters.size(); i++)
+            {
+                if (star.xindex[i] != InvalidCatalogNumber)
+                {
+                    char* q = xindexWriters[i]->append();
+                    putUint(q, star.xindex[i]);
+                    putUint(q + 4, catalogNumber);
+                    stats.crossIndexEntries++;
+                }
+            }
+        }
+        first = false;
+        lastKey = star.key;
+
+        if (run.next())
+            queue.emplace(run.front().key, runIndex);
+    }
+
+    stats.stars = starWriter.getCount();
+    bool success = starWriter.close();
+    for (auto& writer : xindexWriters)
+        success = writer->close() && success;
+    if (!success)
+        cerr << "Error writing output files\n";
+    return success;
+}
+
+
+static bool ingestCatalog(istream& in, IngestStats& stats)
+{
+    Timer totalTimer;
+
+    ColumnLayout layout;
+    size_t lineNumber = 0;
+    if (!readHeader(in, layout, lineNumber))
+        return false;
+
+    WorkerPool* pool = GetWorkerPool();
+    size_t runCapacity = max(memoryLimit / sizeof(StarRecord), (size_t) 1);
+    vector<StarRecord> run;
+    run.reserve(runCapacity);
+    vector<InputBlock> blocks(2 * pool->getConcurrency());
+    vector<char> carry;
+    size_t reportedErrors = 0;
+
+    bool endOfInput = false;
+    while (!endOfInput)
+    {
+        // Read a round of blocks and parse them in parallel
+        Timer parseTimer;
+        size_t nBlocks = 0;
+        while (nBlocks < blocks.size())
+        {
+            InputBlock& block = blocks[nBlocks];
+            block = InputBlock();
+            if (!readBlock(in, carry, block))
+            {
+                endOfInput = true;
+                break;
+            }
+            nBlocks++;
+        }
+        if (in.bad())
+        {
+            cerr << "Error reading input file\n";
+            return false;
+        }
+
+        pool->parallelFor(nBlocks, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+                parseBlock(layout, blocks[i]);
+        });
+        stats.parseTime += parseTimer.getTime();
+
+        // Collect the stars in input order, spilling full runs
+        for (size_t i = 0; i < nBlocks; i++)
+        {
+            InputBlock& block = blocks[i];
+            stats.rows += block.rows;
+            stats.rejected += block.rejected;
+            for (const auto& error : block.errors)
+            {
+                if (reportedErrors == MaxReportedErrors)
+                    break;
+                cerr << "Line " << lineNumber + error.first + 1 << ": " << error.second << '\n';
+                reportedErrors++;
+            }
+            lineNumber += block.lines;
+
+            size_t taken = 0;
+            while (taken < block.stars.size())
+            {
+                size_t n = min(block.stars.size() - taken, runCapacity - run.size());
+                run.insert(run.end(), block.stars.begin() + taken, block.stars.begin() + taken + n);
+                taken += n;
+                if (run.size() == runCapacity)
+                {
+                    Timer sortTimer;
+                    sortRun(run);
+                    if (!writeRun(run, stats.runs))
+                        return false;
+                    stats.runs++;
+                    run.clear();
+                    stats.sortTime += sortTimer.getTime();
+                    fmt::fprintf(clog, "%llu rows read, %u sorted runs\n",
+                                 (unsigned long long) stats.rows, stats.runs);
+                }
+            }
+            vector<StarRecord>().swap(block.stars);
+        }
+    }
+    if (stats.rejected > reportedErrors)
+        cerr << stats.rejected - reportedErrors << " more rows rejected\n";
+
+    Timer sortTimer;
+    sortRun(run);
+    stats.sortTime += sortTimer.getTime();
+
+    Timer mergeTimer;
+    vector<SortedRun> runs(stats.runs + 1);
+    bool success = true;
+    for (unsigned int i = 0; i < stats.runs && success; i++)
+    {
+        if (!runs[i].open(runFilename(i)))
+        {
+            cerr << "Error reading temporary file " << runFilename(i) << '\n';
+            success = false;
+        }
+    }
+    if (success)
+    {
+        runs.back() = SortedRun(std::move(run));
+        success = mergeRuns(runs, stats);
+    }
+    runs.clear();
+    for (unsigned int i = 0; i < stats.runs; i++)
+        remove(runFilename(i).c_str());
+    stats.mergeTime = mergeTimer.getTime();
+    stats.totalTime = totalTimer.getTime();
+
+    return success;
+}
+
+
+/*** Synthetic catalogs ***/
+
+// Append rows of a synthetic catalog resembling Gaia sources within 5 kpc:
+// random 64 bit source ids, a uniform density of stars, a few percent of
+// negative parallaxes and an occasional Hipparcos number.
+static void generateRows(uint64_t firstRow, uint64_t nRows, string& text)
+{
+    mt19937_64 rng(generateSeed * 0x9e3779b97f4a7c15ull + firstRow);
+    uniform_real_distribution<double> uniform(0.0, 1.0);
+    char line[256];
+
+    for (uint64_t row = 0; row < nRows; row++)
+    {
+        uint64_t sourceId = rng() >> 1;
+        double ra = uniform(rng) * 360.0;
+        double dec = asin(uniform(rng) * 2.0 - 1.0) * 180.0 / PI;
+        double distance = 5000.0 * cbrt(uniform(rng));
+        double parallax = 1000.0 / distance;
+        if (uniform(rng) < 0.03)
+            parallax = -parallax;
+        double absMag = -2.0 + 16.0 * uniform(rng);
+        double appMag = absMag + 5.0 * log10(distance) - 5.0;
+        double bpRp = max(-0.3, min(4.5, absMag * 0.25 + 0.1 + (uniform(rng) - 0.5) * 0.4));
+
+        int length = snprintf(line, sizeof line, "%llu,%.9f,%.9f,%.6f,%.5f,%.4f,",
+                              (unsigned long long) sourceId, ra, dec, parallax, appMag, bpRp);
+        text.append(line, length);
+        if (uniform(rng) < 0.01)
+        {
+            length = snprintf(line, sizeof line, "%u", (unsigned int) (1 + rng() % 120000));
+            text.append(line, length);
+        }
+        text.push_back('\n');
+    }
+}
+
+
+static bool generateCatalog(ostream& out)
+{
+    out << "source_id,ra,dec,parallax,phot_g_mean_mag,bp_rp,hip\n";
+
+    WorkerPool* pool = GetWorkerPool();
+    vector<string> blocks(2 * pool->getConcurrency());
+    uint64_t nBlocks = (generateCount + GenerateBlockRows - 1) / GenerateBlockRows;
+    for (uint64_t first = 0; first < nBlocks; first += blocks.size())
+    {
+        size_t n = (size_t) min((uint64_t) blocks.size(), nBlocks - first);
+        pool->parallelFor(n, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                uint64_t firstRow = (first + i) * GenerateBlockRows;
+                blocks[i].clear();
+                generateRows(firstRow, min(GenerateBlockRows, generateCount - firstRow), blocks[i]);
+            }
+        });
+        for (size_t i = 0; i < n; i++)
+            out.write(blocks[i].data(), blocks[i].size());
+    }
+
+    return out.good();
+}
+
+
+static void writeReport(ostream& out, const IngestStats& stats)
+{
+    fmt::fprintf(out, "{\n");
+    fmt::fprintf(out, "  \"threads\": %u,\n", GetWorkerPool()->getConcurrency());
+    fmt::fprintf(out, "  \"rows\": %llu,\n", (unsigned long long) stats.rows);
+    fmt::fprintf(out, "  \"rejected\": %llu,\n", (unsigned long long) stats.rejected);
+    fmt::fprintf(out, "  \"duplicates\": %llu,\n", (unsigned long long) stats.duplicates);
+    fmt::fprintf(out, "  \"stars\": %llu,\n", (unsigned long long) stats.stars);
+    fmt::fprintf(out, "  \"crossIndexEntries\": %llu,\n", (unsigned long long) stats.crossIndexEntries);
+    fmt::fprintf(out, "  \"sortedRuns\": %u,\n", stats.runs + 1);
+    fmt::fprintf(out, "  \"parseSeconds\": %.3f,\n", stats.parseTime);
+    fmt::fprintf(out, "  \"sortSeconds\": %.3f,\n", stats.sortTime);
+    fmt::fprintf(out, "  \"mergeSeconds\": %.3f,\n", stats.mergeTime);
+    fmt::fprintf(out, "  \"totalSeconds\": %.3f,\n", stats.totalTime);
+    fmt::fprintf(out, "  \"rowsPerSecond\": %.0f\n", stats.rows / stats.totalTime);
+    fmt::fprintf(out, "}\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (!parseCommandLine(argc, argv))
+    {
+        Usage();
+        return 1;
+    }
+
+    InitWorkerPool(nThreads);
+
+    if (generateCount != 0)
+    {
+        ofstream catalogFile(inputFilename, ios::out | ios::binary);
+        if (!catalogFile.good())
+        {
+            cerr << "Error opening output file " << inputFilename << '\n';
+            return 1;
+        }
+        Timer timer;
+        if (!generateCatalog(catalogFile))
+        {
+            cerr << "Error writing output file " << inputFilename << '\n';
+            return 1;
+        }
+        fmt::fprintf(clog, "%llu rows generated in %.2f s\n",
+                     (unsigned long long) generateCount, timer.getTime());
+        return 0;
+    }
+
+    ifstream inputFile(inputFilename, ios::in | ios::binary);
+    if (!inputFile.good())
+    {
+        cerr << "Error opening input file " << inputFilename << '\n';
+        return 1;
+    }
+
+    IngestStats stats;
+    if (!ingestCatalog(inputFile, stats))
+        return 1;
+
+    fmt::fprintf(clog, "%llu rows, %llu stars written, %llu rejected, %llu duplicates\n",
+                 (unsigned long long) stats.rows, (unsigned long long) stats.stars,
+                 (unsigned long long) stats.rejected, (unsigned long long) stats.duplicates);
+    fmt::fprintf(clog, "%.2f s, %.0f rows/s\n", stats.totalTime, stats.rows / stats.totalTime);
+
+    if (!reportFile.empty())
+    {
+        ofstream out(reportFile);
+        if (!out.good())
+        {
+            cerr << "Error opening report file " << reportFile << '\n';
+            return 1;
+        }
+        writeReport(out, stats);
+    }
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <celephem/orientbinary.h>
+#include <celutil/bytes.h> // __BYTE_ORDER__
+#include <fmt/printf.h>
+#include <cmath>
+#include <cstring> // memcpy
+#include <fstream>
+#include <iostream>
+#include <limits> // std::numeric_limits
+#include <vector>
+
+using namespace std;
+
+constexpr char magic[8] = "CELQUAT";
+
+// Convert text sampled orientation file to binary file.
+static bool orientationToBinary(const string& inFilename, const string& outFilename)
+{
+    ifstream in(inFilename);
+    ofstream out(outFilename, ios::binary);
+    if (!in.good() || !out.good())
+        return false;
+
+    vector<OrientationBinaryData> records;
+    OrientationBinaryData data;
+    while (in.good())
+    {
+        in >> data.tjd;
+        in >> data.q[0];
+        in >> data.q[1];
+        in >> data.q[2];
+        in >> data.q[3];
+
+        if (!in.good())
+            continue;
+
+        // Quaternions are normalized when text files are loaded
+        float norm = sqrt(data.q[0] * data.q[0] + data.q[1] * data.q[1] +
+                          data.q[2] * data.q[2] + data.q[3] * data.q[3]);
+        if (norm > 0.0f)
+        {
+            for (float& c : data.q)
+                c /= norm;
+        }
+
+        records.push_back(data);
+    }
+
+    if (records.empty())
+        return false;
+
+    OrientationBinaryHeader header;
+    memcpy(header.magic, magic, 8);
+    header.byteOrder = __BYTE_ORDER__;
+    header.digits = std::numeric_limits<double>::digits;
+    header.flags = 0;
+    if (OrientationKeysEvenlySpaced(records.data(), records.size()) > 0.0)
+        header.flags |= OrientationEvenlySpaced;
+    header.count = records.size();
+
+    return out.write(reinterpret_cast<char*>(&header), sizeof(header)) &&
+           out.write(reinterpret_cast<char*>(records.data()), records.size() * sizeof(OrientationBinaryData));
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        fmt::fprintf(cerr, "Usage: %s infile.q outfile.qbin\n", argv[0]);
+        return 1;
+    }
+
+    if (!orientationToBinary(argv[1], argv[2]))
+    {
+        fmt::fprintf(cerr, "Error converting %s to %s.\n", argv[1], argv[2]);
+        return 1;
+    }
+
+    return 0;
+}
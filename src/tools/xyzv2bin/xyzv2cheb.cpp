@@ -0,0 +1,121 @@
+// xyzv2cheb.cpp
+//
+// Copyright (C) 2020, Celestia Development Team
+//
+// Fit piecewise Chebyshev polynomials to an xyzv trajectory, writing a file
+// Celestia uses for SampledTrajectory definitions with a ChebyshevTolerance
+// when it is named like the xyzv file plus "cheb". The file records the
+// tolerance and the size and modification time of infile; Celestia fits the
+// samples itself if the tolerance is larger than the one of the definition
+// or if the file it reads the samples from is not infile as it was then.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <celephem/chebyshevorbit.h>
+#include <celephem/samporbit.h>
+#include <celephem/xyzvbinary.h>
+#include <fmt/printf.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace Eigen;
+using namespace std;
+
+static void usage(const char* name)
+{
+    fmt::fprintf(cerr, "Usage: %s [--degree n] [--tolerance km] infile outfile.xyzvcheb\n", name);
+    fmt::fprintf(cerr, "  infile is either a text or a binary xyzv file\n");
+    fmt::fprintf(cerr, "  --degree n       degree of the polynomials (default %u)\n", ChebyshevOrbit::DefaultDegree);
+    fmt::fprintf(cerr, "  --tolerance km   maximum position error (default 0.1)\n");
+}
+
+// Binary xyzv files are recognized by their header, not by their name.
+static bool isBinaryXYZV(const string& filename)
+{
+    ifstream in(filename, ios::binary);
+    char magic[8];
+    return in.read(magic, sizeof(magic)) && memcmp(magic, "CELXYZV", sizeof(magic)) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int degree = ChebyshevOrbit::DefaultDegree;
+    double tolerance = 0.1;
+    vector<string> files;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--degree" && i + 1 < argc)
+        {
+            degree = (unsigned int) atoi(argv[++i]);
+        }
+        else if (arg == "--tolerance" && i + 1 < argc)
+        {
+            tolerance = atof(argv[++i]);
+        }
+        else if (arg.size() > 1 && arg[0] == '-')
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        else
+        {
+            files.push_back(arg);
+        }
+    }
+
+    if (files.size() != 2 || tolerance <= 0.0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    vector<XYZVBinaryData> samples;
+    bool loaded = isBinaryXYZV(files[0]) ? LoadXYZVBinarySamples(files[0], samples)
+                                         : LoadXYZVSamples(files[0], samples);
+    if (!loaded || samples.size() < 2)
+    {
+        fmt::fprintf(cerr, "Error reading samples from %s.\n", files[0]);
+        return 1;
+    }
+
+    unique_ptr<ChebyshevOrbit> orbit(ChebyshevOrbit::fit(samples, degree, tolerance));
+    if (orbit == nullptr)
+    {
+        fmt::fprintf(cerr, "Error fitting %s.\n", files[0]);
+        return 1;
+    }
+
+    if (!orbit->save(files[1], files[0], tolerance))
+    {
+        fmt::fprintf(cerr, "Error writing %s.\n", files[1]);
+        return 1;
+    }
+
+    double maxError = 0.0;
+    for (const auto& s : samples)
+    {
+        double error = (orbit->evaluatePosition(s.tdb) - Map<const Vector3d>(s.position)).norm();
+        maxError = max(maxError, error);
+    }
+
+    size_t sampleSize = samples.size() * sizeof(XYZVBinaryData);
+    size_t chebSize = sizeof(ChebyshevBinaryHeader) +
+                      (orbit->getSegmentCount() * (3 * (orbit->getDegree() + 1) + 1) + 1) * sizeof(double);
+    fmt::printf("%zu samples, %zu segments of degree %u\n",
+                samples.size(), orbit->getSegmentCount(), orbit->getDegree());
+    fmt::printf("%zu bytes instead of %zu (%.1f%%), max error at samples %g km\n",
+                chebSize, sampleSize, 100.0 * (double) chebSize / (double) sampleSize, maxError);
+
+    return 0;
+}
@@ -0,0 +1,210 @@
+#include <celephem/chebyshevorbit.h>
+#include <celengine/astro.h>
+#include <celmath/mathlib.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+using namespace Eigen;
+
+// An eccentric, inclined orbit with a period of 100 days, in km and days
+constexpr const double Period = 100.0;
+
+static Vector3d analyticPosition(double t)
+{
+    double M = 2.0 * PI * t / Period;
+    return Vector3d(1.0e6 * cos(M), 6.0e5 * sin(M), 2.0e5 * sin(2.0 * M));
+}
+
+static Vector3d analyticVelocity(double t)
+{
+    double n = 2.0 * PI / Period;
+    double M = n * t;
+    return Vector3d(-1.0e6 * n * sin(M), 6.0e5 * n * cos(M), 4.0e5 * n * cos(2.0 * M));
+}
+
+// xyzv samples of the analytic orbit, with velocities in km/s
+static std::vector<XYZVBinaryData> makeSamples(double begin, double end, double step)
+{
+    std::vector<XYZVBinaryData> samples;
+    for (double t = begin; t <= end; t += step)
+    {
+        XYZVBinaryData s;
+        s.tdb = t;
+        Map<Vector3d>(s.position) = analyticPosition(t);
+        Map<Vector3d>(s.velocity) = analyticVelocity(t) / astro::daysToSecs(1.0);
+        samples.push_back(s);
+    }
+    return samples;
+}
+
+
+TEST_CASE("Chebyshev fit of xyzv samples", "[ChebyshevOrbit]")
+{
+    // With samples this dense the cubic interpolation the fit follows is
+    // within a meter of the analytic orbit.
+    const double begin = 2451545.0;
+    const double end = begin + 4.0 * Period;
+    const double tolerance = 1.0;
+    auto samples = makeSamples(begin, end, 0.25);
+
+    std::unique_ptr<ChebyshevOrbit> orbit(ChebyshevOrbit::fit(samples, ChebyshevOrbit::DefaultDegree, tolerance));
+    REQUIRE(orbit != nullptr);
+    REQUIRE(orbit->getSegmentCount() > 1);
+
+    double validBegin, validEnd;
+    orbit->getValidRange(validBegin, validEnd);
+    REQUIRE(validBegin == samples.front().tdb);
+    REQUIRE(validEnd == samples.back().tdb);
+
+    SECTION("Error at and between the samples is within the tolerance")
+    {
+        for (size_t i = 0; i < samples.size(); i++)
+        {
+            double t = samples[i].tdb;
+            REQUIRE((orbit->evaluatePosition(t) - analyticPosition(t)).norm() <= tolerance);
+            if (i + 1 < samples.size())
+            {
+                t = 0.5 * (t + samples[i + 1].tdb);
+                REQUIRE((orbit->evaluatePosition(t) - analyticPosition(t)).norm() <= tolerance + 0.001);
+            }
+        }
+    }
+
+    SECTION("Position and velocity at segment boundaries")
+    {
+        // On both sides of a boundary the constant time segment lookup has
+        // to pick a different segment.
+        const auto& boundaries = orbit->getBoundaries();
+        REQUIRE(boundaries.size() == orbit->getSegmentCount() + 1);
+        for (size_t i = 1; i + 1 < boundaries.size(); i++)
+        {
+            double t = boundaries[i];
+            REQUIRE(t > boundaries[i - 1]);
+
+            for (double dt : { -1.0e-6, 0.0, 1.0e-6 })
+            {
+                Vector3d v = analyticVelocity(t + dt);
+                REQUIRE((orbit->evaluatePosition(t + dt) - analyticPosition(t + dt)).norm() <= tolerance);
+                REQUIRE((orbit->evaluateVelocity(t + dt) - v).norm() <= 1.0e-3 * v.norm());
+            }
+        }
+    }
+
+    SECTION("Times outside the samples")
+    {
+        REQUIRE(orbit->evaluatePosition(begin - 10.0) == orbit->evaluatePosition(begin));
+        REQUIRE(orbit->evaluatePosition(end + 10.0) == orbit->evaluatePosition(validEnd));
+        REQUIRE(orbit->evaluateVelocity(begin - 10.0) == Vector3d::Zero());
+    }
+}
+
+
+TEST_CASE("Chebyshev fit of a position function", "[ChebyshevOrbit]")
+{
+    const double begin = 2451545.0;
+    const double end = begin + 10.0 * Period;
+    const double tolerance = 0.1;
+
+    std::unique_ptr<ChebyshevOrbit> orbit(ChebyshevOrbit::fit(analyticPosition, begin, end,
+                                                               ChebyshevOrbit::DefaultDegree,
+                                                               tolerance, 0.01));
+    REQUIRE(orbit != nullptr);
+    REQUIRE(orbit->getSegmentCount() > 1);
+
+    std::mt19937 gen(30);
+    std::uniform_real_distribution<double> time(begin, end);
+    for (int i = 0; i < 10000; i++)
+    {
+        double t = time(gen);
+        REQUIRE((orbit->evaluatePosition(t) - analyticPosition(t)).norm() <= tolerance);
+    }
+
+    REQUIRE(ChebyshevOrbit::fit(analyticPosition, end, begin, ChebyshevOrbit::DefaultDegree, tolerance, 0.01) == nullptr);
+}
+
+
+TEST_CASE("Saved Chebyshev fits", "[ChebyshevOrbit]")
+{
+    const char* source = "chebyshevorbit_test.xyzv";
+    const char* filename = "chebyshevorbit_test.xyzvcheb";
+    const double begin = 2451545.0;
+    const double tolerance = 1.0;
+    auto samples = makeSamples(begin, begin + 2.0 * Period, 0.5);
+
+    {
+        std::ofstream out(source);
+        for (const auto& s : samples)
+            out << s.tdb << ' ' << s.position[0] << ' ' << s.position[1] << ' ' << s.position[2] << " 0 0 0\n";
+    }
+
+    std::unique_ptr<ChebyshevOrbit> orbit(ChebyshevOrbit::fit(samples, ChebyshevOrbit::DefaultDegree, tolerance));
+    REQUIRE(orbit != nullptr);
+    REQUIRE(orbit->save(filename, source, tolerance));
+
+    SECTION("Up to date fits are loaded")
+    {
+        std::unique_ptr<ChebyshevOrbit> loaded(ChebyshevOrbit::load(filename, source, tolerance));
+        REQUIRE(loaded != nullptr);
+        REQUIRE(loaded->getBoundaries() == orbit->getBoundaries());
+        for (double t = begin; t < begin + 2.0 * Period; t += 0.3)
+            REQUIRE(loaded->evaluatePosition(t) == orbit->evaluatePosition(t));
+
+        // A tighter fit is good for a looser tolerance too
+        loaded.reset(ChebyshevOrbit::load(filename, source, 2.0 * tolerance));
+        REQUIRE(loaded != nullptr);
+    }
+
+    SECTION("Fits made with a larger tolerance are refused")
+    {
+        REQUIRE(ChebyshevOrbit::load(filename, source, 0.5 * tolerance) == nullptr);
+    }
+
+    SECTION("Fits of other samples are refused")
+    {
+        {
+            std::ofstream out(source, std::ios::app);
+            out << begin + 2.0 * Period + 1.0 << " 0 0 0 0 0 0\n";
+        }
+        REQUIRE(ChebyshevOrbit::load(filename, source, tolerance) == nullptr);
+    }
+
+    SECTION("Broken files are refused")
+    {
+        std::string contents;
+        {
+            std::ifstream in(filename, std::ios::binary);
+            contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+
+        // Truncated
+        {
+            std::ofstream out(filename, std::ios::binary);
+            out.write(contents.data(), contents.size() - sizeof(double));
+        }
+        REQUIRE(ChebyshevOrbit::load(filename, source, tolerance) == nullptr);
+
+        // A segment count far too large for the file
+        ChebyshevBinaryHeader header;
+        memcpy(&header, contents.data(), sizeof(header));
+        header.count = UINT64_C(1) << 40;
+        memcpy(&contents[0], &header, sizeof(header));
+        {
+            std::ofstream out(filename, std::ios::binary);
+            out.write(contents.data(), contents.size());
+        }
+        REQUIRE(ChebyshevOrbit::load(filename, source, tolerance) == nullptr);
+    }
+
+    std::remove(filename);
+    std::remove(source);
+}
@@ -0,0 +1,130 @@
+#include <celutil/framequeue.h>
+#include <celutil/yuvconvert.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+constexpr const int Width = 37;
+constexpr const int Height = 23;
+constexpr const int RowStride = (Width * 3 + 3) & ~3;
+constexpr const int FrameSize = RowStride * Height;
+
+// Convert a frame the way movie capture does; the planes are stored one
+// after another.
+static std::vector<uint8_t> convertFrame(YUVConverter& converter, const uint8_t* rgb)
+{
+    const int frameWidth = (Width + 1) & ~1;
+    const int frameHeight = (Height + 1) & ~1;
+    std::vector<uint8_t> yuv(frameWidth * frameHeight * 3 / 2, 0);
+    YUVConverter::Planes planes;
+    planes.y = yuv.data();
+    planes.u = planes.y + frameWidth * frameHeight;
+    planes.v = planes.u + frameWidth * frameHeight / 4;
+    planes.yStride = frameWidth;
+    planes.uvStride = frameWidth / 2;
+    converter.convert(rgb, Width, Height, RowStride, true, planes);
+    return yuv;
+}
+
+
+TEST_CASE("Frame queue", "[FrameQueue]")
+{
+    SECTION("Queued frames give the same video as converting them in place")
+    {
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<int> byte(0, 255);
+        std::uniform_int_distribution<int> delay(0, 2000);
+
+        std::vector<std::vector<uint8_t>> expected;
+        std::vector<std::vector<uint8_t>> result;
+        YUVConverter syncConverter;
+        YUVConverter asyncConverter;
+        std::vector<int> delays(100);
+        for (auto& d : delays)
+            d = delay(gen);
+
+        {
+            // A slow and uneven encoder, so that the queue both grows and
+            // reuses its buffers
+            size_t index = 0;
+            FrameQueue queue(FrameSize, FrameSize * 8, [&](const unsigned char* frame)
+            {
+                result.push_back(convertFrame(asyncConverter, frame));
+                std::this_thread::sleep_for(std::chrono::microseconds(delays[index++]));
+            });
+            REQUIRE(queue.getMaxFrameCount() == 8);
+
+            std::vector<uint8_t> rgb(FrameSize);
+            for (size_t i = 0; i < delays.size(); i++)
+            {
+                for (auto& b : rgb)
+                    b = (uint8_t) byte(gen);
+                expected.push_back(convertFrame(syncConverter, rgb.data()));
+
+                unsigned char* frame = queue.acquire();
+                std::memcpy(frame, rgb.data(), FrameSize);
+                queue.submit(frame);
+            }
+            queue.finish();
+            REQUIRE(queue.getFrameCount() <= queue.getMaxFrameCount());
+        }
+
+        REQUIRE(result == expected);
+    }
+
+    SECTION("The producer only waits once all buffers are queued")
+    {
+        std::mutex gateMutex;
+        std::condition_variable gateCond;
+        bool open = false;
+        std::atomic<int> processed { 0 };
+
+        FrameQueue queue(1000, 10000, [&](const unsigned char*)
+        {
+            std::unique_lock<std::mutex> lock(gateMutex);
+            gateCond.wait(lock, [&] { return open; });
+            processed++;
+        });
+        REQUIRE(queue.getMaxFrameCount() == 10);
+
+        // The encoder is stuck on the first frame; all ten buffers can
+        // still be filled without waiting.
+        auto producer = std::async(std::launch::async, [&]
+        {
+            for (int i = 0; i < 10; i++)
+                queue.submit(queue.acquire());
+        });
+        REQUIRE(producer.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+        REQUIRE(queue.getFrameCount() == 10);
+
+        // The next frame has to wait for the encoder
+        auto blocked = std::async(std::launch::async, [&] { queue.submit(queue.acquire()); });
+        REQUIRE(blocked.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout);
+
+        {
+            std::lock_guard<std::mutex> lock(gateMutex);
+            open = true;
+        }
+        gateCond.notify_all();
+        blocked.wait();
+        queue.finish();
+        REQUIRE(processed == 11);
+        REQUIRE(queue.getFrameCount() == 10);
+    }
+
+    SECTION("Large frames get at least the minimum number of buffers")
+    {
+        FrameQueue queue(1000, 100, [](const unsigned char*) {});
+        REQUIRE(queue.getMaxFrameCount() == FrameQueue::MinFrames);
+    }
+}
@@ -0,0 +1,160 @@
+#include <tools/cmod/common/meshoptimize.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <random>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+// Triangle list of a grid of n by n quads, in row order
+static std::vector<uint32_t> makeGrid(uint32_t n)
+{
+    std::vector<uint32_t> indices;
+    for (uint32_t y = 0; y < n; y++)
+    {
+        for (uint32_t x = 0; x < n; x++)
+        {
+            uint32_t v0 = y * (n + 1) + x;
+            uint32_t v1 = v0 + 1;
+            uint32_t v2 = v0 + n + 1;
+            uint32_t v3 = v2 + 1;
+            indices.insert(indices.end(), { v0, v1, v2, v2, v1, v3 });
+        }
+    }
+    return indices;
+}
+
+// Triangles rotated so that their lowest index comes first, sorted
+static std::vector<std::array<uint32_t, 3>> triangleSet(const std::vector<uint32_t>& indices)
+{
+    std::vector<std::array<uint32_t, 3>> triangles;
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        std::array<uint32_t, 3> t { indices[i], indices[i + 1], indices[i + 2] };
+        while (t[0] > t[1] || t[0] > t[2])
+            std::rotate(t.begin(), t.begin() + 1, t.end());
+        triangles.push_back(t);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+TEST_CASE("Vertex cache simulation", "[MeshOptimize]")
+{
+    SECTION("Every vertex is transformed once when it fits in the cache")
+    {
+        std::vector<uint32_t> indices { 0, 1, 2, 2, 1, 3, 3, 1, 4 };
+        VertexCacheStats stats = SimulateVertexCache(indices.data(), indices.size(), 5, 16);
+        REQUIRE(stats.triangles == 3);
+        REQUIRE(stats.vertices == 5);
+        REQUIRE(stats.transforms == 5);
+    }
+
+    SECTION("The cache is FIFO: hits don't refresh entries")
+    {
+        // With 4 entries, vertex 0 is evicted by 4 although it was reused
+        std::vector<uint32_t> indices { 0, 1, 2, 0, 3, 4, 0, 1, 2 };
+        VertexCacheStats stats = SimulateVertexCache(indices.data(), indices.size(), 5, 4);
+        REQUIRE(stats.vertices == 5);
+        REQUIRE(stats.transforms == 8);
+    }
+}
+
+TEST_CASE("Vertex cache optimization", "[MeshOptimize]")
+{
+    const uint32_t n = 64;
+    const uint32_t nVertices = (n + 1) * (n + 1);
+    std::vector<uint32_t> indices = makeGrid(n);
+
+    // Shuffle the triangles to get a poor order to start with
+    std::vector<uint32_t> order(indices.size() / 3);
+    for (uint32_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(1234));
+    std::vector<uint32_t> shuffled;
+    for (uint32_t t : order)
+        shuffled.insert(shuffled.end(), &indices[t * 3], &indices[t * 3 + 3]);
+
+    VertexCacheStats before = SimulateVertexCache(shuffled.data(), shuffled.size(), nVertices, 16);
+    std::vector<uint32_t> optimized = shuffled;
+    OptimizeVertexCache(optimized.data(), optimized.size(), nVertices, 16);
+    VertexCacheStats after = SimulateVertexCache(optimized.data(), optimized.size(), nVertices, 16);
+
+    REQUIRE(triangleSet(optimized) == triangleSet(shuffled));
+    REQUIRE(before.acmr() > 2.0f);
+    REQUIRE(after.acmr() < 0.8f);
+    REQUIRE(after.atvr() < 1.6f);
+}
+
+TEST_CASE("Vertex fetch remapping", "[MeshOptimize]")
+{
+    std::vector<uint32_t> indices { 5, 2, 7, 7, 2, 0 };
+    std::vector<uint32_t> remap;
+    uint32_t used = BuildVertexFetchRemap(indices.data(), indices.size(), 8, remap);
+
+    REQUIRE(used == 4);
+    REQUIRE(remap[5] == 0);
+    REQUIRE(remap[2] == 1);
+    REQUIRE(remap[7] == 2);
+    REQUIRE(remap[0] == 3);
+    REQUIRE(remap[1] == ~0u);
+}
+
+TEST_CASE("Vertex welding", "[MeshOptimize]")
+{
+    struct TestVertex
+    {
+        float position[3];
+        float texCoord[2];
+    };
+
+    // Few distinct values so that there are many duplicates
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> value(0, 3);
+    std::vector<TestVertex> vertices(100000);
+    for (auto& v : vertices)
+    {
+        for (float& p : v.position)
+            p = (float) value(gen) * 0.5f;
+        for (float& t : v.texCoord)
+            t = (float) (value(gen) % 2);
+    }
+    vertices[17].position[0] = -0.0f;
+    vertices[18].position[0] = 0.0f;
+
+    SECTION("Whole vertices")
+    {
+        std::vector<uint32_t> representative;
+        uint32_t unique = FindIdenticalVertices(vertices.data(), vertices.size(), sizeof(TestVertex),
+                                                representative);
+
+        std::map<std::vector<char>, uint32_t> first;
+        for (uint32_t i = 0; i < vertices.size(); i++)
+        {
+            const char* p = reinterpret_cast<const char*>(&vertices[i]);
+            first.insert({ std::vector<char>(p, p + sizeof(TestVertex)), i });
+            REQUIRE(representative[i] == first[std::vector<char>(p, p + sizeof(TestVertex))]);
+        }
+        REQUIRE(unique == first.size());
+    }
+
+    SECTION("Positions")
+    {
+        std::vector<uint32_t> representative;
+        uint32_t unique = FindIdenticalPositions(vertices.data(), vertices.size(), sizeof(TestVertex), 0,
+                                                 representative);
+
+        std::map<std::array<float, 3>, uint32_t> first;
+        for (uint32_t i = 0; i < vertices.size(); i++)
+        {
+            std::array<float, 3> p { vertices[i].position[0], vertices[i].position[1], vertices[i].position[2] };
+            first.insert({ p, i });
+            REQUIRE(representative[i] == first[p]);
+        }
+        REQUIRE(unique == first.size());
+    }
+}
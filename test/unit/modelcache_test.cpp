@@ -0,0 +1,305 @@
+#include <cel3ds/3dschunk.h>
+#include <cel3ds/3dsread.h>
+#include <celmodel/modelcache.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+using namespace cmod;
+using namespace Eigen;
+
+// Little endian writer for 3DS chunks
+class ChunkWriter
+{
+public:
+    void u16(uint16_t v) { bytes(&v, 2); }
+    void u32(uint32_t v) { bytes(&v, 4); }
+    void f32(float v) { bytes(&v, 4); }
+    void str(const std::string& s) { data.insert(data.end(), s.c_str(), s.c_str() + s.size() + 1); }
+
+    void begin(uint16_t type)
+    {
+        u16(type);
+        starts.push_back(data.size());
+        u32(0);
+    }
+
+    void end()
+    {
+        size_t start = starts.back();
+        starts.pop_back();
+        uint32_t size = (uint32_t) (data.size() - start + 2);
+        std::memcpy(&data[start], &size, 4);
+    }
+
+    std::vector<char> data;
+
+private:
+    void bytes(const void* p, size_t n)
+    {
+        const char* c = static_cast<const char*>(p);
+        data.insert(data.end(), c, c + n);
+    }
+
+    std::vector<size_t> starts;
+};
+
+// A file with one material and a textured quad made of two triangles.
+// The x coordinates are offset to tell different versions apart.
+static std::vector<char> makeSample3DS(float offset = 0.0f, const std::string& objectName = "quad")
+{
+    ChunkWriter w;
+    w.begin(M3DCHUNK_MAGIC);
+    w.begin(M3DCHUNK_MESHDATA);
+
+    w.begin(M3DCHUNK_MATERIAL_ENTRY);
+    w.begin(M3DCHUNK_MATERIAL_NAME);
+    w.str("red");
+    w.end();
+    w.begin(M3DCHUNK_MATERIAL_DIFFUSE);
+    w.begin(M3DCHUNK_COLOR_24);
+    w.data.insert(w.data.end(), { (char) 255, 0, 0 });
+    w.end();
+    w.end();
+    w.end();
+
+    w.begin(M3DCHUNK_NAMED_OBJECT);
+    w.str(objectName);
+    w.begin(M3DCHUNK_TRIANGLE_MESH);
+    w.begin(M3DCHUNK_POINT_ARRAY);
+    w.u16(4);
+    const float points[4][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 } };
+    for (const auto& p : points)
+    {
+        w.f32(p[0] + offset);
+        w.f32(p[1]);
+        w.f32(p[2]);
+    }
+    w.end();
+    w.begin(M3DCHUNK_MESH_TEXTURE_COORDS);
+    w.u16(4);
+    for (const auto& p : points)
+    {
+        w.f32(p[0]);
+        w.f32(p[1]);
+    }
+    w.end();
+    w.begin(M3DCHUNK_FACE_ARRAY);
+    w.u16(2);
+    for (uint16_t v : { 0, 1, 2, 0, 0, 2, 3, 0 })
+        w.u16(v);
+    w.begin(M3DCHUNK_MESH_MATERIAL_GROUP);
+    w.str("red");
+    w.u16(2);
+    w.u16(0);
+    w.u16(1);
+    w.end();
+    w.end();
+    w.end();
+    w.end();
+
+    w.end();
+    w.end();
+    return w.data;
+}
+
+static void writeFile(const std::string& filename, const std::vector<char>& data)
+{
+    std::ofstream out(filename, std::ios::out | std::ios::binary);
+    out.write(data.data(), data.size());
+}
+
+// A minimal conversion to test the cache with: positions and indices only
+static Model* convertScene(const M3DScene& scene)
+{
+    auto* model = new Model();
+    model->addMaterial(new Material());
+    for (uint32_t i = 0; i < scene.getModelCount(); i++)
+    {
+        M3DModel* model3ds = scene.getModel(i);
+        for (uint32_t j = 0; j < model3ds->getTriMeshCount(); j++)
+        {
+            M3DTriangleMesh* triMesh = model3ds->getTriMesh(j);
+            auto* vertices = new float[triMesh->getVertexCount() * 3];
+            for (uint32_t k = 0; k < triMesh->getVertexCount(); k++)
+                Map<Vector3f>(vertices + k * 3) = triMesh->getVertex(k);
+
+            auto* indices = new Mesh::index32[triMesh->getFaceCount() * 3];
+            for (uint32_t k = 0; k < triMesh->getFaceCount(); k++)
+            {
+                uint16_t v0, v1, v2;
+                triMesh->getFace(k, v0, v1, v2);
+                indices[k * 3] = v0;
+                indices[k * 3 + 1] = v1;
+                indices[k * 3 + 2] = v2;
+            }
+
+            Mesh::VertexAttribute position(Mesh::Position, Mesh::Float3, 0);
+            auto* mesh = new Mesh();
+            mesh->setVertexDescription(Mesh::VertexDescription(12, 1, &position));
+            mesh->setVertices(triMesh->getVertexCount(), vertices);
+            mesh->addGroup(Mesh::TriList, 0, triMesh->getFaceCount() * 3, indices);
+            model->addMesh(mesh);
+        }
+    }
+    return model;
+}
+
+static float firstX(const Model& model)
+{
+    return model.getMesh(0)->getPosition(0).x();
+}
+
+TEST_CASE("3DS reader", "[3DS]")
+{
+    std::vector<char> data = makeSample3DS();
+
+    SECTION("Scene contents")
+    {
+        std::unique_ptr<M3DScene> scene(Read3DSFile(data.data(), data.size()));
+        REQUIRE(scene != nullptr);
+        REQUIRE(scene->getMaterialCount() == 1);
+        REQUIRE(scene->getMaterial(0)->getName() == "red");
+        REQUIRE(scene->getMaterial(0)->getDiffuseColor().red == 1.0f);
+        REQUIRE(scene->getMaterial(0)->getDiffuseColor().green == 0.0f);
+
+        REQUIRE(scene->getModelCount() == 1);
+        REQUIRE(scene->getModel(0)->getName() == "quad");
+        REQUIRE(scene->getModel(0)->getTriMeshCount() == 1);
+        M3DTriangleMesh* triMesh = scene->getModel(0)->getTriMesh(0);
+        REQUIRE(triMesh->getVertexCount() == 4);
+        REQUIRE(triMesh->getVertex(2) == Vector3f(1.0f, 1.0f, 0.0f));
+        REQUIRE(triMesh->getTexCoordCount() == 4);
+        REQUIRE(triMesh->getTexCoord(3) == Vector2f(0.0f, -1.0f));
+        REQUIRE(triMesh->getFaceCount() == 2);
+        uint16_t v0, v1, v2;
+        triMesh->getFace(1, v0, v1, v2);
+        REQUIRE((v0 == 0 && v1 == 2 && v2 == 3));
+        REQUIRE(triMesh->getMeshMaterialGroupCount() == 1);
+        REQUIRE(triMesh->getMeshMaterialGroup(0)->faces.size() == 2);
+    }
+
+    SECTION("Truncated and corrupt files are rejected")
+    {
+        REQUIRE(Read3DSFile(data.data(), data.size() - 10) == nullptr);
+        REQUIRE(Read3DSFile(data.data(), 3) == nullptr);
+
+        std::vector<char> bad = data;
+        bad[0] = 0;
+        REQUIRE(Read3DSFile(bad.data(), bad.size()) == nullptr);
+    }
+
+    SECTION("Reading from a file")
+    {
+        writeFile("modelcache_test.3ds", data);
+        std::unique_ptr<M3DScene> scene(Read3DSFile(fs::path("modelcache_test.3ds")));
+        REQUIRE(scene != nullptr);
+        REQUIRE(scene->getModel(0)->getTriMesh(0)->getFaceCount() == 2);
+        std::remove("modelcache_test.3ds");
+    }
+}
+
+TEST_CASE("Model cache", "[ModelCache]")
+{
+    const std::string source = "modelcache_test.3ds";
+    const std::string cacheDir = "modelcache_test_dir";
+    ModelCache cache(cacheDir);
+    writeFile(source, makeSample3DS(0.0f));
+
+    auto convertAndSave = [&](const std::string& parameters)
+    {
+        std::unique_ptr<M3DScene> scene(Read3DSFile(fs::path(source)));
+        REQUIRE(scene != nullptr);
+        std::unique_ptr<Model> model(convertScene(*scene));
+        REQUIRE(cache.save(source, parameters, *model));
+    };
+
+    // Start from an empty cache
+    std::remove(cache.getCacheFile(source, "test 1").string().c_str());
+    std::remove(cache.getCacheFile(source, "test 2").string().c_str());
+
+    SECTION("Misses and hits")
+    {
+        REQUIRE(cache.load(source, "test 1") == nullptr);
+        convertAndSave("test 1");
+
+        std::unique_ptr<Model> model(cache.load(source, "test 1"));
+        REQUIRE(model != nullptr);
+        REQUIRE(model->getMeshCount() == 1);
+        REQUIRE(model->getMesh(0)->getVertexCount() == 4);
+        REQUIRE(model->getMesh(0)->getPosition(2) == Vector3f(1.0f, 1.0f, 0.0f));
+        REQUIRE(model->getMesh(0)->getGroup(0)->nIndices == 6);
+
+        // Other conversion parameters have their own entries
+        REQUIRE(cache.load(source, "test 2") == nullptr);
+        REQUIRE(cache.getCacheFile(source, "test 2") != cache.getCacheFile(source, "test 1"));
+
+        REQUIRE(cache.load("modelcache_test_missing.3ds", "test 1") == nullptr);
+    }
+
+    SECTION("Changing the source invalidates the entry")
+    {
+        convertAndSave("test 1");
+        REQUIRE(std::unique_ptr<Model>(cache.load(source, "test 1")) != nullptr);
+
+        // Different size
+        writeFile(source, makeSample3DS(5.0f, "longer name"));
+        REQUIRE(cache.load(source, "test 1") == nullptr);
+
+        convertAndSave("test 1");
+        std::unique_ptr<Model> model(cache.load(source, "test 1"));
+        REQUIRE(model != nullptr);
+        REQUIRE(firstX(*model) == 5.0f);
+
+#ifndef _WIN32
+        // Same size, different modification time
+        writeFile(source, makeSample3DS(7.0f, "longer name"));
+        utimbuf times { 1000000000, 1000000000 };
+        REQUIRE(utime(source.c_str(), &times) == 0);
+        REQUIRE(cache.load(source, "test 1") == nullptr);
+
+        convertAndSave("test 1");
+        model.reset(cache.load(source, "test 1"));
+        REQUIRE(model != nullptr);
+        REQUIRE(firstX(*model) == 7.0f);
+#endif
+    }
+
+    SECTION("Damaged cache files are ignored")
+    {
+        convertAndSave("test 1");
+        fs::path cacheFile = cache.getCacheFile(source, "test 1");
+        std::ifstream in(cacheFile.string(), std::ios::in | std::ios::binary);
+        std::vector<char> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        in.close();
+
+        contents.resize(contents.size() / 2);
+        writeFile(cacheFile.string(), contents);
+        REQUIRE(cache.load(source, "test 1") == nullptr);
+
+        contents[0] = 'X';
+        writeFile(cacheFile.string(), contents);
+        REQUIRE(cache.load(source, "test 1") == nullptr);
+    }
+
+    std::remove(cache.getCacheFile(source, "test 1").string().c_str());
+    std::remove(source.c_str());
+#ifdef _WIN32
+    _rmdir(cacheDir.c_str());
+#else
+    rmdir(cacheDir.c_str());
+#endif
+}
@@ -0,0 +1,142 @@
+#include <celengine/astro.h>
+#include <celengine/octreebuilder.h>
+#include <celengine/staroctree.h>
+#include <celutil/workerpool.h>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#include "starcollector.h"
+
+using namespace Eigen;
+
+// Same parameters as the star database
+static const float RootSize = 1.0e9f;
+static const Vector3f RootCenter(1000.0f, 1000.0f, 1000.0f);
+static const float RootExclusionFactor = astro::appToAbsMag(6.0f, RootSize * (float) std::sqrt(3.0));
+
+// Stars clustered around the origin with a sparse halo and some binary
+// systems, whose orbits make them straddle node boundaries.
+static std::vector<Star> makeStars(unsigned int nStars, StarDetails* details, StarDetails* binaryDetails)
+{
+    std::mt19937 gen(48);
+    std::normal_distribution<float> cluster(0.0f, 300.0f);
+    std::uniform_real_distribution<float> halo(-1.0e5f, 1.0e5f);
+    std::uniform_real_distribution<float> absMag(-8.0f, 17.0f);
+    std::uniform_int_distribution<int> kind(0, 99);
+
+    std::vector<Star> stars(nStars);
+    for (unsigned int i = 0; i < nStars; i++)
+    {
+        Star& star = stars[i];
+        int k = kind(gen);
+        if (k < 90)
+            star.setPosition(cluster(gen), cluster(gen), cluster(gen));
+        else if (k < 98 || i == 0)
+            star.setPosition(halo(gen), halo(gen), halo(gen));
+        else if (k < 99)
+            star.setPosition(stars[i - 1].getPosition());  // duplicate position
+        else
+            star.setPosition(100.0f, 200.0f, 300.0f);      // many at one position
+        star.setDetails(k == 0 ? binaryDetails : details);
+        star.setAbsoluteMagnitude(absMag(gen));
+        star.setIndex(i);
+    }
+    return stars;
+}
+
+TEST_CASE("Octree builder", "[Octree]")
+{
+    // Several threads even on a single core machine
+    InitWorkerPool(4);
+
+    StarDetails details;
+    StarDetails binaryDetails;
+    binaryDetails.setOrbitalRadius(0.5f);
+    std::vector<Star> stars = makeStars(200000, &details, &binaryDetails);
+
+    // Reference octree built by inserting the stars one by one
+    std::unique_ptr<DynamicStarOctree> dynamicRoot(new DynamicStarOctree(RootCenter, RootExclusionFactor));
+    for (const auto& star : stars)
+        dynamicRoot->insertObject(star, RootSize);
+    std::unique_ptr<Star[]> referenceStars(new Star[stars.size()]);
+    Star* firstStar = referenceStars.get();
+    StarOctree* referenceRoot = nullptr;
+    dynamicRoot->rebuildAndSort(referenceRoot, firstStar);
+    std::unique_ptr<StarOctree> reference(referenceRoot);
+
+    std::unique_ptr<Star[]> sortedStars(new Star[stars.size()]);
+    std::unique_ptr<StarOctree> octree(OctreeBuilder<Star, float>::build(stars, stars.size(), sortedStars.get(),
+                                                                         RootCenter, RootSize, RootExclusionFactor));
+
+    SECTION("Every star is sorted into the octree once")
+    {
+        REQUIRE(octree->countObjects() == (int) stars.size());
+        std::vector<uint32_t> indices;
+        for (size_t i = 0; i < stars.size(); i++)
+            indices.push_back(sortedStars[i].getIndex());
+        std::sort(indices.begin(), indices.end());
+        std::vector<uint32_t> expected(stars.size());
+        std::iota(expected.begin(), expected.end(), 0);
+        REQUIRE(indices == expected);
+
+        // Split decisions may differ from the insertion order dependent
+        // ones of the reference, but not by much.
+        int nodes = octree->countChildren();
+        int referenceNodes = reference->countChildren();
+        INFO("Nodes " << nodes << ", reference " << referenceNodes);
+        REQUIRE(nodes > referenceNodes * 3 / 4);
+        REQUIRE(nodes < referenceNodes * 5 / 4);
+    }
+
+    SECTION("Visibility queries find the same stars")
+    {
+        std::mt19937 gen(4800);
+        std::normal_distribution<float> position(0.0f, 500.0f);
+        std::normal_distribution<float> component;
+        for (int query = 0; query < 30; query++)
+        {
+            Vector3f obsPosition(position(gen), position(gen), position(gen));
+            Quaternionf orientation(component(gen), component(gen), component(gen), component(gen));
+            orientation.normalize();
+            float limitingMag = 4.0f + (float) (query % 4) * 3.0f;
+
+            Hyperplane<float, 3> planes[5];
+            computeFrustumPlanes(planes, obsPosition, orientation);
+
+            StarCollector expected(planes);
+            reference->processVisibleObjects(expected, obsPosition, planes, limitingMag, RootSize);
+            StarCollector found(planes);
+            octree->processVisibleObjects(found, obsPosition, planes, limitingMag, RootSize);
+
+            // Brute force
+            std::vector<uint32_t> visible;
+            for (const auto& star : stars)
+            {
+                float distance = (obsPosition - star.getPosition()).norm();
+                if (astro::absToAppMag(star.getAbsoluteMagnitude(), distance) >= limitingMag)
+                    continue;
+                if (std::all_of(planes, planes + 5, [&](const Hyperplane<float, 3>& p) { return p.signedDistance(star.getPosition()) >= 0.0f; }))
+                    visible.push_back(star.getIndex());
+            }
+
+            INFO("Query " << query << ", limiting magnitude " << limitingMag);
+            REQUIRE(!visible.empty());
+            REQUIRE(found.sortedIndices() == expected.sortedIndices());
+            REQUIRE(found.sortedIndices() == visible);
+
+            StarCollector expectedClose(nullptr);
+            reference->processCloseObjects(expectedClose, obsPosition, 50.0f, RootSize);
+            StarCollector foundClose(nullptr);
+            octree->processCloseObjects(foundClose, obsPosition, 50.0f, RootSize);
+            REQUIRE(foundClose.sortedIndices() == expectedClose.sortedIndices());
+        }
+    }
+}
@@ -0,0 +1,207 @@
+#include <celengine/body.h>
+#include <celengine/frame.h>
+#include <celengine/render.h>
+#include <celengine/shadowcasterindex.h>
+#include <celengine/solarsys.h>
+#include <celengine/star.h>
+#include <celengine/timeline.h>
+#include <celengine/timelinephase.h>
+#include <celengine/universe.h>
+#include <celephem/orbit.h>
+#include <celephem/rotation.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+using namespace Eigen;
+
+constexpr const double Now = 2451545.0;
+constexpr const double SunRadius = 696000.0;
+constexpr const int RandomBodies = 100;
+constexpr const int BodyCount = 300;
+
+// Satellites of a planet 5 AU from the star, lit by it and by a companion
+// star. Most of them are placed close to the shadow axis of another one,
+// in front of or behind it, so that many eclipses and near misses are
+// tested.
+struct Scene
+{
+    Scene()
+    {
+        universe.setSolarSystemCatalog(new SolarSystemCatalog());
+        for (Star* star : { &sun, &companion })
+            star->setDetails(&details);
+        companion.setPosition(Vector3f(0.0002f, 0.0001f, 0.0f));
+
+        solarSystem = universe.createSolarSystem(&sun);
+        system = solarSystem->getPlanets();
+        frame = std::make_shared<J2000EclipticFrame>(Selection(&sun));
+
+        std::mt19937 gen(1234);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        std::normal_distribution<double> normal;
+
+        Vector3d planet(7.5e8, 1.0e7, -1.5e8);
+        for (int i = 0; i < BodyCount; i++)
+        {
+            double radius;
+            Vector3d position;
+            if (i < RandomBodies)
+            {
+                radius = std::exp(uniform(gen) * std::log(5000.0));
+                position = planet + Vector3d(normal(gen), normal(gen), normal(gen)) * 2.0e6;
+            }
+            else
+            {
+                // Near the shadow of an earlier body, as seen from one of
+                // the stars
+                const Body* caster = system->getBody((int) (uniform(gen) * RandomBodies));
+                radius = caster->getRadius() * (0.05 + 1.5 * uniform(gen));
+                Vector3d casterPosition = caster->getAstrocentricPosition(Now);
+                Vector3d light = uniform(gen) < 0.5 ? Vector3d::Zero() : getLightPosition(&companion);
+                Vector3d axis = casterPosition - light;
+                double apparentSize = SunRadius / axis.norm();
+                axis.normalize();
+                Vector3d side = axis.unitOrthogonal();
+                side = AngleAxisd(uniform(gen) * 2.0 * PI, axis) * side;
+                double along = (uniform(gen) < 0.8 ? 1.0 : -0.1) * uniform(gen) * 2.0e6;
+                double reach = caster->getRadius() + radius + apparentSize * std::abs(along);
+                if (caster->getRings() != nullptr)
+                    reach += caster->getRings()->outerRadius;
+                position = casterPosition + axis * along + side * (reach * 2.0 * uniform(gen));
+            }
+
+            Body* body = addBody(position, (float) radius);
+            if (uniform(gen) < 0.1)
+                body->setRings(RingSystem((float) radius * 1.2f, (float) (radius * (1.5 + uniform(gen)))));
+            if (uniform(gen) < 0.05)
+                body->setVisible(false);
+        }
+    }
+
+    Body* addBody(const Vector3d& position, float radius)
+    {
+        auto* body = new Body(system, "body");
+        body->setSemiAxes(Vector3f::Constant(radius));
+
+        orbits.emplace_back(new FixedOrbit(position));
+        rotations.emplace_back(new ConstantOrientation(Quaterniond(AngleAxisd(0.3 * orbits.size(), Vector3d::UnitX()))));
+        auto phase = TimelinePhase::CreateTimelinePhase(universe, body,
+                                                        -std::numeric_limits<double>::infinity(),
+                                                        std::numeric_limits<double>::infinity(),
+                                                        frame, *orbits.back(),
+                                                        frame, *rotations.back());
+        auto* timeline = new Timeline();
+        timeline->appendPhase(phase);
+        body->setTimeline(timeline);
+        return body;
+    }
+
+    Vector3d getLightPosition(const Star* light) const
+    {
+        return light->getPosition(Now).offsetFromKm(sun.getPosition(Now));
+    }
+
+    // The bodies shadowing receiver according to Renderer::testEclipse
+    std::vector<const Body*> getShadowingBodies(const Body* receiver, const Star* light) const
+    {
+        Vector3d receiverPosition = receiver->getAstrocentricPosition(Now);
+        LightingState::EclipseShadowVector shadows;
+        LightingState lights;
+        lights.nLights = 1;
+        lights.lights[0].position = getLightPosition(light) - receiverPosition;
+        lights.lights[0].apparentSize = (float) (SunRadius / lights.lights[0].position.norm());
+        lights.lights[0].castsShadows = true;
+        lights.lights[0].star = light;
+        lights.shadows[0] = &shadows;
+
+        std::vector<const Body*> result;
+        for (int i = 0; i < system->getSystemSize(); i++)
+        {
+            const Body* caster = system->getBody(i);
+            if (caster == receiver)
+                continue;
+
+            lights.ringShadows[0].ringSystem = nullptr;
+            if (Renderer::testEclipse(*receiver, *caster, lights, 0, Now) ||
+                lights.ringShadows[0].ringSystem != nullptr)
+            {
+                result.push_back(caster);
+            }
+        }
+        return result;
+    }
+
+    Universe universe;
+    StarDetails details;
+    Star sun;
+    Star companion;
+    SolarSystem* solarSystem;
+    PlanetarySystem* system;
+    ReferenceFrame::SharedConstPtr frame;
+    std::vector<std::unique_ptr<Orbit>> orbits;
+    std::vector<std::unique_ptr<RotationModel>> rotations;
+};
+
+
+TEST_CASE("Shadow caster index", "[ShadowCasterIndex]")
+{
+    Scene scene;
+    const PlanetarySystem* system = scene.system;
+
+    SECTION("Indexes are keyed by system, light and time")
+    {
+        ShadowCasterIndex index;
+        index.build(system, &scene.sun, Now);
+        REQUIRE(index.matches(system, &scene.sun, Now));
+        REQUIRE(!index.matches(system, &scene.companion, Now));
+        REQUIRE(!index.matches(system, &scene.sun, Now + 1.0e-6));
+        REQUIRE(!index.matches(nullptr, &scene.sun, Now));
+    }
+
+    SECTION("Casters include every body found by testEclipse")
+    {
+        size_t nShadowed = 0;
+        size_t nCandidates = 0;
+        for (const Star* light : { &scene.sun, &scene.companion })
+        {
+            ShadowCasterIndex index;
+            index.build(system, light, Now);
+            Vector3d lightPosition = scene.getLightPosition(light);
+
+            std::vector<const Body*> casters;
+            for (int i = 0; i < system->getSystemSize(); i++)
+            {
+                const Body* receiver = system->getBody(i);
+                Vector3d receiverPosition = receiver->getAstrocentricPosition(Now);
+                double apparentSize = SunRadius / (receiverPosition - lightPosition).norm();
+                index.findCasters(receiver, receiverPosition, apparentSize, casters);
+
+                // In system order, without the receiver
+                REQUIRE(std::is_sorted(casters.begin(), casters.end(),
+                                       [system](const Body* a, const Body* b)
+                                       { return system->getOrder(a) < system->getOrder(b); }));
+                REQUIRE(std::find(casters.begin(), casters.end(), receiver) == casters.end());
+
+                for (const Body* caster : scene.getShadowingBodies(receiver, light))
+                {
+                    INFO("receiver " << i << ", caster " << system->getOrder(caster));
+                    REQUIRE(std::find(casters.begin(), casters.end(), caster) != casters.end());
+                    nShadowed++;
+                }
+                nCandidates += casters.size();
+            }
+        }
+
+        // The scene has plenty of shadows, and the index leaves out most
+        // bodies.
+        REQUIRE(nShadowed > 100);
+        REQUIRE(nCandidates < 2 * BodyCount * (BodyCount - 1) / 10);
+    }
+}
@@ -0,0 +1,200 @@
+#include <celephem/spkreader.h>
+#include <celmath/mathlib.h>
+#include <celutil/bytes.h>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+using namespace Eigen;
+
+constexpr const double EPSILON = 1.0e-6;
+
+struct TestSegment
+{
+    double begin;
+    double end;
+    int target;
+    int center;
+    int frame;
+    int type;
+    std::vector<double> data;
+};
+
+// Write a minimal SPK file: the file record, one summary record, one name
+// record and the segment data.
+static void writeSPK(const char* filename, const std::vector<TestSegment>& segments)
+{
+    std::vector<double> words(3 * 128, 0.0);
+    char* header = reinterpret_cast<char*>(words.data());
+    memcpy(header, "DAF/SPK ", 8);
+    int32_t fileInts[5] = { 2, 6, 0, 0, 0 };
+    memcpy(header + 8, fileInts, 8);
+    int32_t records[3] = { 2, 2, 0 };
+    memcpy(header + 76, records, 12);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(header + 88, "BIG-IEEE", 8);
+#else
+    memcpy(header + 88, "LTL-IEEE", 8);
+#endif
+
+    double* summary = words.data() + 128;
+    summary[2] = (double) segments.size();
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        const TestSegment& s = segments[i];
+        auto first = (int32_t) words.size() + 1;
+        words.insert(words.end(), s.data.begin(), s.data.end());
+        auto last = (int32_t) words.size();
+
+        // words may have been reallocated
+        summary = words.data() + 128;
+        double* sum = summary + 3 + i * 5;
+        sum[0] = s.begin;
+        sum[1] = s.end;
+        int32_t ints[6] = { s.target, s.center, s.frame, s.type, first, last };
+        memcpy(sum + 2, ints, sizeof(ints));
+    }
+
+    std::ofstream out(filename, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(double));
+}
+
+// Type 2 segment with two one day records of quadratic polynomials
+static TestSegment type2Segment(int target, int center, int frame)
+{
+    TestSegment s { 0.0, 2 * 86400.0, target, center, frame, 2, {} };
+    for (int r = 0; r < 2; r++)
+    {
+        s.data.insert(s.data.end(), { 43200.0 + 86400.0 * r, 43200.0 });
+        s.data.insert(s.data.end(), { 1000.0 * (r + 1), 200.0, 10.0 });
+        s.data.insert(s.data.end(), { -500.0, 100.0 * (r + 1), 0.0 });
+        s.data.insert(s.data.end(), { 50.0, 0.0, 5.0 });
+    }
+    s.data.insert(s.data.end(), { 0.0, 86400.0, 11.0, 2.0 });
+    return s;
+}
+
+// Type 13 segment of uneven states of a body moving along a parabola, which
+// Hermite interpolation reproduces exactly
+static Vector3d parabola(double t)
+{
+    return Vector3d(1.0e5 + 2.0 * t, 3.0e4 - 0.5 * t + 1.0e-5 * t * t, 10.0);
+}
+
+static Vector3d parabolaVelocity(double t)
+{
+    return Vector3d(2.0, -0.5 + 2.0e-5 * t, 0.0);
+}
+
+static TestSegment type13Segment(int target, int center)
+{
+    std::vector<double> epochs = { 0.0, 1000.0, 3000.0, 3500.0, 7000.0, 8000.0, 12000.0 };
+    TestSegment s { 0.0, 12000.0, target, center, 17, 13, {} };
+    for (double t : epochs)
+    {
+        Vector3d p = parabola(t);
+        Vector3d v = parabolaVelocity(t);
+        s.data.insert(s.data.end(), { p.x(), p.y(), p.z(), v.x(), v.y(), v.z() });
+    }
+    s.data.insert(s.data.end(), epochs.begin(), epochs.end());
+    s.data.insert(s.data.end(), { 3.0, (double) epochs.size() });
+    return s;
+}
+
+TEST_CASE("SPK reader", "[SPK]")
+{
+    const char* filename = "spk_test.bsp";
+    writeSPK(filename, { type2Segment(399, 3, 17), type13Segment(301, 3), type2Segment(3, 0, 1) });
+
+    auto file = std::make_shared<SpkFile>();
+    REQUIRE(SpkFile::isSPK(filename));
+    REQUIRE(file->open(filename));
+    REQUIRE(file->getSegments().size() == 3);
+
+    SECTION("Type 2 segments")
+    {
+        const SpkFile::Segment& s = file->getSegments()[0];
+        REQUIRE(s.supported);
+        REQUIRE(s.target == 399);
+        REQUIRE(s.center == 3);
+
+        // Second record, x = 0.5
+        double et = 86400.0 + 43200.0 * 1.5;
+        Vector3d p, v;
+        REQUIRE(file->evaluate(s, et, p, &v));
+        REQUIRE(p.x() == Approx(2000.0 + 200.0 * 0.5 + 10.0 * (2.0 * 0.25 - 1.0)));
+        REQUIRE(p.y() == Approx(-500.0 + 200.0 * 0.5));
+        REQUIRE(p.z() == Approx(50.0 + 5.0 * (2.0 * 0.25 - 1.0)));
+        REQUIRE(v.x() == Approx((200.0 + 40.0 * 0.5) / 43200.0));
+        REQUIRE(v.y() == Approx(200.0 / 43200.0));
+    }
+
+    SECTION("Type 13 segments")
+    {
+        const SpkFile::Segment& s = file->getSegments()[1];
+        REQUIRE(s.supported);
+        REQUIRE(s.windowSize == 4);
+
+        for (double et : { 0.0, 500.0, 3200.0, 6000.0, 11999.0 })
+        {
+            Vector3d p, v;
+            REQUIRE(file->evaluate(s, et, p, &v));
+            REQUIRE((p - parabola(et)).norm() < EPSILON);
+            REQUIRE((v - parabolaVelocity(et)).norm() < EPSILON);
+        }
+    }
+
+    SECTION("Chains of segments")
+    {
+        SpkEphemeris ephemeris;
+        ephemeris.addFile(file);
+
+        double et = 5000.0;
+        Vector3d earth, moon, earthBary;
+        REQUIRE(file->evaluate(file->getSegments()[0], et, earth, nullptr));
+        REQUIRE(file->evaluate(file->getSegments()[1], et, moon, nullptr));
+        REQUIRE(file->evaluate(file->getSegments()[2], et, earthBary, nullptr));
+
+        Vector3d p;
+        REQUIRE(ephemeris.getState(301, 399, et, p, nullptr));
+        REQUIRE((p - (moon - earth)).norm() < EPSILON);
+        REQUIRE(ephemeris.getState(301, 0, et, p, nullptr));
+        REQUIRE((p - (moon + earthBary)).norm() < EPSILON);
+        REQUIRE(ephemeris.getState(0, 399, et, p, nullptr));
+        REQUIRE((p + (earth + earthBary)).norm() < EPSILON);
+
+        // No coverage
+        REQUIRE(!ephemeris.getState(301, 399, 20000.0, p, nullptr));
+        // Unknown body
+        REQUIRE(!ephemeris.getState(499, 399, et, p, nullptr));
+
+        double times[3] = { 100.0, 200.0, 300.0 };
+        Vector3d positions[3];
+        REQUIRE(ephemeris.getPositions(301, 3, times, 3, positions));
+        REQUIRE((positions[2] - parabola(300.0)).norm() < EPSILON);
+    }
+
+    SECTION("J2000 frame")
+    {
+        // The same polynomials in the equatorial frame
+        const SpkFile::Segment& s = file->getSegments()[2];
+        Vector3d p, q;
+        REQUIRE(file->evaluate(file->getSegments()[0], 1000.0, p, nullptr));
+        REQUIRE(file->evaluate(s, 1000.0, q, nullptr));
+
+        double obliquity = 84381.448 / 3600.0 * PI / 180.0;
+        REQUIRE(q.x() == Approx(p.x()));
+        REQUIRE(q.y() == Approx(std::cos(obliquity) * p.y() + std::sin(obliquity) * p.z()));
+        REQUIRE(q.z() == Approx(-std::sin(obliquity) * p.y() + std::cos(obliquity) * p.z()));
+    }
+
+    file.reset();
+    std::remove(filename);
+}
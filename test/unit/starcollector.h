@@ -0,0 +1,61 @@
+#pragma once
+
+#include <celengine/star.h>
+#include <celengine/stardb.h>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Star handler collecting the stars passed to it, for comparing the results
+// of queries with a brute force search.
+class StarCollector : public StarHandler
+{
+public:
+    StarCollector(const Eigen::Hyperplane<float, 3>* _planes) : planes(_planes) {}
+
+    void process(const Star& star, float /*distance*/, float /*appMag*/) override
+    {
+        // The octree only tests the frustum at the node level
+        for (int i = 0; planes != nullptr && i < 5; i++)
+        {
+            if (planes[i].signedDistance(star.getPosition()) < 0.0f)
+                return;
+        }
+        stars.push_back(&star);
+    }
+
+    std::vector<const Star*> sorted() const
+    {
+        std::vector<const Star*> result = stars;
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    std::vector<uint32_t> sortedIndices() const
+    {
+        std::vector<uint32_t> indices;
+        for (const Star* star : stars)
+            indices.push_back(star->getIndex());
+        std::sort(indices.begin(), indices.end());
+        return indices;
+    }
+
+    const Eigen::Hyperplane<float, 3>* planes;
+    std::vector<const Star*> stars;
+};
+
+// The planes of the view frustum used by the star queries in the tests:
+// a field of view of 0.8 radians with an aspect ratio of 1.5.
+inline void computeFrustumPlanes(Eigen::Hyperplane<float, 3>* planes,
+                                 const Eigen::Vector3f& position,
+                                 const Eigen::Quaternionf& orientation)
+{
+    float h = std::tan(0.4f);
+    float w = h * 1.5f;
+    Eigen::Vector3f normals[5] = { { 0.0f, 1.0f, -h }, { 0.0f, -1.0f, -h }, { 1.0f, 0.0f, -w }, { -1.0f, 0.0f, -w }, { 0.0f, 0.0f, -1.0f } };
+    Eigen::Matrix3f rot = orientation.toRotationMatrix();
+    for (int i = 0; i < 5; i++)
+        planes[i] = Eigen::Hyperplane<float, 3>(rot.transpose() * normals[i].normalized(), position);
+}
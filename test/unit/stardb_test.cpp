@@ -0,0 +1,373 @@
+#include <celengine/astro.h>
+#include <celengine/stardb.h>
+#include <celengine/stellarclass.h>
+#include <celutil/workerpool.h>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fmt/format.h>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#include "starcollector.h"
+
+using namespace Eigen;
+
+// A binary star database with nStars stars clustered around the origin
+static std::string makeStarFile(unsigned int nStars)
+{
+    std::mt19937 gen(49);
+    std::normal_distribution<float> position(0.0f, 300.0f);
+    std::uniform_real_distribution<float> absMag(-5.0f, 15.0f);
+    uint16_t spectralType = StellarClass(StellarClass::NormalStar,
+                                         StellarClass::Spectral_G,
+                                         2,
+                                         StellarClass::Lum_V).packV1();
+
+    std::ostringstream out;
+    uint16_t version = 0x0100;
+    out.write("CELSTARS", 8);
+    out.write((const char*) &version, sizeof version);
+    out.write((const char*) &nStars, sizeof nStars);
+    for (uint32_t catalogNumber = 1; catalogNumber <= nStars; catalogNumber++)
+    {
+        float xyz[3] = { position(gen), position(gen), position(gen) };
+        int16_t mag = (int16_t) (absMag(gen) * 256.0f);
+        out.write((const char*) &catalogNumber, sizeof catalogNumber);
+        out.write((const char*) xyz, sizeof xyz);
+        out.write((const char*) &mag, sizeof mag);
+        out.write((const char*) &spectralType, sizeof spectralType);
+    }
+    return out.str();
+}
+
+// Compare the queries of the database with a brute force search through
+// the stars expected to be in it.
+static void checkQueries(const StarDatabase& db, const std::vector<const Star*>& stars)
+{
+    std::mt19937 gen(4900);
+    std::normal_distribution<float> position(0.0f, 400.0f);
+    std::normal_distribution<float> component;
+    size_t nVisible = 0;
+    for (int query = 0; query < 10; query++)
+    {
+        Vector3f obsPosition(position(gen), position(gen), position(gen));
+        Quaternionf orientation(component(gen), component(gen), component(gen), component(gen));
+        orientation.normalize();
+        float limitingMag = 6.0f + (float) (query % 3) * 3.0f;
+
+        Hyperplane<float, 3> planes[5];
+        computeFrustumPlanes(planes, obsPosition, orientation);
+
+        StarCollector found(planes);
+        db.findVisibleStars(found, obsPosition, orientation, 0.8f, 1.5f, limitingMag);
+        StarCollector foundClose(nullptr);
+        db.findCloseStars(foundClose, obsPosition, 200.0f);
+        Vector3f direction = orientation.conjugate() * -Vector3f::UnitZ();
+        StarCollector foundInCone(nullptr);
+        db.findStarsInCone(foundInCone, obsPosition, direction, 0.3f, 500.0f, limitingMag);
+
+        std::vector<const Star*> visible, close, inCone;
+        for (const Star* star : stars)
+        {
+            Vector3f v = star->getPosition() - obsPosition;
+            float distance = v.norm();
+            float appMag = astro::absToAppMag(star->getAbsoluteMagnitude(), distance);
+            if (appMag < limitingMag &&
+                std::all_of(planes, planes + 5, [&](const Hyperplane<float, 3>& p) { return p.signedDistance(star->getPosition()) >= 0.0f; }))
+            {
+                visible.push_back(star);
+            }
+            if (v.squaredNorm() < 200.0f * 200.0f)
+                close.push_back(star);
+            if (appMag < limitingMag && distance <= 500.0f && v.dot(direction) >= std::cos(0.3f) * distance)
+                inCone.push_back(star);
+        }
+        std::sort(visible.begin(), visible.end());
+        std::sort(close.begin(), close.end());
+        std::sort(inCone.begin(), inCone.end());
+
+        INFO("Query " << query << ", limiting magnitude " << limitingMag);
+        nVisible += visible.size();
+        REQUIRE(found.sorted() == visible);
+        REQUIRE(foundClose.sorted() == close);
+        REQUIRE(foundInCone.sorted() == inCone);
+    }
+    REQUIRE(nVisible > 0);
+}
+
+TEST_CASE("Stars added after loading", "[StarDatabase]")
+{
+    // Several threads even on a single core machine
+    InitWorkerPool(4);
+
+    const unsigned int nBaseStars = 20000;
+    std::istringstream in(makeStarFile(nBaseStars));
+    StarDatabase db;
+    REQUIRE(db.loadBinary(in));
+    db.finish();
+    REQUIRE(db.size() == nBaseStars);
+
+    std::vector<const Star*> expected;
+    for (uint32_t i = 0; i < db.size(); i++)
+        expected.push_back(db.getStar(i));
+
+    StarDetails details;
+    std::mt19937 gen(490);
+    std::normal_distribution<float> position(0.0f, 300.0f);
+    std::uniform_real_distribution<float> absMag(-5.0f, 15.0f);
+    auto addStars = [&](unsigned int nStars)
+    {
+        for (unsigned int i = 0; i < nStars; i++)
+        {
+            Star star;
+            star.setPosition(position(gen), position(gen), position(gen));
+            star.setAbsoluteMagnitude(absMag(gen));
+            star.setDetails(&details);
+            star.setIndex(AstroCatalog::InvalidIndex);
+            Star* added = db.addStar(star);
+            REQUIRE(added != nullptr);
+            REQUIRE(db.find(added->getIndex()) == added);
+            expected.push_back(added);
+        }
+    };
+
+    SECTION("Added stars are found before and after merging")
+    {
+        addStars(3000);
+        db.update();
+        REQUIRE(db.getUnmergedStarCount() == 3000);
+        checkQueries(db, expected);
+
+        // Beyond the merge threshold; stars added during the merge stay
+        // in the unmerged list.
+        addStars(5000);
+        db.update();
+        addStars(100);
+        checkQueries(db, expected);
+        db.update(true);
+        REQUIRE(db.getUnmergedStarCount() == 100);
+        checkQueries(db, expected);
+    }
+
+    SECTION("Removed stars are not found")
+    {
+        addStars(6000);
+        db.update(true);
+        db.update(true);
+        addStars(500);
+
+        std::set<const Star*> removed;
+        for (size_t i = 0; i < expected.size(); i += 7)
+        {
+            AstroCatalog::IndexNumber catalogNumber = expected[i]->getIndex();
+            REQUIRE(db.removeStar(catalogNumber));
+            REQUIRE(db.find(catalogNumber) == nullptr);
+            REQUIRE(!db.removeStar(catalogNumber));
+            removed.insert(expected[i]);
+        }
+        expected.erase(std::remove_if(expected.begin(), expected.end(),
+                                      [&](const Star* star) { return removed.count(star) != 0; }),
+                       expected.end());
+        checkQueries(db, expected);
+
+        // Merging drops the removed stars
+        addStars(5000);
+        db.update();
+        db.update(true);
+        checkQueries(db, expected);
+    }
+
+    SECTION("Catalog numbers")
+    {
+        Star star;
+        star.setDetails(&details);
+        star.setIndex(1);
+        REQUIRE(db.addStar(star) == nullptr);
+
+        star.setIndex(nBaseStars + 1);
+        Star* added = db.addStar(star);
+        REQUIRE(added != nullptr);
+        REQUIRE(db.find(nBaseStars + 1) == added);
+        REQUIRE(db.addStar(star) == nullptr);
+
+        // A removed star's catalog number can be reused
+        REQUIRE(db.removeStar(1));
+        star.setIndex(1);
+        added = db.addStar(star);
+        REQUIRE(added != nullptr);
+        REQUIRE(db.find(1) == added);
+    }
+
+    SECTION("Names")
+    {
+        StarNameDatabase names;
+        db.setNameDatabase(&names);
+
+        Star star;
+        star.setDetails(&details);
+        star.setIndex(AstroCatalog::InvalidIndex);
+        Star* added = db.addStar(star, "Added Star:ADD 1");
+        REQUIRE(added != nullptr);
+        REQUIRE(db.find("Added Star") == added);
+        REQUIRE(db.find("ADD 1") == added);
+        REQUIRE(db.getStarName(*added) == "Added Star");
+
+        db.setNameDatabase(nullptr);
+    }
+}
+
+// Right ascension and declination in degrees of a position in Celestia's
+// ecliptic frame
+static Vector2d toEquatorial(const Vector3f& position)
+{
+    Vector3d v(position.x(), -position.z(), position.y());
+    v = AngleAxisd(astro::J2000Obliquity, Vector3d::UnitX()) * v;
+    v.normalize();
+    return Vector2d(std::atan2(v.y(), v.x()), std::asin(v.z())) * 180.0 / PI;
+}
+
+TEST_CASE("Star motion", "[StarDatabase]")
+{
+    InitWorkerPool(4);
+
+    // Static stars from a binary file and fast moving ones from an stc
+    // file, among them Barnard's Star with its Hipparcos data.
+    const unsigned int nBaseStars = 20000;
+    std::istringstream binaryIn(makeStarFile(nBaseStars));
+    StarDatabase db;
+    db.setNameDatabase(new StarNameDatabase());
+    REQUIRE(db.loadBinary(binaryIn));
+
+    std::string stc = "87937 \"Barnard's Star\" { RA 269.4520 Dec 4.6934 Distance 5.963 "
+                      "SpectralType \"M4V\" AppMag 9.54 "
+                      "ProperMotionRA -798.58 ProperMotionDec 10328.12 RadialVelocity -110.6 }\n";
+    std::mt19937 gen(4950);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    const unsigned int nMovingStars = 3000;
+    for (unsigned int i = 0; i < nMovingStars; i++)
+    {
+        double ra = unit(gen) * 360.0;
+        double dec = std::asin(unit(gen) * 2.0 - 1.0) * 180.0 / PI;
+        stc += fmt::format("{} {{ RA {} Dec {} Distance {} SpectralType \"K0V\" AbsMag {} "
+                           "ProperMotionRA {} ProperMotionDec {} RadialVelocity {} }}\n",
+                           100000 + i, ra, dec, 50.0 + unit(gen) * 550.0, -2.0 + unit(gen) * 14.0,
+                           (unit(gen) - 0.5) * 1.0e5, (unit(gen) - 0.5) * 1.0e5, (unit(gen) - 0.5) * 1.0e4);
+    }
+    std::istringstream stcIn(stc);
+    REQUIRE(db.load(stcIn));
+    db.finish();
+    REQUIRE(db.getMovingStarCount() == nMovingStars + 1);
+
+    Star* barnard = db.find(87937);
+    REQUIRE(barnard != nullptr);
+    Vector3f barnardAtJ2000 = barnard->getPosition();
+
+    SECTION("Barnard's Star")
+    {
+        // Proper motion over a century; it speeds up slightly as the star
+        // comes closer.
+        Vector2d start = toEquatorial(barnard->getPosition());
+        db.setTime(astro::J2000 + 100.0 * DAYS_PER_YEAR);
+        Vector2d end = toEquatorial(barnard->getPosition());
+        double dRA = (end.x() - start.x()) * std::cos(start.y() * PI / 180.0) * 3600.0;
+        double dDec = (end.y() - start.y()) * 3600.0;
+        REQUIRE(dRA == Approx(-79.9).epsilon(0.03));
+        REQUIRE(dDec == Approx(1032.8).epsilon(0.02));
+
+        // Closest approach of 3.75 ly around the year 11800
+        float minDistance = 1.0e6f;
+        int minYear = 0;
+        for (int year = 2000; year <= 20000; year += 10)
+        {
+            db.setTime(astro::J2000 + (year - 2000) * DAYS_PER_YEAR);
+            float distance = barnard->getPosition().norm();
+            if (distance < minDistance)
+            {
+                minDistance = distance;
+                minYear = year;
+            }
+        }
+        REQUIRE(minDistance == Approx(3.75f).epsilon(0.02));
+        REQUIRE(minYear > 11500);
+        REQUIRE(minYear < 12000);
+
+        db.setTime(astro::J2000);
+        REQUIRE(barnard->getPosition() == barnardAtJ2000);
+    }
+
+    SECTION("Queries find moving stars without rebuilding the octree")
+    {
+        std::vector<const Star*> stars;
+        for (uint32_t i = 0; i < db.size(); i++)
+            stars.push_back(db.getStar(i));
+
+        for (double years : { -30000.0, -1000.0, 20000.0, 0.0 })
+        {
+            INFO("Years from J2000: " << years);
+            db.setTime(astro::J2000 + years * DAYS_PER_YEAR);
+            checkQueries(db, stars);
+        }
+    }
+
+    SECTION("Aggregates follow the moving stars")
+    {
+        // Seen from far away, every star is either processed by itself or
+        // summarized by an aggregate, and together they have the centroid
+        // of all the stars. With the aggregates left at the J2000 positions
+        // the error is about 1e-3 ly. Over longer times the nodes with fast
+        // stars grow too large to be aggregated.
+        class CentroidHandler : public StarHandler, public StarAggregateHandler
+        {
+        public:
+            void process(const Star& star, float /*distance*/, float /*appMag*/) override
+            {
+                weightedPosition += star.getPosition().cast<double>() * star.getLuminosity();
+                luminosity += star.getLuminosity();
+            }
+
+            void processAggregate(const StarNodeData& data, float /*distance*/, float /*appMag*/) override
+            {
+                weightedPosition += data.centroid.cast<double>() * data.luminosity;
+                luminosity += data.luminosity;
+                nAggregates++;
+            }
+
+            Vector3d weightedPosition { Vector3d::Zero() };
+            double luminosity { 0.0 };
+            unsigned int nAggregates { 0 };
+        };
+
+        for (double years : { 200.0, 1000.0, -3000.0, 0.0 })
+        {
+            INFO("Years from J2000: " << years);
+            db.setTime(astro::J2000 + years * DAYS_PER_YEAR);
+
+            Vector3d weightedPosition = Vector3d::Zero();
+            double luminosity = 0.0;
+            for (uint32_t i = 0; i < db.size(); i++)
+            {
+                const Star* star = db.getStar(i);
+                weightedPosition += star->getPosition().cast<double>() * star->getLuminosity();
+                luminosity += star->getLuminosity();
+            }
+
+            CentroidHandler handler;
+            db.findVisibleStars(handler, handler, Vector3f(0.0f, 0.0f, 2.0e4f), Quaternionf::Identity(),
+                                0.8f, 1.5f, 1000.0f, 0.05f);
+            REQUIRE(handler.nAggregates > 0);
+            REQUIRE(handler.luminosity == Approx(luminosity).epsilon(1.0e-4));
+            Vector3d centroid = weightedPosition / luminosity;
+            Vector3d found = handler.weightedPosition / handler.luminosity;
+            INFO("Error " << (found - centroid).norm() << " ly");
+            REQUIRE((found - centroid).norm() < 1.0e-4);
+        }
+    }
+}
@@ -0,0 +1,147 @@
+#include <celengine/trianglebvh.h>
+#include <celmodel/model.h>
+#include <celmath/mathlib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+using namespace cmod;
+using namespace Eigen;
+
+constexpr const unsigned int Rings = 24;
+constexpr const unsigned int Slices = 48;
+
+static Mesh::index32* copyIndices(const std::vector<Mesh::index32>& indices)
+{
+    auto* result = new Mesh::index32[indices.size()];
+    std::copy(indices.begin(), indices.end(), result);
+    return result;
+}
+
+// A bumpy sphere band as a triangle list, closed at the top by a cone
+// drawn as a triangle fan, and narrowed at the bottom by a triangle strip
+// which leaves a hole for rays to pass through.
+static Model* makeModel()
+{
+    std::vector<Vector3f> positions;
+    for (unsigned int i = 0; i <= Rings; i++)
+    {
+        float theta = (float) PI * (0.2f + 0.6f * (float) i / (float) Rings);
+        for (unsigned int j = 0; j < Slices; j++)
+        {
+            float phi = 2.0f * (float) PI * (float) j / (float) Slices;
+            float r = 3.0f + 0.2f * std::sin(7.0f * phi) * std::sin(5.0f * theta);
+            positions.emplace_back(Vector3f(std::sin(theta) * std::cos(phi),
+                                            std::sin(theta) * std::sin(phi),
+                                            std::cos(theta)) * r);
+        }
+    }
+
+    Mesh::index32 apex = (Mesh::index32) positions.size();
+    positions.emplace_back(0.0f, 0.0f, 3.5f);
+
+    Mesh::index32 hole = (Mesh::index32) positions.size();
+    for (unsigned int j = 0; j < Slices; j++)
+    {
+        float phi = 2.0f * (float) PI * (float) j / (float) Slices;
+        positions.emplace_back(0.5f * std::cos(phi), 0.5f * std::sin(phi), -2.8f);
+    }
+
+    Mesh::VertexAttribute attributes[] = { Mesh::VertexAttribute(Mesh::Position, Mesh::Float3, 0) };
+    auto* mesh = new Mesh();
+    mesh->setVertexDescription(Mesh::VertexDescription(12, 1, attributes));
+    auto* data = new char[positions.size() * 12];
+    for (size_t i = 0; i < positions.size(); i++)
+        memcpy(data + i * 12, positions[i].data(), 12);
+    mesh->setVertices((unsigned int) positions.size(), data);
+
+    std::vector<Mesh::index32> band;
+    for (unsigned int i = 0; i < Rings; i++)
+    {
+        for (unsigned int j = 0; j < Slices; j++)
+        {
+            Mesh::index32 v0 = i * Slices + j;
+            Mesh::index32 v1 = i * Slices + (j + 1) % Slices;
+            band.insert(band.end(), { v0, v0 + Slices, v1, v1, v0 + Slices, v1 + Slices });
+        }
+    }
+    mesh->addGroup(Mesh::TriList, 0, (unsigned int) band.size(), copyIndices(band));
+
+    std::vector<Mesh::index32> fan = { apex };
+    for (unsigned int j = 0; j <= Slices; j++)
+        fan.push_back(j % Slices);
+    mesh->addGroup(Mesh::TriFan, 0, (unsigned int) fan.size(), copyIndices(fan));
+
+    std::vector<Mesh::index32> strip;
+    for (unsigned int j = 0; j <= Slices; j++)
+    {
+        strip.push_back(Rings * Slices + j % Slices);
+        strip.push_back(hole + j % Slices);
+    }
+    mesh->addGroup(Mesh::TriStrip, 0, (unsigned int) strip.size(), copyIndices(strip));
+
+    auto* model = new Model();
+    model->addMesh(mesh);
+    return model;
+}
+
+
+TEST_CASE("Triangle BVH matches Model::pick", "[TriangleBVH]")
+{
+    std::unique_ptr<Model> model(makeModel());
+    TriangleBVH bvh(*model);
+    REQUIRE(bvh.getTriangleCount() == 2 * Rings * Slices + 3 * Slices);
+
+    std::mt19937 gen(37);
+    std::uniform_real_distribution<double> coord(-1.0, 1.0);
+    auto randomVector = [&]
+    {
+        Vector3d v;
+        do
+        {
+            v = Vector3d(coord(gen), coord(gen), coord(gen));
+        }
+        while (v.squaredNorm() > 1.0 || v.squaredNorm() < 0.01);
+        return v;
+    };
+
+    // Rays from outside and inside the model, with directions of varying
+    // length, as the distances are in units of the direction length.
+    int hits = 0;
+    int misses = 0;
+    for (int i = 0; i < 20000; i++)
+    {
+        Vector3d origin = randomVector();
+        origin = i % 4 == 0 ? Vector3d(origin * 2.0) : Vector3d(origin.normalized() * 8.0);
+        Vector3d target = randomVector();
+        target = i % 5 == 0 ? Vector3d(Vector3d(0.0, 0.0, -6.0) + target) : Vector3d(target * 3.0);
+        Vector3d direction = (target - origin) * (0.5 + 0.5 * (coord(gen) + 1.0));
+
+        double expected = -1.0;
+        double distance = -1.0;
+        bool picked = model->pick(origin, direction, expected);
+        bool intersected = bvh.intersect(origin, direction, distance);
+
+        REQUIRE(intersected == picked);
+        if (picked)
+        {
+            REQUIRE(std::abs(distance - expected) <= 1.0e-9 * std::max(1.0, expected));
+            hits++;
+        }
+        else
+        {
+            REQUIRE(distance == -1.0);
+            misses++;
+        }
+    }
+
+    // Both outcomes have to be covered for the comparison to mean anything
+    REQUIRE(hits > 1000);
+    REQUIRE(misses > 1000);
+}
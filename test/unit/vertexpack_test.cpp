@@ -0,0 +1,251 @@
+#include <celmodel/modelfile.h>
+#include <celmodel/vertexpack.h>
+#include <celmath/mathlib.h>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+using namespace cmod;
+using namespace Eigen;
+
+struct TestVertex
+{
+    Vector3f position;
+    Vector3f normal;
+    Vector2f texCoord;
+};
+
+// A bumpy UV sphere, slightly off the origin
+static std::vector<TestVertex> makeVertices(unsigned int rings, unsigned int slices)
+{
+    std::vector<TestVertex> vertices;
+    for (unsigned int i = 0; i <= rings; i++)
+    {
+        float theta = (float) PI * (float) i / (float) rings;
+        for (unsigned int j = 0; j <= slices; j++)
+        {
+            float phi = 2.0f * (float) PI * (float) j / (float) slices;
+            Vector3f n(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+            float r = 3.0f + 0.1f * std::sin(7.0f * phi) * std::sin(5.0f * theta);
+            vertices.push_back({ n * r + Vector3f(1.0f, -2.0f, 0.5f), n,
+                                 Vector2f((float) j / (float) slices, (float) i / (float) rings) });
+        }
+    }
+    return vertices;
+}
+
+// Angle between two vectors, accurate for small angles
+static double angle(const Vector3f& a, const Vector3f& b)
+{
+    Vector3d ad = a.cast<double>().normalized();
+    Vector3d bd = b.cast<double>().normalized();
+    return std::atan2(ad.cross(bd).norm(), ad.dot(bd));
+}
+
+static Mesh* makeMesh(const std::vector<TestVertex>& vertices, unsigned int rings, unsigned int slices)
+{
+    Mesh::VertexAttribute attributes[] =
+    {
+        Mesh::VertexAttribute(Mesh::Position, Mesh::Float3, 0),
+        Mesh::VertexAttribute(Mesh::Normal, Mesh::Float3, 12),
+        Mesh::VertexAttribute(Mesh::Texture0, Mesh::Float2, 24),
+    };
+    auto* mesh = new Mesh();
+    mesh->setVertexDescription(Mesh::VertexDescription(32, 3, attributes));
+
+    auto* data = new char[vertices.size() * 32];
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        memcpy(data + i * 32, vertices[i].position.data(), 12);
+        memcpy(data + i * 32 + 12, vertices[i].normal.data(), 12);
+        memcpy(data + i * 32 + 24, vertices[i].texCoord.data(), 8);
+    }
+    mesh->setVertices(vertices.size(), data);
+
+    std::vector<Mesh::index32> indices;
+    for (unsigned int i = 0; i < rings; i++)
+    {
+        for (unsigned int j = 0; j < slices; j++)
+        {
+            Mesh::index32 v0 = i * (slices + 1) + j;
+            Mesh::index32 v1 = v0 + slices + 1;
+            indices.insert(indices.end(), { v0, v1, v0 + 1, v0 + 1, v1, v1 + 1 });
+        }
+    }
+    auto* groupIndices = new Mesh::index32[indices.size()];
+    std::copy(indices.begin(), indices.end(), groupIndices);
+    mesh->addGroup(Mesh::TriList, 0, indices.size(), groupIndices);
+
+    return mesh;
+}
+
+static void quantize(Mesh& mesh, Mesh::VertexAttributeFormat positionFormat)
+{
+    Mesh::VertexAttribute attributes[] =
+    {
+        Mesh::VertexAttribute(Mesh::Position, positionFormat, 0),
+        Mesh::VertexAttribute(Mesh::Normal, Mesh::Octahedral, 8),
+        Mesh::VertexAttribute(Mesh::Texture0, Mesh::Half2, 12),
+    };
+    REQUIRE(mesh.convertVertices(Mesh::VertexDescription(16, 3, attributes)));
+}
+
+static std::unique_ptr<Model> roundTrip(const Model& model, bool binary, size_t* fileSize = nullptr)
+{
+    std::stringstream buffer;
+    if (binary)
+        SaveModelBinary(&model, buffer);
+    else
+        SaveModelAscii(&model, buffer);
+    if (fileSize != nullptr)
+        *fileSize = buffer.str().size();
+
+    std::unique_ptr<Model> loaded(LoadModel(buffer));
+    REQUIRE(loaded != nullptr);
+    return loaded;
+}
+
+TEST_CASE("Packed scalar conversions", "[VertexPack]")
+{
+    SECTION("Half floats round trip exactly")
+    {
+        for (uint32_t h = 0; h < 0x10000; h++)
+        {
+            if ((h & 0x7c00) == 0x7c00 && (h & 0x3ff) != 0)
+                continue;  // NaN
+            REQUIRE(FloatToHalf(HalfToFloat((uint16_t) h)) == h);
+        }
+    }
+
+    SECTION("Half float rounding")
+    {
+        REQUIRE(FloatToHalf(1.0f) == 0x3c00);
+        REQUIRE(FloatToHalf(65504.0f) == 0x7bff);
+        REQUIRE(FloatToHalf(65520.0f) == 0x7c00);
+        REQUIRE(FloatToHalf(1.0f + 1.0f / 2048.0f) == 0x3c00);      // tie to even
+        REQUIRE(FloatToHalf(1.0f + 3.0f / 2048.0f) == 0x3c02);      // tie to even
+        REQUIRE(FloatToHalf(std::ldexp(1.0f, -24)) == 0x0001);      // smallest denormal
+        REQUIRE(FloatToHalf(std::ldexp(1.0f, -25)) == 0x0000);
+
+        std::mt19937 gen(5);
+        std::uniform_real_distribution<float> value(-1000.0f, 1000.0f);
+        for (int i = 0; i < 10000; i++)
+        {
+            float f = value(gen);
+            REQUIRE(std::abs(HalfToFloat(FloatToHalf(f)) - f) <= std::abs(f) * (1.0f / 2048.0f));
+        }
+    }
+
+    SECTION("Octahedral unit vectors")
+    {
+        std::mt19937 gen(6);
+        std::normal_distribution<float> value;
+        double maxError = 0.0;
+        for (int i = 0; i < 100000; i++)
+        {
+            Vector3f v(value(gen), value(gen), value(gen));
+            v.normalize();
+            int16_t oct[2];
+            EncodeOctahedral(v, oct);
+            Vector3f decoded = DecodeOctahedral(oct);
+            maxError = std::max(maxError, angle(decoded, v));
+        }
+        REQUIRE(maxError < 5.0e-5);
+
+        int16_t oct[2];
+        EncodeOctahedral(Vector3f(0.0f, 0.0f, -1.0f), oct);
+        REQUIRE(DecodeOctahedral(oct).isApprox(Vector3f(0.0f, 0.0f, -1.0f)));
+    }
+}
+
+TEST_CASE("Quantized model round trip", "[VertexPack]")
+{
+    const unsigned int rings = 64;
+    const unsigned int slices = 128;
+    std::vector<TestVertex> vertices = makeVertices(rings, slices);
+
+    Model original;
+    original.addMesh(makeMesh(vertices, rings, slices));
+    size_t originalSize = 0;
+    roundTrip(original, true, &originalSize);
+
+    for (auto positionFormat : { Mesh::Short4N, Mesh::Half4 })
+    {
+        Model model;
+        Mesh* mesh = makeMesh(vertices, rings, slices);
+        model.addMesh(mesh);
+        quantize(*mesh, positionFormat);
+        REQUIRE(mesh->hasPackedVertices());
+
+        // Quantization error
+        AlignedBox<float, 3> bbox = original.getMesh(0)->getBoundingBox();
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            Vector3f p = mesh->getPosition(i);
+            if (positionFormat == Mesh::Short4N)
+            {
+                Vector3f maxError = bbox.sizes() / 65534.0f + Vector3f::Constant(1.0e-5f);
+                REQUIRE(((p - vertices[i].position).cwiseAbs().array() <= maxError.array()).all());
+            }
+            else
+            {
+                REQUIRE((p - vertices[i].position).norm() <= vertices[i].position.norm() * (1.0f / 1024.0f));
+            }
+        }
+
+        std::vector<char> unpacked(mesh->getVertexCount() * mesh->getUnpackedVertexDescription().stride);
+        mesh->unpackVertices(unpacked.data());
+        REQUIRE(mesh->getUnpackedVertexDescription().stride == 32);
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            Vector3f n = Map<Vector3f>(reinterpret_cast<float*>(unpacked.data() + i * 32 + 12));
+            Vector2f t = Map<Vector2f>(reinterpret_cast<float*>(unpacked.data() + i * 32 + 24));
+            REQUIRE(angle(n, vertices[i].normal) < 5.0e-5);
+            REQUIRE((t - vertices[i].texCoord).cwiseAbs().maxCoeff() <= 1.0f / 4096.0f);
+        }
+
+        // Bounding box and picking see the quantized positions
+        REQUIRE(mesh->getBoundingBox().isApprox(bbox, 1.0e-3f));
+        double distance = 0.0;
+        REQUIRE(model.pick(Vector3d(1.0, -2.0, 10.0), Vector3d(0.0, 0.0, -1.0), distance));
+        double originalDistance = 0.0;
+        REQUIRE(original.pick(Vector3d(1.0, -2.0, 10.0), Vector3d(0.0, 0.0, -1.0), originalDistance));
+        REQUIRE(std::abs(distance - originalDistance) < 1.0e-3);
+
+        // The packed data survives both file formats unchanged
+        for (bool binary : { true, false })
+        {
+            size_t size = 0;
+            std::unique_ptr<Model> loaded = roundTrip(model, binary, &size);
+            const Mesh* loadedMesh = loaded->getMesh(0);
+            REQUIRE(loadedMesh->getVertexCount() == mesh->getVertexCount());
+            REQUIRE(loadedMesh->getVertexStride() == 16);
+            for (size_t i = 0; i < vertices.size(); i++)
+            {
+                if (binary)
+                {
+                    REQUIRE(loadedMesh->getPosition(i) == mesh->getPosition(i));
+                }
+                else
+                {
+                    // ASCII files store the bounds with 6 digits
+                    REQUIRE((loadedMesh->getPosition(i) - mesh->getPosition(i)).norm() < 1.0e-4f);
+                }
+            }
+            REQUIRE(memcmp(loadedMesh->getVertexData(), mesh->getVertexData(), vertices.size() * 16) == 0);
+
+            if (binary)
+            {
+                INFO("Binary size " << originalSize << " -> " << size);
+                REQUIRE(size < originalSize * 3 / 4);
+            }
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#include <celutil/workerpool.h>
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+TEST_CASE("Parallel for", "[WorkerPool]")
+{
+    WorkerPool pool(4);
+
+    SECTION("Every item is processed once")
+    {
+        std::vector<std::atomic<int>> counts(10000);
+        for (auto& count : counts)
+            count = 0;
+
+        pool.parallelFor(counts.size(), 16, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+                counts[i]++;
+        });
+
+        for (const auto& count : counts)
+            REQUIRE(count == 1);
+    }
+
+    SECTION("Exceptions reach the caller")
+    {
+        // Throw from chunks run on the workers as well as on this thread
+        REQUIRE_THROWS_AS(pool.parallelFor(1000, 1, [](size_t begin, size_t)
+        {
+            if (begin % 3 == 0)
+                throw std::runtime_error("chunk failed");
+        }), std::runtime_error);
+
+        // The pool is still usable afterwards
+        std::atomic<size_t> total { 0 };
+        pool.parallelFor(1000, 1, [&](size_t begin, size_t end) { total += end - begin; });
+        REQUIRE(total == 1000);
+    }
+}
+
+
+TEST_CASE("Shared pool", "[WorkerPool]")
+{
+    REQUIRE(InitWorkerPool(3));
+    WorkerPool* pool = GetWorkerPool();
+    REQUIRE(pool->getConcurrency() == 3);
+
+    // Reinitialization would invalidate the pointer above
+    REQUIRE_FALSE(InitWorkerPool(2));
+    REQUIRE(GetWorkerPool() == pool);
+    REQUIRE(pool->getConcurrency() == 3);
+}
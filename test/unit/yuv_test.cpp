@@ -0,0 +1,80 @@
+#include <celutil/yuvconvert.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+// The conversion done by the movie capture before it was moved to a
+// separate thread: a full 4:4:4 frame is built and its chroma planes are
+// reduced to 4:2:0 afterwards. Samples outside of the image are black.
+static void referenceConvert(const std::vector<uint8_t>& rgb, int width, int height, int rowStride,
+                             int frameWidth, int frameHeight,
+                             std::vector<uint8_t>& y, std::vector<uint8_t>& u, std::vector<uint8_t>& v)
+{
+    std::vector<int> u444(frameWidth * frameHeight, 0x80);
+    std::vector<int> v444(frameWidth * frameHeight, 0x80);
+    y.assign(frameWidth * frameHeight, 0x10);
+    for (int row = 0; row < height; row++)
+    {
+        const uint8_t* p = rgb.data() + (height - 1 - row) * rowStride;
+        for (int x = 0; x < width; x++)
+        {
+            int r = p[x * 3];
+            int g = p[x * 3 + 1];
+            int b = p[x * 3 + 2];
+            y[row * frameWidth + x] = std::min(std::abs(r * 2104 + g * 4130 + b * 802 + 4096 + 131072) >> 13, 235);
+            u444[row * frameWidth + x] = std::min(std::abs(r * -1214 + g * -2384 + b * 3598 + 4096 + 1048576) >> 13, 240);
+            v444[row * frameWidth + x] = std::min(std::abs(r * 3598 + g * -3013 + b * -585 + 4096 + 1048576) >> 13, 240);
+        }
+    }
+
+    u.assign(frameWidth * frameHeight / 4, 0);
+    v.assign(frameWidth * frameHeight / 4, 0);
+    for (int row = 0; row < frameHeight; row += 2)
+    {
+        for (int x = 0; x < frameWidth; x += 2)
+        {
+            int i = row * frameWidth + x;
+            u[row / 2 * frameWidth / 2 + x / 2] = (u444[i] + u444[i + 1] + u444[i + frameWidth] + u444[i + frameWidth + 1]) >> 2;
+            v[row / 2 * frameWidth / 2 + x / 2] = (v444[i] + v444[i + 1] + v444[i + frameWidth] + v444[i + frameWidth + 1]) >> 2;
+        }
+    }
+}
+
+TEST_CASE("RGB to YUV 4:2:0 conversion", "[YUV]")
+{
+    YUVConverter converter;
+
+    for (auto size : { std::make_pair(64, 32), std::make_pair(37, 21), std::make_pair(2, 1) })
+    {
+        int width = size.first;
+        int height = size.second;
+        int rowStride = (width * 3 + 3) & ~3;
+        int frameWidth = (width + 15) & ~15;
+        int frameHeight = (height + 15) & ~15;
+
+        std::vector<uint8_t> rgb(rowStride * height);
+        srand(width * height);
+        for (auto& c : rgb)
+            c = (uint8_t) (rand() & 0xff);
+        // Include the extremes
+        for (int i = 0; i < 6; i++)
+            rgb[i] = (i & 1) != 0 ? 255 : 0;
+
+        std::vector<uint8_t> y(frameWidth * frameHeight, 0x10);
+        std::vector<uint8_t> u(frameWidth * frameHeight / 4, 0x80);
+        std::vector<uint8_t> v(frameWidth * frameHeight / 4, 0x80);
+        YUVConverter::Planes planes { y.data(), u.data(), v.data(), frameWidth, frameWidth / 2 };
+        converter.convert(rgb.data(), width, height, rowStride, true, planes);
+
+        std::vector<uint8_t> refY, refU, refV;
+        referenceConvert(rgb, width, height, rowStride, frameWidth, frameHeight, refY, refU, refV);
+
+        REQUIRE(y == refY);
+        REQUIRE(u == refU);
+        REQUIRE(v == refV);
+    }
+}